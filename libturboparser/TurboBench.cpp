@@ -0,0 +1,799 @@
+// Copyright (c) 2012-2015 Andre Martins
+// All Rights Reserved.
+//
+// This file is part of TurboParser 2.3.
+//
+// TurboParser 2.3 is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// TurboParser 2.3 is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with TurboParser 2.3.  If not, see <http://www.gnu.org/licenses/>.
+
+// Benchmark harness: loads a model of any of the tasks, replays a corpus
+// through the test-time pipeline and reports per-stage latency percentiles,
+// throughput, peak memory and heap allocations, in JSON or CSV.
+//
+// Example:
+//   turbo_bench --bench_task=parser --file_model=model --file_test=test.conll
+//     --bench_runs=5 --file_bench_output=out.json
+//
+// The predictions are only written (and the write stage only measures
+// something) if --file_prediction is given.
+//
+// With --bench_task=decoder, a dependency decoder is benchmarked alone on
+// random dense graphs of increasing sentence length (no model is needed):
+//   turbo_bench --bench_task=decoder --bench_decoder=eisner --bench_runs=100
+//
+// With --bench_verify, the decoder is checked instead against a brute-force
+// enumeration of all the trees of small random graphs:
+//   turbo_bench --bench_task=decoder --bench_verify --bench_decoder=all
+//     --bench_min_length=1 --bench_max_length=6 --bench_length_step=1
+//     --bench_runs=100
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <atomic>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <limits>
+#include <new>
+#include <random>
+#include <glog/logging.h>
+#include <gflags/gflags.h>
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+#include "Utils.h"
+#include "TimeUtils.h"
+#include "TaggerPipe.h"
+#include "EntityPipe.h"
+#include "MorphologicalPipe.h"
+#include "DependencyPipe.h"
+#include "SemanticPipe.h"
+#include "CoreferencePipe.h"
+
+using namespace std;
+
+DEFINE_string(bench_task, "parser",
+              "Task whose model is benchmarked: parser, tagger, "
+              "entity_recognizer, morphological_tagger, semantic_parser or "
+              "coreference_resolver; or decoder, for benchmarking a "
+              "dependency decoder alone.");
+DEFINE_int32(bench_runs, 1,
+             "Number of times the corpus is replayed (all runs are "
+             "measured).");
+DEFINE_int32(bench_warmup_runs, 0,
+             "Number of unmeasured runs before the measured ones.");
+DEFINE_string(file_bench_output, "",
+              "Path to the file where the results are written. If empty, "
+              "they are only logged.");
+DEFINE_string(bench_output_format, "json",
+              "Format of --file_bench_output: json or csv.");
+DEFINE_string(bench_decoder, "eisner",
+              "Decoder benchmarked if --bench_task=decoder: eisner, "
+              "eisner_marginals, matrix_tree, chu_liu_edmonds, "
+              "chu_liu_edmonds_single_root, second_order_eisner (with "
+              "random consecutive sibling and grandparent scores) or "
+              "pruner_selection (selection of the candidate heads from the "
+              "matrix-tree marginals, with the default pruner options).");
+DEFINE_int32(bench_min_length, 10,
+             "Smallest sentence length if --bench_task=decoder.");
+DEFINE_int32(bench_max_length, 150,
+             "Largest sentence length if --bench_task=decoder.");
+DEFINE_int32(bench_length_step, 10,
+             "Increment of the sentence length if --bench_task=decoder.");
+DEFINE_bool(bench_verify, false,
+            "If --bench_task=decoder, check the decoder against a "
+            "brute-force enumeration of all the trees instead of timing it, "
+            "on --bench_runs random graphs of each length (at most 7). "
+            "With --bench_decoder=all, all the decoders that can be checked "
+            "are. The exit status is nonzero if any check fails.");
+
+// Count heap allocations by replacing the global operator new. The counter
+// is only read between stages, so relaxed ordering is enough.
+static std::atomic<uint64_t> num_allocations(0);
+
+void *operator new(size_t size) {
+  num_allocations.fetch_add(1, std::memory_order_relaxed);
+  void *p = malloc(size ? size : 1);
+  if (!p) throw std::bad_alloc();
+  return p;
+}
+void *operator new[](size_t size) { return operator new(size); }
+void operator delete(void *p) noexcept { free(p); }
+void operator delete[](void *p) noexcept { free(p); }
+void operator delete(void *p, size_t size) noexcept { free(p); }
+void operator delete[](void *p, size_t size) noexcept { free(p); }
+
+static uint64_t CountAllocations() {
+  return num_allocations.load(std::memory_order_relaxed);
+}
+
+// Peak resident set size in kilobytes (0 if unknown).
+static long GetPeakResidentSetSize() {
+#ifndef _WIN32
+  struct rusage usage;
+  if (0 == getrusage(RUSAGE_SELF, &usage)) return usage.ru_maxrss;
+#endif
+  return 0;
+}
+
+struct BenchmarkResults {
+  double load_time;
+  double run_time;
+};
+
+template <class OptionsType, class PipeType>
+void RunTaskBenchmark(StageProfiler *profiler, BenchmarkResults *results) {
+  OptionsType *options = new OptionsType;
+  options->Initialize();
+
+  chronowrap::Chronometer chrono;
+  chrono.GetTime();
+  PipeType *pipe = new PipeType(options);
+  pipe->Initialize();
+  pipe->LoadModelFile();
+  chrono.StopTime();
+  results->load_time = chrono.GetElapsedTime();
+
+  for (int k = 0; k < FLAGS_bench_warmup_runs; ++k) {
+    pipe->Run();
+  }
+
+  chrono.Reset();
+  chrono.GetTime();
+  for (int k = 0; k < FLAGS_bench_runs; ++k) {
+    pipe->RunBenchmark(profiler);
+  }
+  chrono.StopTime();
+  results->run_time = chrono.GetElapsedTime();
+
+  delete pipe;
+  delete options;
+}
+
+struct DecoderBenchmarkResult {
+  int length; // Number of words (not counting the root).
+  int num_arcs;
+  double mean_time; // Seconds per sentence.
+  double allocations; // Heap allocations per sentence.
+};
+
+// Run the decoder selected by --bench_decoder on a dense graph (all possible
+// arcs, with random scores) for each sentence length. Each length gets
+// --bench_warmup_runs unmeasured runs and --bench_runs measured ones.
+static void RunDecoderBenchmark(vector<DecoderBenchmarkResult> *results) {
+  DependencyDecoder decoder;
+  std::mt19937 generator(1234);
+  std::normal_distribution<double> distribution(0.0, 1.0);
+  vector<int> heads;
+  vector<double> marginals;
+  double value;
+  CHECK_GT(FLAGS_bench_length_step, 0);
+  for (int length = FLAGS_bench_min_length; length <= FLAGS_bench_max_length;
+       length += FLAGS_bench_length_step) {
+    int sentence_length = length + 1;
+    vector<DependencyPartArc*> arcs;
+    vector<double> scores;
+    for (int h = 0; h < sentence_length; ++h) {
+      for (int m = 1; m < sentence_length; ++m) {
+        if (h == m) continue;
+        arcs.push_back(new DependencyPartArc(h, m));
+        scores.push_back(distribution(generator));
+      }
+    }
+    SecondOrderWorkspace second_order_workspace;
+    if (FLAGS_bench_decoder == "second_order_eisner") {
+      second_order_workspace.Initialize(sentence_length, true);
+      for (int r = 0; r < arcs.size(); ++r) {
+        second_order_workspace.arc_scores[arcs[r]->head() * sentence_length +
+                                          arcs[r]->modifier()] = scores[r];
+      }
+      for (auto &score : second_order_workspace.sibling_scores) {
+        score = distribution(generator);
+      }
+      for (auto &score : second_order_workspace.grandparent_scores) {
+        score = distribution(generator);
+      }
+    }
+
+    vector<double> posteriors;
+    vector<int> offsets;
+    vector<int> selected_arcs;
+    if (FLAGS_bench_decoder == "pruner_selection") {
+      decoder.RunMatrixTree(sentence_length, arcs, scores, &posteriors,
+                            &value);
+    }
+
+    chronowrap::Chronometer chrono;
+    uint64_t initial_allocations = 0;
+    for (int k = 0; k < FLAGS_bench_warmup_runs + FLAGS_bench_runs; ++k) {
+      if (k == FLAGS_bench_warmup_runs) {
+        initial_allocations = CountAllocations();
+        chrono.GetTime();
+      }
+      if (FLAGS_bench_decoder == "eisner") {
+        decoder.RunEisner(sentence_length, arcs, scores, &heads, &value);
+      } else if (FLAGS_bench_decoder == "eisner_marginals") {
+        decoder.RunEisnerMarginals(sentence_length, arcs, scores, &marginals,
+                                   &value);
+      } else if (FLAGS_bench_decoder == "matrix_tree") {
+        decoder.RunMatrixTree(sentence_length, arcs, scores, &marginals,
+                              &value);
+      } else if (FLAGS_bench_decoder == "chu_liu_edmonds") {
+        decoder.RunChuLiuEdmonds(sentence_length, arcs, scores, &heads,
+                                 &value);
+      } else if (FLAGS_bench_decoder == "chu_liu_edmonds_single_root") {
+        decoder.RunChuLiuEdmondsSingleRoot(sentence_length, arcs, scores,
+                                           &heads, &value);
+      } else if (FLAGS_bench_decoder == "second_order_eisner") {
+        decoder.RunSecondOrderEisner(&second_order_workspace, &heads, &value);
+      } else if (FLAGS_bench_decoder == "pruner_selection") {
+        decoder.SelectPrunerArcs(sentence_length, arcs, posteriors,
+                                 FLAGS_pruner_posterior_threshold,
+                                 FLAGS_pruner_max_heads, &offsets,
+                                 &selected_arcs);
+      } else {
+        CHECK(false) << "Unknown decoder: " << FLAGS_bench_decoder;
+      }
+    }
+    chrono.StopTime();
+
+    DecoderBenchmarkResult result;
+    result.length = length;
+    result.num_arcs = arcs.size();
+    result.mean_time = chrono.GetElapsedTime() / FLAGS_bench_runs;
+    result.allocations =
+      static_cast<double>(CountAllocations() - initial_allocations) /
+      FLAGS_bench_runs;
+    results->push_back(result);
+
+    for (int r = 0; r < arcs.size(); ++r) {
+      delete arcs[r];
+    }
+  }
+}
+
+// Decoders checked by --bench_verify.
+static const char *kVerifiedDecoders[] = {
+  "eisner", "eisner_marginals", "chu_liu_edmonds",
+  "chu_liu_edmonds_single_root", "second_order_eisner", "matrix_tree"
+};
+
+// Largest sentence length (not counting the root) for --bench_verify, which
+// enumerates up to (length + 1)^length head assignments per graph.
+static const int kMaxVerifiedLength = 7;
+
+// Largest difference allowed between a decoder and the enumeration, on the
+// tree scores, the log-partition function and the marginals.
+static const double kVerifyTolerance = 1e-8;
+
+// Check whether heads (from position 1 on) is a tree rooted at 0 using only
+// the arcs of index_arcs ([h][m]: index of the arc h -> m, or -1). With
+// projective, the tree must be projective, and with single_root, the root
+// must have a single child.
+static bool IsTree(const vector<int> &heads, const vector<int> &index_arcs,
+                   bool projective, bool single_root) {
+  int n = heads.size();
+  int num_root_children = 0;
+  for (int m = 1; m < n; ++m) {
+    int h = heads[m];
+    if (h < 0 || h >= n || index_arcs[h * n + m] < 0) return false;
+    if (h == 0) ++num_root_children;
+    // m must reach the root in less than n steps.
+    int a = m;
+    for (int k = 0; k < n && a != 0; ++k) a = heads[a];
+    if (a != 0) return false;
+  }
+  if (single_root && num_root_children != 1) return false;
+  if (projective) {
+    // Every word between a head and its modifier descends from the head.
+    for (int m = 1; m < n; ++m) {
+      int h = heads[m];
+      for (int k = std::min(h, m) + 1; k < std::max(h, m); ++k) {
+        int a = k;
+        while (a != 0 && a != h) a = heads[a];
+        if (a != h) return false;
+      }
+    }
+  }
+  return true;
+}
+
+// Call visit for every tree (as defined in IsTree) of a sentence, by trying
+// all the head assignments of its words.
+static void EnumerateTrees(
+    int sentence_length, const vector<int> &index_arcs, bool projective,
+    bool single_root, const std::function<void(const vector<int>&)> &visit) {
+  vector<int> heads(sentence_length, -1);
+  std::function<void(int)> assign = [&](int m) {
+    if (m == sentence_length) {
+      if (IsTree(heads, index_arcs, projective, single_root)) visit(heads);
+      return;
+    }
+    for (int h = 0; h < sentence_length; ++h) {
+      if (index_arcs[h * sentence_length + m] < 0) continue;
+      heads[m] = h;
+      assign(m + 1);
+    }
+  };
+  assign(1);
+}
+
+static int CountRootChildren(const vector<int> &heads) {
+  int num_root_children = 0;
+  for (int m = 1; m < heads.size(); ++m) {
+    if (heads[m] == 0) ++num_root_children;
+  }
+  return num_root_children;
+}
+
+// Sum of the scores of the arcs of a tree and, if second_order is not NULL,
+// of its consecutive siblings and grandparents, as scored by
+// RunSecondOrderEisner: the children of each node are visited from the
+// innermost to the outermost on each side, starting from the node itself
+// and ending at -1 (left) or n (right).
+static double ComputeTreeScore(const vector<int> &heads,
+                               const vector<int> &index_arcs,
+                               const vector<double> &scores,
+                               const SecondOrderWorkspace *second_order) {
+  int n = heads.size();
+  double score = 0.0;
+  for (int m = 1; m < n; ++m) {
+    score += scores[index_arcs[heads[m] * n + m]];
+  }
+  if (!second_order) return score;
+  for (int h = 0; h < n; ++h) {
+    int previous = h;
+    for (int m = h + 1; m < n; ++m) {
+      if (heads[m] != h) continue;
+      score += second_order->sibling_scores[
+        second_order->Sibling(h, previous, m)];
+      previous = m;
+    }
+    score += second_order->sibling_scores[
+      second_order->Sibling(h, previous, n)];
+    previous = h;
+    for (int m = h - 1; m >= 1; --m) {
+      if (heads[m] != h) continue;
+      score += second_order->sibling_scores[
+        second_order->Sibling(h, previous, m)];
+      previous = m;
+    }
+    score += second_order->sibling_scores[
+      second_order->Sibling(h, previous, -1)];
+  }
+  if (second_order->use_grandparents) {
+    for (int m = 1; m < n; ++m) {
+      int h = heads[m];
+      if (h == 0) continue;
+      score += second_order->grandparent_scores[(heads[h] * n + h) * n + m];
+    }
+  }
+  return score;
+}
+
+// Check a decoder against a brute-force enumeration of the trees, on
+// --bench_runs random graphs of each length: half of them have all the
+// possible arcs, and the others all the arcs from the root and each other
+// arc with probability 1/2. For second_order_eisner, the consecutive sibling
+// scores and, in every other graph, the grandparent scores are random as
+// well. The decoders of the best tree must return a tree
+// with the best score (among the ones with the fewest children of the root,
+// for chu_liu_edmonds_single_root), and the marginal decoders the
+// log-partition function and arc marginals of the enumeration. Graphs without any tree allowed by
+// the decoder are skipped. Returns the number of graphs where the check
+// failed.
+static int VerifyDecoder(const string &name) {
+  DependencyDecoder decoder;
+  std::mt19937 generator(1234);
+  std::normal_distribution<double> distribution(0.0, 1.0);
+  std::bernoulli_distribution coin(0.5);
+  bool second_order = (name == "second_order_eisner");
+  bool projective = (name == "eisner" || name == "eisner_marginals" ||
+                     second_order);
+  bool single_root = projective;
+  // The root has as few children as possible.
+  bool fewest_root_children = (name == "chu_liu_edmonds_single_root");
+  bool marginal = (name == "eisner_marginals" || name == "matrix_tree");
+  int num_failures = 0;
+  CHECK_GT(FLAGS_bench_length_step, 0);
+  CHECK_GE(FLAGS_bench_min_length, 1);
+  CHECK_LE(FLAGS_bench_max_length, kMaxVerifiedLength)
+    << "Sentences are too long for enumerating their trees.";
+  for (int length = FLAGS_bench_min_length; length <= FLAGS_bench_max_length;
+       length += FLAGS_bench_length_step) {
+    int n = length + 1;
+    int num_skipped = 0;
+    double max_error = 0.0;
+    for (int run = 0; run < FLAGS_bench_runs; ++run) {
+      bool dense = coin(generator);
+      vector<DependencyPartArc*> arcs;
+      vector<double> scores;
+      vector<int> index_arcs(n * n, -1);
+      for (int h = 0; h < n; ++h) {
+        for (int m = 1; m < n; ++m) {
+          if (h == m) continue;
+          if (h > 0 && !dense && coin(generator)) continue;
+          index_arcs[h * n + m] = arcs.size();
+          arcs.push_back(new DependencyPartArc(h, m));
+          scores.push_back(distribution(generator));
+        }
+      }
+      SecondOrderWorkspace second_order_workspace;
+      if (second_order) {
+        second_order_workspace.Initialize(n, run % 2 == 1);
+        for (int r = 0; r < arcs.size(); ++r) {
+          second_order_workspace.arc_scores[arcs[r]->head() * n +
+                                            arcs[r]->modifier()] = scores[r];
+        }
+        for (auto &score : second_order_workspace.sibling_scores) {
+          score = distribution(generator);
+        }
+        for (auto &score : second_order_workspace.grandparent_scores) {
+          score = distribution(generator);
+        }
+      }
+      const SecondOrderWorkspace *tree_scores =
+        second_order ? &second_order_workspace : NULL;
+
+      // Enumerate the trees, first for the best score, then (for the
+      // marginal decoders) for the partition function and the marginals.
+      int num_trees = 0;
+      int min_root_children = n;
+      double best_value = -std::numeric_limits<double>::infinity();
+      EnumerateTrees(n, index_arcs, projective, single_root,
+                     [&](const vector<int> &heads) {
+        ++num_trees;
+        int num_root_children =
+          fewest_root_children ? CountRootChildren(heads) : 0;
+        if (num_root_children < min_root_children) {
+          min_root_children = num_root_children;
+          best_value = -std::numeric_limits<double>::infinity();
+        }
+        if (num_root_children == min_root_children) {
+          best_value = std::max(best_value,
+                                ComputeTreeScore(heads, index_arcs, scores,
+                                                 tree_scores));
+        }
+      });
+
+      bool valid = true;
+      double error = 0.0;
+      if (num_trees == 0) {
+        ++num_skipped;
+      } else if (marginal) {
+        double partition = 0.0;
+        vector<double> expected(arcs.size(), 0.0);
+        EnumerateTrees(n, index_arcs, projective, single_root,
+                       [&](const vector<int> &heads) {
+          double weight = exp(ComputeTreeScore(heads, index_arcs, scores,
+                                               NULL) - best_value);
+          partition += weight;
+          for (int m = 1; m < n; ++m) {
+            expected[index_arcs[heads[m] * n + m]] += weight;
+          }
+        });
+        vector<double> marginals;
+        double log_partition_function;
+        if (name == "eisner_marginals") {
+          decoder.RunEisnerMarginals(n, arcs, scores, &marginals,
+                                     &log_partition_function);
+        } else {
+          decoder.RunMatrixTree(n, arcs, scores, &marginals,
+                                &log_partition_function);
+        }
+        valid = (marginals.size() == arcs.size());
+        if (valid) {
+          error = fabs(log_partition_function - best_value - log(partition));
+          for (int r = 0; r < arcs.size(); ++r) {
+            error = std::max(error,
+                             fabs(marginals[r] - expected[r] / partition));
+          }
+        }
+      } else {
+        vector<int> heads;
+        double value;
+        if (name == "eisner") {
+          decoder.RunEisner(n, arcs, scores, &heads, &value);
+        } else if (name == "chu_liu_edmonds") {
+          decoder.RunChuLiuEdmonds(n, arcs, scores, &heads, &value);
+        } else if (name == "chu_liu_edmonds_single_root") {
+          decoder.RunChuLiuEdmondsSingleRoot(n, arcs, scores, &heads, &value);
+        } else {
+          decoder.RunSecondOrderEisner(&second_order_workspace, &heads,
+                                       &value);
+        }
+        valid = (heads.size() == n &&
+                 IsTree(heads, index_arcs, projective, single_root) &&
+                 (!fewest_root_children ||
+                  CountRootChildren(heads) == min_root_children));
+        if (valid) {
+          error = std::max(
+            fabs(value - best_value),
+            fabs(ComputeTreeScore(heads, index_arcs, scores, tree_scores) -
+                 best_value));
+        }
+      }
+      // The comparisons are false for NaNs.
+      if (!valid || !(error <= kVerifyTolerance)) {
+        ++num_failures;
+        if (valid) {
+          LOG(ERROR) << name << "  length " << length << "  graph " << run
+                     << ": error " << error;
+        } else {
+          LOG(ERROR) << name << "  length " << length << "  graph " << run
+                     << ": not a tree or wrong number of marginals";
+        }
+      }
+      if (valid) max_error = std::max(max_error, error);
+
+      for (int r = 0; r < arcs.size(); ++r) {
+        delete arcs[r];
+      }
+    }
+    LOG(INFO) << name << "  length " << setfill(' ') << setw(2) << length
+              << "  graphs " << FLAGS_bench_runs - num_skipped
+              << " (" << num_skipped << " without trees skipped)"
+              << "  max error " << max_error;
+  }
+  return num_failures;
+}
+
+static void WriteDecoderResults(ostream &os,
+                                const vector<DecoderBenchmarkResult> &results) {
+  os << setprecision(6) << fixed;
+  if (FLAGS_bench_output_format == "json") {
+    os << "{" << endl;
+    os << "  \"task\": \"decoder\"," << endl;
+    os << "  \"decoder\": \"" << FLAGS_bench_decoder << "\"," << endl;
+    os << "  \"runs\": " << FLAGS_bench_runs << "," << endl;
+    os << "  \"lengths\": [" << endl;
+    for (int i = 0; i < results.size(); ++i) {
+      os << "    {\"length\": " << results[i].length << ", "
+         << "\"arcs\": " << results[i].num_arcs << ", "
+         << "\"mean_us\": " << 1e6 * results[i].mean_time << ", "
+         << "\"allocations\": " << results[i].allocations << "}";
+      if (i + 1 < results.size()) os << ",";
+      os << endl;
+    }
+    os << "  ]" << endl;
+    os << "}" << endl;
+  } else if (FLAGS_bench_output_format == "csv") {
+    os << "decoder,length,arcs,runs,mean_us,allocations" << endl;
+    for (int i = 0; i < results.size(); ++i) {
+      os << FLAGS_bench_decoder << "," << results[i].length << ","
+         << results[i].num_arcs << "," << FLAGS_bench_runs << ","
+         << 1e6 * results[i].mean_time << "," << results[i].allocations
+         << endl;
+    }
+  } else {
+    CHECK(false) << "Unknown output format: " << FLAGS_bench_output_format;
+  }
+}
+
+struct LatencySummary {
+  int count;
+  double total;
+  double mean;
+  double p50;
+  double p90;
+  double p99;
+  double max;
+};
+
+static void SummarizeLatencies(const vector<double> &latencies,
+                               LatencySummary *summary) {
+  summary->count = latencies.size();
+  summary->total = 0.0;
+  for (int i = 0; i < latencies.size(); ++i) summary->total += latencies[i];
+  summary->mean = latencies.empty() ? 0.0 : summary->total / latencies.size();
+  summary->p50 = StageProfiler::ComputePercentile(latencies, 50.0);
+  summary->p90 = StageProfiler::ComputePercentile(latencies, 90.0);
+  summary->p99 = StageProfiler::ComputePercentile(latencies, 99.0);
+  summary->max = StageProfiler::ComputePercentile(latencies, 100.0);
+}
+
+// Writes one JSON object with the global measurements and a list of
+// stages; the last stage ("total") is the end-to-end latency per instance.
+// Latencies are in microseconds.
+static void WriteJson(ostream &os, const StageProfiler &profiler,
+                      const BenchmarkResults &results,
+                      const vector<string> &stage_names,
+                      const vector<LatencySummary> &summaries,
+                      const vector<uint64_t> &allocations) {
+  int num_items = profiler.GetNumItems();
+  os << setprecision(6) << fixed;
+  os << "{" << endl;
+  os << "  \"task\": \"" << FLAGS_bench_task << "\"," << endl;
+  os << "  \"runs\": " << FLAGS_bench_runs << "," << endl;
+  os << "  \"instances\": " << num_items << "," << endl;
+  os << "  \"tokens\": " << profiler.GetNumTokens() << "," << endl;
+  os << "  \"load_seconds\": " << results.load_time << "," << endl;
+  os << "  \"run_seconds\": " << results.run_time << "," << endl;
+  os << "  \"sentences_per_second\": "
+     << num_items / results.run_time << "," << endl;
+  os << "  \"tokens_per_second\": "
+     << profiler.GetNumTokens() / results.run_time << "," << endl;
+  os << "  \"peak_rss_kb\": " << GetPeakResidentSetSize() << "," << endl;
+  os << "  \"allocations\": " << profiler.GetTotalAllocations() << ","
+     << endl;
+  os << "  \"stages\": [" << endl;
+  for (int k = 0; k < stage_names.size(); ++k) {
+    const LatencySummary &summary = summaries[k];
+    os << "    {\"name\": \"" << stage_names[k] << "\", "
+       << "\"count\": " << summary.count << ", "
+       << "\"total_seconds\": " << summary.total << ", "
+       << "\"mean_us\": " << 1e6 * summary.mean << ", "
+       << "\"p50_us\": " << 1e6 * summary.p50 << ", "
+       << "\"p90_us\": " << 1e6 * summary.p90 << ", "
+       << "\"p99_us\": " << 1e6 * summary.p99 << ", "
+       << "\"max_us\": " << 1e6 * summary.max << ", "
+       << "\"allocations\": " << allocations[k] << "}";
+    if (k + 1 < stage_names.size()) os << ",";
+    os << endl;
+  }
+  os << "  ]" << endl;
+  os << "}" << endl;
+}
+
+// Writes one CSV row per stage; the global measurements are repeated in
+// every row so that each row can be read on its own.
+static void WriteCsv(ostream &os, const StageProfiler &profiler,
+                     const BenchmarkResults &results,
+                     const vector<string> &stage_names,
+                     const vector<LatencySummary> &summaries,
+                     const vector<uint64_t> &allocations) {
+  int num_items = profiler.GetNumItems();
+  os << setprecision(6) << fixed;
+  os << "task,stage,count,total_seconds,mean_us,p50_us,p90_us,p99_us,max_us,"
+     << "allocations,instances,tokens,sentences_per_second,tokens_per_second,"
+     << "peak_rss_kb" << endl;
+  for (int k = 0; k < stage_names.size(); ++k) {
+    const LatencySummary &summary = summaries[k];
+    os << FLAGS_bench_task << "," << stage_names[k] << ","
+       << summary.count << "," << summary.total << ","
+       << 1e6 * summary.mean << "," << 1e6 * summary.p50 << ","
+       << 1e6 * summary.p90 << "," << 1e6 * summary.p99 << ","
+       << 1e6 * summary.max << "," << allocations[k] << ","
+       << num_items << "," << profiler.GetNumTokens() << ","
+       << num_items / results.run_time << ","
+       << profiler.GetNumTokens() / results.run_time << ","
+       << GetPeakResidentSetSize() << endl;
+  }
+}
+
+int main(int argc, char** argv) {
+  // Initialize Google's logging library.
+  google::InitGoogleLogging(argv[0]);
+
+  // Parse command line flags.
+  google::ParseCommandLineFlags(&argc, &argv, true);
+  FLAGS_train = false;
+  FLAGS_test = true;
+
+  if (FLAGS_bench_task == "decoder" && FLAGS_bench_verify) {
+    int num_decoders = 0;
+    int num_failures = 0;
+    for (const char *name : kVerifiedDecoders) {
+      if (FLAGS_bench_decoder != "all" && FLAGS_bench_decoder != name) {
+        continue;
+      }
+      ++num_decoders;
+      num_failures += VerifyDecoder(name);
+    }
+    CHECK_GT(num_decoders, 0)
+      << "Cannot verify decoder: " << FLAGS_bench_decoder;
+    if (num_failures > 0) {
+      LOG(ERROR) << "Failed checks: " << num_failures;
+    } else {
+      LOG(INFO) << "All the checks passed.";
+    }
+    google::ShutDownCommandLineFlags();
+    google::ShutdownGoogleLogging();
+    return (num_failures > 0) ? 1 : 0;
+  }
+
+  if (FLAGS_bench_task == "decoder") {
+    vector<DecoderBenchmarkResult> decoder_results;
+    RunDecoderBenchmark(&decoder_results);
+    for (int i = 0; i < decoder_results.size(); ++i) {
+      LOG(INFO) << FLAGS_bench_decoder << "  length "
+                << setfill(' ') << setw(4) << decoder_results[i].length
+                << "  mean " << 1e6 * decoder_results[i].mean_time << " us"
+                << "  allocations " << decoder_results[i].allocations;
+    }
+    if (FLAGS_file_bench_output != "") {
+      ofstream os(FLAGS_file_bench_output.c_str());
+      CHECK(os.good()) << "Could not open " << FLAGS_file_bench_output << ".";
+      WriteDecoderResults(os, decoder_results);
+    }
+    google::ShutDownCommandLineFlags();
+    google::ShutdownGoogleLogging();
+    return 0;
+  }
+
+  vector<string> stage_names;
+  Pipe::GetBenchmarkStageNames(&stage_names);
+  StageProfiler profiler(stage_names);
+  profiler.SetAllocationCounter(CountAllocations);
+
+  BenchmarkResults results;
+  if (FLAGS_bench_task == "parser") {
+    RunTaskBenchmark<DependencyOptions, DependencyPipe>(&profiler, &results);
+  } else if (FLAGS_bench_task == "tagger") {
+    RunTaskBenchmark<TaggerOptions, TaggerPipe>(&profiler, &results);
+  } else if (FLAGS_bench_task == "entity_recognizer") {
+    RunTaskBenchmark<EntityOptions, EntityPipe>(&profiler, &results);
+  } else if (FLAGS_bench_task == "morphological_tagger") {
+    RunTaskBenchmark<MorphologicalOptions, MorphologicalPipe>(&profiler,
+                                                              &results);
+  } else if (FLAGS_bench_task == "semantic_parser") {
+    RunTaskBenchmark<SemanticOptions, SemanticPipe>(&profiler, &results);
+  } else if (FLAGS_bench_task == "coreference_resolver") {
+    RunTaskBenchmark<CoreferenceOptions, CoreferencePipe>(&profiler,
+                                                          &results);
+  } else {
+    CHECK(false) << "Unknown task: " << FLAGS_bench_task;
+  }
+
+  // Stages that never ran (e.g. pruning in the tagger) are left out.
+  vector<string> names;
+  vector<LatencySummary> summaries;
+  vector<uint64_t> allocations;
+  for (int k = 0; k < profiler.GetNumStages(); ++k) {
+    if (profiler.GetStageLatencies(k).empty()) continue;
+    LatencySummary summary;
+    SummarizeLatencies(profiler.GetStageLatencies(k), &summary);
+    names.push_back(profiler.GetStageName(k));
+    summaries.push_back(summary);
+    allocations.push_back(profiler.GetStageAllocations(k));
+  }
+  LatencySummary summary;
+  SummarizeLatencies(profiler.GetItemLatencies(), &summary);
+  names.push_back("total");
+  summaries.push_back(summary);
+  allocations.push_back(profiler.GetTotalAllocations());
+
+  for (int k = 0; k < names.size(); ++k) {
+    LOG(INFO) << setfill(' ') << setw(12) << names[k]
+              << "  mean " << 1e6 * summaries[k].mean << " us"
+              << "  p50 " << 1e6 * summaries[k].p50 << " us"
+              << "  p90 " << 1e6 * summaries[k].p90 << " us"
+              << "  p99 " << 1e6 * summaries[k].p99 << " us"
+              << "  allocations " << allocations[k];
+  }
+  LOG(INFO) << "Instances: " << profiler.GetNumItems()
+            << "  Tokens: " << profiler.GetNumTokens();
+  LOG(INFO) << "Sentences per second: "
+            << profiler.GetNumItems() / results.run_time;
+  LOG(INFO) << "Tokens per second: "
+            << profiler.GetNumTokens() / results.run_time;
+  LOG(INFO) << "Peak RSS: " << GetPeakResidentSetSize() << " KB";
+
+  if (FLAGS_file_bench_output != "") {
+    ofstream os(FLAGS_file_bench_output.c_str());
+    CHECK(os.good()) << "Could not open " << FLAGS_file_bench_output << ".";
+    if (FLAGS_bench_output_format == "json") {
+      WriteJson(os, profiler, results, names, summaries, allocations);
+    } else if (FLAGS_bench_output_format == "csv") {
+      WriteCsv(os, profiler, results, names, summaries, allocations);
+    } else {
+      CHECK(false) << "Unknown output format: " << FLAGS_bench_output_format;
+    }
+  }
+
+  // Destroy allocated memory regarding line flags.
+  google::ShutDownCommandLineFlags();
+  google::ShutdownGoogleLogging();
+  return 0;
+}
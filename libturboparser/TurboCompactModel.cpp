@@ -0,0 +1,162 @@
+// Copyright (c) 2012-2015 Andre Martins
+// All Rights Reserved.
+//
+// This file is part of TurboParser 2.3.
+//
+// TurboParser 2.3 is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// TurboParser 2.3 is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with TurboParser 2.3.  If not, see <http://www.gnu.org/licenses/>.
+
+// Model compaction tool: loads a model of any of the tasks, drops the weights
+// whose magnitude is at most --compact_threshold (by default, only the ones
+// that are exactly zero) and, with --compact_max_features_per_type, all but
+// the largest features of each feature type, and saves the smaller model (see
+// Parameters::Compact). The pruner of the parsers is compacted as well.
+// The sizes of both model files are reported, and with --file_test, also the
+// evaluation score (e.g. accuracy) of both models on that data.
+//
+// Example:
+//   turbo_compact_model --compact_task=parser --file_model=model
+//     --file_compact_model=model.compact --compact_threshold=1e-4
+//     --file_test=dev.conll
+//
+// The predictions on --file_test are not written unless --file_prediction
+// is given (both models write them to that file in turn).
+
+#include <stdio.h>
+#include <glog/logging.h>
+#include <gflags/gflags.h>
+#include "Utils.h"
+#include "TaggerPipe.h"
+#include "EntityPipe.h"
+#include "MorphologicalPipe.h"
+#include "DependencyPipe.h"
+#include "SemanticPipe.h"
+
+using namespace std;
+
+DEFINE_string(compact_task, "parser",
+              "Task whose model is compacted: parser, tagger, "
+              "entity_recognizer, morphological_tagger or semantic_parser.");
+DEFINE_string(file_compact_model, "",
+              "Path to the file where the compacted model is saved.");
+DEFINE_double(compact_threshold, 0.0,
+              "Weights whose magnitude is at most this value are dropped.");
+DEFINE_int32(compact_max_features_per_type, 0,
+             "If positive, keep at most this number of features of each "
+             "feature type, by decreasing magnitude of their weights.");
+
+struct CompactionResults {
+  int num_features; // Features of the original model (without the pruner).
+  int num_compacted_features; // Same, for the compacted model.
+  int num_dropped; // Features dropped, including the ones of the pruner.
+  double score; // Evaluation score of the original model.
+  double compacted_score; // Evaluation score of the compacted model.
+};
+
+// Size of a file in bytes.
+static long GetFileSize(const string &path) {
+  FILE *fs = fopen(path.c_str(), "rb");
+  CHECK(fs) << "Could not open " << path << ".";
+  fseek(fs, 0, SEEK_END);
+  long size = ftell(fs);
+  fclose(fs);
+  return size;
+}
+
+// Load a model and run it on --file_test, returning the evaluation score.
+template <class OptionsType, class PipeType>
+double EvaluateModel(const string &model_path) {
+  OptionsType *options = new OptionsType;
+  options->Initialize();
+  options->SetModelFilePath(model_path);
+  PipeType *pipe = new PipeType(options);
+  pipe->Initialize();
+  pipe->LoadModelFile();
+  pipe->Run();
+  double score = pipe->GetEvaluationScore();
+  delete pipe;
+  delete options;
+  return score;
+}
+
+template <class OptionsType, class PipeType>
+void CompactTaskModel(CompactionResults *results) {
+  OptionsType *options = new OptionsType;
+  options->Initialize();
+  PipeType *pipe = new PipeType(options);
+  pipe->Initialize();
+  pipe->LoadModelFile();
+  results->num_features = pipe->GetParameters()->Size();
+  results->num_dropped = pipe->CompactParameters(
+    FLAGS_compact_threshold, FLAGS_compact_max_features_per_type);
+  results->num_compacted_features = pipe->GetParameters()->Size();
+  options->SetModelFilePath(FLAGS_file_compact_model);
+  pipe->SaveModelFile();
+  delete pipe;
+  delete options;
+
+  if (FLAGS_file_test != "") {
+    results->score = EvaluateModel<OptionsType, PipeType>(FLAGS_file_model);
+    results->compacted_score =
+      EvaluateModel<OptionsType, PipeType>(FLAGS_file_compact_model);
+  }
+}
+
+int main(int argc, char** argv) {
+  // Initialize Google's logging library.
+  google::InitGoogleLogging(argv[0]);
+
+  // Parse command line flags.
+  google::ParseCommandLineFlags(&argc, &argv, true);
+  FLAGS_train = false;
+  FLAGS_test = true;
+  FLAGS_evaluate = (FLAGS_file_test != "");
+
+  CHECK(FLAGS_file_compact_model != "")
+    << "Specify the compacted model with --file_compact_model.";
+  CHECK(FLAGS_file_compact_model != FLAGS_file_model)
+    << "The compacted model must be saved to another file.";
+  CHECK_GE(FLAGS_compact_threshold, 0.0);
+
+  CompactionResults results;
+  if (FLAGS_compact_task == "parser") {
+    CompactTaskModel<DependencyOptions, DependencyPipe>(&results);
+  } else if (FLAGS_compact_task == "tagger") {
+    CompactTaskModel<TaggerOptions, TaggerPipe>(&results);
+  } else if (FLAGS_compact_task == "entity_recognizer") {
+    CompactTaskModel<EntityOptions, EntityPipe>(&results);
+  } else if (FLAGS_compact_task == "morphological_tagger") {
+    CompactTaskModel<MorphologicalOptions, MorphologicalPipe>(&results);
+  } else if (FLAGS_compact_task == "semantic_parser") {
+    CompactTaskModel<SemanticOptions, SemanticPipe>(&results);
+  } else {
+    CHECK(false) << "Unknown task: " << FLAGS_compact_task;
+  }
+
+  long size = GetFileSize(FLAGS_file_model);
+  long compacted_size = GetFileSize(FLAGS_file_compact_model);
+  LOG(INFO) << "Features: " << results.num_features << " -> "
+            << results.num_compacted_features
+            << " (" << results.num_dropped << " dropped in total).";
+  LOG(INFO) << "Model size: " << size << " -> " << compacted_size
+            << " bytes (" << 100.0 * compacted_size / size << "%).";
+  if (FLAGS_file_test != "") {
+    LOG(INFO) << "Evaluation score: " << results.score << " -> "
+              << results.compacted_score << " (delta "
+              << results.compacted_score - results.score << ").";
+  }
+
+  google::ShutDownCommandLineFlags();
+  google::ShutdownGoogleLogging();
+  return 0;
+}
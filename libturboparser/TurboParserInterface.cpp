@@ -122,15 +122,61 @@ void TurboEntityRecognizerWorker::TagSentence(EntityInstance *sentence) {
   entity_pipe_->ClassifyInstance(sentence);
 }
 
+TurboParserModel::TurboParserModel() {
+  parser_options_ = new DependencyOptions;
+  parser_options_->Initialize();
+
+  parser_pipe_ = new DependencyPipe(parser_options_);
+  parser_pipe_->Initialize();
+}
+
+TurboParserModel::~TurboParserModel() {
+  LOG(INFO) << "Deleting shared parser pipe.";
+  delete parser_pipe_;
+  LOG(INFO) << "Deleting shared parser options.";
+  delete parser_options_;
+}
+
+void TurboParserModel::LoadParserModel(const std::string &file_model) {
+  parser_options_->SetModelFilePath(file_model);
+
+  double time;
+  chronowrap::Chronometer chrono;
+  chrono.GetTime();
+
+  LOG(INFO) << "Loading shared model file " << file_model;
+
+  parser_pipe_->LoadModelFile();
+  // Freeze the model: from now on it is only read by the workers.
+  parser_pipe_->GetParameters()->StopGrowth();
+
+  chrono.StopTime();
+  time = chrono.GetElapsedTime();
+
+  LOG(INFO) << "Took " << time << " sec." << endl;
+}
+
 TurboParserWorker::TurboParserWorker() {
   parser_options_ = new DependencyOptions;
   parser_options_->Initialize();
 
   parser_pipe_ = new DependencyPipe(parser_options_);
   parser_pipe_->Initialize();
+  workspace_ = NULL;
+}
+
+TurboParserWorker::TurboParserWorker(TurboParserModel *model) {
+  parser_options_ = NULL;
+  parser_pipe_ = model->GetPipe();
+  workspace_ = parser_pipe_->CreateWorkspace();
 }
 
 TurboParserWorker::~TurboParserWorker() {
+  if (workspace_) {
+    // The pipe and options belong to the shared model.
+    delete workspace_;
+    return;
+  }
   LOG(INFO) << "Deleting parser pipe.";
   delete parser_pipe_;
   LOG(INFO) << "Deleting parser options.";
@@ -138,6 +184,7 @@ TurboParserWorker::~TurboParserWorker() {
 }
 
 void TurboParserWorker::LoadParserModel(const std::string &file_model) {
+  CHECK(!workspace_) << "Cannot load a model into a worker sharing a model.";
   parser_options_->SetModelFilePath(file_model);
 
   double time;
@@ -156,6 +203,7 @@ void TurboParserWorker::LoadParserModel(const std::string &file_model) {
 
 void TurboParserWorker::Parse(const std::string &file_test,
                               const std::string &file_prediction) {
+  CHECK(!workspace_) << "Cannot parse files with a worker sharing a model.";
   parser_options_->SetTestFilePath(file_test);
   parser_options_->SetOutputFilePath(file_prediction);
 
@@ -174,7 +222,11 @@ void TurboParserWorker::Parse(const std::string &file_test,
 void TurboParserWorker::ParseSentence(DependencyInstance *sentence) {
   if (sentence->size() == 0)
     return;
-  parser_pipe_->ClassifyInstance(sentence);
+  if (workspace_) {
+    parser_pipe_->ClassifyInstance(sentence, workspace_);
+  } else {
+    parser_pipe_->ClassifyInstance(sentence);
+  }
 }
 
 TurboSemanticParserWorker::TurboSemanticParserWorker() {
@@ -388,6 +440,9 @@ TurboParserInterface::~TurboParserInterface() {
   LOG(INFO) << "Deleting parser workers.";
   DeleteAllParsers();
 
+  LOG(INFO) << "Deleting shared parser models.";
+  DeleteAllParserModels();
+
   LOG(INFO) << "Deleting semantic parser workers.";
   DeleteAllSemanticParsers();
 
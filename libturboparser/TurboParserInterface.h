@@ -42,9 +42,31 @@ private:
   EntityPipe *entity_pipe_;
 };
 
+// A dependency parsing model (options, dictionaries, parameters and pruner)
+// loaded once and frozen, so that it can be shared read-only by several
+// TurboParserWorker instances, e.g. one per request thread. The model must
+// outlive all the workers created from it.
+class TurboParserModel {
+public:
+  TurboParserModel();
+  virtual ~TurboParserModel();
+
+  void LoadParserModel(const std::string &file_model);
+
+  DependencyPipe *GetPipe() { return parser_pipe_; }
+
+private:
+  DependencyOptions *parser_options_;
+  DependencyPipe *parser_pipe_;
+};
+
 class TurboParserWorker {
 public:
   TurboParserWorker();
+  // Create a lightweight worker that shares a loaded model and only owns its
+  // own decoding scratch space. Workers created this way can parse sentences
+  // concurrently (ParseSentence), but cannot load models or parse files.
+  TurboParserWorker(TurboParserModel *model);
   virtual ~TurboParserWorker();
 
   void LoadParserModel(const std::string &file_model);
@@ -57,6 +79,7 @@ public:
 private:
   DependencyOptions *parser_options_;
   DependencyPipe *parser_pipe_;
+  PipeWorkspace *workspace_; // Only for workers sharing a model.
 };
 
 class TurboSemanticParserWorker {
@@ -149,6 +172,20 @@ public:
     return parser;
   }
 
+  TurboParserModel *LoadParserModel(const std::string &file_model) {
+    TurboParserModel *parser_model = new TurboParserModel();
+    parser_model->LoadParserModel(file_model);
+    parser_models_.push_back(parser_model);
+    return parser_model;
+  }
+
+  // Create a parser that shares a model loaded with LoadParserModel.
+  TurboParserWorker *CreateParser(TurboParserModel *parser_model) {
+    TurboParserWorker *parser = new TurboParserWorker(parser_model);
+    parsers_.push_back(parser);
+    return parser;
+  }
+
   TurboSemanticParserWorker *CreateSemanticParser() {
     TurboSemanticParserWorker *semantic_parser =
       new TurboSemanticParserWorker();
@@ -191,6 +228,13 @@ public:
     parsers_.clear();
   }
 
+  void DeleteAllParserModels() {
+    for (int i = 0; i < parser_models_.size(); ++i) {
+      delete parser_models_[i];
+    }
+    parser_models_.clear();
+  }
+
   void DeleteAllSemanticParsers() {
     for (int i = 0; i < semantic_parsers_.size(); ++i) {
       delete semantic_parsers_[i];
@@ -217,6 +261,7 @@ private:
   char** argv_;
   std::vector<TurboTaggerWorker*> taggers_;
   std::vector<TurboParserWorker*> parsers_;
+  std::vector<TurboParserModel*> parser_models_;
   std::vector<TurboSemanticParserWorker*> semantic_parsers_;
   std::vector<TurboEntityRecognizerWorker*> entity_recognizers_;
   std::vector<TurboCoreferenceResolverWorker*> coreference_resolvers_;
@@ -75,6 +75,26 @@ int Alphabet::Save(FILE* fs) const {
 }
 
 // Loads the alphabet from a file.
+uint64_t Alphabet::GetChecksum() const {
+  // Sum a hash of each (entry, id) pair, so that the order does not matter.
+  uint64_t checksum = static_cast<uint64_t>(num_entries_);
+  for (const_iterator iter = begin(); iter != end(); ++iter) {
+    // FNV-1a hash of the entry and the id, mixed as in MurmurHash3.
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < iter->first.size(); ++i) {
+      hash ^= static_cast<unsigned char>(iter->first[i]);
+      hash *= 1099511628211ULL;
+    }
+    hash ^= static_cast<uint64_t>(iter->second);
+    hash *= 1099511628211ULL;
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    checksum += hash;
+  }
+  return checksum;
+}
+
 int Alphabet::Load(FILE* fs) {
   bool success;
   success = ReadInteger(fs, &num_entries_);
@@ -22,6 +22,7 @@
 #include "Utils.h"
 #include <unordered_map>
 #include <stdio.h>
+#include <stdint.h>
 #ifdef _WIN32
 #include <glog\logging.h>
 #endif
@@ -40,6 +41,11 @@ public:
   int Save(FILE* fs) const;
   int Load(FILE* fs);
 
+  // Checksum of the entries and their ids. It does not depend on the order
+  // in which the hash table stores (and Save writes) the entries, so equal
+  // dictionaries have the same checksum however they were built.
+  uint64_t GetChecksum() const;
+
   // Clear the dictionary.
   void clear() {
     num_entries_ = 0;
@@ -61,6 +67,8 @@ public:
   bool growth_stopped() const { return growth_stopped_; }
 
   // Insert/lookup/check existence of an entry.
+  // Lookup, Contains and GetName are safe to call from several threads as
+  // long as nobody is inserting.
   int Insert(const std::string &entry);
   int Lookup(const std::string &entry) const;
   bool Contains(const std::string &entry) const;
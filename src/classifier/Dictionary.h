@@ -23,6 +23,9 @@
 
 // Abstract class for a dictionary. Task-specific dictionaries should derive
 // from this class and implement the pure virtual methods.
+// Thread safety: once a dictionary is loaded (or locked with StopGrowth),
+// the const lookup methods of task-specific dictionaries can be called
+// concurrently from several threads; Load, Clear and insertions cannot.
 class Dictionary {
 public:
   Dictionary() {};
@@ -19,6 +19,9 @@
 #ifndef FEATURE_ENCODER_H_
 #define FEATURE_ENCODER_H_
 
+#include <stddef.h>
+#include <stdint.h>
+
 // This class implements several methods to pack a conjunction of atomic
 // features into a 64-bit word.
 class FeatureEncoder {
@@ -146,4 +149,125 @@ public:
   }
 };
 
+// A row of a declarative table of feature templates: the type of the feature
+// and the atoms that it conjoins, given as indices into an array of atom
+// values filled by the extractor. As in the CreateFKey_* methods, the atoms
+// are packed in order from bit 16 on, in 16 bits if their letter in the
+// layout is 'W' and in 8 bits if it is 'P'. The templates of a group are
+// written together (e.g., once per word between a head and a modifier), and
+// a template is only enabled if the extractor has all the options in its
+// requirements (e.g., labeled parsing).
+struct FeatureTemplate {
+  int group;
+  uint8_t type;
+  int requirements; // Bitmask of options.
+  const char *layout; // E.g. "WPP" for a word and two POS tags.
+  uint8_t atoms[6];
+};
+
+// First template of a group, or size if there is none.
+constexpr int FindFeatureTemplateGroup(const FeatureTemplate *table, int size,
+                                       int group) {
+  int i = 0;
+  while (i < size && table[i].group != group) ++i;
+  return i;
+}
+
+// End of the templates of a group, which must be contiguous.
+constexpr int FindFeatureTemplateGroupEnd(const FeatureTemplate *table,
+                                          int size, int group) {
+  int i = FindFeatureTemplateGroup(table, size, group);
+  while (i < size && table[i].group == group) ++i;
+  return i;
+}
+
+// Number of templates in [begin, end) enabled with the given options.
+constexpr int CountFeatureTemplates(const FeatureTemplate *table, int begin,
+                                    int end, int options) {
+  int count = 0;
+  for (int i = begin; i < end; ++i) {
+    if ((table[i].requirements & ~options) == 0) ++count;
+  }
+  return count;
+}
+
+// Offset of the k-th atom of a layout in the key.
+constexpr int GetFeatureAtomShift(const char *layout, int k) {
+  int shift = 16;
+  for (int j = 0; j < k; ++j) shift += (layout[j] == 'W') ? 16 : 8;
+  return shift;
+}
+
+constexpr int GetFeatureLayoutLength(const char *layout) {
+  int length = 0;
+  while (layout[length] != '\0') ++length;
+  return length;
+}
+
+// Writes the keys of the templates Table[I, End) enabled with Options,
+// unrolled at compile time: the disabled templates produce no code, and each
+// key is a fixed sequence of shifts and ors of the atom values. If
+// SourceOptions is not negative, the keys of the templates also enabled with
+// SourceOptions are copied from *source instead (which is advanced), so that
+// the keys extracted with fewer options can be completed in place.
+template <const FeatureTemplate *Table, int I, int End, int Options,
+          int SourceOptions>
+struct FeatureTemplateWriter {
+  static uint64_t *Write(uint8_t flags, const uint16_t *values,
+                         const uint64_t **source, uint64_t *keys) {
+    constexpr bool enabled = (Table[I].requirements & ~Options) == 0;
+    constexpr bool copied = SourceOptions >= 0 &&
+      (Table[I].requirements & ~SourceOptions) == 0;
+    if (enabled && copied) {
+      *keys++ = *(*source)++;
+    } else if (enabled) {
+      constexpr int num_atoms = GetFeatureLayoutLength(Table[I].layout);
+      uint64_t key = static_cast<uint64_t>(Table[I].type) |
+        (static_cast<uint64_t>(flags) << 8);
+      for (int k = 0; k < num_atoms; ++k) {
+        uint64_t value = values[Table[I].atoms[k]];
+        if (Table[I].layout[k] == 'P') value &= 0xff;
+        key |= value << GetFeatureAtomShift(Table[I].layout, k);
+      }
+      *keys++ = key;
+    }
+    return FeatureTemplateWriter<Table, I + 1, End, Options, SourceOptions>::
+      Write(flags, values, source, keys);
+  }
+};
+
+template <const FeatureTemplate *Table, int End, int Options,
+          int SourceOptions>
+struct FeatureTemplateWriter<Table, End, End, Options, SourceOptions> {
+  static uint64_t *Write(uint8_t flags, const uint16_t *values,
+                         const uint64_t **source, uint64_t *keys) {
+    return keys;
+  }
+};
+
+// The templates of a group of a table with Size templates, specialized for
+// Options: NumKeys is the number of keys that Write produces. Splice writes
+// the same keys, copying those of the templates enabled with SourceOptions
+// from *source (see FeatureTemplateWriter).
+template <const FeatureTemplate *Table, int Size, int Group, int Options>
+struct FeatureTemplateGroup {
+  static constexpr int Begin = FindFeatureTemplateGroup(Table, Size, Group);
+  static constexpr int End = FindFeatureTemplateGroupEnd(Table, Size, Group);
+  static constexpr int NumKeys =
+    CountFeatureTemplates(Table, Begin, End, Options);
+
+  static uint64_t *Write(uint8_t flags, const uint16_t *values,
+                         uint64_t *keys) {
+    return FeatureTemplateWriter<Table, Begin, End, Options, -1>::Write(
+      flags, values, NULL, keys);
+  }
+
+  template <int SourceOptions>
+  static uint64_t *Splice(uint8_t flags, const uint16_t *values,
+                          const uint64_t **source, uint64_t *keys) {
+    return FeatureTemplateWriter<Table, Begin, End, Options, SourceOptions>::
+      Write(flags, values, source, keys);
+  }
+};
+
 #endif /* FEATURE_ENCODER_H_ */
@@ -28,7 +28,13 @@ DEFINE_string(file_test, "",
 DEFINE_string(file_model, "",
               "Path to the file containing the model.");
 DEFINE_string(file_prediction, "",
-              "Path to the file where the predictions are output.");
+              "Path to the file where the predictions are output. If "
+              "empty, the predictions are not written.");
+DEFINE_string(file_mapped_model, "",
+              "If set, convert the model in --file_model to the "
+              "memory-mappable format, and save it to this path. The "
+              "weights of a mapped model are used in place, without "
+              "parsing them; its dictionaries are still parsed.");
 DEFINE_bool(train, false,
             "True for training the parser.");
 DEFINE_bool(test, false,
@@ -53,13 +59,84 @@ DEFINE_double(train_regularization_constant, 1e12,
               "Regularization parameter C.");
 DEFINE_int32(parameters_max_num_buckets, 50000000,
              "Maximum number of buckets in the hash table that stores the parameters.");
+DEFINE_bool(parameters_frozen_label_weights, true,
+            "True for storing the labeled weights of a model loaded for "
+            "testing in flat rows of weights, instead of a hash table of "
+            "label weights (see --parameters_dense_label_density). This "
+            "speeds up scoring; the weights keep the precision in "
+            "--parameters_precision.");
+DEFINE_double(parameters_dense_label_density, 0.5,
+              "Features of a model loaded for testing whose nonzero weights "
+              "cover at least this fraction of the labels get a dense row of "
+              "weights, with a column per label; the others a sparse row. "
+              "Dense rows are faster to score; with 0.5, they never take "
+              "more memory than sparse rows, and with 0, every row is "
+              "dense.");
+DEFINE_string(parameters_precision, "double",
+              "Precision of the weights of a model loaded for testing: "
+              "double, float, or int16 (with a scale factor per row of "
+              "labeled weights, or per block of 64 other weights). Lower "
+              "precisions use less memory, but change the scores slightly "
+              "(and so, possibly, the predictions); int16 is lossier than "
+              "float, which is the recommended reduced precision. A model "
+              "converted with --file_mapped_model keeps the precision of "
+              "its weights.");
+DEFINE_int32(feature_hash_bits, 0,
+             "If positive, train a model whose features (conjoined or not "
+             "with labels) are hashed into a fixed array of "
+             "2^feature_hash_bits float weights, instead of storing a weight "
+             "per feature. This bounds the memory of the model, at the cost of "
+             "collisions between features.");
 DEFINE_int32(save_model_period, 1000000,
              "Number of iteration after which a temporaty model is saved.");
+DEFINE_int32(train_num_threads, 1,
+             "Number of worker threads used at training time. With more than "
+             "one thread, instances are decoded in parallel in mini-batches "
+             "of --train_batch_size instances, and the updates are applied "
+             "in order at the end of each mini-batch.");
+DEFINE_int32(train_batch_size, 0,
+             "Number of instances decoded in parallel before updating the "
+             "parameters, if --train_num_threads > 1 (0 for the number of "
+             "threads). The instances of a batch are decoded with the same "
+             "parameters and, with SGD, their average gradient is followed, "
+             "so larger batches need more epochs to reach the accuracy of "
+             "sequential training. Small batches need few: with a batch of "
+             "4, MIRA needs no more epochs and SGD about twice as many. "
+             "When increasing the batch, scale --train_epochs along and "
+             "check the accuracy on held-out data.");
+DEFINE_bool(train_cache_features, false,
+            "True for caching the parts and features of the training "
+            "instances in the first epoch and reusing them in the next "
+            "epochs, instead of extracting them again. This speeds up the "
+            "models whose epochs are dominated by feature extraction (e.g. "
+            "basic), much less the larger ones. The cache is written to a "
+            "file and mapped in memory; it takes about 1 MB per sentence "
+            "with the standard model, so it needs disk space rather than "
+            "RAM.");
+DEFINE_string(train_feature_cache_file, "",
+              "File where the feature cache is written (and then mapped in "
+              "memory). Setting it implies --train_cache_features. If empty, "
+              "the cache is written to a temporary file in $TMPDIR (or "
+              "/tmp).");
+DEFINE_bool(train_streaming, false,
+            "True for reading the training instances from the training file "
+            "in every epoch, instead of keeping them all in memory.");
+DEFINE_int32(train_prefetch_size, 1024,
+             "Maximum number of training instances read ahead of the "
+             "trainer, if --train_streaming.");
+DEFINE_int32(train_shuffle_buffer_size, 0,
+             "If positive and --train_streaming, shuffle the training "
+             "instances in every epoch with a buffer of this many "
+             "instances.");
+DEFINE_int32(num_threads, 1,
+             "Number of worker threads used to classify instances at test "
+             "time. The output is written in the same order as the input.");
 
 void Options::Initialize() {
   file_train_ = FLAGS_file_train;
   file_test_ = FLAGS_file_test;
   file_model_ = FLAGS_file_model;
+  file_mapped_model_ = FLAGS_file_mapped_model;
   file_prediction_ = FLAGS_file_prediction;
   if (!FLAGS_train && !FLAGS_test) {
     FLAGS_test = true;
@@ -75,5 +152,28 @@ void Options::Initialize() {
   train_learning_rate_schedule_ = FLAGS_train_learning_rate_schedule;
   only_supported_features_ = FLAGS_only_supported_features;
   use_averaging_ = FLAGS_use_averaging;
+  feature_hash_bits_ = FLAGS_feature_hash_bits;
+  CHECK_GE(feature_hash_bits_, 0);
+  CHECK_LE(feature_hash_bits_, 32);
+  if (feature_hash_bits_ > 0 && only_supported_features_) {
+    // With hashing, every feature has a weight.
+    LOG(INFO) << "Ignoring --only_supported_features with --feature_hash_bits.";
+    only_supported_features_ = false;
+  }
   save_model_period_ = FLAGS_save_model_period;
+  train_num_threads_ = FLAGS_train_num_threads;
+  CHECK_GE(train_num_threads_, 1) << "--train_num_threads must be at least 1.";
+  train_batch_size_ = FLAGS_train_batch_size;
+  CHECK_GE(train_batch_size_, 0) << "--train_batch_size must be at least 0.";
+  if (train_batch_size_ == 0) train_batch_size_ = train_num_threads_;
+  train_feature_cache_file_ = FLAGS_train_feature_cache_file;
+  train_cache_features_ =
+    FLAGS_train_cache_features || !train_feature_cache_file_.empty();
+  train_streaming_ = FLAGS_train_streaming;
+  train_prefetch_size_ = FLAGS_train_prefetch_size;
+  CHECK_GE(train_prefetch_size_, 1)
+    << "--train_prefetch_size must be at least 1.";
+  train_shuffle_buffer_size_ = FLAGS_train_shuffle_buffer_size;
+  num_threads_ = FLAGS_num_threads;
+  CHECK_GE(num_threads_, 1) << "--num_threads must be at least 1.";
 }
@@ -28,6 +28,9 @@ using namespace std;
 DECLARE_bool(train);
 DECLARE_bool(test);
 DECLARE_bool(evaluate);
+DECLARE_string(file_test);
+DECLARE_string(file_model);
+DECLARE_string(file_mapped_model);
 
 DECLARE_string(train_algorithm);
 DECLARE_bool(only_supported_features);
@@ -38,9 +41,22 @@ DECLARE_double(train_initial_learning_rate);
 DECLARE_string(train_learning_rate_schedule);
 
 DECLARE_int32(parameters_max_num_buckets);
+DECLARE_bool(parameters_frozen_label_weights);
+DECLARE_double(parameters_dense_label_density);
+DECLARE_string(parameters_precision);
+DECLARE_int32(feature_hash_bits);
 
 DECLARE_int32(save_model_period);
 
+DECLARE_int32(train_num_threads);
+DECLARE_int32(train_batch_size);
+DECLARE_bool(train_cache_features);
+DECLARE_string(train_feature_cache_file);
+DECLARE_bool(train_streaming);
+DECLARE_int32(train_prefetch_size);
+DECLARE_int32(train_shuffle_buffer_size);
+DECLARE_int32(num_threads);
+
 //1 to use new developments regarding performance optimizations
 #ifndef USE_N_OPTIMIZATIONS
 #define USE_N_OPTIMIZATIONS 0 //1
@@ -69,6 +85,7 @@ public:
   const std::string &GetTestFilePath() { return file_test_; };
   const std::string &GetModelFilePath() { return file_model_; };
   const std::string &GetOutputFilePath() { return file_prediction_; };
+  const std::string &GetMappedModelFilePath() { return file_mapped_model_; };
   int GetNumEpochs() { return train_epochs_; };
   double GetRegularizationConstant() { return train_regularization_constant_; }
   const std::string &GetTrainingAlgorithm() { return train_algorithm_; }
@@ -78,10 +95,21 @@ public:
   }
   bool use_averaging() { return use_averaging_; }
   bool only_supported_features() { return only_supported_features_; }
+  int feature_hash_bits() { return feature_hash_bits_; }
   bool train() { return train_; }
   bool test() { return test_; }
   bool evaluate() { return evaluate_; }
   int save_model_period() { return save_model_period_; } 
+  int train_num_threads() { return train_num_threads_; }
+  int train_batch_size() { return train_batch_size_; }
+  bool train_cache_features() { return train_cache_features_; }
+  const std::string &train_feature_cache_file() {
+    return train_feature_cache_file_;
+  }
+  bool train_streaming() { return train_streaming_; }
+  int train_prefetch_size() { return train_prefetch_size_; }
+  int train_shuffle_buffer_size() { return train_shuffle_buffer_size_; }
+  int num_threads() { return num_threads_; }
 
   // Set option values.
   void SetTrainingFilePath(const std::string &file_train) {
@@ -108,6 +136,7 @@ protected:
   std::string file_test_;
   std::string file_model_;
   std::string file_prediction_;
+  std::string file_mapped_model_;
   bool train_;
   bool test_;
   bool evaluate_;
@@ -131,8 +160,17 @@ protected:
   std::string train_learning_rate_schedule_;
 
   bool only_supported_features_; // Use only supported features.
+  int feature_hash_bits_; // Bits of the hashed weight indices (0 = no hashing).
   bool use_averaging_; // Include a final averaging step during training.
   int save_model_period_; // Number of iteration after which a temporaty model is saved.
+  int train_num_threads_; // Number of worker threads used at training time.
+  int train_batch_size_; // Instances decoded in parallel between updates.
+  bool train_cache_features_; // Reuse the parts and features across epochs.
+  std::string train_feature_cache_file_; // Feature cache file (empty = RAM).
+  bool train_streaming_; // Read the training instances in every epoch.
+  int train_prefetch_size_; // Training instances read ahead when streaming.
+  int train_shuffle_buffer_size_; // Shuffle buffer when streaming (0 = none).
+  int num_threads_; // Number of worker threads used at test time.
 };
 
 #endif /*OPTIONS_H_*/
@@ -20,14 +20,41 @@
 #include <iostream>
 #include <math.h>
 
-void Parameters::Save(FILE *fs) {
-  weights_.Save(fs);
-  labeled_weights_.Save(fs);
+// Hashed parameters are saved after this marker, which cannot start the
+// (non-hashed) weights_: it would be a negative number of features, or the
+// low half of a number of buckets that is a power of two.
+const int kHashedParametersMarker = -1;
+
+void Parameters::Save(FILE *fs, const StreamLayout &layout) {
+  if (hashed()) {
+    bool success = WriteInteger(fs, kHashedParametersMarker);
+    CHECK(success);
+    hashed_weights_.Save(fs, layout);
+    return;
+  }
+  weights_.Save(fs, layout);
+  labeled_weights_.Save(fs, layout);
 }
 
-void Parameters::Load(FILE *fs) {
-  weights_.Load(fs);
-  labeled_weights_.Load(fs);
+void Parameters::Load(FILE *fs, const StreamLayout &layout) {
+  long position = ftell(fs);
+  int marker;
+  bool success = ReadInteger(fs, &marker);
+  CHECK(success);
+  hashed_averaged_weights_.Clear();
+  if (marker == kHashedParametersMarker) {
+    hashed_weights_.Load(fs, layout);
+    hash_bits_ = hashed_weights_.hash_bits();
+    weights_.Initialize();
+    labeled_weights_.Initialize();
+  } else {
+    success = (0 == fseek(fs, position, SEEK_SET));
+    CHECK(success);
+    hash_bits_ = 0;
+    hashed_weights_.Clear();
+    weights_.Load(fs, layout);
+    labeled_weights_.Load(fs, layout);
+  }
 
   LOG(INFO) << "Squared norm of the weight vector = " << GetSquaredNorm();
   LOG(INFO) << "Number of features = " << Size();
@@ -35,8 +35,8 @@ public:
     labeled_weights_.Initialize();
   }
   virtual ~FeatureVector() {};
-  const SparseParameterVectorDouble &weights() { return weights_; }
-  const SparseLabeledParameterVector &labeled_weights() {
+  const SparseParameterVectorDouble &weights() const { return weights_; }
+  const SparseLabeledParameterVector &labeled_weights() const {
     return labeled_weights_;
   }
   SparseParameterVectorDouble *mutable_weights() { return &weights_; }
@@ -57,20 +57,35 @@ protected:
 // output labels) and regular weights.
 // It allows averaging the parameters (as in averaged perceptron), which
 // requires keeping around another weight vector of the same size.
+// With feature hashing (feature_hash_bits > 0), all the weights, "simple" or
+// conjoined with labels, are instead kept in a HashedParameterVector of fixed
+// size; every feature then "exists", and there is nothing to grow or freeze.
+// Thread safety: the const methods (Get, ComputeScore, ComputeLabelScores,
+// etc.) do not modify the parameters, so they can be called concurrently
+// from several threads on a loaded model. They must not overlap with any
+// non-const call (gradient steps, Scale, Finalize, Load, ...).
 class Parameters {
 public:
   Parameters() {
     use_average_ = true;
+    hash_bits_ = 0;
   };
   virtual ~Parameters() {};
 
-  // Save/load the parameters.
-  void Save(FILE *fs);
-  void Load(FILE *fs);
+  // Save/load the parameters, in the layout of the stream (see StreamLayout).
+  void Save(FILE *fs, const StreamLayout &layout);
+  void Load(FILE *fs, const StreamLayout &layout);
 
-  // Initialize the parameters.
-  void Initialize(bool use_average) {
+  // Initialize the parameters. If feature_hash_bits is positive, the features
+  // are hashed into 2^feature_hash_bits weights.
+  void Initialize(bool use_average, int feature_hash_bits) {
     use_average_ = use_average;
+    hash_bits_ = feature_hash_bits;
+    if (hashed()) {
+      hashed_weights_.Initialize(hash_bits_);
+      if (use_average_) hashed_averaged_weights_.Initialize(hash_bits_);
+      return;
+    }
     weights_.Initialize();
     if (use_average_) averaged_weights_.Initialize();
     labeled_weights_.Initialize();
@@ -80,6 +95,13 @@ public:
   // Overwrite
   void Overwrite(Parameters *output_parameters){
     output_parameters->use_average_=use_average_;  // could be removed
+    output_parameters->hash_bits_ = hash_bits_;
+    if (hashed()) {
+      hashed_weights_.Copy(&output_parameters->hashed_weights_);
+      hashed_averaged_weights_.Copy(
+        &output_parameters->hashed_averaged_weights_);
+      return;
+    }
 
     weights_.Overwrite(&output_parameters->weights_);
     averaged_weights_.Overwrite(&output_parameters->averaged_weights_);
@@ -90,8 +112,14 @@ public:
 
   // Copy Parameters.
   void Copy(Parameters *output_parameters){
-    output_parameters->Initialize(use_average_);
+    output_parameters->Initialize(use_average_, hash_bits_);
     output_parameters->use_average_=use_average_;  // could be removed
+    if (hashed()) {
+      hashed_weights_.Copy(&output_parameters->hashed_weights_);
+      hashed_averaged_weights_.Copy(
+        &output_parameters->hashed_averaged_weights_);
+      return;
+    }
 
     weights_.Copy(&output_parameters->weights_);
     averaged_weights_.Copy(&output_parameters->averaged_weights_);
@@ -115,21 +143,104 @@ public:
     averaged_labeled_weights_.AllowGrowth();
   }
 
+  // Freeze the parameters once they will no longer be updated (e.g. after
+  // loading a model at test time). The "simple" weights are moved to a flat
+  // read-only layout, and the labeled weights (unless disabled by
+  // --parameters_frozen_label_weights) to rows, dense or sparse depending on
+  // --parameters_dense_label_density; they can still be read and saved, but
+  // not updated. Both are then stored with the precision in
+  // --parameters_precision (by default, double, which keeps the scores
+  // exact), except the weights of a mapped model (already frozen), which
+  // keep the precision in which the model was converted.
+  void Freeze() {
+    StopGrowth();
+    if (hashed()) return;
+    weights_.Freeze();
+    averaged_weights_.Freeze();
+    if (FLAGS_parameters_frozen_label_weights) {
+      labeled_weights_.Freeze(FLAGS_parameters_dense_label_density);
+      averaged_labeled_weights_.Freeze(FLAGS_parameters_dense_label_density);
+      LOG(INFO) << "Labeled weights frozen in "
+                << labeled_weights_.GetNumDenseRows() << " dense and "
+                << labeled_weights_.GetNumSparseRows() << " sparse rows ("
+                << labeled_weights_.GetFrozenWeightBytes() << " bytes).";
+    }
+    int precision = GetPrecisionCode(FLAGS_parameters_precision);
+    if (precision == kPrecisionDouble) return;
+    if (weights_.mapped()) {
+      // The weights of a mapped model are used in place; their precision is
+      // the one of the model converter (see SaveMappedModelFile).
+      if (weights_.precision() != precision) {
+        LOG(WARNING) << "The weights of the mapped model are stored in "
+                     << GetPrecisionName(weights_.precision())
+                     << "; ignoring --parameters_precision="
+                     << FLAGS_parameters_precision << " for them. Convert "
+                     << "the model with that flag to change their precision.";
+      }
+    } else {
+      double max_error = weights_.Quantize(precision);
+      LOG(INFO) << "Weights stored in " << FLAGS_parameters_precision
+                << " (maximum absolute error: " << max_error << ").";
+    }
+    if (labeled_weights_.mapped()) {
+      if (labeled_weights_.precision() != precision) {
+        LOG(WARNING) << "The labeled weights of the mapped model are stored "
+                     << "in " << GetPrecisionName(labeled_weights_.precision())
+                     << "; ignoring --parameters_precision="
+                     << FLAGS_parameters_precision << " for them.";
+      }
+    } else if (labeled_weights_.frozen()) {
+      double max_error = labeled_weights_.Quantize(precision);
+      LOG(INFO) << "Labeled weights stored in " << FLAGS_parameters_precision
+                << " (maximum absolute error: " << max_error << ").";
+    }
+  }
+
+  // Compact the parameters of a trained model (after Finalize, or once
+  // loaded), dropping the weights whose magnitude is at most threshold (with
+  // threshold 0, the weights that are exactly zero, e.g. of features that
+  // never fired on a mistake) and, if max_features_per_type is positive,
+  // keeping only the features of largest magnitude of each feature type (the
+  // low 8 bits of the key). Labeled features are ranked by the L1 norm of
+  // their weights. Frozen weights are frozen again in full precision.
+  // Returns the number of features dropped.
+  int Compact(double threshold, int max_features_per_type) {
+    CHECK(!hashed()) << "Hashed parameters cannot be compacted.";
+    CHECK_GE(threshold, 0.0);
+    return weights_.Compact(threshold, max_features_per_type) +
+      labeled_weights_.Compact(threshold, max_features_per_type);
+  }
+
+  // True if the features are hashed into a fixed number of weights.
+  bool hashed() const { return hash_bits_ > 0; }
+  int hash_bits() const { return hash_bits_; }
+
   // Get the number of parameters.
   // NOTE: this counts the parameters of the features that are conjoined with
-  // output labels as a single parameter.
-  int Size() const { return weights_.Size() + labeled_weights_.Size(); }
+  // output labels as a single parameter. With feature hashing, this is the
+  // number of nonzero weights instead.
+  int Size() const {
+    if (hashed()) return hashed_weights_.Size();
+    return weights_.Size() + labeled_weights_.Size();
+  }
 
   // Checks if a feature exists.
-  bool Exists(uint64_t key) const { return weights_.Exists(key); }
+  bool Exists(uint64_t key) const {
+    if (hashed()) return true;
+    return weights_.Exists(key);
+  }
 
   // Checks if a labeled feature exists.
   bool ExistsLabeled(uint64_t key) const {
+    if (hashed()) return true;
     return labeled_weights_.Exists(key);
   }
 
   // Get the weight of a "simple" feature.
-  double Get(uint64_t key) const { return weights_.Get(key); }
+  double Get(uint64_t key) const {
+    if (hashed()) return hashed_weights_.Get(key);
+    return weights_.Get(key);
+  }
 
   // Get the weights of features conjoined with output labels.
   // The vector "labels" contains the labels that we want to conjoin with;
@@ -139,23 +250,67 @@ public:
   bool Get(uint64_t key,
            const vector<int> &labels,
            vector<double> *label_scores) const {
+    if (hashed()) {
+      label_scores->resize(labels.size());
+      for (int k = 0; k < labels.size(); ++k) {
+        (*label_scores)[k] = hashed_weights_.Get(key, labels[k]);
+      }
+      return true;
+    }
     return labeled_weights_.Get(key, labels, label_scores);
   }
 
   // Get the squared norm of the parameter vector.
   double GetSquaredNorm() const {
+    if (hashed()) return hashed_weights_.GetSquaredNorm();
     return weights_.GetSquaredNorm() + labeled_weights_.GetSquaredNorm();
   }
 
   // Compute the score corresponding to a set of "simple" features.
   double ComputeScore(const BinaryFeatures &features) const {
-    double score = 0.0;
-    for (int j = 0; j < features.size(); ++j) {
-      score += Get(features[j]);
+    if (hashed()) {
+      return hashed_weights_.ComputeSum(features.data(), features.size());
     }
+    return weights_.ComputeSum(features.data(), features.size());
+  }
+
+  // Compute the score of a feature vector (e.g. the difference between the
+  // features of two outputs, see Pipe::MakeFeatureDifference), i.e. its dot
+  // product with the weights.
+  double ComputeScore(const FeatureVector &vector) const {
+    double score = vector.weights().DotProduct([this](uint64_t key) {
+      return Get(key);
+    });
+    score += vector.labeled_weights().DotProduct([this](uint64_t key,
+                                                        int label) {
+      if (hashed()) return hashed_weights_.Get(key, label);
+      return labeled_weights_.Get(key, label);
+    });
     return score;
   }
 
+  // Compute the scores of several parts from their "simple" features, storing
+  // the score of part part_indices[i] in (*scores)[part_indices[i]]. While a
+  // part is scored, the weights of the first features of the next part are
+  // prefetched.
+  void ComputeScores(const Features &features, const vector<int> &part_indices,
+                     vector<double> *scores) const {
+    for (int i = 0; i < part_indices.size(); ++i) {
+      if (i + 1 < part_indices.size()) {
+        const BinaryFeatures &next_features =
+          features.GetPartFeatures(part_indices[i + 1]);
+        if (hashed()) {
+          hashed_weights_.Prefetch(next_features.data(),
+                                   next_features.size());
+        } else {
+          weights_.Prefetch(next_features.data(), next_features.size());
+        }
+      }
+      int r = part_indices[i];
+      (*scores)[r] = ComputeScore(features.GetPartFeatures(r));
+    }
+  }
+
   // Compute the scores corresponding to a set of features, conjoined with
   // output labels. The vector scores, provided as output, contains the score
   // for each label.
@@ -164,17 +319,21 @@ public:
                           vector<double> *scores) const {
     scores->clear();
     scores->resize(labels.size(), 0.0);
-    vector<double> label_scores(labels.size(), 0.0);
-    for (int j = 0; j < features.size(); ++j) {
-      if (!Get(features[j], labels, &label_scores)) continue;
-      for (int k = 0; k < labels.size(); ++k) {
-        (*scores)[k] += label_scores[k];
-      }
+    if (hashed()) {
+      hashed_weights_.AddLabelScores(features.data(), features.size(), labels,
+                                     scores);
+      return;
     }
+    labeled_weights_.AddLabelScores(features.data(), features.size(), labels,
+                                    scores);
   }
 
   // Scale the parameter vector by scale_factor.
   void Scale(double scale_factor) {
+    if (hashed()) {
+      hashed_weights_.Scale(scale_factor);
+      return;
+    }
     weights_.Scale(scale_factor);
     labeled_weights_.Scale(scale_factor);
   }
@@ -187,6 +346,16 @@ public:
                         double eta,
                         int iteration,
                         double gradient) {
+    if (hashed()) {
+      for (int j = 0; j < features.size(); ++j) {
+        hashed_weights_.Add(features[j], -eta * gradient);
+        if (use_average_) {
+          hashed_averaged_weights_.Add(
+            features[j], static_cast<double>(iteration) * eta * gradient);
+        }
+      }
+      return;
+    }
     for (int j = 0; j < features.size(); ++j) {
       weights_.Add(features[j], -eta * gradient);
       if (use_average_) {
@@ -208,6 +377,17 @@ public:
                              int iteration,
                              int label,
                              double gradient) {
+    if (hashed()) {
+      for (int j = 0; j < features.size(); ++j) {
+        hashed_weights_.Add(features[j], label, -eta * gradient);
+        if (use_average_) {
+          hashed_averaged_weights_.Add(
+            features[j], label,
+            static_cast<double>(iteration) * eta * gradient);
+        }
+      }
+      return;
+    }
     for (int j = 0; j < features.size(); ++j) {
       labeled_weights_.Add(features[j], label, -eta * gradient);
     }
@@ -227,6 +407,13 @@ public:
     if (use_average_) {
       LOG(INFO) << "Averaging the weights...";
 
+      if (hashed()) {
+        hashed_averaged_weights_.Scale(
+          1.0 / static_cast<double>(num_iterations));
+        hashed_weights_.Add(hashed_averaged_weights_);
+        return;
+      }
+
       averaged_weights_.Scale(1.0 / static_cast<double>(num_iterations));
       weights_.Add(averaged_weights_);
 
@@ -248,6 +435,14 @@ protected:
   // Weights and averaged weights for the "labeled" features.
   SparseLabeledParameterVector labeled_weights_;
   SparseLabeledParameterVector averaged_labeled_weights_;
+
+  // Number of bits of the hashed weight indices, or 0 if the features are not
+  // hashed.
+  int hash_bits_;
+
+  // Weights and averaged weights of all the features, if they are hashed.
+  HashedParameterVectorFloat hashed_weights_;
+  HashedParameterVectorDouble hashed_averaged_weights_;
 };
 
 #endif /*PARAMETERS_H_*/
@@ -50,4 +50,36 @@ public:
   }
 };
 
+// An arena of parts of type T. Parts are allocated in blocks which are kept
+// when the arena is reset, so that the same memory is reused for the parts of
+// the next instance instead of allocating and deleting each part. Parts
+// created by the arena must not be deleted; they are invalidated by Reset().
+template <class T> class PartArena {
+public:
+  PartArena() { num_parts_ = 0; }
+  ~PartArena() {
+    for (int i = 0; i < blocks_.size(); ++i) {
+      delete[] blocks_[i];
+    }
+  }
+
+  // Create a part, constructed from the given arguments.
+  template <class... Args> T *Create(Args... args) {
+    int block = num_parts_ / kBlockSize;
+    if (block == blocks_.size()) blocks_.push_back(new T[kBlockSize]);
+    T *part = &blocks_[block][num_parts_ % kBlockSize];
+    *part = T(args...);
+    ++num_parts_;
+    return part;
+  }
+
+  // Make all the memory available again (without releasing it).
+  void Reset() { num_parts_ = 0; }
+
+private:
+  static const int kBlockSize = 1024;
+  vector<T*> blocks_;
+  int num_parts_;
+};
+
 #endif /* PART_H_ */
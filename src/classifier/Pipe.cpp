@@ -21,6 +21,24 @@
 #include <math.h>
 #include <iostream>
 #include <sstream>
+#include <deque>
+#include <map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <algorithm>
+#include <random>
+
+// Magic number and format version at the beginning of memory-mappable model
+// files. The rest of the file is the model as written by SaveModel, with the
+// parameter vectors in the mapped layout (see SerializationUtils.h).
+const uint64_t kMappedModelMagic = 0x4c444f4d4f425254ULL; // "TRBOMODL".
+// Version 2 added the precision of the weights; version 3 replaced the
+// scales of the int16 weights per feature type by scales per block; version
+// 4 stores the frozen rows of the labeled weights.
+const uint64_t kMappedModelFormatVersion = 4;
 
 Pipe::Pipe(Options* options) {
   options_ = options;
@@ -30,6 +48,14 @@ Pipe::Pipe(Options* options) {
   writer_ = NULL;
   decoder_ = NULL;
   parameters_ = NULL;
+  feature_cache_filling_ = false;
+  feature_cache_stream_ = NULL;
+  feature_cache_data_ = NULL;
+  feature_cache_ready_ = false;
+  num_training_instances_ = 0;
+  instance_stream_ = NULL;
+  training_workers_ = NULL;
+  profiler_ = NULL;
 }
 
 Pipe::~Pipe() {
@@ -38,7 +64,10 @@ Pipe::~Pipe() {
   delete writer_;
   delete decoder_;
   delete parameters_;
+  CloseInstanceStream();
+  StopTrainingWorkers();
   DeleteInstances();
+  DeleteFeatureCache();
 }
 
 void Pipe::Initialize() {
@@ -57,22 +86,61 @@ void Pipe::SaveModelByName(const std::string &model_name) {
 }
 
 void Pipe::LoadModelByName(const std::string &model_name) {
-  FILE *fs = fopen(model_name.c_str(), "rb");
-  CHECK(fs) << "Could not open model file for reading: " << model_name;
+  FILE *fs = OpenModelFile(model_name, &model_layout_);
   LoadModel(fs);
   fclose(fs);
+  model_layout_ = StreamLayout();
+}
+
+void Pipe::SaveMappedModelByName(const std::string &model_name) {
+  FILE *fs = fopen(model_name.c_str(), "wb");
+  CHECK(fs) << "Could not open model file for writing: " << model_name;
+  model_layout_.mapped = true;
+  bool success;
+  success = WriteUINT64(fs, kMappedModelMagic);
+  CHECK(success);
+  success = WriteUINT64(fs, kMappedModelFormatVersion);
+  CHECK(success);
+  SaveModel(fs);
+  fclose(fs);
+  model_layout_ = StreamLayout();
+}
+
+FILE *Pipe::OpenModelFile(const std::string &model_name,
+                          StreamLayout *layout) {
+  *layout = StreamLayout();
+  MappedFilePtr mapped_file(new MappedFile);
+  if (mapped_file->Open(model_name) &&
+      mapped_file->size() >= 2 * sizeof(uint64_t)) {
+    const uint64_t *header =
+      reinterpret_cast<const uint64_t*>(mapped_file->data());
+    if (header[0] == kMappedModelMagic) {
+      CHECK_EQ(header[1], kMappedModelFormatVersion)
+        << "Unsupported version of the mapped model format.";
+      FILE *fs = OpenMappedStream(mapped_file, layout);
+      CHECK(fs) << "Could not read mapped model file: " << model_name;
+      CHECK_EQ(0, fseek(fs, 2 * sizeof(uint64_t), SEEK_SET));
+      LOG(INFO) << "Using memory-mapped model file " << model_name;
+      return fs;
+    }
+  }
+  FILE *fs = fopen(model_name.c_str(), "rb");
+  CHECK(fs) << "Could not open model file for reading: " << model_name;
+  return fs;
 }
 
 void Pipe::SaveModel(FILE* fs) {
   options_->Save(fs);
   dictionary_->Save(fs);
-  parameters_->Save(fs);
+  parameters_->Save(fs, model_layout_);
 }
 
 void Pipe::LoadModel(FILE* fs) {
   options_->Load(fs);
   dictionary_->Load(fs);
-  parameters_->Load(fs);
+  parameters_->Load(fs, model_layout_);
+  // The parameters are read-only from now on unless we are training.
+  if (!options_->train()) parameters_->Freeze();
 }
 
 // TODO: Implement ComputeScores as follows:
@@ -83,10 +151,11 @@ void Pipe::LoadModel(FILE* fs) {
 void Pipe::ComputeScores(Instance *instance, Parts *parts, Features *features,
                          vector<double> *scores) {
   scores->resize(parts->size());
+  vector<int> part_indices(parts->size());
   for (int r = 0; r < parts->size(); ++r) {
-    const BinaryFeatures &part_features = features->GetPartFeatures(r);
-    (*scores)[r] = parameters_->ComputeScore(part_features);
+    part_indices[r] = r;
   }
+  parameters_->ComputeScores(*features, part_indices, scores);
 }
 
 void Pipe::MakeGradientStep(Parts *parts, Features *features, double eta,
@@ -145,16 +214,29 @@ void Pipe::RemoveUnsupportedFeatures(Instance *instance, Parts *parts,
 void Pipe::Train() {
   PreprocessData();
   CreateInstances();
-  parameters_->Initialize(options_->use_averaging());
+  parameters_->Initialize(options_->use_averaging(),
+                          options_->feature_hash_bits());
 
   if (options_->only_supported_features()) MakeSupportedParameters();
 
+  CreateFeatureCache();
+  if (options_->train_num_threads() > 1) {
+    if (options_->train_batch_size() > 1) {
+      LOG(WARNING) << "Training in mini-batches of "
+                   << options_->train_batch_size() << " instances "
+                   << "(--train_batch_size): the instances of a batch are "
+                   << "decoded with the same parameters, which may need more "
+                   << "epochs to reach the accuracy of sequential training.";
+    }
+    StartTrainingWorkers(options_->train_num_threads() - 1);
+  }
   for (int i = 0; i < options_->GetNumEpochs(); ++i) {
     TrainEpoch(i);
+    if (i == 0) FinishFeatureCache();
     if (options_->save_model_period() == 1 || (i && i%(options_->save_model_period()) == 0)){    
       Parameters *parameters_aux = new Parameters; 
       parameters_->Copy(parameters_aux);
-      parameters_->Finalize((i+1) * (int)instances_.size());
+      parameters_->Finalize((i+1) * num_training_instances_);
       SaveModelByName(options_->GetModelFilePath() + ".temp." + std::to_string(i));
       //parameters_aux->Copy(parameters_);
       //parameters_aux->Overwrite(parameters_);
@@ -164,7 +246,118 @@ void Pipe::Train() {
     }
   }
 
-  parameters_->Finalize(options_->GetNumEpochs() * (int)instances_.size());
+  StopTrainingWorkers();
+  DeleteFeatureCache();
+
+  parameters_->Finalize(options_->GetNumEpochs() * num_training_instances_);
+}
+
+void Pipe::CreateFeatureCache() {
+  DeleteFeatureCache();
+  if (!options_->train_cache_features()) return;
+  if (!SupportsFeatureCache()) {
+    LOG(INFO) << "Feature cache not supported by this task; ignoring it.";
+    return;
+  }
+  if (options_->train_streaming() &&
+      options_->train_shuffle_buffer_size() > 0) {
+    // The cache is indexed by the position of the instances in the epoch.
+    LOG(INFO) << "Feature cache not supported with shuffling; ignoring it.";
+    return;
+  }
+
+  // The cache is written to a file and mapped, so that it does not take
+  // heap memory and its pages can be dropped and read back by the system.
+  feature_cache_file_name_ = options_->train_feature_cache_file();
+  if (feature_cache_file_name_.empty()) {
+    feature_cache_stream_ = CreateTemporaryFile(&feature_cache_file_name_);
+    if (!feature_cache_stream_) {
+      LOG(INFO) << "Could not create a temporary feature cache file; "
+                << "ignoring it.";
+      return;
+    }
+  } else {
+    feature_cache_stream_ = fopen(feature_cache_file_name_.c_str(), "wb");
+    CHECK(feature_cache_stream_) << "Could not open feature cache "
+      << feature_cache_file_name_;
+  }
+  feature_cache_offsets_.assign(1, 0);
+  feature_cache_filling_ = true;
+}
+
+void Pipe::AppendCachedInstance(TrainingWorkspace *workspace) {
+  const vector<char> &entry = workspace->cache_entry;
+  CHECK_EQ(fwrite(entry.data(), 1, entry.size(), feature_cache_stream_),
+           entry.size()) << "Could not write the feature cache.";
+  feature_cache_offsets_.push_back(feature_cache_offsets_.back() +
+                                   entry.size());
+}
+
+void Pipe::FinishFeatureCache() {
+  if (!feature_cache_filling_) return;
+  feature_cache_filling_ = false;
+
+  CHECK_EQ(fclose(feature_cache_stream_), 0)
+    << "Could not write the feature cache.";
+  feature_cache_stream_ = NULL;
+  feature_cache_file_.reset(new MappedFile);
+  if (!feature_cache_file_->Open(feature_cache_file_name_)) {
+    LOG(INFO) << "Could not map feature cache " << feature_cache_file_name_
+              << "; ignoring it.";
+    DeleteFeatureCache();
+    return;
+  }
+  if (options_->train_feature_cache_file().empty()) {
+    // The mapping outlives the temporary file.
+    remove(feature_cache_file_name_.c_str());
+    feature_cache_file_name_.clear();
+  }
+  feature_cache_data_ = feature_cache_file_->data();
+  CHECK_EQ(feature_cache_offsets_.size(), num_training_instances_ + 1);
+  feature_cache_ready_ = true;
+
+  LOG(INFO) << "Feature cache size: " << feature_cache_offsets_.back()
+            << " bytes.";
+}
+
+void Pipe::DeleteFeatureCache() {
+  feature_cache_filling_ = false;
+  if (feature_cache_stream_) fclose(feature_cache_stream_);
+  feature_cache_stream_ = NULL;
+  feature_cache_file_.reset();
+  if (!feature_cache_file_name_.empty()) {
+    remove(feature_cache_file_name_.c_str());
+    feature_cache_file_name_.clear();
+  }
+  feature_cache_data_ = NULL;
+  feature_cache_offsets_.clear();
+  feature_cache_ready_ = false;
+}
+
+void Pipe::SaveCachedInstance(Instance *instance,
+                              TrainingWorkspace *workspace) {
+  vector<char> *entry = &workspace->cache_entry;
+  entry->clear();
+  SaveCachedPartsAndFeatures(entry, instance, workspace->parts,
+                             workspace->features);
+  const vector<double> &gold_outputs = workspace->gold_outputs;
+  AppendToBuffer(static_cast<int>(gold_outputs.size()), entry);
+  AppendToBuffer(gold_outputs.data(), gold_outputs.size(), entry);
+}
+
+void Pipe::LoadCachedInstance(int i, Instance *instance,
+                              TrainingWorkspace *workspace) {
+  const char *data = feature_cache_data_ + feature_cache_offsets_[i];
+  const char *end = feature_cache_data_ + feature_cache_offsets_[i + 1];
+  LoadCachedPartsAndFeatures(&data, end, instance, workspace->parts,
+                             workspace->features);
+  int num_outputs;
+  CHECK(ReadFromBuffer(&data, end, &num_outputs));
+  CHECK_GE(num_outputs, 0);
+  vector<double> *gold_outputs = &workspace->gold_outputs;
+  gold_outputs->resize(num_outputs);
+  CHECK(ReadFromBuffer(&data, end, gold_outputs->data(), num_outputs));
+  CHECK(data == end) << "Corrupt feature cache entry " << i << ".";
 }
 
 void Pipe::CreateInstances() {
@@ -175,19 +368,130 @@ void Pipe::CreateInstances() {
 
   reader_->Open(options_->GetTrainingFilePath());
   DeleteInstances();
+  num_training_instances_ = 0;
   Instance *instance = reader_->GetNext();
   while (instance) {
-    AddInstance(instance);
+    if (options_->train_streaming()) {
+      delete instance;
+    } else {
+      AddInstance(instance);
+    }
+    ++num_training_instances_;
     instance = reader_->GetNext();
   }
   reader_->Close();
 
-  LOG(INFO) << "Number of instances: " << instances_.size();
+  LOG(INFO) << "Number of instances: " << num_training_instances_;
 
   chrono.StopTime();
   LOG(INFO) << "Time: " << chrono.GetElapsedTime() << " sec.";
 }
 
+// State of a stream of training instances (see Pipe::OpenInstanceStream).
+struct InstanceStream {
+  std::thread reader; // Thread reading and formatting the instances.
+  std::mutex mutex;
+  std::condition_variable not_empty;
+  std::condition_variable not_full;
+  std::deque<Instance*> queue; // Instances read and not yet consumed.
+  bool done; // True when the reader has put all the instances in the queue.
+  bool stop; // True when the stream is being closed.
+};
+
+void Pipe::OpenInstanceStream(int shuffle_buffer_size, unsigned int seed) {
+  CHECK(!instance_stream_);
+  InstanceStream *stream = new InstanceStream;
+  stream->done = false;
+  stream->stop = false;
+  instance_stream_ = stream;
+  int prefetch_size = options_->train_prefetch_size();
+
+  reader_->Open(options_->GetTrainingFilePath());
+  stream->reader = std::thread([this, stream, prefetch_size,
+                                shuffle_buffer_size, seed]() {
+    // Put an instance in the queue, waiting while it is full. Return false
+    // (and delete the instance) if the stream is being closed.
+    auto push = [&](Instance *instance) {
+      std::unique_lock<std::mutex> lock(stream->mutex);
+      stream->not_full.wait(lock, [&]() {
+        return stream->stop || stream->queue.size() < prefetch_size;
+      });
+      if (stream->stop) {
+        delete instance;
+        return false;
+      }
+      stream->queue.push_back(instance);
+      stream->not_empty.notify_one();
+      return true;
+    };
+
+    // Once the shuffle buffer is full, each new instance replaces a random
+    // instance of the buffer, which goes to the queue.
+    std::mt19937 generator(seed);
+    vector<Instance*> shuffle_buffer;
+    bool open = true;
+    Instance *instance;
+    while (open && (instance = reader_->GetNext())) {
+      Instance *formatted_instance = GetFormattedInstance(instance);
+      if (instance != formatted_instance) delete instance;
+      if (shuffle_buffer_size <= 0) {
+        open = push(formatted_instance);
+      } else if (shuffle_buffer.size() < shuffle_buffer_size) {
+        shuffle_buffer.push_back(formatted_instance);
+      } else {
+        std::uniform_int_distribution<int> distribution(
+          0, shuffle_buffer_size - 1);
+        int k = distribution(generator);
+        open = push(shuffle_buffer[k]);
+        shuffle_buffer[k] = formatted_instance;
+      }
+    }
+    std::shuffle(shuffle_buffer.begin(), shuffle_buffer.end(), generator);
+    for (int k = 0; k < shuffle_buffer.size(); ++k) {
+      if (open) {
+        open = push(shuffle_buffer[k]);
+      } else {
+        delete shuffle_buffer[k];
+      }
+    }
+
+    std::lock_guard<std::mutex> lock(stream->mutex);
+    stream->done = true;
+    stream->not_empty.notify_all();
+  });
+}
+
+Instance *Pipe::GetNextStreamInstance() {
+  InstanceStream *stream = instance_stream_;
+  CHECK(stream);
+  std::unique_lock<std::mutex> lock(stream->mutex);
+  stream->not_empty.wait(lock, [&]() {
+    return stream->done || !stream->queue.empty();
+  });
+  if (stream->queue.empty()) return NULL;
+  Instance *instance = stream->queue.front();
+  stream->queue.pop_front();
+  stream->not_full.notify_one();
+  return instance;
+}
+
+void Pipe::CloseInstanceStream() {
+  InstanceStream *stream = instance_stream_;
+  if (!stream) return;
+  {
+    std::lock_guard<std::mutex> lock(stream->mutex);
+    stream->stop = true;
+    stream->not_full.notify_all();
+  }
+  stream->reader.join();
+  for (int i = 0; i < stream->queue.size(); ++i) {
+    delete stream->queue[i];
+  }
+  delete stream;
+  instance_stream_ = NULL;
+  reader_->Close();
+}
+
 void Pipe::MakeSupportedParameters() {
   Parts *parts = CreateParts();
   Features *features = CreateFeatures();
@@ -197,8 +501,12 @@ void Pipe::MakeSupportedParameters() {
 
   dictionary_->StopGrowth();
   parameters_->AllowGrowth();
-  for (int i = 0; i < instances_.size(); i++) {
-    Instance *instance = instances_[i];
+  bool streaming = options_->train_streaming();
+  if (streaming) OpenInstanceStream(0, 0);
+  for (int i = 0; i < num_training_instances_; i++) {
+    Instance *instance =
+      streaming ? GetNextStreamInstance() : instances_[i];
+    CHECK(instance) << "The training file has changed.";
     MakeParts(instance, parts, &gold_outputs);
     vector<bool> selected_parts(gold_outputs.size(), false);
     for (int r = 0; r < gold_outputs.size(); ++r) {
@@ -208,7 +516,9 @@ void Pipe::MakeSupportedParameters() {
     }
     MakeSelectedFeatures(instance, parts, selected_parts, features);
     TouchParameters(parts, features, selected_parts);
+    if (streaming) delete instance;
   }
+  if (streaming) CloseInstanceStream();
 
   delete parts;
   delete features;
@@ -218,16 +528,10 @@ void Pipe::MakeSupportedParameters() {
 }
 
 void Pipe::TrainEpoch(int epoch) {
-  Instance *instance;
-  Parts *parts = CreateParts();
-  Features *features = CreateFeatures();
-  vector<double> scores;
-  vector<double> gold_outputs;
-  vector<double> predicted_outputs;
   double total_cost = 0.0;
   double total_loss = 0.0;
   double eta;
-  int num_instances = (int)instances_.size();
+  int num_instances = num_training_instances_;
   double lambda = 1.0 / (options_->GetRegularizationConstant() *
                          (static_cast<double>(num_instances)));
   chronowrap::Chronometer chrono;
@@ -235,6 +539,9 @@ void Pipe::TrainEpoch(int epoch) {
   double time_decoding = 0;
   double time_scores = 0;
   int num_mistakes = 0;
+  bool sgd = (options_->GetTrainingAlgorithm() == "svm_sgd" ||
+              options_->GetTrainingAlgorithm() == "crf_sgd" ||
+              options_->GetTrainingAlgorithm() == "crf_margin_sgd");
 
   if (epoch == 0) {
     LOG(INFO) << "Lambda: " << lambda << "\t"
@@ -245,115 +552,59 @@ void Pipe::TrainEpoch(int epoch) {
 
   dictionary_->StopGrowth();
 
-  for (int i = 0; i < instances_.size(); i++) {
-    int t = num_instances * epoch + i;
-    instance = instances_[i];
-    MakeParts(instance, parts, &gold_outputs);
-    MakeFeatures(instance, parts, features);
+  int num_threads = options_->train_num_threads();
+  int batch_size = (num_threads > 1) ? options_->train_batch_size() : 1;
+  vector<TrainingWorkspace*> workspaces(batch_size);
+  for (int k = 0; k < batch_size; ++k) {
+    workspaces[k] = new TrainingWorkspace;
+    workspaces[k]->parts = CreateParts();
+    workspaces[k]->features = CreateFeatures();
+    workspaces[k]->delayed_update = (batch_size > 1);
+  }
 
-    // If using only supported features, must remove the unsupported ones.
-    // This is necessary not to mess up the computation of the squared norm
-    // of the feature difference vector in MIRA.
-    if (options_->only_supported_features()) {
-      RemoveUnsupportedFeatures(instance, parts, features);
+  // When streaming, the instances are read again in every epoch, shuffled
+  // differently each time.
+  bool streaming = options_->train_streaming();
+  if (streaming) {
+    OpenInstanceStream(options_->train_shuffle_buffer_size(), epoch);
+  }
+  vector<Instance*> batch(batch_size);
+
+  for (int begin = 0; begin < num_instances; begin += batch_size) {
+    int end = std::min(begin + batch_size, num_instances);
+    for (int i = begin; i < end; ++i) {
+      batch[i - begin] = streaming ? GetNextStreamInstance() : instances_[i];
+      CHECK(batch[i - begin]) << "The training file has changed.";
     }
 
-    chronowrap::Chronometer chrono_scores;
-    chrono_scores.GetTime();
-    ComputeScores(instance, parts, features, &scores);
-    chrono_scores.StopTime();
-    time_scores += chrono_scores.GetElapsedTime();
-
-    // This is a no-op by default. But it's convenient to have it here to build
-    // latent-variable structured classifiers (e.g. for coreference resolution).
-    double inner_loss = 0.0;
-    TransformGold(instance, parts, scores, &gold_outputs, &inner_loss);
-
-    if (options_->GetTrainingAlgorithm() == "perceptron" ||
-        options_->GetTrainingAlgorithm() == "mira") {
-      chronowrap::Chronometer chrono_decoding;
-      chrono_decoding.GetTime();
-      decoder_->Decode(instance, parts, scores, &predicted_outputs);
-      chrono_decoding.StopTime();
-      time_decoding += chrono_decoding.GetElapsedTime();
-
-      if (options_->GetTrainingAlgorithm() == "perceptron") {
-        for (int r = 0; r < parts->size(); ++r) {
-          if (!NEARLY_EQ_TOL(gold_outputs[r], predicted_outputs[r], 1e-6)) {
-            ++num_mistakes;
-          }
+    // Decode the instances in the batch with the current parameters.
+    DecodeTrainingBatch(begin, end, batch, workspaces);
+
+    // Update the parameters, one instance at a time.
+    for (int i = begin; i < end; ++i) {
+      int t = num_instances * epoch + i;
+      TrainingWorkspace *workspace = workspaces[i - begin];
+      if (i > begin && workspace->difference) {
+        // The parameters changed since this instance was decoded: re-derive
+        // its loss for the same predicted output (see TrainEpoch in Pipe.h).
+        double loss = workspace->loss - workspace->difference_score +
+          parameters_->ComputeScore(*workspace->difference);
+        if (loss < 0.0) loss = 0.0;
+        workspace->loss = loss;
+        if (!sgd && options_->GetTrainingAlgorithm() != "perceptron") {
+          workspace->eta = ComputeMiraStepsize(
+            loss, workspace->difference_squared_norm);
         }
-        eta = 1.0;
-      } else {
-        CHECK(false) << "Plain mira is not implemented yet.";
-      }
-
-      MakeGradientStep(parts, features, eta, t, gold_outputs,
-                       predicted_outputs);
-    } else if (options_->GetTrainingAlgorithm() == "svm_mira" ||
-               options_->GetTrainingAlgorithm() == "crf_mira" ||
-               options_->GetTrainingAlgorithm() == "crf_margin_mira" ||
-               options_->GetTrainingAlgorithm() == "svm_sgd" ||
-               options_->GetTrainingAlgorithm() == "crf_sgd" ||
-               options_->GetTrainingAlgorithm() == "crf_margin_sgd") {
-      double loss;
-      chronowrap::Chronometer chrono_decoding;
-      chrono_decoding.GetTime();
-      if (options_->GetTrainingAlgorithm() == "svm_mira" ||
-          options_->GetTrainingAlgorithm() == "svm_sgd") {
-        // Do cost-augmented inference.
-        double cost;
-        decoder_->DecodeCostAugmented(instance, parts, scores, gold_outputs,
-                                      &predicted_outputs, &cost, &loss);
-        total_cost += cost;
-      } else if (options_->GetTrainingAlgorithm() == "crf_margin_mira" ||
-                 options_->GetTrainingAlgorithm() == "crf_margin_sgd") {
-        // Do cost-augmented marginal inference.
-        double entropy;
-        double cost;
-        decoder_->DecodeCostAugmentedMarginals(instance, parts, scores,
-                                               gold_outputs, &predicted_outputs,
-                                               &entropy, &cost, &loss);
-        total_cost += cost;
-      } else {
-        // Do marginal inference.
-        double entropy;
-        decoder_->DecodeMarginals(instance, parts, scores, gold_outputs,
-                                  &predicted_outputs, &entropy, &loss);
-        CHECK_GE(entropy, 0.0);
       }
-      chrono_decoding.StopTime();
-      time_decoding += chrono_decoding.GetElapsedTime();
+      total_cost += workspace->cost;
+      total_loss += workspace->loss;
+      num_mistakes += workspace->num_mistakes;
+      time_scores += workspace->time_scores;
+      time_decoding += workspace->time_decoding;
 
-      loss -= inner_loss;
-      if (loss < 0.0) {
-        if (!NEARLY_EQ_TOL(loss, 0.0, 1e-9)) {
-          LOG(INFO) << "Warning: negative loss set to zero: " << loss;
-        }
-        loss = 0.0;
-      }
-      total_loss += loss;
+      if (feature_cache_filling_) AppendCachedInstance(workspace);
 
-      // Compute difference between predicted and gold feature vectors.
-      FeatureVector difference;
-      MakeFeatureDifference(parts, features, gold_outputs, predicted_outputs,
-                            &difference);
-
-      // Get the stepsize.
-      if (options_->GetTrainingAlgorithm() == "svm_mira" ||
-          options_->GetTrainingAlgorithm() == "crf_mira" ||
-          options_->GetTrainingAlgorithm() == "crf_margin_mira") {
-        double squared_norm = difference.GetSquaredNorm();
-        double threshold = 1e-9;
-        if (loss < threshold || squared_norm < threshold) {
-          eta = 0.0;
-        } else {
-          eta = loss / squared_norm;
-          if (eta > options_->GetRegularizationConstant()) {
-            eta = options_->GetRegularizationConstant();
-          }
-        }
-      } else {
+      if (sgd) {
         if (options_->GetLearningRateSchedule() == "fixed") {
           eta = options_->GetInitialLearningRate();
         } else if (options_->GetLearningRateSchedule() == "invsqrt") {
@@ -369,18 +620,31 @@ void Pipe::TrainEpoch(int epoch) {
           CHECK(false) << "Unknown learning rate schedule: "
             << options_->GetLearningRateSchedule();
         }
+        // Average the gradients of the instances of a batch.
+        eta /= static_cast<double>(end - begin);
 
         // Scale the parameter vector (only for SGD).
         double decay = 1 - eta * lambda;
         CHECK_GT(decay, 0.0);
         parameters_->Scale(decay);
+      } else {
+        eta = workspace->eta;
       }
 
-      MakeGradientStep(parts, features, eta, t, gold_outputs,
-                       predicted_outputs);
-    } else {
-      CHECK(false) << "Unknown algorithm: " << options_->GetTrainingAlgorithm();
+      MakeGradientStep(workspace->parts, workspace->features, eta, t,
+                       workspace->gold_outputs, workspace->predicted_outputs);
     }
+
+    if (streaming) {
+      for (int i = begin; i < end; ++i) {
+        delete batch[i - begin];
+      }
+    }
+  }
+  if (streaming) CloseInstanceStream();
+
+  for (int k = 0; k < batch_size; ++k) {
+    delete workspaces[k];
   }
 
   // Compute the regularization value (halved squared L2 norm of the weights).
@@ -388,9 +652,6 @@ void Pipe::TrainEpoch(int epoch) {
     lambda * static_cast<double>(num_instances) *
     parameters_->GetSquaredNorm() / 2.0;
 
-  delete parts;
-  delete features;
-
   chrono.StopTime();
   LOG(INFO) << "Time: " << chrono.GetElapsedTime() << " sec.";
   LOG(INFO) << "Time to score: " << time_scores << " sec.";
@@ -408,61 +669,479 @@ void Pipe::TrainEpoch(int epoch) {
     << "Squared norm: " << parameters_->GetSquaredNorm() << endl;
 }
 
-void Pipe::Run() {
-  Parts *parts = CreateParts();
-  Features *features = CreateFeatures();
-  vector<double> scores;
-  vector<double> gold_outputs;
-  vector<double> predicted_outputs;
+void Pipe::DecodeTrainingInstance(int i, Instance *instance,
+                                  TrainingWorkspace *workspace) {
+  Parts *parts = workspace->parts;
+  Features *features = workspace->features;
+  vector<double> &scores = workspace->scores;
+  vector<double> &gold_outputs = workspace->gold_outputs;
+  vector<double> &predicted_outputs = workspace->predicted_outputs;
+  workspace->eta = 0.0;
+  workspace->loss = 0.0;
+  workspace->cost = 0.0;
+  workspace->num_mistakes = 0;
+  workspace->time_scores = 0.0;
+  workspace->time_decoding = 0.0;
+
+  if (UseFeatureCache()) {
+    LoadCachedInstance(i, instance, workspace);
+  } else {
+    MakeParts(instance, parts, &gold_outputs);
+    MakeFeatures(instance, parts, features);
+
+    // If using only supported features, must remove the unsupported ones.
+    // This is necessary not to mess up the computation of the squared norm
+    // of the feature difference vector in MIRA.
+    if (options_->only_supported_features()) {
+      RemoveUnsupportedFeatures(instance, parts, features);
+    }
+
+    if (feature_cache_filling_) SaveCachedInstance(instance, workspace);
+  }
+
+  chronowrap::Chronometer chrono_scores;
+  chrono_scores.GetTime();
+  ComputeScores(instance, parts, features, &scores);
+  chrono_scores.StopTime();
+  workspace->time_scores += chrono_scores.GetElapsedTime();
+
+  // This is a no-op by default. But it's convenient to have it here to build
+  // latent-variable structured classifiers (e.g. for coreference resolution).
+  double inner_loss = 0.0;
+  TransformGold(instance, parts, scores, &gold_outputs, &inner_loss);
+
+  if (options_->GetTrainingAlgorithm() == "perceptron" ||
+      options_->GetTrainingAlgorithm() == "mira") {
+    chronowrap::Chronometer chrono_decoding;
+    chrono_decoding.GetTime();
+    decoder_->Decode(instance, parts, scores, &predicted_outputs);
+    chrono_decoding.StopTime();
+    workspace->time_decoding += chrono_decoding.GetElapsedTime();
+
+    if (options_->GetTrainingAlgorithm() == "perceptron") {
+      for (int r = 0; r < parts->size(); ++r) {
+        if (!NEARLY_EQ_TOL(gold_outputs[r], predicted_outputs[r], 1e-6)) {
+          ++workspace->num_mistakes;
+        }
+      }
+      workspace->eta = 1.0;
+    } else {
+      CHECK(false) << "Plain mira is not implemented yet.";
+    }
+  } else if (options_->GetTrainingAlgorithm() == "svm_mira" ||
+             options_->GetTrainingAlgorithm() == "crf_mira" ||
+             options_->GetTrainingAlgorithm() == "crf_margin_mira" ||
+             options_->GetTrainingAlgorithm() == "svm_sgd" ||
+             options_->GetTrainingAlgorithm() == "crf_sgd" ||
+             options_->GetTrainingAlgorithm() == "crf_margin_sgd") {
+    double loss;
+    chronowrap::Chronometer chrono_decoding;
+    chrono_decoding.GetTime();
+    if (options_->GetTrainingAlgorithm() == "svm_mira" ||
+        options_->GetTrainingAlgorithm() == "svm_sgd") {
+      // Do cost-augmented inference.
+      double cost;
+      decoder_->DecodeCostAugmented(instance, parts, scores, gold_outputs,
+                                    &predicted_outputs, &cost, &loss);
+      workspace->cost += cost;
+    } else if (options_->GetTrainingAlgorithm() == "crf_margin_mira" ||
+               options_->GetTrainingAlgorithm() == "crf_margin_sgd") {
+      // Do cost-augmented marginal inference.
+      double entropy;
+      double cost;
+      decoder_->DecodeCostAugmentedMarginals(instance, parts, scores,
+                                             gold_outputs, &predicted_outputs,
+                                             &entropy, &cost, &loss);
+      workspace->cost += cost;
+    } else {
+      // Do marginal inference.
+      double entropy;
+      decoder_->DecodeMarginals(instance, parts, scores, gold_outputs,
+                                &predicted_outputs, &entropy, &loss);
+      CHECK_GE(entropy, 0.0);
+    }
+    chrono_decoding.StopTime();
+    workspace->time_decoding += chrono_decoding.GetElapsedTime();
+
+    loss -= inner_loss;
+    if (loss < 0.0) {
+      if (!NEARLY_EQ_TOL(loss, 0.0, 1e-9)) {
+        LOG(INFO) << "Warning: negative loss set to zero: " << loss;
+      }
+      loss = 0.0;
+    }
+    workspace->loss += loss;
+
+    bool mira = (options_->GetTrainingAlgorithm() == "svm_mira" ||
+                 options_->GetTrainingAlgorithm() == "crf_mira" ||
+                 options_->GetTrainingAlgorithm() == "crf_margin_mira");
+    workspace->difference.reset();
+    if (mira || workspace->delayed_update) {
+      // Compute difference between predicted and gold feature vectors.
+      workspace->difference.reset(new FeatureVector);
+      MakeFeatureDifference(parts, features, gold_outputs, predicted_outputs,
+                            workspace->difference.get());
+      workspace->difference_squared_norm =
+        workspace->difference->GetSquaredNorm();
+      if (workspace->delayed_update) {
+        workspace->difference_score =
+          parameters_->ComputeScore(*workspace->difference);
+      }
+    }
+
+    // Get the stepsize (for SGD, this is done when updating, since it
+    // depends on the iteration number).
+    if (mira) {
+      workspace->eta = ComputeMiraStepsize(
+        loss, workspace->difference_squared_norm);
+    }
+  } else {
+    CHECK(false) << "Unknown algorithm: " << options_->GetTrainingAlgorithm();
+  }
+}
+
+double Pipe::ComputeMiraStepsize(double loss, double squared_norm) {
+  double threshold = 1e-9;
+  if (loss < threshold || squared_norm < threshold) return 0.0;
+  double eta = loss / squared_norm;
+  if (eta > options_->GetRegularizationConstant()) {
+    eta = options_->GetRegularizationConstant();
+  }
+  return eta;
+}
+
+// Threads decoding the instances of the training mini-batches (see
+// Pipe::StartTrainingWorkers).
+struct TrainingWorkers {
+  std::vector<std::thread> threads;
+  std::mutex mutex;
+  std::condition_variable batch_ready; // A batch was posted, or stop is set.
+  std::condition_variable batch_done; // No worker is busy with the batch.
+  std::function<void()> decode; // Decodes instances until none is left.
+  int batch_id; // Incremented with each batch.
+  int num_busy; // Workers not yet done with the current batch.
+  bool stop; // True when the workers are being stopped.
+};
+
+void Pipe::StartTrainingWorkers(int num_workers) {
+  CHECK(!training_workers_);
+  TrainingWorkers *workers = new TrainingWorkers;
+  workers->batch_id = 0;
+  workers->num_busy = 0;
+  workers->stop = false;
+  training_workers_ = workers;
+  for (int k = 0; k < num_workers; ++k) {
+    workers->threads.push_back(std::thread([workers]() {
+      int last_batch_id = 0;
+      while (true) {
+        std::function<void()> decode;
+        {
+          std::unique_lock<std::mutex> lock(workers->mutex);
+          workers->batch_ready.wait(lock, [&]() {
+            return workers->stop || workers->batch_id != last_batch_id;
+          });
+          if (workers->stop) break;
+          last_batch_id = workers->batch_id;
+          decode = workers->decode;
+        }
+        decode();
+        std::lock_guard<std::mutex> lock(workers->mutex);
+        if (--workers->num_busy == 0) workers->batch_done.notify_one();
+      }
+    }));
+  }
+}
+
+void Pipe::StopTrainingWorkers() {
+  TrainingWorkers *workers = training_workers_;
+  if (!workers) return;
+  {
+    std::lock_guard<std::mutex> lock(workers->mutex);
+    workers->stop = true;
+    workers->batch_ready.notify_all();
+  }
+  for (int k = 0; k < workers->threads.size(); ++k) {
+    workers->threads[k].join();
+  }
+  delete workers;
+  training_workers_ = NULL;
+}
 
+void Pipe::DecodeTrainingBatch(int begin, int end,
+                               const vector<Instance*> &batch,
+                               const vector<TrainingWorkspace*> &workspaces) {
+  std::atomic<int> next_instance(begin);
+  std::function<void()> decode = [&]() {
+    int i;
+    while ((i = next_instance++) < end) {
+      DecodeTrainingInstance(i, batch[i - begin], workspaces[i - begin]);
+    }
+  };
+  TrainingWorkers *workers = training_workers_;
+  if (!workers || end - begin == 1) {
+    decode();
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(workers->mutex);
+    workers->decode = decode;
+    ++workers->batch_id;
+    workers->num_busy = workers->threads.size();
+    workers->batch_ready.notify_all();
+  }
+  decode();
+  // Every worker must be done with decode, which refers to this frame.
+  std::unique_lock<std::mutex> lock(workers->mutex);
+  workers->batch_done.wait(lock, [&]() { return workers->num_busy == 0; });
+  workers->decode = std::function<void()>();
+}
+
+void Pipe::Run() {
   chronowrap::Chronometer chrono;
   chrono.GetTime();
 
   if (options_->evaluate()) BeginEvaluation();
 
   reader_->Open(options_->GetTestFilePath());
-  writer_->Open(options_->GetOutputFilePath());
+  if (WritesPredictions()) {
+    writer_->Open(options_->GetOutputFilePath());
+  } else {
+    LOG(INFO) << "No prediction file given; predictions are not written.";
+  }
+
+  int num_instances = 0;
+  if (options_->num_threads() > 1 && !profiler_) {
+    num_instances = RunParallel(options_->num_threads());
+  } else {
+    num_instances = RunSequential();
+  }
+
+  if (WritesPredictions()) writer_->Close();
+  reader_->Close();
+
+  chrono.StopTime();
+  LOG(INFO) << "Number of instances: " << num_instances;
+  LOG(INFO) << "Time: " << chrono.GetElapsedTime() << " sec.";
+
+  if (options_->evaluate()) EndEvaluation();
+}
+
+void Pipe::RunBenchmark(StageProfiler *profiler) {
+  CHECK_EQ(profiler->GetNumStages(), NUM_PIPE_STAGES);
+  profiler_ = profiler;
+  Run();
+  profiler_ = NULL;
+}
+
+void Pipe::GetBenchmarkStageNames(vector<string> *stage_names) {
+  const char *names[NUM_PIPE_STAGES] = {
+    "read", "format", "make_parts", "prune", "features", "score", "decode",
+    "label", "write"
+  };
+  stage_names->assign(names, names + NUM_PIPE_STAGES);
+}
+
+int Pipe::RunSequential() {
+  Parts *parts = CreateParts();
+  Features *features = CreateFeatures();
+  vector<double> scores;
+  vector<double> gold_outputs;
+  vector<double> predicted_outputs;
 
   int num_instances = 0;
+  if (profiler_) profiler_->BeginItem();
+  BeginProfilingStage(PIPE_STAGE_READ);
   Instance *instance = reader_->GetNext();
+  EndProfilingStage(PIPE_STAGE_READ);
   while (instance) {
+    BeginProfilingStage(PIPE_STAGE_FORMAT);
     Instance *formatted_instance = GetFormattedInstance(instance);
+    EndProfilingStage(PIPE_STAGE_FORMAT);
 
+    BeginProfilingStage(PIPE_STAGE_MAKE_PARTS);
     MakeParts(formatted_instance, parts, &gold_outputs);
+    EndProfilingStage(PIPE_STAGE_MAKE_PARTS);
+    BeginProfilingStage(PIPE_STAGE_FEATURES);
     MakeFeatures(formatted_instance, parts, features);
+    EndProfilingStage(PIPE_STAGE_FEATURES);
+    BeginProfilingStage(PIPE_STAGE_SCORE);
     ComputeScores(formatted_instance, parts, features, &scores);
+    EndProfilingStage(PIPE_STAGE_SCORE);
+    BeginProfilingStage(PIPE_STAGE_DECODE);
     decoder_->Decode(formatted_instance, parts, scores, &predicted_outputs);
+    EndProfilingStage(PIPE_STAGE_DECODE);
 
+    BeginProfilingStage(PIPE_STAGE_LABEL);
     Instance *output_instance = instance->Copy();
     LabelInstance(parts, predicted_outputs, output_instance);
+    EndProfilingStage(PIPE_STAGE_LABEL);
 
     if (options_->evaluate()) {
       EvaluateInstance(instance, output_instance,
                        parts, gold_outputs, predicted_outputs);
     }
 
-    writer_->Write(output_instance);
-    writer_->WriteFormatted(this, formatted_instance);
+    BeginProfilingStage(PIPE_STAGE_WRITE);
+    if (WritesPredictions()) {
+      writer_->Write(output_instance);
+      writer_->WriteFormatted(this, formatted_instance);
+    }
+    EndProfilingStage(PIPE_STAGE_WRITE);
 
+    int num_tokens = profiler_ ? GetNumTokens(instance) : 0;
     if (formatted_instance != instance) delete formatted_instance;
     delete output_instance;
     delete instance;
+    if (profiler_) profiler_->EndItem(num_tokens);
 
+    if (profiler_) profiler_->BeginItem();
+    BeginProfilingStage(PIPE_STAGE_READ);
     instance = reader_->GetNext();
+    EndProfilingStage(PIPE_STAGE_READ);
     ++num_instances;
   }
 
   delete parts;
   delete features;
 
-  writer_->Close();
-  reader_->Close();
+  return num_instances;
+}
 
-  chrono.StopTime();
-  LOG(INFO) << "Number of instances: " << num_instances;
-  LOG(INFO) << "Time: " << chrono.GetElapsedTime() << " sec.";
+// An instance travelling through the parallel pipeline, together with the
+// formatted and output instances that must be written and released in order.
+struct PipelineItem {
+  Instance *instance;
+  Instance *formatted_instance;
+  Instance *output_instance;
+};
+
+int Pipe::RunParallel(int num_threads) {
+  // Bound the number of instances that have been read but not yet written,
+  // so that memory does not grow with the size of the input when a single
+  // slow instance holds back the writer.
+  const int kMaxInstancesInFlightPerThread = 16;
+  const int max_instances_in_flight =
+    kMaxInstancesInFlightPerThread * num_threads;
+
+  // All the queue state below is protected by mutex. Instances read from
+  // the input are tagged with their position, and processed instances wait
+  // in a reorder buffer until all the preceding ones have been written.
+  std::mutex mutex;
+  std::condition_variable input_ready;
+  std::condition_variable output_ready;
+  std::condition_variable slot_free;
+  std::deque<std::pair<int, Instance*> > input_queue;
+  std::map<int, PipelineItem> reorder_buffer;
+  bool end_of_input = false;
+  int num_read = 0;
+  int num_written = 0;
+
+  // The evaluation counters are plain sums, so they only need to be
+  // serialized, not ordered.
+  std::mutex evaluation_mutex;
+
+  std::thread reader_thread([&]() {
+    while (true) {
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        slot_free.wait(lock, [&]() {
+          return num_read - num_written < max_instances_in_flight;
+        });
+      }
+      Instance *instance = reader_->GetNext();
+      std::lock_guard<std::mutex> lock(mutex);
+      if (!instance) {
+        end_of_input = true;
+        input_ready.notify_all();
+        output_ready.notify_all();
+        break;
+      }
+      input_queue.push_back(std::make_pair(num_read, instance));
+      ++num_read;
+      input_ready.notify_one();
+    }
+  });
+
+  // The decoder and the parameters are shared read-only by all the workers;
+  // parts, features and score vectors are owned by each worker.
+  std::vector<std::thread> workers;
+  for (int k = 0; k < num_threads; ++k) {
+    workers.push_back(std::thread([&]() {
+      PipeWorkspace *workspace = CreateWorkspace();
+
+      while (true) {
+        std::pair<int, Instance*> next;
+        {
+          std::unique_lock<std::mutex> lock(mutex);
+          input_ready.wait(lock, [&]() {
+            return !input_queue.empty() || end_of_input;
+          });
+          if (input_queue.empty()) break;
+          next = input_queue.front();
+          input_queue.pop_front();
+        }
 
-  if (options_->evaluate()) EndEvaluation();
+        PipelineItem item;
+        item.instance = next.second;
+        item.formatted_instance = GetFormattedInstance(item.instance);
+        item.output_instance = item.instance->Copy();
+        ClassifyFormattedInstance(item.formatted_instance,
+                                  item.output_instance, workspace);
+
+        if (options_->evaluate()) {
+          std::lock_guard<std::mutex> lock(evaluation_mutex);
+          EvaluateInstance(item.instance, item.output_instance,
+                           workspace->parts, workspace->gold_outputs,
+                           workspace->predicted_outputs);
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        reorder_buffer[next.first] = item;
+        if (next.first == num_written) output_ready.notify_all();
+      }
+
+      delete workspace;
+    }));
+  }
+
+  // Write the instances in input order from this thread.
+  while (true) {
+    PipelineItem item;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      output_ready.wait(lock, [&]() {
+        return reorder_buffer.count(num_written) > 0 ||
+          (end_of_input && num_written == num_read);
+      });
+      std::map<int, PipelineItem>::iterator it =
+        reorder_buffer.find(num_written);
+      if (it == reorder_buffer.end()) break;
+      item = it->second;
+      reorder_buffer.erase(it);
+    }
+
+    if (WritesPredictions()) {
+      writer_->Write(item.output_instance);
+      writer_->WriteFormatted(this, item.formatted_instance);
+    }
+
+    if (item.formatted_instance != item.instance) {
+      delete item.formatted_instance;
+    }
+    delete item.output_instance;
+    delete item.instance;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    ++num_written;
+    slot_free.notify_one();
+  }
+
+  reader_thread.join();
+  for (int k = 0; k < workers.size(); ++k) {
+    workers[k].join();
+  }
+
+  return num_written;
 }
 
 void Pipe::ClassifyInstance(Instance *instance) {
@@ -508,3 +1187,35 @@ void Pipe::ClassifyInstance(Instance *instance) {
   delete features;
   return;
 }
+
+PipeWorkspace *Pipe::CreateWorkspace() {
+  PipeWorkspace *workspace = new PipeWorkspace;
+  workspace->parts = CreateParts();
+  workspace->features = CreateFeatures();
+  return workspace;
+}
+
+void Pipe::ClassifyInstance(Instance *instance, PipeWorkspace *workspace) {
+  Instance *formatted_instance = GetFormattedInstance(instance);
+  ClassifyFormattedInstance(formatted_instance, instance, workspace);
+  if (formatted_instance != instance) delete formatted_instance;
+}
+
+void Pipe::ClassifyFormattedInstance(Instance *formatted_instance,
+                                     Instance *output_instance,
+                                     PipeWorkspace *workspace) {
+  Parts *parts = workspace->parts;
+  Features *features = workspace->features;
+
+  MakeParts(formatted_instance, parts, &workspace->gold_outputs);
+  if (parts->empty()) {
+    // Nothing to decode; leave the outputs consistent with the parts.
+    workspace->predicted_outputs.clear();
+    return;
+  }
+  MakeFeatures(formatted_instance, parts, features);
+  ComputeScores(formatted_instance, parts, features, &workspace->scores);
+  decoder_->Decode(formatted_instance, parts, workspace->scores,
+                   &workspace->predicted_outputs);
+  LabelInstance(parts, workspace->predicted_outputs, output_instance);
+}
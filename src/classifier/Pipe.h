@@ -28,6 +28,64 @@
 #include "Decoder.h"
 #include "Parameters.h"
 #include "AlgUtils.h"
+#include "SerializationUtils.h"
+#include "TimeUtils.h"
+
+// Stages of the test-time pipeline, as timed by Pipe::RunBenchmark.
+// Pruning is timed separately from the part construction it happens in.
+enum PipeStages {
+  PIPE_STAGE_READ = 0,
+  PIPE_STAGE_FORMAT,
+  PIPE_STAGE_MAKE_PARTS,
+  PIPE_STAGE_PRUNE,
+  PIPE_STAGE_FEATURES,
+  PIPE_STAGE_SCORE,
+  PIPE_STAGE_DECODE,
+  PIPE_STAGE_LABEL,
+  PIPE_STAGE_WRITE,
+  NUM_PIPE_STAGES
+};
+
+// Scratch space used to classify instances: parts, features, and score and
+// output vectors. Each thread classifying instances with a shared pipe must
+// use its own workspace (see Pipe::ClassifyInstance).
+struct PipeWorkspace {
+  PipeWorkspace() : parts(NULL), features(NULL) {}
+  ~PipeWorkspace() { delete parts; delete features; }
+
+  Parts *parts;
+  Features *features;
+  vector<double> scores;
+  vector<double> gold_outputs;
+  vector<double> predicted_outputs;
+};
+
+// Scratch space for a training instance, holding also what the gradient step
+// needs once the instance has been decoded (see Pipe::TrainEpoch).
+struct TrainingWorkspace : public PipeWorkspace {
+  TrainingWorkspace() : delayed_update(false) {}
+
+  double eta; // Stepsize (only for the non-SGD algorithms).
+  double loss;
+  double cost;
+  int num_mistakes;
+  double time_scores;
+  double time_decoding;
+  // Parts, features and gold outputs of the instance as saved in the feature
+  // cache (only filled in the first epoch when --train_cache_features).
+  vector<char> cache_entry;
+  // True if the parameters may change between decoding and updating (with
+  // mini-batches of several instances). The loss is then re-derived at
+  // update time from the difference between the features of the predicted
+  // and gold outputs, and its score with the parameters used for decoding.
+  bool delayed_update;
+  std::unique_ptr<FeatureVector> difference;
+  double difference_score;
+  double difference_squared_norm;
+};
+
+struct InstanceStream;
+struct TrainingWorkers;
 
 // Abstract class for the structured classifier mainframe.
 // It requires parts, features, a dictionary, a reader and writer, and
@@ -45,6 +103,13 @@ public:
   void SaveModelFile() { SaveModelByName(options_->GetModelFilePath()); }
   void LoadModelFile() { LoadModelByName(options_->GetModelFilePath()); }
 
+  // Save the model in the memory-mappable format. Models in this format are
+  // recognized by LoadModelFile, which maps them and uses the parameters in
+  // place instead of inserting them one by one.
+  void SaveMappedModelFile() {
+    SaveMappedModelByName(options_->GetMappedModelFilePath());
+  }
+
   // Initialize. Override this method for task-specific initialization.
   virtual void Initialize();
 
@@ -55,15 +120,47 @@ public:
   Parameters *GetParameters() { return parameters_; }
   void SetParameters(Parameters *parameters) { parameters_ = parameters; }
 
+  // Compact the model parameters (see Parameters::Compact), returning the
+  // number of features dropped. Override this function for tasks with other
+  // parameters (e.g. a pruner).
+  virtual int CompactParameters(double threshold, int max_features_per_type) {
+    return parameters_->Compact(threshold, max_features_per_type);
+  }
+
+  // Get the score of the last evaluation (see EndEvaluation), where higher
+  // is better. The version implemented here returns the accuracy based on
+  // Hamming distance. Override this function for task-specific evaluation.
+  virtual double GetEvaluationScore() {
+    return static_cast<double>(num_total_parts_ - num_mistakes_) /
+      static_cast<double>(num_total_parts_);
+  }
+
   // Train the classifier.
   void Train();
 
   // Run a previously trained classifier on new data.
   void Run();
 
+  // Same as Run, but always sequential and recording the latency and
+  // allocations of each stage (see PipeStages) for every instance in
+  // profiler, which must have been created with GetBenchmarkStageNames.
+  void RunBenchmark(StageProfiler *profiler);
+  static void GetBenchmarkStageNames(vector<string> *stage_names);
+
   // Run a previously trained classifier on a single instance.
   void ClassifyInstance(Instance *instance);
 
+  // Run a previously trained classifier on a single instance, using the
+  // scratch space in workspace. Once the model is loaded, the pipe is only
+  // read by this function, so several threads may call it concurrently on
+  // the same pipe as long as each one has its own workspace and nobody
+  // trains or reloads the model meanwhile. No evaluation is performed, since
+  // the evaluation counters are shared; the parts and the gold and predicted
+  // outputs are left in workspace for the caller to evaluate (as RunParallel
+  // does).
+  PipeWorkspace *CreateWorkspace();
+  void ClassifyInstance(Instance *instance, PipeWorkspace *workspace);
+
   // Get model version.
   uint64_t GetModelVersion() {
     LOG(INFO) << "model version: " << model_version_;
@@ -81,6 +178,12 @@ protected:
   // Save/load model.
   void SaveModelByName(const std::string &model_name);
   void LoadModelByName(const std::string &model_name);
+  void SaveMappedModelByName(const std::string &model_name);
+
+  // Open a model file for reading, in either format, setting its layout.
+  static FILE *OpenModelFile(const std::string &model_name,
+                             StreamLayout *layout);
+  // Save/load the model to/from a stream whose layout is model_layout_.
   virtual void SaveModel(FILE* fs);
   virtual void LoadModel(FILE* fs);
 
@@ -106,9 +209,21 @@ protected:
     return instance;
   }
 
-  // Create a vector of instances by reading the training data.
+  // Create a vector of instances by reading the training data. With
+  // --train_streaming, only count them (see OpenInstanceStream).
   void CreateInstances();
 
+  // Streaming of the training data (flag --train_streaming). Instead of
+  // keeping all the instances in instances_, every pass reads them again
+  // from the training file in a background thread, which formats them and
+  // keeps at most --train_prefetch_size of them in a queue. If
+  // shuffle_buffer_size > 0, the instances go through a shuffle buffer of
+  // that size first. GetNextStreamInstance returns NULL at the end of the
+  // file; the caller must delete the instances it gets.
+  void OpenInstanceStream(int shuffle_buffer_size, unsigned int seed);
+  Instance *GetNextStreamInstance();
+  void CloseInstanceStream();
+
   // Construct the vector of parts for a particular instance.
   // Eventually, obtain the binary vector of gold outputs (one entry per part)
   // if this information is available.
@@ -221,6 +336,37 @@ protected:
   // task-specific instance preprocessing.
   virtual void PreprocessData() {};
 
+  // Save/load the parts and features of an instance in the feature cache
+  // (flag --train_cache_features), appending them to a flat buffer, or
+  // reading them from *data (and advancing it, without going past end).
+  // Pipes whose parts and features do not change across training epochs
+  // should override these functions; the default is not to cache anything.
+  virtual bool SupportsFeatureCache() { return false; }
+  virtual void SaveCachedPartsAndFeatures(vector<char> *buffer,
+                                          Instance *instance,
+                                          Parts *parts, Features *features) {
+    CHECK(false) << "Feature cache not supported.";
+  }
+  virtual void LoadCachedPartsAndFeatures(const char **data, const char *end,
+                                          Instance *instance,
+                                          Parts *parts, Features *features) {
+    CHECK(false) << "Feature cache not supported.";
+  }
+
+  // Feature cache for training. In the first epoch, the parts, features and
+  // gold outputs of each instance are appended to the cache, a single flat
+  // buffer written to a file (--train_feature_cache_file, or a temporary
+  // one) and then mapped in memory; the next epochs read them back instead
+  // of calling MakeParts and MakeFeatures.
+  void CreateFeatureCache();
+  void FinishFeatureCache();
+  void DeleteFeatureCache();
+  bool UseFeatureCache() { return feature_cache_ready_; }
+  void SaveCachedInstance(Instance *instance, TrainingWorkspace *workspace);
+  void AppendCachedInstance(TrainingWorkspace *workspace);
+  void LoadCachedInstance(int i, Instance *instance,
+                          TrainingWorkspace *workspace);
+
   // Build and lock a parameter vector with only supported parameters, by
   // looking at the gold outputs in the training data. This is a preprocessing
   // stage for training with supported features (flag
@@ -228,7 +374,66 @@ protected:
   void MakeSupportedParameters();
 
   // Run one epoch of training.
+  // Instances are processed in mini-batches: first each instance in the batch
+  // is decoded with the current parameters (DecodeTrainingInstance, in
+  // parallel if --train_num_threads > 1), then the gradient steps are made
+  // one instance at a time, in order. Since the parameters are only read
+  // while decoding and only written while updating, the averaged weights and
+  // the scale factor are kept as in plain sequential training, which is
+  // the case of mini-batches with a single instance.
+  // With several instances per batch, all but the first are updated with
+  // parameters that changed since they were decoded: their loss (and MIRA
+  // stepsize) is re-derived with the current parameters for the same
+  // predicted output (exactly for the SVM losses, to first order for the
+  // CRF ones), and the SGD stepsize is divided by the size of the batch, so
+  // that a batch moves the parameters by its average gradient. The
+  // predicted outputs themselves are still those of the older parameters,
+  // so training needs more epochs than sequential training to reach the
+  // same accuracy, the more so with larger batches.
   void TrainEpoch(int epoch);
+  void DecodeTrainingInstance(int i, Instance *instance,
+                              TrainingWorkspace *workspace);
+  double ComputeMiraStepsize(double loss, double squared_norm);
+
+  // Pool of threads decoding the instances of the training mini-batches
+  // along with the calling thread (DecodeTrainingBatch). The threads are
+  // kept during the whole training, so that their per-thread decoder
+  // workspaces are reused across batches and epochs.
+  void StartTrainingWorkers(int num_workers);
+  void StopTrainingWorkers();
+  void DecodeTrainingBatch(int begin, int end, const vector<Instance*> &batch,
+                           const vector<TrainingWorkspace*> &workspaces);
+
+  // Classify all the instances read by reader_ and write them with writer_.
+  // Return the number of instances processed. The parallel version uses a
+  // reader thread, a pool of num_threads workers (each with its own parts and
+  // features), and writes the output in the same order as the input.
+  int RunSequential();
+  int RunParallel(int num_threads);
+
+  // Run only writes the predictions if a file was given for them; without
+  // one, the instances are still classified (and evaluated).
+  bool WritesPredictions() { return !options_->GetOutputFilePath().empty(); }
+
+  // Same as ClassifyInstance(instance, workspace), given the formatted
+  // instance, and writing the labels to output_instance (which may be the
+  // instance itself).
+  void ClassifyFormattedInstance(Instance *formatted_instance,
+                                 Instance *output_instance,
+                                 PipeWorkspace *workspace);
+
+  // Number of tokens of an instance, used to report throughput in
+  // benchmarks. Override this function for task-specific instances.
+  virtual int GetNumTokens(Instance *instance) { return 0; }
+
+  // Mark the beginning/end of a stage. These do nothing unless a benchmark
+  // is running (see RunBenchmark).
+  void BeginProfilingStage(int stage) {
+    if (profiler_) profiler_->BeginStage(stage);
+  }
+  void EndProfilingStage(int stage) {
+    if (profiler_) profiler_->EndStage(stage);
+  }
 
   // Start all the evaluation counters for evaluating the classifier,
   // evaluate each instance, and plot evaluation information at the end.
@@ -250,9 +455,7 @@ protected:
     }
   }
   virtual void EndEvaluation() {
-    LOG(INFO) << "Accuracy (parts): " <<
-      static_cast<double>(num_total_parts_ - num_mistakes_) /
-      static_cast<double>(num_total_parts_);
+    LOG(INFO) << "Accuracy (parts): " << GetEvaluationScore();
   }
 
 protected:
@@ -262,7 +465,22 @@ protected:
   Writer *writer_; // Writer for writing instance to a file.
   Decoder *decoder_; // Decoder for this classification task.
   Parameters *parameters_; // Parameter vector.
+  StreamLayout model_layout_; // Layout of the model being saved or loaded.
   vector<Instance*> instances_; // Set of instances.
+  int num_training_instances_; // Also counted when streaming.
+  InstanceStream *instance_stream_; // Open during a streaming pass.
+  TrainingWorkers *training_workers_; // Running during training.
+
+  // Feature cache (see CreateFeatureCache).
+  bool feature_cache_filling_; // True while filling the cache.
+  std::string feature_cache_file_name_; // Cache file, until removed.
+  FILE *feature_cache_stream_; // Cache file, open while filling it.
+  MappedFilePtr feature_cache_file_; // Cache file, mapped.
+  const char *feature_cache_data_;
+  vector<size_t> feature_cache_offsets_; // Entry i ends where i+1 starts.
+  bool feature_cache_ready_;
+
+  StageProfiler *profiler_; // Only set during RunBenchmark.
 
   // Number of mistakes and number of total parts at test time (used for
   // evaluation purposes).
@@ -30,7 +30,10 @@
 #include <tr1/unordered_map>
 #endif
 #endif
+#include <algorithm>
 #include "SerializationUtils.h"
+#include "SparseParameterVector.h"
+#include "Utils.h"
 
 using namespace std;
 
@@ -38,6 +41,8 @@ using namespace std;
 const double kLabeledScaleFactorThreshold = 1e-9;
 // After more than kNumMaxSparseLabels labels, use a dense representation.
 const int kNumMaxSparseLabels = 5;
+// Number of keys looked up together by the batched lookups.
+const int kLabeledLookupBlockSize = 16;
 
 // This class contains the weights for every label conjoined with a single
 // feature. This is a pure virtual class, so that we can derive from it a
@@ -230,6 +235,69 @@ protected:
   vector<double> weights_;
 };
 
+// An array of the frozen rows of a labeled parameter vector (their weights,
+// labels or starts), either owned or used in place from a mapped model file.
+// Only owned arrays can be modified.
+template<typename T>
+class FrozenArray {
+public:
+  FrozenArray() { data_ = NULL; size_ = 0; }
+
+  void Clear() {
+    vector<T>().swap(owned_values_);
+    mapped_file_.reset();
+    data_ = NULL;
+    size_ = 0;
+  }
+
+  // Take the values of a vector (leaving it empty), or a copy of a range.
+  void Swap(vector<T> *values) {
+    Clear();
+    owned_values_.swap(*values);
+    data_ = owned_values_.data();
+    size_ = owned_values_.size();
+  }
+  template<typename Iterator>
+  void Assign(Iterator begin, Iterator end) {
+    vector<T> values(begin, end);
+    Swap(&values);
+  }
+  void Resize(size_t size) {
+    CHECK(!mapped_file_) << "Cannot resize a mapped array.";
+    owned_values_.resize(size);
+    data_ = owned_values_.data();
+    size_ = size;
+  }
+
+  // Use size values stored in mapped_file, which is kept mapped while the
+  // array points to it.
+  void Attach(const T *data, size_t size, const MappedFilePtr &mapped_file) {
+    Clear();
+    mapped_file_ = mapped_file;
+    data_ = data;
+    size_ = size;
+  }
+
+  size_t size() const { return size_; }
+  const T *data() const { return data_; }
+  const T &operator[](size_t i) const { return data_[i]; }
+  bool mapped() const { return mapped_file_ != NULL; }
+  T *mutable_data() {
+    CHECK(!mapped_file_) << "Cannot modify a mapped array.";
+    return owned_values_.data();
+  }
+
+private:
+  vector<T> owned_values_; // Storage of the values, if owned.
+  const T *data_; // The values (owned_values_ or the mapped file).
+  size_t size_; // Number of values.
+  MappedFilePtr mapped_file_; // File holding data_, if attached.
+
+  // The array may point to its own storage, hence it cannot be copied.
+  FrozenArray(const FrozenArray &);
+  FrozenArray &operator=(const FrozenArray &);
+};
+
 // A labeled parameter map maps from feature keys ("labeled" features) to
 // LabelWeights, which contain the weights of several labels conjoined with
 // that feature.
@@ -239,6 +307,30 @@ typedef HashTable<uint64_t, LabelWeights*> LabeledParameterMap;
 typedef std::tr1::unordered_map <uint64_t, LabelWeights*> LabeledParameterMap;
 #endif
 
+// Add to label_scores the weights of a row of a frozen dense matrix (with
+// num_columns columns) at the label columns, times scale_factor. The loop is
+// a plain indexed loop, so that it can be vectorized (with gather
+// instructions, where available). If labels_in_range is false, the labels
+// beyond the last column are skipped.
+template<typename Value>
+inline void AddRowLabelScores(const Value *row_weights, double scale_factor,
+                              const int *label_columns, int num_labels,
+                              int num_columns, bool labels_in_range,
+                              double *label_scores) {
+  if (labels_in_range) {
+    for (int k = 0; k < num_labels; ++k) {
+      label_scores[k] +=
+        static_cast<double>(row_weights[label_columns[k]]) * scale_factor;
+    }
+  } else {
+    for (int k = 0; k < num_labels; ++k) {
+      if (label_columns[k] >= num_columns) continue;
+      label_scores[k] +=
+        static_cast<double>(row_weights[label_columns[k]]) * scale_factor;
+    }
+  }
+}
+
 // This class implements a sparse parameter vector, which contains weights for
 // the labels conjoined with each feature key. For fast lookup, this is
 // implemented using an hash table.
@@ -249,9 +341,24 @@ typedef std::tr1::unordered_map <uint64_t, LabelWeights*> LabeledParameterMap;
 // This way we can scale the weight vector in constant time (this operation is
 // necessary in some training algorithms such as SGD), and manipulating a few
 // elements is still fast. Plus, we can obtain the norm in constant time.
+// Once training is over, the vector can be frozen: each feature key is mapped
+// to a row of weights, and the weights can no longer be changed (other than
+// scaled). Features with a large fraction of the labels get a row of a dense
+// matrix with a column per label; the others a sparse row, with the weights
+// of their labels only. The frozen weights are kept in double, so that
+// scores are the same as before freezing, and can be stored in float or
+// quantized to int16 (with a scale per row) to save memory. Frozen rows
+// saved in the mapped layout are used in place from a mapped model file.
 class SparseLabeledParameterVector {
 public:
-  SparseLabeledParameterVector() { growth_stopped_ = false; }
+  SparseLabeledParameterVector() {
+    growth_stopped_ = false;
+    frozen_ = false;
+    num_labels_ = 0;
+    num_dense_rows_ = 0;
+    frozen_precision_ = kPrecisionDouble;
+    min_dense_density_ = 0.0;
+  }
   virtual ~SparseLabeledParameterVector() { Clear(); }
 
   // Lock/unlock the parameter vector. If the vector is locked, no new features
@@ -268,10 +375,294 @@ public:
       delete iterator->second;
     }
     values_.clear();
+    frozen_rows_.Clear();
+    frozen_dense_weights_.Clear();
+    frozen_dense_float_weights_.Clear();
+    frozen_dense_int16_weights_.Clear();
+    frozen_sparse_starts_.Clear();
+    frozen_sparse_labels_.Clear();
+    frozen_sparse_weights_.Clear();
+    frozen_sparse_float_weights_.Clear();
+    frozen_sparse_int16_weights_.Clear();
+    frozen_row_scales_.Clear();
+    frozen_precision_ = kPrecisionDouble;
+    num_labels_ = 0;
+    num_dense_rows_ = 0;
+    frozen_ = false;
+  }
+
+  // Freeze the parameter vector, moving the weights to rows of doubles and
+  // releasing the LabelWeights. The features whose nonzero weights cover at
+  // least a fraction min_dense_density of the labels get a row of a dense
+  // matrix with a column per label (labels absent from a feature get a zero
+  // weight); the others get a sparse row with their nonzero weights, sorted by
+  // label. With min_dense_density 0.5, a sparse row (a label and a weight per
+  // entry) never takes more memory than a dense one. This also locks the
+  // vector. The weights can then be stored in a lower precision with
+  // Quantize.
+  void Freeze(double min_dense_density) {
+    if (frozen_) return;
+    int num_labels = 0;
+    vector<int> num_nonzeros;
+    num_nonzeros.reserve(values_.size());
+    for (LabeledParameterMap::const_iterator iterator = values_.begin();
+         iterator != values_.end();
+         ++iterator) {
+      const LabelWeights *label_weights = iterator->second;
+      int label;
+      double value;
+      int num_nonzero = 0;
+      for (int k = 0; k < label_weights->Size(); ++k) {
+        label_weights->GetLabelWeightByPosition(k, &label, &value);
+        if (label >= num_labels) num_labels = label + 1;
+        if (value != 0.0) ++num_nonzero;
+      }
+      num_nonzeros.push_back(num_nonzero);
+    }
+    int num_dense_rows = 0;
+    int num_sparse_rows = 0;
+    size_t num_sparse_values = 0;
+    for (int i = 0; i < num_nonzeros.size(); ++i) {
+      if (num_nonzeros[i] >= min_dense_density * num_labels) {
+        ++num_dense_rows;
+      } else {
+        ++num_sparse_rows;
+        num_sparse_values += num_nonzeros[i];
+      }
+    }
+
+    vector<pair<uint64_t, int> > rows;
+    rows.reserve(values_.size());
+    vector<double> dense_weights(static_cast<size_t>(num_dense_rows) *
+                                 num_labels, 0.0);
+    vector<size_t> sparse_starts(1, 0);
+    sparse_starts.reserve(num_sparse_rows + 1);
+    vector<int> sparse_labels;
+    sparse_labels.reserve(num_sparse_values);
+    vector<double> sparse_weights;
+    sparse_weights.reserve(num_sparse_values);
+    vector<pair<int, double> > row_weights;
+    int i = 0;
+    for (LabeledParameterMap::const_iterator iterator = values_.begin();
+         iterator != values_.end();
+         ++iterator, ++i) {
+      const LabelWeights *label_weights = iterator->second;
+      row_weights.clear();
+      int label;
+      double value;
+      for (int k = 0; k < label_weights->Size(); ++k) {
+        label_weights->GetLabelWeightByPosition(k, &label, &value);
+        if (value == 0.0) continue;
+        row_weights.push_back(pair<int, double>(label, value));
+      }
+      if (num_nonzeros[i] >= min_dense_density * num_labels) {
+        int row = rows.size() - (sparse_starts.size() - 1);
+        rows.push_back(pair<uint64_t, int>(iterator->first, row));
+        double *row_dense_weights =
+          dense_weights.data() + static_cast<size_t>(row) * num_labels;
+        for (int k = 0; k < row_weights.size(); ++k) {
+          row_dense_weights[row_weights[k].first] = row_weights[k].second;
+        }
+      } else {
+        // Sparse rows are encoded as negative rows (see GetFrozenRowIndex).
+        int sparse_row = sparse_starts.size() - 1;
+        rows.push_back(pair<uint64_t, int>(iterator->first, -sparse_row - 1));
+        sort(row_weights.begin(), row_weights.end());
+        for (int k = 0; k < row_weights.size(); ++k) {
+          sparse_labels.push_back(row_weights[k].first);
+          sparse_weights.push_back(row_weights[k].second);
+        }
+        sparse_starts.push_back(sparse_labels.size());
+      }
+    }
+    Clear();
+    frozen_rows_.Build(rows.begin(), rows.end(), rows.size());
+    frozen_dense_weights_.Swap(&dense_weights);
+    frozen_sparse_starts_.Swap(&sparse_starts);
+    frozen_sparse_labels_.Swap(&sparse_labels);
+    frozen_sparse_weights_.Swap(&sparse_weights);
+    num_labels_ = num_labels;
+    num_dense_rows_ = num_dense_rows;
+    min_dense_density_ = min_dense_density;
+    frozen_ = true;
+    StopGrowth();
+  }
+  bool frozen() const { return frozen_; }
+
+  // True if the frozen rows are used in place from a mapped model file, in
+  // which case they keep the precision in which the file was saved.
+  bool mapped() const { return frozen_ && !frozen_rows_.owns_data(); }
+  int precision() const { return frozen_precision_; }
+
+  // Get the number of dense and sparse rows of a frozen vector.
+  int GetNumDenseRows() const { return num_dense_rows_; }
+  int GetNumSparseRows() const {
+    return frozen_ ? frozen_sparse_starts_.size() - 1 : 0;
+  }
+
+  // Get the number of bytes taken by the weights of a frozen vector.
+  size_t GetFrozenWeightBytes() const {
+    return frozen_dense_weights_.size() * sizeof(double) +
+      frozen_dense_float_weights_.size() * sizeof(float) +
+      frozen_dense_int16_weights_.size() * sizeof(int16_t) +
+      frozen_sparse_weights_.size() * sizeof(double) +
+      frozen_sparse_float_weights_.size() * sizeof(float) +
+      frozen_sparse_int16_weights_.size() * sizeof(int16_t) +
+      frozen_sparse_labels_.size() * sizeof(int) +
+      frozen_sparse_starts_.size() * sizeof(size_t) +
+      frozen_row_scales_.size() * sizeof(float);
+  }
+
+  // Store the weights of a frozen vector (in double) in float or int16,
+  // releasing the doubles; kPrecisionDouble leaves them as they are.
+  // Return the maximum absolute error of a weight.
+  double Quantize(int precision) {
+    CHECK(frozen_);
+    if (precision == kPrecisionDouble) return 0.0;
+    CHECK_EQ(frozen_precision_, kPrecisionDouble) << "Already quantized.";
+    double max_error = 0.0;
+    CHECK(!mapped()) << "Cannot quantize mapped weights.";
+    if (precision == kPrecisionFloat) {
+      frozen_dense_float_weights_.Assign(
+        frozen_dense_weights_.data(),
+        frozen_dense_weights_.data() + frozen_dense_weights_.size());
+      frozen_sparse_float_weights_.Assign(
+        frozen_sparse_weights_.data(),
+        frozen_sparse_weights_.data() + frozen_sparse_weights_.size());
+      for (size_t i = 0; i < frozen_dense_weights_.size(); ++i) {
+        max_error = std::max(max_error, fabs(frozen_dense_float_weights_[i] -
+                                             frozen_dense_weights_[i]));
+      }
+      for (size_t i = 0; i < frozen_sparse_weights_.size(); ++i) {
+        max_error = std::max(max_error, fabs(frozen_sparse_float_weights_[i] -
+                                             frozen_sparse_weights_[i]));
+      }
+      frozen_dense_weights_.Clear();
+      frozen_sparse_weights_.Clear();
+      frozen_precision_ = precision;
+      return max_error * fabs(scale_factor_);
+    }
+    CHECK_EQ(precision, kPrecisionInt16);
+    int num_rows = frozen_rows_.size();
+    vector<double> max_abs_values(num_rows, 0.0);
+    for (int index = 0; index < num_rows; ++index) {
+      const double *row_weights;
+      int length;
+      GetFrozenRowWeights(index, &row_weights, &length);
+      for (int k = 0; k < length; ++k) {
+        double value = fabs(row_weights[k]);
+        if (value > max_abs_values[index]) max_abs_values[index] = value;
+      }
+    }
+    vector<float> row_scales;
+    ComputeInt16Scales(max_abs_values, &row_scales);
+    frozen_row_scales_.Swap(&row_scales);
+    frozen_dense_int16_weights_.Resize(frozen_dense_weights_.size());
+    frozen_sparse_int16_weights_.Resize(frozen_sparse_weights_.size());
+    for (int index = 0; index < num_rows; ++index) {
+      float scale = frozen_row_scales_[index];
+      const double *row_weights;
+      int length;
+      size_t position = GetFrozenRowWeights(index, &row_weights, &length);
+      int16_t *row_int16_weights = (index < num_dense_rows_) ?
+        frozen_dense_int16_weights_.mutable_data() + position :
+        frozen_sparse_int16_weights_.mutable_data() + position;
+      for (int k = 0; k < length; ++k) {
+        row_int16_weights[k] = QuantizeToInt16(row_weights[k], scale);
+        double error = fabs(row_int16_weights[k] * scale - row_weights[k]);
+        if (error > max_error) max_error = error;
+      }
+    }
+    frozen_dense_weights_.Clear();
+    frozen_sparse_weights_.Clear();
+    frozen_precision_ = precision;
+    return max_error * fabs(scale_factor_);
+  }
+
+  // Compact the parameter vector: drop the label weights whose magnitude is
+  // at most threshold, and then the features whose remaining weights have an
+  // L1 norm at most threshold or, if max_features_per_type is positive, are
+  // not among the largest ones of their feature type (see
+  // SelectCompactedFeatures). The features are reinserted, so that those left
+  // with few labels get sparse LabelWeights again. A frozen vector is frozen
+  // again (in double). Returns the number of features dropped.
+  int Compact(double threshold, int max_features_per_type) {
+    vector<uint64_t> keys;
+    vector<vector<pair<int, double> > > label_weights;
+    if (frozen_) {
+      const uint64_t *frozen_keys = frozen_rows_.keys();
+      const int *rows = frozen_rows_.values();
+      for (uint64_t i = 0; i <= frozen_rows_.num_buckets(); ++i) {
+        int row;
+        if (i < frozen_rows_.num_buckets()) {
+          if (frozen_keys[i] == kFrozenEmptyKey) continue;
+          keys.push_back(frozen_keys[i]);
+          row = rows[i];
+        } else {
+          if (!frozen_rows_.has_empty_key()) continue;
+          keys.push_back(kFrozenEmptyKey);
+          row = frozen_rows_.empty_key_value();
+        }
+        label_weights.push_back(vector<pair<int, double> >());
+        GetFrozenLabelWeights(row, &label_weights.back());
+        int num_kept_labels = 0;
+        for (int k = 0; k < label_weights.back().size(); ++k) {
+          double value = label_weights.back()[k].second * scale_factor_;
+          if (fabs(value) <= threshold) continue;
+          label_weights.back()[num_kept_labels].first =
+            label_weights.back()[k].first;
+          label_weights.back()[num_kept_labels].second = value;
+          ++num_kept_labels;
+        }
+        label_weights.back().resize(num_kept_labels);
+      }
+    } else {
+      for (LabeledParameterMap::const_iterator iterator = values_.begin();
+           iterator != values_.end();
+           ++iterator) {
+        keys.push_back(iterator->first);
+        label_weights.push_back(vector<pair<int, double> >());
+        const LabelWeights *weights = iterator->second;
+        int label;
+        double value;
+        for (int k = 0; k < weights->Size(); ++k) {
+          weights->GetLabelWeightByPosition(k, &label, &value);
+          value *= scale_factor_;
+          if (fabs(value) <= threshold) continue;
+          label_weights.back().push_back(pair<int, double>(label, value));
+        }
+      }
+    }
+
+    vector<double> magnitudes(keys.size(), 0.0);
+    for (int i = 0; i < keys.size(); ++i) {
+      for (int k = 0; k < label_weights[i].size(); ++k) {
+        magnitudes[i] += fabs(label_weights[i][k].second);
+      }
+    }
+    vector<bool> keep;
+    int num_kept = SelectCompactedFeatures(keys, magnitudes, threshold,
+                                           max_features_per_type, &keep);
+
+    // Rebuild the vector with the features that are kept.
+    bool frozen = frozen_;
+    bool growth_stopped = growth_stopped_;
+    Initialize();
+    AllowGrowth();
+    for (int i = 0; i < keys.size(); ++i) {
+      if (!keep[i]) continue;
+      for (int k = 0; k < label_weights[i].size(); ++k) {
+        Set(keys[i], label_weights[i][k].first, label_weights[i][k].second);
+      }
+    }
+    growth_stopped_ = growth_stopped;
+    if (frozen) Freeze(min_dense_density_);
+    return keys.size() - num_kept;
   }
 
   // Overwrite
   void Overwrite(SparseLabeledParameterVector *output_parameters) {
+    CHECK(!frozen_);
     output_parameters->scale_factor_ = scale_factor_;
     output_parameters->squared_norm_ = squared_norm_;
     output_parameters->growth_stopped_ = growth_stopped_;
@@ -287,7 +678,8 @@ public:
   }
 
   // Copy
-  void Copy(SparseLabeledParameterVector *output_parameters){
+  void Copy(SparseLabeledParameterVector *output_parameters) const {
+    CHECK(!frozen_);
     output_parameters->scale_factor_=scale_factor_; 
     output_parameters->squared_norm_=squared_norm_; 
     output_parameters->growth_stopped_=growth_stopped_; 
@@ -306,11 +698,21 @@ public:
   }
 
 
-  // Save/load the parameters to/from a file.
-  void Save(FILE *fs) const {
+  // Save/load the parameters to/from a file. Streams in the mapped layout
+  // store the frozen rows themselves, which are used in place when loading
+  // from a mapped file.
+  void Save(FILE *fs, const StreamLayout &layout) const {
+    if (layout.mapped) {
+      SaveMapped(fs);
+      return;
+    }
     bool success;
     success = WriteInteger(fs, Size());
     CHECK(success);
+    if (frozen_) {
+      SaveFrozen(fs);
+      return;
+    }
     for (LabeledParameterMap::const_iterator iterator = values_.begin();
     iterator != values_.end();
       ++iterator) {
@@ -332,11 +734,15 @@ public:
       }
     }
   }
-  void Load(FILE *fs) {
+  void Load(FILE *fs, const StreamLayout &layout) {
     bool success;
     int num_features;
 
     Initialize();
+    if (layout.mapped) {
+      LoadMapped(fs, layout.mapped_file);
+      return;
+    }
     success = ReadInteger(fs, &num_features);
     CHECK(success);
     for (int i = 0; i < num_features; ++i) {
@@ -390,10 +796,17 @@ public:
 
   // Get the number of instantiated features.
   // This is the number of parameters up to different labels.
-  int Size() const { return (int) values_.size(); }
+  int Size() const {
+    if (frozen_) return frozen_rows_.size();
+    return (int) values_.size();
+  }
 
   // True if this feature key is already instantiated.
   bool Exists(uint64_t key) const {
+    if (frozen_) {
+      int row;
+      return frozen_rows_.Find(key, &row);
+    }
     LabeledParameterMap::const_iterator iterator = values_.find(key);
     if (iterator == values_.end()) return false;
     return true;
@@ -403,6 +816,19 @@ public:
   // found, in which case weights becomes empty.
   bool Get(uint64_t key, const vector<int> &labels,
            vector<double> *weights) const {
+    if (frozen_) {
+      int row;
+      if (!frozen_rows_.Find(key, &row)) {
+        weights->clear();
+        return false;
+      }
+      weights->resize(labels.size());
+      for (int k = 0; k < labels.size(); ++k) {
+        (*weights)[k] = (labels[k] < num_labels_) ?
+          GetFrozenWeight(row, labels[k]) * scale_factor_ : 0.0;
+      }
+      return true;
+    }
     LabeledParameterMap::const_iterator iterator = values_.find(key);
     if (iterator == values_.end()) {
       weights->clear();
@@ -412,6 +838,72 @@ public:
     return true;
   }
 
+  // Get the weight of a feature key conjoined with a label (zero if the
+  // key does not exist).
+  double Get(uint64_t key, int label) const {
+    if (frozen_) {
+      int row;
+      if (!frozen_rows_.Find(key, &row) || label >= num_labels_) return 0.0;
+      return GetFrozenWeight(row, label) * scale_factor_;
+    }
+    LabeledParameterMap::const_iterator iterator = values_.find(key);
+    if (iterator == values_.end()) return 0.0;
+    return GetValue(iterator, label);
+  }
+
+  // Get the dot product of this vector (not frozen) with other weights,
+  // where weights(key, label) is the weight of a feature key conjoined with
+  // a label in the latter.
+  template<typename Weights>
+  double DotProduct(const Weights &weights) const {
+    CHECK(!frozen_);
+    double value = 0.0;
+    for (LabeledParameterMap::const_iterator iterator = values_.begin();
+         iterator != values_.end();
+         ++iterator) {
+      const LabelWeights *label_weights = iterator->second;
+      int label;
+      double label_value;
+      for (int k = 0; k < label_weights->Size(); ++k) {
+        label_weights->GetLabelWeightByPosition(k, &label, &label_value);
+        value += label_value * scale_factor_ *
+          weights(iterator->first, label);
+      }
+    }
+    return value;
+  }
+
+  // Add to scores the weights of several feature keys conjoined with the
+  // specified labels. The keys of a block are looked up first and the label
+  // weights they point to are prefetched, so that the loads overlap before
+  // the weights are read. Scores are accumulated in the order of the keys.
+  void AddLabelScores(const uint64_t *keys, int num_keys,
+                      const vector<int> &labels,
+                      vector<double> *scores) const {
+    if (frozen_) {
+      AddFrozenLabelScores(keys, num_keys, labels, scores);
+      return;
+    }
+    const LabelWeights *label_weights[kLabeledLookupBlockSize];
+    for (int start = 0; start < num_keys; start += kLabeledLookupBlockSize) {
+      int end = std::min(num_keys, start + kLabeledLookupBlockSize);
+      int num_found = 0;
+      for (int j = start; j < end; ++j) {
+        LabeledParameterMap::const_iterator iterator = values_.find(keys[j]);
+        if (iterator == values_.end()) continue;
+        label_weights[num_found] = iterator->second;
+        PREFETCH_READ(label_weights[num_found]);
+        ++num_found;
+      }
+      for (int i = 0; i < num_found; ++i) {
+        for (int k = 0; k < labels.size(); ++k) {
+          (*scores)[k] += label_weights[i]->GetWeight(labels[k]) *
+            scale_factor_;
+        }
+      }
+    }
+  }
+
   // Get squared norm of the parameter vector.
   double GetSquaredNorm() const { return squared_norm_; }
 
@@ -477,6 +969,7 @@ public:
   // of several features.
   // NOTE: Silently bypasses the ones that could not be inserted, if any.
   void Add(const SparseLabeledParameterVector &parameters) {
+    CHECK(!parameters.frozen_);
     for (LabeledParameterMap::const_iterator iterator =
          parameters.values_.begin();
          iterator != parameters.values_.end();
@@ -496,6 +989,406 @@ public:
   }
 
 protected:
+  // Get the index of a frozen row among all the rows: the dense rows come
+  // first, followed by the sparse rows (whose rows are encoded as -1, -2...).
+  int GetFrozenRowIndex(int row) const {
+    return (row >= 0) ? row : num_dense_rows_ - row - 1;
+  }
+
+  // Get the double weights of the frozen row with this index (see
+  // GetFrozenRowIndex) and their number, returning the position of the first
+  // one among the dense or the sparse weights. The vector must not be
+  // quantized yet.
+  size_t GetFrozenRowWeights(int index, const double **row_weights,
+                             int *length) const {
+    if (index < num_dense_rows_) {
+      size_t position = static_cast<size_t>(index) * num_labels_;
+      *row_weights = frozen_dense_weights_.data() + position;
+      *length = num_labels_;
+      return position;
+    }
+    int sparse_row = index - num_dense_rows_;
+    size_t position = frozen_sparse_starts_[sparse_row];
+    *row_weights = frozen_sparse_weights_.data() + position;
+    *length = frozen_sparse_starts_[sparse_row + 1] - position;
+    return position;
+  }
+
+  // Get the factor of the stored weights of a frozen row: its scale if
+  // quantized to int16, and 1 otherwise.
+  double GetFrozenRowScale(int row) const {
+    if (frozen_precision_ != kPrecisionInt16) return 1.0;
+    return frozen_row_scales_[GetFrozenRowIndex(row)];
+  }
+
+  // Get a weight of a frozen row (up to a scale), in any precision.
+  double GetFrozenWeight(int row, int label) const {
+    size_t position;
+    if (row >= 0) {
+      position = static_cast<size_t>(row) * num_labels_ + label;
+    } else {
+      int sparse_row = -row - 1;
+      const int *labels = frozen_sparse_labels_.data();
+      const int *begin = labels + frozen_sparse_starts_[sparse_row];
+      const int *end = labels + frozen_sparse_starts_[sparse_row + 1];
+      const int *found = std::lower_bound(begin, end, label);
+      if (found == end || *found != label) return 0.0;
+      position = found - labels;
+    }
+    if (frozen_precision_ == kPrecisionInt16) {
+      const int16_t *weights = (row >= 0) ?
+        frozen_dense_int16_weights_.data() :
+        frozen_sparse_int16_weights_.data();
+      return static_cast<double>(weights[position]) * GetFrozenRowScale(row);
+    }
+    if (frozen_precision_ == kPrecisionFloat) {
+      const float *weights = (row >= 0) ?
+        frozen_dense_float_weights_.data() :
+        frozen_sparse_float_weights_.data();
+      return static_cast<double>(weights[position]);
+    }
+    const double *weights = (row >= 0) ?
+      frozen_dense_weights_.data() : frozen_sparse_weights_.data();
+    return weights[position];
+  }
+
+  // Get the nonzero weights of a frozen row (up to a scale), as pairs of
+  // label and weight sorted by label.
+  void GetFrozenLabelWeights(int row,
+                             vector<pair<int, double> > *label_weights) const {
+    label_weights->clear();
+    if (row >= 0) {
+      for (int label = 0; label < num_labels_; ++label) {
+        double value = GetFrozenWeight(row, label);
+        if (value == 0.0) continue;
+        label_weights->push_back(pair<int, double>(label, value));
+      }
+      return;
+    }
+    int sparse_row = -row - 1;
+    double scale = GetFrozenRowScale(row);
+    for (size_t j = frozen_sparse_starts_[sparse_row];
+         j < frozen_sparse_starts_[sparse_row + 1]; ++j) {
+      double value;
+      if (frozen_precision_ == kPrecisionInt16) {
+        value = frozen_sparse_int16_weights_[j] * scale;
+      } else if (frozen_precision_ == kPrecisionFloat) {
+        value = frozen_sparse_float_weights_[j];
+      } else {
+        value = frozen_sparse_weights_[j];
+      }
+      if (value == 0.0) continue;
+      label_weights->push_back(pair<int, double>(frozen_sparse_labels_[j],
+                                                 value));
+    }
+  }
+
+  // Per-thread buffer with the position of each label among the scores of
+  // AddFrozenLabelScores (-1 for the labels that are not scored). Its entries
+  // are reset to -1 after each use.
+  static vector<int> *GetLabelPositionsBuffer() {
+    static thread_local vector<int> label_positions;
+    return &label_positions;
+  }
+
+  // Same as AddLabelScores, for a frozen vector: the rows of a block of keys
+  // are found and prefetched, and then each dense row is gathered at the
+  // label columns (see AddRowLabelScores), and each sparse row is scattered
+  // to the positions of its labels among the scores.
+  void AddFrozenLabelScores(const uint64_t *keys, int num_keys,
+                            const vector<int> &labels,
+                            vector<double> *scores) const {
+    if (frozen_precision_ == kPrecisionInt16) {
+      AddFrozenLabelScores(frozen_dense_int16_weights_.data(),
+                           frozen_sparse_int16_weights_.data(), keys,
+                           num_keys, labels, scores);
+    } else if (frozen_precision_ == kPrecisionFloat) {
+      AddFrozenLabelScores(frozen_dense_float_weights_.data(),
+                           frozen_sparse_float_weights_.data(), keys,
+                           num_keys, labels, scores);
+    } else {
+      AddFrozenLabelScores(frozen_dense_weights_.data(),
+                           frozen_sparse_weights_.data(), keys, num_keys,
+                           labels, scores);
+    }
+  }
+
+  template<typename Value>
+  void AddFrozenLabelScores(const Value *dense_weights,
+                            const Value *sparse_weights,
+                            const uint64_t *keys, int num_keys,
+                            const vector<int> &labels,
+                            vector<double> *scores) const {
+    int num_labels = labels.size();
+    const int *label_columns = labels.data();
+    double *label_scores = scores->data();
+    bool labels_in_range = true;
+    for (int k = 0; k < num_labels; ++k) {
+      if (label_columns[k] >= num_labels_) labels_in_range = false;
+    }
+    // The label positions are only set at the first sparse row. If a label
+    // is repeated, the sparse rows are looked up label by label instead.
+    vector<int> *label_positions = NULL;
+    bool repeated_labels = false;
+    int rows[kLabeledLookupBlockSize];
+    for (int start = 0; start < num_keys; start += kLabeledLookupBlockSize) {
+      int end = std::min(num_keys, start + kLabeledLookupBlockSize);
+      int num_found = 0;
+      for (int j = start; j < end; ++j) {
+        int row;
+        if (!frozen_rows_.Find(keys[j], &row)) continue;
+        rows[num_found] = row;
+        if (row >= 0) {
+          PREFETCH_READ(dense_weights + static_cast<size_t>(row) * num_labels_);
+        } else {
+          size_t position = frozen_sparse_starts_[-row - 1];
+          PREFETCH_READ(frozen_sparse_labels_.data() + position);
+          PREFETCH_READ(sparse_weights + position);
+        }
+        ++num_found;
+      }
+      for (int i = 0; i < num_found; ++i) {
+        int row = rows[i];
+        double scale_factor = scale_factor_ * GetFrozenRowScale(row);
+        if (row >= 0) {
+          AddRowLabelScores(dense_weights +
+                            static_cast<size_t>(row) * num_labels_,
+                            scale_factor, label_columns, num_labels,
+                            num_labels_, labels_in_range, label_scores);
+          continue;
+        }
+        if (!label_positions) {
+          label_positions = GetLabelPositionsBuffer();
+          if (label_positions->size() < num_labels_) {
+            label_positions->resize(num_labels_, -1);
+          }
+          for (int k = 0; k < num_labels; ++k) {
+            if (label_columns[k] >= num_labels_) continue;
+            int &position = (*label_positions)[label_columns[k]];
+            if (position >= 0) repeated_labels = true;
+            position = k;
+          }
+        }
+        if (repeated_labels) {
+          for (int k = 0; k < num_labels; ++k) {
+            if (label_columns[k] >= num_labels_) continue;
+            label_scores[k] += GetFrozenWeight(row, label_columns[k]) *
+              scale_factor_;
+          }
+          continue;
+        }
+        int sparse_row = -row - 1;
+        for (size_t j = frozen_sparse_starts_[sparse_row];
+             j < frozen_sparse_starts_[sparse_row + 1]; ++j) {
+          int position = (*label_positions)[frozen_sparse_labels_[j]];
+          if (position < 0) continue;
+          label_scores[position] +=
+            static_cast<double>(sparse_weights[j]) * scale_factor;
+        }
+      }
+    }
+    if (label_positions) {
+      for (int k = 0; k < num_labels; ++k) {
+        if (label_columns[k] >= num_labels_) continue;
+        (*label_positions)[label_columns[k]] = -1;
+      }
+    }
+  }
+
+  // Save/load the frozen rows in the mapped layout: a small header, the
+  // table of the row of each key (as in SparseParameterVector) and then each
+  // array of the rows, 8-byte aligned. The weights are stored with the scale
+  // factor already applied, in the precision of the rows (only the arrays of
+  // that precision are stored). A vector that is not frozen is saved as if
+  // it were.
+  void SaveMapped(FILE *fs) const {
+    if (!frozen_) {
+      SparseLabeledParameterVector frozen_copy;
+      Copy(&frozen_copy);
+      frozen_copy.Freeze(FLAGS_parameters_dense_label_density);
+      frozen_copy.SaveMapped(fs);
+      return;
+    }
+    bool success;
+    success = WriteInteger(fs, num_labels_);
+    CHECK(success);
+    success = WriteInteger(fs, num_dense_rows_);
+    CHECK(success);
+    success = WriteDouble(fs, min_dense_density_);
+    CHECK(success);
+    success = WriteDouble(fs, squared_norm_);
+    CHECK(success);
+    success = WriteInteger(fs, frozen_precision_);
+    CHECK(success);
+    uint64_t num_buckets = frozen_rows_.num_buckets();
+    success = WriteUINT64(fs, num_buckets);
+    CHECK(success);
+    success = WriteInteger(fs, frozen_rows_.size());
+    CHECK(success);
+    success = WriteBool(fs, frozen_rows_.has_empty_key());
+    CHECK(success);
+    success = WriteInteger(fs, frozen_rows_.empty_key_value());
+    CHECK(success);
+    SaveMappedArray(fs, frozen_rows_.keys(), num_buckets);
+    SaveMappedArray(fs, frozen_rows_.values(), num_buckets);
+    SaveMappedArray(fs, frozen_sparse_starts_.data(),
+                    frozen_sparse_starts_.size());
+    SaveMappedArray(fs, frozen_sparse_labels_.data(),
+                    frozen_sparse_labels_.size());
+    if (frozen_precision_ == kPrecisionInt16) {
+      vector<float> row_scales;
+      GetScaledValues(frozen_row_scales_, &row_scales);
+      SaveMappedArray(fs, row_scales.data(), row_scales.size());
+      SaveMappedArray(fs, frozen_dense_int16_weights_.data(),
+                      frozen_dense_int16_weights_.size());
+      SaveMappedArray(fs, frozen_sparse_int16_weights_.data(),
+                      frozen_sparse_int16_weights_.size());
+    } else if (frozen_precision_ == kPrecisionFloat) {
+      vector<float> weights;
+      GetScaledValues(frozen_dense_float_weights_, &weights);
+      SaveMappedArray(fs, weights.data(), weights.size());
+      GetScaledValues(frozen_sparse_float_weights_, &weights);
+      SaveMappedArray(fs, weights.data(), weights.size());
+    } else {
+      vector<double> weights;
+      GetScaledValues(frozen_dense_weights_, &weights);
+      SaveMappedArray(fs, weights.data(), weights.size());
+      GetScaledValues(frozen_sparse_weights_, &weights);
+      SaveMappedArray(fs, weights.data(), weights.size());
+    }
+  }
+  void LoadMapped(FILE *fs, const MappedFilePtr &mapped_file) {
+    CHECK(mapped_file) << "Streams in the mapped layout must be mapped.";
+    bool success;
+    success = ReadInteger(fs, &num_labels_);
+    CHECK(success);
+    success = ReadInteger(fs, &num_dense_rows_);
+    CHECK(success);
+    success = ReadDouble(fs, &min_dense_density_);
+    CHECK(success);
+    success = ReadDouble(fs, &squared_norm_);
+    CHECK(success);
+    success = ReadInteger(fs, &frozen_precision_);
+    CHECK(success);
+    uint64_t num_buckets;
+    int size;
+    bool has_empty_key;
+    int empty_key_value;
+    success = ReadUINT64(fs, &num_buckets);
+    CHECK(success);
+    success = ReadInteger(fs, &size);
+    CHECK(success);
+    success = ReadBool(fs, &has_empty_key);
+    CHECK(success);
+    success = ReadInteger(fs, &empty_key_value);
+    CHECK(success);
+    FrozenArray<uint64_t> keys;
+    FrozenArray<int> rows;
+    LoadMappedArray(fs, mapped_file, &keys);
+    LoadMappedArray(fs, mapped_file, &rows);
+    CHECK_EQ(keys.size(), num_buckets);
+    CHECK_EQ(rows.size(), num_buckets);
+    // The rows are never quantized, hence they are attached as "doubles".
+    frozen_rows_.Attach(num_buckets, size, keys.data(), kPrecisionDouble,
+                        rows.data(), NULL, has_empty_key, empty_key_value,
+                        mapped_file);
+    LoadMappedArray(fs, mapped_file, &frozen_sparse_starts_);
+    LoadMappedArray(fs, mapped_file, &frozen_sparse_labels_);
+    if (frozen_precision_ == kPrecisionInt16) {
+      LoadMappedArray(fs, mapped_file, &frozen_row_scales_);
+      LoadMappedArray(fs, mapped_file, &frozen_dense_int16_weights_);
+      LoadMappedArray(fs, mapped_file, &frozen_sparse_int16_weights_);
+    } else if (frozen_precision_ == kPrecisionFloat) {
+      LoadMappedArray(fs, mapped_file, &frozen_dense_float_weights_);
+      LoadMappedArray(fs, mapped_file, &frozen_sparse_float_weights_);
+    } else {
+      CHECK_EQ(frozen_precision_, kPrecisionDouble);
+      LoadMappedArray(fs, mapped_file, &frozen_dense_weights_);
+      LoadMappedArray(fs, mapped_file, &frozen_sparse_weights_);
+    }
+    CHECK_EQ(frozen_sparse_starts_.size(), size - num_dense_rows_ + 1);
+    frozen_ = true;
+    StopGrowth();
+  }
+
+  // Save/load an array in the mapped layout: its size and then its values,
+  // 8-byte aligned. Loading attaches the array to the mapped file.
+  template<typename T>
+  static void SaveMappedArray(FILE *fs, const T *values, uint64_t size) {
+    bool success;
+    success = WriteUINT64(fs, size);
+    CHECK(success);
+    success = WritePadding(fs, sizeof(uint64_t));
+    CHECK(success);
+    CHECK_EQ(size, fwrite(values, sizeof(T), size, fs));
+    success = WritePadding(fs, sizeof(uint64_t));
+    CHECK(success);
+  }
+  template<typename T>
+  static void LoadMappedArray(FILE *fs, const MappedFilePtr &mapped_file,
+                              FrozenArray<T> *array) {
+    bool success;
+    uint64_t size;
+    success = ReadUINT64(fs, &size);
+    CHECK(success);
+    success = SkipPadding(fs, sizeof(uint64_t));
+    CHECK(success);
+    long offset = ftell(fs);
+    long end_offset = offset + size * sizeof(T);
+    CHECK_LE(end_offset, mapped_file->size());
+    array->Attach(reinterpret_cast<const T*>(mapped_file->data() + offset),
+                  size, mapped_file);
+    success = (0 == fseek(fs, end_offset, SEEK_SET));
+    CHECK(success);
+    success = SkipPadding(fs, sizeof(uint64_t));
+    CHECK(success);
+  }
+
+  // Copy the values of an array of weights (or int16 scales), multiplied by
+  // the scale factor.
+  template<typename T>
+  void GetScaledValues(const FrozenArray<T> &array, vector<T> *values) const {
+    values->assign(array.data(), array.data() + array.size());
+    for (size_t i = 0; i < values->size(); ++i) {
+      (*values)[i] *= scale_factor_;
+    }
+  }
+
+  // Save the features of a frozen vector, in the same format as Save. Only
+  // the labels with nonzero weights are written.
+  void SaveFrozen(FILE *fs) const {
+    bool success;
+    const uint64_t *keys = frozen_rows_.keys();
+    const int *rows = frozen_rows_.values();
+    vector<pair<int, double> > label_weights;
+    for (uint64_t i = 0; i <= frozen_rows_.num_buckets(); ++i) {
+      uint64_t key;
+      int row;
+      if (i < frozen_rows_.num_buckets()) {
+        if (keys[i] == kFrozenEmptyKey) continue;
+        key = keys[i];
+        row = rows[i];
+      } else {
+        // The key kFrozenEmptyKey is kept apart from the buckets.
+        if (!frozen_rows_.has_empty_key()) continue;
+        key = kFrozenEmptyKey;
+        row = frozen_rows_.empty_key_value();
+      }
+      GetFrozenLabelWeights(row, &label_weights);
+      int length = label_weights.size();
+      success = WriteUINT64(fs, key);
+      CHECK(success);
+      success = WriteInteger(fs, length);
+      CHECK(success);
+      for (int k = 0; k < length; ++k) {
+        success = WriteInteger(fs, label_weights[k].first);
+        CHECK(success);
+        success = WriteDouble(fs, label_weights[k].second);
+        CHECK(success);
+      }
+    }
+  }
+
   // Get the weights for the specified labels.
   void GetValues(LabeledParameterMap::const_iterator iterator,
                  const vector<int> &labels,
@@ -596,6 +1489,7 @@ protected:
 
   // Find a key, or insert it in case it does not exist.
   LabeledParameterMap::iterator FindOrInsert(uint64_t key) {
+    CHECK(!frozen_);
     LabeledParameterMap::iterator iterator = values_.find(key);
     if (iterator != values_.end() || growth_stopped()) return iterator;
     LabelWeights *label_weights = new SparseLabelWeights;
@@ -616,6 +1510,11 @@ protected:
   // Renormalize the entire parameter map (an expensive operation).
   void Renormalize() {
     LOG(INFO) << "Renormalizing the parameter map...";
+    ScaleFrozenArray(&frozen_dense_weights_);
+    ScaleFrozenArray(&frozen_sparse_weights_);
+    ScaleFrozenArray(&frozen_dense_float_weights_);
+    ScaleFrozenArray(&frozen_sparse_float_weights_);
+    ScaleFrozenArray(&frozen_row_scales_);
     for (LabeledParameterMap::iterator iterator = values_.begin();
     iterator != values_.end();
       ++iterator) {
@@ -630,8 +1529,33 @@ protected:
     scale_factor_ = 1.0;
   }
 
+  // Multiply the values of a frozen array by the scale factor.
+  template<typename T>
+  void ScaleFrozenArray(FrozenArray<T> *array) {
+    if (array->size() == 0) return;
+    T *values = array->mutable_data();
+    for (size_t i = 0; i < array->size(); ++i) {
+      values[i] *= scale_factor_;
+    }
+  }
+
 protected:
   LabeledParameterMap values_; // Weight values, up to a scale.
+  bool frozen_; // True if the weights were moved to the frozen rows.
+  FrozenParameterMap<int> frozen_rows_; // Row of each key, once frozen.
+  int frozen_precision_; // Precision of the rows.
+  double min_dense_density_; // Density threshold of the dense rows.
+  int num_dense_rows_; // Number of rows of the dense matrix.
+  FrozenArray<double> frozen_dense_weights_; // Dense matrix (double).
+  FrozenArray<float> frozen_dense_float_weights_; // Same, if kPrecisionFloat.
+  FrozenArray<int16_t> frozen_dense_int16_weights_; // Same, if int16.
+  FrozenArray<size_t> frozen_sparse_starts_; // Start of each sparse row.
+  FrozenArray<int> frozen_sparse_labels_; // Labels of the sparse rows.
+  FrozenArray<double> frozen_sparse_weights_; // Sparse rows (double).
+  FrozenArray<float> frozen_sparse_float_weights_; // Same, if float.
+  FrozenArray<int16_t> frozen_sparse_int16_weights_; // Same, if int16.
+  FrozenArray<float> frozen_row_scales_; // Scale of each row (int16).
+  int num_labels_; // Number of columns of the dense matrix.
   double scale_factor_; // The scale factor, such that w = values * scale.
   double squared_norm_; // The squared norm of the parameter vector.
   bool growth_stopped_; // True if parameters are locked.
@@ -30,8 +30,11 @@
 #include <tr1/unordered_map>
 #endif
 #endif
+#include <algorithm>
+#include <math.h>
 #include "SerializationUtils.h"
 #include "Options.h"
+#include "Utils.h"
 
 using namespace std;
 
@@ -72,6 +75,444 @@ struct ParameterMap {
   typedef MapUINT64<Real> type;
 };
 
+// Mix the bits of a feature key (the finalizer of MurmurHash3), since feature
+// keys are packed fields and their low-order bits are far from uniform.
+inline uint64_t HashFeatureKey(uint64_t key) {
+  key ^= key >> 33;
+  key *= 0xff51afd7ed558ccdULL;
+  key ^= key >> 33;
+  key *= 0xc4ceb9fe1a85ec53ULL;
+  key ^= key >> 33;
+  return key;
+}
+
+// Precision of the values of a frozen parameter vector (see
+// FrozenParameterMap::Quantize). With kPrecisionInt16, each value is a 16-bit
+// integer times a scale factor shared by a few neighbouring values: a block
+// of kInt16BlockSize buckets of a frozen table, or a row of labeled weights.
+// Like float, int16 changes the scores slightly, but more so.
+enum {
+  kPrecisionDouble = 0,
+  kPrecisionFloat,
+  kPrecisionInt16
+};
+const int kNumFeatureTypes = 256;
+inline int GetFeatureType(uint64_t key) { return key & 0xff; }
+const int kInt16BlockSize = 64;
+
+// Number of scale factors of the int16 values of a frozen table.
+inline uint64_t GetNumInt16Blocks(uint64_t num_buckets) {
+  return (num_buckets + kInt16BlockSize - 1) / kInt16BlockSize;
+}
+
+// Convert the name of a precision (--parameters_precision) to its code.
+inline int GetPrecisionCode(const std::string &name) {
+  if (name == "double") return kPrecisionDouble;
+  if (name == "float") return kPrecisionFloat;
+  if (name == "int16") return kPrecisionInt16;
+  CHECK(false) << "Unknown precision: " << name
+               << ". Use double, float or int16.";
+  return kPrecisionDouble;
+}
+
+// Convert a precision code to its name.
+inline const char *GetPrecisionName(int precision) {
+  if (precision == kPrecisionFloat) return "float";
+  if (precision == kPrecisionInt16) return "int16";
+  return "double";
+}
+
+// Compute the scale factors of the int16 weights, one per block of weights
+// sharing a scale, from the maximum absolute weight of each block.
+inline void ComputeInt16Scales(const vector<double> &max_abs_values,
+                               vector<float> *scales) {
+  scales->resize(max_abs_values.size());
+  for (size_t b = 0; b < max_abs_values.size(); ++b) {
+    (*scales)[b] = static_cast<float>(max_abs_values[b] / 32767.0);
+  }
+}
+
+// Quantize a value to an int16 with a given scale.
+inline int16_t QuantizeToInt16(double value, float scale) {
+  if (scale == 0.0) return 0;
+  double quantized = floor(value / scale + 0.5);
+  if (quantized > 32767.0) quantized = 32767.0;
+  if (quantized < -32767.0) quantized = -32767.0;
+  return static_cast<int16_t>(quantized);
+}
+
+// Select the features to keep when compacting a model: those whose magnitude
+// is above threshold and, if max_features_per_type is positive, among the
+// max_features_per_type features of largest magnitude of their feature type.
+// Ties are broken by key, so that the selection does not depend on the order
+// of the features. Returns the number of features kept.
+inline int SelectCompactedFeatures(const vector<uint64_t> &keys,
+                                   const vector<double> &magnitudes,
+                                   double threshold,
+                                   int max_features_per_type,
+                                   vector<bool> *keep) {
+  keep->assign(keys.size(), false);
+  vector<vector<int> > candidates(kNumFeatureTypes);
+  for (int i = 0; i < keys.size(); ++i) {
+    if (magnitudes[i] <= threshold) continue;
+    candidates[GetFeatureType(keys[i])].push_back(i);
+  }
+  int num_kept = 0;
+  for (int t = 0; t < kNumFeatureTypes; ++t) {
+    vector<int> &indices = candidates[t];
+    if (max_features_per_type > 0 && indices.size() > max_features_per_type) {
+      std::nth_element(indices.begin(),
+                       indices.begin() + max_features_per_type,
+                       indices.end(),
+                       [&](int i, int j) {
+                         if (magnitudes[i] != magnitudes[j]) {
+                           return magnitudes[i] > magnitudes[j];
+                         }
+                         return keys[i] < keys[j];
+                       });
+      indices.resize(max_features_per_type);
+    }
+    for (int k = 0; k < indices.size(); ++k) {
+      (*keep)[indices[k]] = true;
+    }
+    num_kept += indices.size();
+  }
+  return num_kept;
+}
+
+// A read-only hash table for parameter vectors that are no longer updated
+// (e.g. at test time). Keys and values are stored in two contiguous arrays,
+// using open addressing with linear probing, which saves the heap node per
+// feature of the node-based maps and makes lookups more cache-friendly.
+// The arrays are either owned by the table or point to external memory
+// (e.g. a memory-mapped model file), in which case they are not released.
+// Buckets whose key is kFrozenEmptyKey are empty; the (rare) feature whose
+// key is kFrozenEmptyKey itself is kept apart.
+// The values can be quantized to float or int16 (see Quantize), in which case
+// they are read through Lookup and ComputeSum, but not through Find.
+const uint64_t kFrozenEmptyKey = 0xffffffffffffffffULL;
+const double kFrozenMaxLoadFactor = 0.7;
+// Number of keys whose buckets are hashed and prefetched together by the
+// batched lookups.
+const int kFrozenLookupBlockSize = 16;
+
+template<typename Real>
+class FrozenParameterMap {
+public:
+  FrozenParameterMap() {
+    num_buckets_ = 0;
+    size_ = 0;
+    keys_ = NULL;
+    values_ = NULL;
+    float_values_ = NULL;
+    int16_values_ = NULL;
+    block_scales_ = NULL;
+    precision_ = kPrecisionDouble;
+    owns_data_ = false;
+    has_empty_key_ = false;
+    empty_key_value_ = 0.0;
+  }
+  virtual ~FrozenParameterMap() { Clear(); }
+
+  void Clear() {
+    if (owns_data_) {
+      delete[] keys_;
+      delete[] values_;
+    }
+    num_buckets_ = 0;
+    size_ = 0;
+    keys_ = NULL;
+    values_ = NULL;
+    vector<float>().swap(owned_float_values_);
+    vector<int16_t>().swap(owned_int16_values_);
+    vector<float>().swap(owned_block_scales_);
+    float_values_ = NULL;
+    int16_values_ = NULL;
+    block_scales_ = NULL;
+    precision_ = kPrecisionDouble;
+    owns_data_ = false;
+    has_empty_key_ = false;
+    empty_key_value_ = 0.0;
+    mapped_file_.reset();
+  }
+
+  // Build the table from a sequence of (key, value) pairs.
+  template<class Iterator>
+  void Build(Iterator begin, Iterator end, int size) {
+    Clear();
+    num_buckets_ = 1;
+    while (num_buckets_ * kFrozenMaxLoadFactor < size) num_buckets_ *= 2;
+    uint64_t *keys = new uint64_t[num_buckets_];
+    Real *values = new Real[num_buckets_];
+    for (uint64_t i = 0; i < num_buckets_; ++i) {
+      keys[i] = kFrozenEmptyKey;
+      values[i] = 0.0;
+    }
+    for (Iterator iterator = begin; iterator != end; ++iterator) {
+      uint64_t key = iterator->first;
+      if (key == kFrozenEmptyKey) {
+        has_empty_key_ = true;
+        empty_key_value_ = iterator->second;
+      } else {
+        uint64_t bucket = FindBucket(keys, key);
+        keys[bucket] = key;
+        values[bucket] = iterator->second;
+      }
+      ++size_;
+    }
+    keys_ = keys;
+    values_ = values;
+    owns_data_ = true;
+  }
+
+  // Replace the values, built in full precision, by float or int16 ones (or
+  // keep them if precision is kPrecisionDouble). The value of the key
+  // kFrozenEmptyKey, if any, is kept in full precision. Return the maximum
+  // absolute difference between a value and its quantized version.
+  // Attached tables keep the precision in which they were saved.
+  double Quantize(int precision) {
+    if (precision == precision_) return 0.0;
+    CHECK_EQ(precision_, kPrecisionDouble) << "Values already quantized.";
+    CHECK(owns_data_) << "Cannot quantize an attached table.";
+    double max_error = 0.0;
+    if (precision == kPrecisionFloat) {
+      owned_float_values_.resize(num_buckets_);
+      for (uint64_t i = 0; i < num_buckets_; ++i) {
+        owned_float_values_[i] = static_cast<float>(values_[i]);
+        double error = fabs(owned_float_values_[i] - values_[i]);
+        if (error > max_error) max_error = error;
+      }
+      float_values_ = owned_float_values_.data();
+    } else {
+      CHECK_EQ(precision, kPrecisionInt16);
+      vector<double> max_abs_values(GetNumInt16Blocks(num_buckets_), 0.0);
+      for (uint64_t i = 0; i < num_buckets_; ++i) {
+        if (keys_[i] == kFrozenEmptyKey) continue;
+        uint64_t block = i / kInt16BlockSize;
+        double value = fabs(static_cast<double>(values_[i]));
+        if (value > max_abs_values[block]) max_abs_values[block] = value;
+      }
+      ComputeInt16Scales(max_abs_values, &owned_block_scales_);
+      owned_int16_values_.resize(num_buckets_);
+      for (uint64_t i = 0; i < num_buckets_; ++i) {
+        if (keys_[i] == kFrozenEmptyKey) {
+          owned_int16_values_[i] = 0;
+          continue;
+        }
+        float scale = owned_block_scales_[i / kInt16BlockSize];
+        owned_int16_values_[i] = QuantizeToInt16(values_[i], scale);
+        double error = fabs(owned_int16_values_[i] * scale - values_[i]);
+        if (error > max_error) max_error = error;
+      }
+      int16_values_ = owned_int16_values_.data();
+      block_scales_ = owned_block_scales_.data();
+    }
+    delete[] values_;
+    values_ = NULL;
+    precision_ = precision;
+    return max_error;
+  }
+
+  // Use arrays of keys and values laid out as by Build (and possibly
+  // Quantize), but stored elsewhere (in mapped_file, which is kept mapped
+  // while the table points to it). The values point to num_buckets values of
+  // the given precision; block_scales is only used for kPrecisionInt16.
+  void Attach(uint64_t num_buckets, int size, const uint64_t *keys,
+              int precision, const void *values, const float *block_scales,
+              bool has_empty_key, Real empty_key_value,
+              const MappedFilePtr &mapped_file) {
+    Clear();
+    mapped_file_ = mapped_file;
+    CHECK_EQ(num_buckets & (num_buckets - 1), 0);
+    num_buckets_ = num_buckets;
+    size_ = size;
+    keys_ = keys;
+    precision_ = precision;
+    if (precision == kPrecisionFloat) {
+      float_values_ = static_cast<const float*>(values);
+    } else if (precision == kPrecisionInt16) {
+      int16_values_ = static_cast<const int16_t*>(values);
+      block_scales_ = block_scales;
+    } else {
+      CHECK_EQ(precision, kPrecisionDouble);
+      values_ = static_cast<const Real*>(values);
+    }
+    has_empty_key_ = has_empty_key;
+    empty_key_value_ = empty_key_value;
+  }
+
+  // Get the value of a key. Return false if the key does not exist.
+  // Only for values in full precision.
+  bool Find(uint64_t key, Real *value) const {
+    CHECK_EQ(precision_, kPrecisionDouble);
+    if (key == kFrozenEmptyKey) {
+      *value = empty_key_value_;
+      return has_empty_key_;
+    }
+    if (num_buckets_ == 0) return false;
+    uint64_t bucket = FindBucket(keys_, key);
+    if (keys_[bucket] == kFrozenEmptyKey) return false;
+    *value = values_[bucket];
+    return true;
+  }
+
+  // Same as Find, for values of any precision.
+  bool Lookup(uint64_t key, double *value) const {
+    if (key == kFrozenEmptyKey) {
+      *value = static_cast<double>(empty_key_value_);
+      return has_empty_key_;
+    }
+    if (num_buckets_ == 0) return false;
+    uint64_t bucket = FindBucket(keys_, key);
+    if (keys_[bucket] == kFrozenEmptyKey) return false;
+    *value = GetValue(bucket);
+    return true;
+  }
+
+  // Compute the sum of the values of several keys (keys that do not exist
+  // count as zero), each multiplied by scale_factor. Keys are processed in
+  // blocks: the buckets of the next block are hashed and prefetched before
+  // the current block is probed, so that the cache misses of a block overlap
+  // with the work on the previous one. The sum is accumulated in the order of
+  // the keys, hence it matches summing the results of Find one by one.
+  double ComputeSum(const uint64_t *keys, int num_keys,
+                    double scale_factor) const {
+    double sum = 0.0;
+    if (num_buckets_ == 0) {
+      for (int j = 0; j < num_keys; ++j) {
+        if (keys[j] == kFrozenEmptyKey && has_empty_key_) {
+          sum += static_cast<double>(empty_key_value_) * scale_factor;
+        }
+      }
+      return sum;
+    }
+    uint64_t buckets[2][kFrozenLookupBlockSize];
+    int block_end = std::min(num_keys, kFrozenLookupBlockSize);
+    HashAndPrefetch(keys, block_end, buckets[0]);
+    for (int start = 0, block = 0; start < num_keys;
+         start = block_end, block = 1 - block) {
+      block_end = std::min(num_keys, start + kFrozenLookupBlockSize);
+      int next_end = std::min(num_keys, block_end + kFrozenLookupBlockSize);
+      HashAndPrefetch(keys + block_end, next_end - block_end,
+                      buckets[1 - block]);
+      for (int j = start; j < block_end; ++j) {
+        uint64_t key = keys[j];
+        if (key == kFrozenEmptyKey) {
+          if (has_empty_key_) {
+            sum += static_cast<double>(empty_key_value_) * scale_factor;
+          }
+          continue;
+        }
+        uint64_t bucket = ProbeFrom(buckets[block][j - start], key);
+        if (keys_[bucket] == kFrozenEmptyKey) continue;
+        sum += GetValue(bucket) * scale_factor;
+      }
+    }
+    return sum;
+  }
+
+  // Prefetch the buckets of the first keys, for a lookup that will follow
+  // shortly (e.g. the features of the next part to be scored).
+  void Prefetch(const uint64_t *keys, int num_keys) const {
+    if (num_buckets_ == 0) return;
+    uint64_t buckets[kFrozenLookupBlockSize];
+    HashAndPrefetch(keys, std::min(num_keys, kFrozenLookupBlockSize),
+                    buckets);
+  }
+
+  // Get the value in a bucket, in full precision.
+  double GetValue(uint64_t bucket) const {
+    switch (precision_) {
+    case kPrecisionFloat:
+      return static_cast<double>(float_values_[bucket]);
+    case kPrecisionInt16:
+      return static_cast<double>(int16_values_[bucket]) *
+        static_cast<double>(block_scales_[bucket / kInt16BlockSize]);
+    default:
+      return static_cast<double>(values_[bucket]);
+    }
+  }
+
+  int size() const { return size_; }
+  uint64_t num_buckets() const { return num_buckets_; }
+  const uint64_t *keys() const { return keys_; }
+  const Real *values() const { return values_; }
+  const float *float_values() const { return float_values_; }
+  const int16_t *int16_values() const { return int16_values_; }
+  const float *block_scales() const { return block_scales_; }
+  int precision() const { return precision_; }
+  bool has_empty_key() const { return has_empty_key_; }
+  bool owns_data() const { return owns_data_; }
+  Real empty_key_value() const { return empty_key_value_; }
+
+protected:
+  static uint64_t Hash(uint64_t key) { return HashFeatureKey(key); }
+
+  // Return the bucket holding key, or the empty bucket where it would go.
+  uint64_t FindBucket(const uint64_t *keys, uint64_t key) const {
+    uint64_t mask = num_buckets_ - 1;
+    uint64_t bucket = Hash(key) & mask;
+    while (keys[bucket] != key && keys[bucket] != kFrozenEmptyKey) {
+      bucket = (bucket + 1) & mask;
+    }
+    return bucket;
+  }
+
+  // Same as FindBucket on keys_, starting from the (already hashed) bucket.
+  uint64_t ProbeFrom(uint64_t bucket, uint64_t key) const {
+    uint64_t mask = num_buckets_ - 1;
+    while (keys_[bucket] != key && keys_[bucket] != kFrozenEmptyKey) {
+      bucket = (bucket + 1) & mask;
+    }
+    return bucket;
+  }
+
+  // Compute the home buckets of num_keys keys and prefetch them. The hashing
+  // loop does not touch the table, so it runs independently of the loads.
+  void HashAndPrefetch(const uint64_t *keys, int num_keys,
+                       uint64_t *buckets) const {
+    uint64_t mask = num_buckets_ - 1;
+    for (int j = 0; j < num_keys; ++j) {
+      buckets[j] = Hash(keys[j]) & mask;
+    }
+    for (int j = 0; j < num_keys; ++j) {
+      PREFETCH_READ(keys_ + buckets[j]);
+      switch (precision_) {
+      case kPrecisionFloat:
+        PREFETCH_READ(float_values_ + buckets[j]);
+        break;
+      case kPrecisionInt16:
+        PREFETCH_READ(int16_values_ + buckets[j]);
+        break;
+      default:
+        PREFETCH_READ(values_ + buckets[j]);
+      }
+    }
+  }
+
+protected:
+  uint64_t num_buckets_; // Number of buckets (a power of two).
+  int size_; // Number of keys.
+  const uint64_t *keys_; // Key in each bucket.
+  const Real *values_; // Value in each bucket (full precision).
+  const float *float_values_; // Value in each bucket (kPrecisionFloat).
+  const int16_t *int16_values_; // Value in each bucket (kPrecisionInt16).
+  const float *block_scales_; // Scale of each block of int16 values.
+  int precision_; // Precision of the values.
+  vector<float> owned_float_values_; // Storage of quantized values, if owned.
+  vector<int16_t> owned_int16_values_;
+  vector<float> owned_block_scales_;
+  bool owns_data_; // True if keys_ and values_ were allocated by Build.
+  bool has_empty_key_; // True if kFrozenEmptyKey is itself a key.
+  Real empty_key_value_; // Value of kFrozenEmptyKey, if it is a key.
+  MappedFilePtr mapped_file_; // File holding keys_ and values_, if attached.
+
+private:
+  // The table owns raw arrays, hence it cannot be copied.
+  FrozenParameterMap(const FrozenParameterMap &);
+  FrozenParameterMap &operator=(const FrozenParameterMap &);
+};
+
 // A threshold beyond which we need to renormalize the parameter vector.
 const double kScaleFactorThreshold = 1e-9;
 
@@ -84,10 +525,12 @@ const double kScaleFactorThreshold = 1e-9;
 // This way we can scale the weight vector in constant time (this operation is
 // necessary in some training algorithms such as SGD), and manipulating a few
 // elements is still fast. Plus, we can obtain the norm in constant time.
+// Once training is over, the vector can be frozen: the weights are moved to
+// a FrozenParameterMap and can no longer be changed (other than scaled).
 template<typename Real>
 class SparseParameterVector {
 public:
-  SparseParameterVector() { growth_stopped_ = false; };
+  SparseParameterVector() { growth_stopped_ = false; frozen_ = false; };
   virtual ~SparseParameterVector() {};
 
   // Lock/unlock the parameter vector. If the vector is locked, no new features
@@ -96,8 +539,86 @@ public:
   void AllowGrowth() { growth_stopped_ = false; }
   bool growth_stopped() const { return growth_stopped_; }
 
+  // Freeze the parameter vector, moving the weights to the read-only flat
+  // layout and releasing the hash map. This also locks the vector.
+  void Freeze() {
+    if (frozen_) return;
+    frozen_values_.Build(values_.begin(), values_.end(), Size());
+    values_ = typename ParameterMap<Real>::type();
+    frozen_ = true;
+    StopGrowth();
+  }
+  bool frozen() const { return frozen_; }
+
+  // True if the weights are used in place from a mapped model file, in which
+  // case they keep the precision in which the file was saved.
+  bool mapped() const { return frozen_ && !frozen_values_.owns_data(); }
+  int precision() const { return frozen_values_.precision(); }
+
+  // Quantize the weights of a frozen vector to the given precision (see
+  // FrozenParameterMap::Quantize), returning the maximum absolute error.
+  double Quantize(int precision) {
+    CHECK(frozen_);
+    return frozen_values_.Quantize(precision) * fabs(scale_factor_);
+  }
+
+  // Compact the parameter vector, dropping the weights whose magnitude is at
+  // most threshold and, if max_features_per_type is positive, all but the
+  // largest ones of each feature type (see SelectCompactedFeatures). A frozen
+  // vector is frozen again (in full precision). Returns the number of
+  // features dropped.
+  int Compact(double threshold, int max_features_per_type) {
+    vector<uint64_t> keys;
+    vector<double> weights;
+    if (frozen_) {
+      const uint64_t *frozen_keys = frozen_values_.keys();
+      for (uint64_t i = 0; i < frozen_values_.num_buckets(); ++i) {
+        if (frozen_keys[i] == kFrozenEmptyKey) continue;
+        keys.push_back(frozen_keys[i]);
+        weights.push_back(frozen_values_.GetValue(i) * scale_factor_);
+      }
+      if (frozen_values_.has_empty_key()) {
+        keys.push_back(kFrozenEmptyKey);
+        weights.push_back(static_cast<double>(
+          frozen_values_.empty_key_value()) * scale_factor_);
+      }
+    } else {
+      for (typename ParameterMap<Real>::type::const_iterator iterator =
+           values_.begin();
+           iterator != values_.end();
+           ++iterator) {
+        keys.push_back(iterator->first);
+        weights.push_back(GetValue(iterator));
+      }
+    }
+
+    vector<double> magnitudes(weights.size());
+    for (int i = 0; i < weights.size(); ++i) {
+      magnitudes[i] = fabs(weights[i]);
+    }
+    vector<bool> keep;
+    int num_kept = SelectCompactedFeatures(keys, magnitudes, threshold,
+                                           max_features_per_type, &keep);
+
+    // Rebuild the vector with the features that are kept.
+    bool frozen = frozen_;
+    bool growth_stopped = growth_stopped_;
+    frozen_values_.Clear();
+    frozen_ = false;
+    values_ = typename ParameterMap<Real>::type();
+    Initialize();
+    AllowGrowth();
+    for (int i = 0; i < keys.size(); ++i) {
+      if (keep[i]) Set(keys[i], weights[i]);
+    }
+    growth_stopped_ = growth_stopped;
+    if (frozen) Freeze();
+    return keys.size() - num_kept;
+  }
+
   // Overwrite
   void Overwrite(SparseParameterVector *output_parameters) {
+    CHECK(!frozen_);
     output_parameters->scale_factor_ = scale_factor_;
     output_parameters->squared_norm_ = squared_norm_;
     output_parameters->growth_stopped_ = growth_stopped_;
@@ -109,6 +630,7 @@ public:
   
   // Copy 
   void Copy(SparseParameterVector *output_parameters){
+    CHECK(!frozen_);
     output_parameters->scale_factor_=scale_factor_; 
     output_parameters->squared_norm_=squared_norm_; 
     output_parameters->growth_stopped_=growth_stopped_; 
@@ -118,11 +640,21 @@ public:
     }
   }
   
-  // Save/load the parameters to/from a file.
-  void Save(FILE *fs) const {
+  // Save/load the parameters to/from a file. Streams in the mapped layout
+  // store the frozen table itself, which is used in place when loading from
+  // a mapped file.
+  void Save(FILE *fs, const StreamLayout &layout) const {
+    if (layout.mapped) {
+      SaveMapped(fs);
+      return;
+    }
     bool success;
     success = WriteInteger(fs, Size());
     CHECK(success);
+    if (frozen_) {
+      SaveFrozen(fs);
+      return;
+    }
     for (typename ParameterMap<Real>::type::const_iterator iterator =
          values_.begin();
          iterator != values_.end();
@@ -134,8 +666,14 @@ public:
       CHECK(success);
     }
   }
-  void Load(FILE *fs) {
+  void Load(FILE *fs, const StreamLayout &layout) {
     Initialize();
+    frozen_values_.Clear();
+    frozen_ = false;
+    if (layout.mapped) {
+      LoadMapped(fs, layout.mapped_file);
+      return;
+    }
 
     bool success;
     int length;
@@ -160,10 +698,17 @@ public:
   }
 
   // Get the number of instantiated features.
-  int Size() const { return (int) values_.size(); }
+  int Size() const {
+    if (frozen_) return frozen_values_.size();
+    return (int) values_.size();
+  }
 
   // True if this feature key is already instantiated.
   bool Exists(uint64_t key) const {
+    if (frozen_) {
+      double value;
+      return frozen_values_.Lookup(key, &value);
+    }
     typename ParameterMap<Real>::type::const_iterator iterator =
       values_.find(key);
     if (iterator == values_.end()) return false;
@@ -172,12 +717,50 @@ public:
 
   // Get the weight of this feature key.
   double Get(uint64_t key) const {
+    if (frozen_) {
+      double value;
+      if (!frozen_values_.Lookup(key, &value)) return 0.0;
+      return value * scale_factor_;
+    }
     typename ParameterMap<Real>::type::const_iterator iterator =
       values_.find(key);
     if (iterator == values_.end()) return 0.0;
     return GetValue(iterator);
   }
 
+  // Get the sum of the weights of several feature keys. Once frozen, the
+  // lookups are batched and prefetched (see FrozenParameterMap::ComputeSum).
+  double ComputeSum(const uint64_t *keys, int num_keys) const {
+    if (frozen_) {
+      return frozen_values_.ComputeSum(keys, num_keys, scale_factor_);
+    }
+    double sum = 0.0;
+    for (int j = 0; j < num_keys; ++j) {
+      sum += Get(keys[j]);
+    }
+    return sum;
+  }
+
+  // Prefetch the weights of the first feature keys, if frozen.
+  void Prefetch(const uint64_t *keys, int num_keys) const {
+    if (frozen_) frozen_values_.Prefetch(keys, num_keys);
+  }
+
+  // Get the dot product of this vector (not frozen) with other weights,
+  // where weights(key) is the weight of a feature key in the latter.
+  template<typename Weights>
+  double DotProduct(const Weights &weights) const {
+    CHECK(!frozen_);
+    double value = 0.0;
+    for (typename ParameterMap<Real>::type::const_iterator iterator =
+         values_.begin();
+         iterator != values_.end();
+         ++iterator) {
+      value += GetValue(iterator) * weights(iterator->first);
+    }
+    return value;
+  }
+
   // Get the squared norm of the parameter vector.
   double GetSquaredNorm() const { return squared_norm_; }
 
@@ -218,6 +801,7 @@ public:
   // and the parameters are not locked, inserts the key and returns the
   // corresponding iterator.
   typename ParameterMap<Real>::type::iterator FindOrInsert(uint64_t key) {
+    CHECK(!frozen_) << "Cannot update a frozen parameter vector.";
     typename ParameterMap<Real>::type::iterator iterator = values_.find(key);
     if (iterator != values_.end() || growth_stopped()) return iterator;
     values_.PrepareForResize();
@@ -267,6 +851,7 @@ public:
   // NOTE: Silently bypasses the ones that could not be inserted, if any.
   // w'[id] = w[id] + val.
   void Add(const SparseParameterVector &parameters) {
+    CHECK(!parameters.frozen_);
     for (typename ParameterMap<Real>::type::const_iterator iterator =
          parameters.values_.begin();
          iterator != parameters.values_.end();
@@ -279,6 +864,131 @@ public:
   }
 
 protected:
+  // Save/load the frozen table in the mapped layout: a small header followed
+  // by the arrays of keys and values, 8-byte aligned. The values are stored
+  // with the scale factor already applied, in the precision of the table;
+  // int16 values are preceded by the scale of each block of buckets.
+  void SaveMapped(FILE *fs) const {
+    const FrozenParameterMap<Real> *table = &frozen_values_;
+    FrozenParameterMap<Real> temporary_table;
+    if (!frozen_) {
+      temporary_table.Build(values_.begin(), values_.end(), Size());
+      table = &temporary_table;
+    }
+    bool success;
+    success = WriteUINT64(fs, table->num_buckets());
+    CHECK(success);
+    success = WriteInteger(fs, table->size());
+    CHECK(success);
+    success = WriteBool(fs, table->has_empty_key());
+    CHECK(success);
+    success = WriteDouble(fs, table->empty_key_value() * scale_factor_);
+    CHECK(success);
+    success = WriteDouble(fs, squared_norm_);
+    CHECK(success);
+    success = WriteInteger(fs, table->precision());
+    CHECK(success);
+    success = WritePadding(fs, sizeof(uint64_t));
+    CHECK(success);
+    uint64_t num_buckets = table->num_buckets();
+    CHECK_EQ(num_buckets, fwrite(table->keys(), sizeof(uint64_t), num_buckets,
+                                 fs));
+    if (table->precision() == kPrecisionFloat) {
+      vector<float> values(table->float_values(),
+                           table->float_values() + num_buckets);
+      for (uint64_t i = 0; i < num_buckets; ++i) values[i] *= scale_factor_;
+      CHECK_EQ(num_buckets, fwrite(values.data(), sizeof(float), num_buckets,
+                                   fs));
+    } else if (table->precision() == kPrecisionInt16) {
+      uint64_t num_blocks = GetNumInt16Blocks(num_buckets);
+      vector<float> block_scales(table->block_scales(),
+                                 table->block_scales() + num_blocks);
+      for (uint64_t b = 0; b < num_blocks; ++b) {
+        block_scales[b] *= scale_factor_;
+      }
+      CHECK_EQ(num_blocks, fwrite(block_scales.data(), sizeof(float),
+                                  num_blocks, fs));
+      CHECK_EQ(num_buckets, fwrite(table->int16_values(), sizeof(int16_t),
+                                   num_buckets, fs));
+    } else {
+      vector<Real> values(table->values(), table->values() + num_buckets);
+      for (uint64_t i = 0; i < num_buckets; ++i) values[i] *= scale_factor_;
+      CHECK_EQ(num_buckets, fwrite(values.data(), sizeof(Real), num_buckets,
+                                   fs));
+    }
+    success = WritePadding(fs, sizeof(uint64_t));
+    CHECK(success);
+  }
+  void LoadMapped(FILE *fs, const MappedFilePtr &mapped_file) {
+    bool success;
+    uint64_t num_buckets;
+    int size;
+    bool has_empty_key;
+    double empty_key_value;
+    success = ReadUINT64(fs, &num_buckets);
+    CHECK(success);
+    success = ReadInteger(fs, &size);
+    CHECK(success);
+    success = ReadBool(fs, &has_empty_key);
+    CHECK(success);
+    success = ReadDouble(fs, &empty_key_value);
+    CHECK(success);
+    success = ReadDouble(fs, &squared_norm_);
+    CHECK(success);
+    int precision;
+    success = ReadInteger(fs, &precision);
+    CHECK(success);
+    success = SkipPadding(fs, sizeof(uint64_t));
+    CHECK(success);
+    long keys_offset = ftell(fs);
+    long scales_offset = keys_offset + num_buckets * sizeof(uint64_t);
+    long values_offset = scales_offset;
+    long end_offset;
+    if (precision == kPrecisionFloat) {
+      end_offset = values_offset + num_buckets * sizeof(float);
+    } else if (precision == kPrecisionInt16) {
+      values_offset += GetNumInt16Blocks(num_buckets) * sizeof(float);
+      end_offset = values_offset + num_buckets * sizeof(int16_t);
+    } else {
+      CHECK_EQ(precision, kPrecisionDouble);
+      end_offset = values_offset + num_buckets * sizeof(Real);
+    }
+    // Use the arrays in place.
+    CHECK(mapped_file) << "Streams in the mapped layout must be mapped.";
+    CHECK_LE(end_offset, mapped_file->size());
+    frozen_values_.Attach(num_buckets, size,
+      reinterpret_cast<const uint64_t*>(mapped_file->data() + keys_offset),
+      precision, mapped_file->data() + values_offset,
+      reinterpret_cast<const float*>(mapped_file->data() + scales_offset),
+      has_empty_key, empty_key_value, mapped_file);
+    success = (0 == fseek(fs, end_offset, SEEK_SET));
+    CHECK(success);
+    success = SkipPadding(fs, sizeof(uint64_t));
+    CHECK(success);
+    frozen_ = true;
+    StopGrowth();
+  }
+
+  // Save the (key, value) pairs of a frozen vector.
+  void SaveFrozen(FILE *fs) const {
+    bool success;
+    const uint64_t *keys = frozen_values_.keys();
+    for (uint64_t i = 0; i < frozen_values_.num_buckets(); ++i) {
+      if (keys[i] == kFrozenEmptyKey) continue;
+      success = WriteUINT64(fs, keys[i]);
+      CHECK(success);
+      success = WriteDouble(fs, frozen_values_.GetValue(i) * scale_factor_);
+      CHECK(success);
+    }
+    if (frozen_values_.has_empty_key()) {
+      success = WriteUINT64(fs, kFrozenEmptyKey);
+      CHECK(success);
+      success = WriteDouble(fs, static_cast<double>(
+        frozen_values_.empty_key_value()) * scale_factor_);
+      CHECK(success);
+    }
+  }
+
   // If the scale factor is too small, renormalize the entire parameter map.
   void RenormalizeIfNecessary() {
     if (scale_factor_ > -kScaleFactorThreshold &&
@@ -289,6 +999,7 @@ protected:
 
   // Renormalize the entire parameter map (an expensive operation).
   void Renormalize() {
+    CHECK(!frozen_);
     LOG(INFO) << "Renormalizing the parameter map...";
     for (typename ParameterMap<Real>::type::iterator iterator = values_.begin();
     iterator != values_.end();
@@ -303,9 +1014,268 @@ protected:
   double scale_factor_; // The scale factor, such that w = values * scale.
   double squared_norm_; // The squared norm of the parameter vector.
   bool growth_stopped_; // True if parameters are locked.
+  FrozenParameterMap<Real> frozen_values_; // Weight values, once frozen.
+  bool frozen_; // True if the weights are in frozen_values_.
 };
 
 typedef SparseParameterVector<double> SparseParameterVectorDouble;
 typedef SparseParameterVector<float> SparseParameterVectorFloat;
 
+// This class implements a parameter vector with a fixed number (2^hash_bits)
+// of weights, to which the feature keys are hashed ("hashing trick"). Keys
+// conjoined with a label are hashed together with the label, into the same
+// array. No keys are stored, hence the memory does not depend on the number
+// of features, and distinct features may share a weight. As in
+// SparseParameterVector, the weights are kept up to a scale factor, and
+// stored as Real (updates are computed in double precision).
+// The weights are either owned by the vector or point to a mapped model file,
+// in which case they can be read but not updated.
+template<typename Real>
+class HashedParameterVector {
+public:
+  HashedParameterVector() {
+    hash_bits_ = 0;
+    mask_ = 0;
+    weights_ = NULL;
+    scale_factor_ = 1.0;
+    squared_norm_ = 0.0;
+  }
+  virtual ~HashedParameterVector() {};
+
+  // Initialize to 2^hash_bits zeros.
+  void Initialize(int hash_bits) {
+    CHECK_GE(hash_bits, 1);
+    CHECK_LE(hash_bits, 32);
+    mapped_file_.reset();
+    hash_bits_ = hash_bits;
+    mask_ = (1ULL << hash_bits) - 1;
+    vector<Real>(mask_ + 1, 0.0).swap(values_);
+    weights_ = values_.data();
+    scale_factor_ = 1.0;
+    squared_norm_ = 0.0;
+  }
+
+  // Release the weights.
+  void Clear() {
+    mapped_file_.reset();
+    vector<Real>().swap(values_);
+    hash_bits_ = 0;
+    mask_ = 0;
+    weights_ = NULL;
+    scale_factor_ = 1.0;
+    squared_norm_ = 0.0;
+  }
+
+  int hash_bits() const { return hash_bits_; }
+
+  // Copy the weights to another vector (which will own them).
+  void Copy(HashedParameterVector *output_parameters) const {
+    output_parameters->Clear();
+    if (hash_bits_ == 0) return;
+    output_parameters->hash_bits_ = hash_bits_;
+    output_parameters->mask_ = mask_;
+    output_parameters->values_.assign(weights_, weights_ + mask_ + 1);
+    output_parameters->weights_ = output_parameters->values_.data();
+    output_parameters->scale_factor_ = scale_factor_;
+    output_parameters->squared_norm_ = squared_norm_;
+  }
+
+  // Save/load the weights to/from a file, with the scale factor applied. In
+  // the mapped layout, the array is aligned and used in place when loading
+  // from a mapped file.
+  void Save(FILE *fs, const StreamLayout &layout) const {
+    bool mapped = layout.mapped;
+    bool success;
+    success = WriteInteger(fs, hash_bits_);
+    CHECK(success);
+    success = WriteDouble(fs, squared_norm_);
+    CHECK(success);
+    if (mapped) {
+      success = WritePadding(fs, sizeof(double));
+      CHECK(success);
+    }
+    const int kBlockSize = 4096;
+    vector<Real> block(kBlockSize);
+    for (uint64_t start = 0; start <= mask_; start += kBlockSize) {
+      uint64_t size = std::min(static_cast<uint64_t>(kBlockSize),
+                               mask_ + 1 - start);
+      for (uint64_t i = 0; i < size; ++i) {
+        block[i] = weights_[start + i] * scale_factor_;
+      }
+      CHECK_EQ(size, fwrite(block.data(), sizeof(Real), size, fs));
+    }
+    if (mapped) {
+      success = WritePadding(fs, sizeof(double));
+      CHECK(success);
+    }
+  }
+  void Load(FILE *fs, const StreamLayout &layout) {
+    bool mapped = layout.mapped;
+    bool success;
+    int hash_bits;
+    double squared_norm;
+    success = ReadInteger(fs, &hash_bits);
+    CHECK(success);
+    success = ReadDouble(fs, &squared_norm);
+    CHECK(success);
+    if (!mapped) {
+      Initialize(hash_bits);
+      CHECK_EQ(mask_ + 1, fread(values_.data(), sizeof(Real), mask_ + 1,
+                                fs));
+      squared_norm_ = squared_norm;
+      return;
+    }
+    Clear();
+    CHECK_GE(hash_bits, 1);
+    CHECK_LE(hash_bits, 32);
+    hash_bits_ = hash_bits;
+    mask_ = (1ULL << hash_bits) - 1;
+    squared_norm_ = squared_norm;
+    success = SkipPadding(fs, sizeof(double));
+    CHECK(success);
+    long offset = ftell(fs);
+    long end_offset = offset + (mask_ + 1) * sizeof(Real);
+    // Use the array in place.
+    mapped_file_ = layout.mapped_file;
+    CHECK(mapped_file_) << "Streams in the mapped layout must be mapped.";
+    CHECK_LE(end_offset, mapped_file_->size());
+    weights_ = reinterpret_cast<const Real*>(mapped_file_->data() + offset);
+    success = (0 == fseek(fs, end_offset, SEEK_SET));
+    CHECK(success);
+    success = SkipPadding(fs, sizeof(double));
+    CHECK(success);
+  }
+
+  // Get the number of nonzero weights (this takes a pass over the array).
+  int Size() const {
+    int size = 0;
+    for (uint64_t i = 0; i <= mask_; ++i) {
+      if (weights_[i] != 0.0) ++size;
+    }
+    return size;
+  }
+
+  // Get the weight of a feature key.
+  double Get(uint64_t key) const {
+    return weights_[Index(key)] * scale_factor_;
+  }
+
+  // Get the weight of a feature key conjoined with a label.
+  double Get(uint64_t key, int label) const {
+    return weights_[Index(key, label)] * scale_factor_;
+  }
+
+  // Get the sum of the weights of several feature keys. The indices of a
+  // block of keys are computed and prefetched before the weights are read.
+  // The sum is accumulated in the order of the keys.
+  double ComputeSum(const uint64_t *keys, int num_keys) const {
+    uint64_t indices[kFrozenLookupBlockSize];
+    double sum = 0.0;
+    for (int start = 0; start < num_keys; start += kFrozenLookupBlockSize) {
+      int size = std::min(num_keys - start, kFrozenLookupBlockSize);
+      for (int j = 0; j < size; ++j) {
+        indices[j] = Index(keys[start + j]);
+        PREFETCH_READ(weights_ + indices[j]);
+      }
+      for (int j = 0; j < size; ++j) {
+        sum += weights_[indices[j]] * scale_factor_;
+      }
+    }
+    return sum;
+  }
+
+  // Prefetch the weights of the first feature keys.
+  void Prefetch(const uint64_t *keys, int num_keys) const {
+    int size = std::min(num_keys, kFrozenLookupBlockSize);
+    for (int j = 0; j < size; ++j) {
+      PREFETCH_READ(weights_ + Index(keys[j]));
+    }
+  }
+
+  // Add to scores the weights of several feature keys conjoined with the
+  // specified labels, in the order of the keys.
+  void AddLabelScores(const uint64_t *keys, int num_keys,
+                      const vector<int> &labels,
+                      vector<double> *scores) const {
+    for (int j = 0; j < num_keys; ++j) {
+      for (int k = 0; k < labels.size(); ++k) {
+        (*scores)[k] += weights_[Index(keys[j], labels[k])] * scale_factor_;
+      }
+    }
+  }
+
+  // Get the squared norm of the parameter vector.
+  double GetSquaredNorm() const { return squared_norm_; }
+
+  // Scale the parameter vector by a factor.
+  void Scale(double scale_factor) {
+    scale_factor_ *= scale_factor;
+    squared_norm_ *= scale_factor * scale_factor;
+    if (scale_factor_ > -kScaleFactorThreshold &&
+        scale_factor_ < kScaleFactorThreshold) {
+      Renormalize();
+    }
+  }
+
+  // Increment the weight of a feature key (possibly conjoined with a label)
+  // by an amount of "value".
+  void Add(uint64_t key, double value) { AddAt(Index(key), value); }
+  void Add(uint64_t key, int label, double value) {
+    AddAt(Index(key, label), value);
+  }
+
+  // Add another parameter vector of the same size.
+  template<typename OtherReal>
+  void Add(const HashedParameterVector<OtherReal> &parameters) {
+    CHECK_EQ(hash_bits_, parameters.hash_bits());
+    for (uint64_t i = 0; i <= mask_; ++i) {
+      double value = parameters.GetByIndex(i);
+      if (value != 0.0) AddAt(i, value);
+    }
+  }
+
+  // Get the weight stored at an index of the array.
+  double GetByIndex(uint64_t index) const {
+    return weights_[index] * scale_factor_;
+  }
+
+protected:
+  // Index of the weight of a feature key, and of a key conjoined with a label.
+  uint64_t Index(uint64_t key) const { return HashFeatureKey(key) & mask_; }
+  uint64_t Index(uint64_t key, int label) const {
+    return HashFeatureKey(key + (static_cast<uint64_t>(label) + 1) *
+                          0x9e3779b97f4a7c15ULL) & mask_;
+  }
+
+  void AddAt(uint64_t index, double value) {
+    CHECK(!mapped_file_) << "Cannot update a mapped parameter vector.";
+    double current_value = values_[index] * scale_factor_;
+    double new_value = current_value + value;
+    squared_norm_ += new_value * new_value - current_value * current_value;
+    values_[index] = new_value / scale_factor_;
+    if (squared_norm_ < 0.0) squared_norm_ = 0.0;
+  }
+
+  void Renormalize() {
+    CHECK(!mapped_file_);
+    LOG(INFO) << "Renormalizing the parameter map...";
+    for (uint64_t i = 0; i <= mask_; ++i) {
+      values_[i] *= scale_factor_;
+    }
+    scale_factor_ = 1.0;
+  }
+
+protected:
+  int hash_bits_; // Number of bits of the weight indices (0 if unused).
+  uint64_t mask_; // Number of weights minus one.
+  vector<Real> values_; // Weight values, up to a scale, if owned.
+  const Real *weights_; // Weight values (values_ or the mapped file).
+  double scale_factor_; // The scale factor, such that w = values * scale.
+  double squared_norm_; // The squared norm of the parameter vector.
+  MappedFilePtr mapped_file_; // File holding weights_, if mapped.
+};
+
+typedef HashedParameterVector<double> HashedParameterVectorDouble;
+typedef HashedParameterVector<float> HashedParameterVectorFloat;
+
 #endif /*SPARSEPARAMETERVECTOR_H_*/
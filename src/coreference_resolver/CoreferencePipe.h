@@ -101,6 +101,16 @@ protected:
     return instance_numeric;
   }
 
+  // The root symbol of each sentence is not counted.
+  int GetNumTokens(Instance *instance) {
+    CoreferenceDocument *document = static_cast<CoreferenceDocument*>(instance);
+    int num_tokens = 0;
+    for (int i = 0; i < document->GetNumSentences(); ++i) {
+      num_tokens += document->GetSentence(i)->size() - 1;
+    }
+    return num_tokens;
+  }
+
 protected:
   void SaveModel(FILE* fs);
   void LoadModel(FILE* fs);
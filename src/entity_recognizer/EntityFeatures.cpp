@@ -24,10 +24,7 @@
 
 void EntityFeatures::AddUnigramFeatures(SequenceInstanceNumeric *sentence,
                                         int position) {
-  CHECK(!input_features_unigrams_[position]);
-
-  BinaryFeatures *features = new BinaryFeatures;
-  input_features_unigrams_[position] = features;
+  BinaryFeatures *features = CreateUnigramFeatures(position);
 
   int sentence_length = sentence->size();
 
@@ -253,10 +250,7 @@ void EntityFeatures::AddUnigramFeatures(SequenceInstanceNumeric *sentence,
 
 void EntityFeatures::AddBigramFeatures(SequenceInstanceNumeric *sentence,
                                        int position) {
-  CHECK(!input_features_bigrams_[position]) << position
-    << " " << sentence->size();
-  BinaryFeatures *features = new BinaryFeatures;
-  input_features_bigrams_[position] = features;
+  BinaryFeatures *features = CreateBigramFeatures(position);
 
   uint64_t fkey;
   uint8_t flags = 0x0;
@@ -406,10 +400,7 @@ void EntityFeatures::AddBigramFeatures(SequenceInstanceNumeric *sentence,
 
 void EntityFeatures::AddTrigramFeatures(SequenceInstanceNumeric *sentence,
                                         int position) {
-  CHECK(!input_features_trigrams_[position]) << position
-    << " " << sentence->size();
-  BinaryFeatures *features = new BinaryFeatures;
-  input_features_trigrams_[position] = features;
+  BinaryFeatures *features = CreateTrigramFeatures(position);
 
   uint64_t fkey;
   uint8_t flags = 0x0;
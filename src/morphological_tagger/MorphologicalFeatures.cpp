@@ -23,10 +23,7 @@
 
 void MorphologicalFeatures::AddUnigramFeatures(SequenceInstanceNumeric *sentence,
                                                int position) {
-  CHECK(!input_features_unigrams_[position]);
-
-  BinaryFeatures *features = new BinaryFeatures;
-  input_features_unigrams_[position] = features;
+  BinaryFeatures *features = CreateUnigramFeatures(position);
 
   int sentence_length = sentence->size();
 
@@ -330,10 +327,7 @@ void MorphologicalFeatures::AddUnigramFeatures(SequenceInstanceNumeric *sentence
 
 void MorphologicalFeatures::AddBigramFeatures(SequenceInstanceNumeric *sentence,
                                               int position) {
-  CHECK(!input_features_bigrams_[position]) << position
-    << " " << sentence->size();
-  BinaryFeatures *features = new BinaryFeatures;
-  input_features_bigrams_[position] = features;
+  BinaryFeatures *features = CreateBigramFeatures(position);
 
   uint64_t fkey;
   uint8_t flags = 0x0;
@@ -347,10 +341,7 @@ void MorphologicalFeatures::AddBigramFeatures(SequenceInstanceNumeric *sentence,
 
 void MorphologicalFeatures::AddTrigramFeatures(SequenceInstanceNumeric *sentence,
                                                int position) {
-  CHECK(!input_features_trigrams_[position]) << position
-    << " " << sentence->size();
-  BinaryFeatures *features = new BinaryFeatures;
-  input_features_trigrams_[position] = features;
+  BinaryFeatures *features = CreateTrigramFeatures(position);
 
   uint64_t fkey;
   uint8_t flags = 0x0;
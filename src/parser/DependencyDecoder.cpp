@@ -172,7 +172,7 @@ void DependencyDecoder::DecodeLabels(Instance *instance, Parts *parts,
   for (int r = 0; r < num_arcs; ++r) {
     DependencyPartArc *arc =
       static_cast<DependencyPartArc*>((*parts)[offset + r]);
-    const vector<int> &index_labeled_parts =
+    LabeledArcIndices index_labeled_parts =
       dependency_parts->FindLabeledArcs(arc->head(), arc->modifier());
     // Find the best label for each candidate arc.
     int best_label = -1;
@@ -209,7 +209,7 @@ void DependencyDecoder::DecodeLabelMarginals(Instance *instance, Parts *parts,
   for (int r = 0; r < num_arcs; ++r) {
     DependencyPartArc *arc =
       static_cast<DependencyPartArc*>((*parts)[offset + r]);
-    const vector<int> &index_labeled_parts =
+    LabeledArcIndices index_labeled_parts =
       dependency_parts->FindLabeledArcs(arc->head(), arc->modifier());
     // Find the best label for each candidate arc.
     LogValD total_score = LogValD::Zero();
@@ -257,6 +257,10 @@ void DependencyDecoder::Decode(Instance *instance, Parts *parts,
       dependency_parts->IsLabeledArcFactored()) {
     double value;
     DecodeBasic(instance, parts, copied_scores, predicted_output, &value);
+  } else if (UseSecondOrderEisner(instance, parts) &&
+             DecodeSecondOrderEisner(instance, parts, copied_scores,
+                                     predicted_output)) {
+    // The dynamic program is exact, so there is no need for AD3 or rounding.
   } else {
 #ifdef USE_CPLEX
     DecodeCPLEX(instance, parts, copied_scores, false, true, predicted_output);
@@ -314,19 +318,92 @@ void DependencyDecoder::DecodePruner(Instance *instance, Parts *parts,
                      &log_partition_function, &entropy);
   }
 
-  int num_used_parts = 0;
-  for (int m = 1; m < sentence_length; ++m) {
-    vector<pair<double, int> > scores_heads;
-    for (int h = 0; h < sentence_length; ++h) {
-      int r = dependency_parts->FindArc(h, m);
-      if (r < 0) continue;
-      scores_heads.push_back(pair<double, int>(-posteriors[r], r));
-    }
-    if (scores_heads.size() == 0) continue;
-    sort(scores_heads.begin(), scores_heads.end());
-    double max_posterior = -scores_heads[0].first;
-    for (int k = 0; k < max_heads && k < scores_heads.size(); ++k) {
-      int r = scores_heads[k].second;
+  // Note: the arc index of the parts (FindArc) is not used here, so the pipe
+  // does not need to build it before pruning.
+  int offset_arcs, num_arcs;
+  dependency_parts->GetOffsetArc(&offset_arcs, &num_arcs);
+  vector<DependencyPartArc*> arcs(num_arcs);
+  vector<double> posteriors_arcs(num_arcs);
+  for (int r = 0; r < num_arcs; ++r) {
+    arcs[r] = static_cast<DependencyPartArc*>((*parts)[offset_arcs + r]);
+    posteriors_arcs[r] = posteriors[offset_arcs + r];
+  }
+
+  vector<int> offsets;
+  vector<int> selected_arcs;
+  SelectPrunerArcs(sentence_length, arcs, posteriors_arcs,
+                   posterior_threshold, max_heads, &offsets, &selected_arcs);
+  for (int k = 0; k < selected_arcs.size(); ++k) {
+    (*predicted_output)[offset_arcs + selected_arcs[k]] = 1.0;
+  }
+
+  VLOG(2) << "Pruning reduced to "
+    << static_cast<double>(selected_arcs.size()) /
+    static_cast<double>(sentence_length)
+    << " candidate heads per word.";
+}
+
+// Candidate arcs of each modifier, grouped by modifier, reused across calls
+// to SelectPrunerArcs in each thread.
+struct PrunerWorkspace {
+  vector<int> offsets; // Start of the candidates of each modifier.
+  vector<pair<double, int> > candidates; // Posterior and index of each arc.
+};
+
+static PrunerWorkspace *GetPrunerWorkspace() {
+  static thread_local PrunerWorkspace workspace;
+  return &workspace;
+}
+
+// Select the candidate heads of each modifier from the arc posteriors: the
+// (at most) max_heads most likely ones, and among those only the ones whose
+// posterior is at least posterior_threshold times the largest one. The
+// selected arcs of modifier m are (*selected_arcs)[(*offsets)[m]] to
+// (*selected_arcs)[(*offsets)[m+1] - 1], by decreasing posterior (ties are
+// broken by arc index).
+// Instead of sorting all the candidates of each modifier, only the top
+// max_heads are partially sorted, which takes O(n log max_heads) time per
+// modifier.
+void DependencyDecoder::SelectPrunerArcs(int sentence_length,
+                                         const vector<DependencyPartArc*> &arcs,
+                                         const vector<double> &posteriors,
+                                         double posterior_threshold,
+                                         int max_heads,
+                                         vector<int> *offsets,
+                                         vector<int> *selected_arcs) {
+  PrunerWorkspace *workspace = GetPrunerWorkspace();
+  vector<int> &candidate_offsets = workspace->offsets;
+  vector<pair<double, int> > &candidates = workspace->candidates;
+
+  // Group the arcs by modifier (counting sort, which keeps them in order).
+  candidate_offsets.assign(sentence_length + 1, 0);
+  for (int r = 0; r < arcs.size(); ++r) {
+    ++candidate_offsets[arcs[r]->modifier() + 1];
+  }
+  for (int m = 0; m < sentence_length; ++m) {
+    candidate_offsets[m + 1] += candidate_offsets[m];
+  }
+  candidates.resize(arcs.size());
+  // Use offsets as the insertion position of each modifier.
+  offsets->assign(candidate_offsets.begin(), candidate_offsets.end() - 1);
+  for (int r = 0; r < arcs.size(); ++r) {
+    int m = arcs[r]->modifier();
+    candidates[(*offsets)[m]++] = pair<double, int>(-posteriors[r], r);
+  }
+
+  offsets->assign(sentence_length + 1, 0);
+  selected_arcs->clear();
+  for (int m = 0; m < sentence_length; ++m) {
+    (*offsets)[m] = selected_arcs->size();
+    vector<pair<double, int> >::iterator begin =
+      candidates.begin() + candidate_offsets[m];
+    vector<pair<double, int> >::iterator end =
+      candidates.begin() + candidate_offsets[m + 1];
+    int num_heads = std::min(max_heads, static_cast<int>(end - begin));
+    if (num_heads <= 0) continue;
+    std::partial_sort(begin, begin + num_heads, end);
+    double max_posterior = -begin->first;
+    for (int k = 0; k < num_heads; ++k) {
       // Note: better to put k == 0 because things could have gone
       // wrong with the marginal decoder and all parents could
       // end up with zero probability.
@@ -334,20 +411,13 @@ void DependencyDecoder::DecodePruner(Instance *instance, Parts *parts,
       // it doesn't guarantee that there is a tree spanning the
       // pruned graph. Need to call DependencyPipe::EnforceConnectedGraph
       // somewhere after pruning.
-      if (k == 0 ||
-          -scores_heads[k].first >= posterior_threshold * max_posterior) {
-        ++num_used_parts;
-        (*predicted_output)[r] = 1.0;
-      } else {
+      if (k > 0 && -begin[k].first < posterior_threshold * max_posterior) {
         break;
       }
+      selected_arcs->push_back(begin[k].second);
     }
   }
-
-  VLOG(2) << "Pruning reduced to "
-    << static_cast<double>(num_used_parts) /
-    static_cast<double>(sentence_length)
-    << " candidate heads per word.";
+  (*offsets)[sentence_length] = selected_arcs->size();
 }
 
 void DependencyDecoder::DecodePrunerNaive(Instance *instance, Parts *parts,
@@ -380,7 +450,8 @@ void DependencyDecoder::DecodePrunerNaive(Instance *instance, Parts *parts,
 
 // Decoder for the basic model; it finds a maximum weighted arborescence
 // using Edmonds' algorithm (which runs in O(n^2)) or, if the --projective
-// option is set, Eisner's algorithm (O(n^3)).
+// option is set, Eisner's algorithm (O(n^3)). If the --single_root option is
+// set, Edmonds' algorithm only allows one child of the root.
 void DependencyDecoder::DecodeBasic(Instance *instance, Parts *parts,
                                     const vector<double> &scores,
                                     vector<double> *predicted_output,
@@ -400,6 +471,9 @@ void DependencyDecoder::DecodeBasic(Instance *instance, Parts *parts,
   vector<int> heads;
   if (pipe_->GetDependencyOptions()->projective()) {
     RunEisner(sentence_length, arcs, scores_arcs, &heads, value);
+  } else if (pipe_->GetDependencyOptions()->single_root()) {
+    RunChuLiuEdmondsSingleRoot(sentence_length, arcs, scores_arcs, &heads,
+                               value);
   } else {
     RunChuLiuEdmonds(sentence_length, arcs, scores_arcs, &heads, value);
   }
@@ -419,186 +493,293 @@ void DependencyDecoder::DecodeBasic(Instance *instance, Parts *parts,
   }
 }
 
-// Decoder for the basic model; it finds a maximum weighted arborescence
-// using Edmonds' algorithm (which runs in O(n^2)).
-void DependencyDecoder::RunChuLiuEdmondsIteration(
-  vector<bool> *disabled,
-  vector<vector<int> > *candidate_heads,
-  vector<vector<double> > *candidate_scores,
-  vector<int> *heads,
-  double *value) {
-  // Original number of nodes (including the root).
-  int length = disabled->size();
-
-  // Pick the best incoming arc for each node.
-  heads->resize(length);
-  vector<double> best_scores(length);
-  for (int m = 1; m < length; ++m) {
-    if ((*disabled)[m]) continue;
-    int best = -1;
-    for (int k = 0; k < (*candidate_heads)[m].size(); ++k) {
-      if (best < 0 ||
-          (*candidate_scores)[m][k] >(*candidate_scores)[m][best]) {
-        best = k;
-      }
-    }
-    if (best < 0) {
-      // No spanning tree exists. Assign the parent of this node
-      // to the root, and give it a minus infinity score.
-      (*heads)[m] = 0;
-      best_scores[m] = -std::numeric_limits<double>::infinity();
-    } else {
-      (*heads)[m] = (*candidate_heads)[m][best]; //best;
-      best_scores[m] = (*candidate_scores)[m][best]; //best;
-    }
-  }
+void ChuLiuEdmondsWorkspace::Initialize(int sentence_length,
+                                        const vector<DependencyPartArc*> &arcs,
+                                        const vector<double> &arc_scores,
+                                        bool single_root) {
+  length = sentence_length;
+  order_offset = std::max(sentence_length, static_cast<int>(arcs.size()));
+  int size = sentence_length * sentence_length;
+  scores.resize(size);
+  penalties.resize(size);
+  order.assign(size, -1);
+  // The candidate heads of each node are listed in the order of the arcs.
+  for (int r = 0; r < arcs.size(); ++r) {
+    int h = arcs[r]->head();
+    int m = arcs[r]->modifier();
+    scores[m * sentence_length + h] = arc_scores[r];
+    penalties[m * sentence_length + h] = (single_root && h == 0) ? -1 : 0;
+    order[m * sentence_length + h] = r;
+  }
+  disabled.assign(sentence_length, false);
+  in_cycle.assign(sentence_length, false);
+  tied.assign(sentence_length, false);
+  best_scores.assign(sentence_length, 0.0);
+  best_penalties.assign(sentence_length, 0);
+  visited.resize(sentence_length);
+  best_scores_cycle.resize(sentence_length);
+  best_penalties_cycle.resize(sentence_length);
+  representatives.clear();
+  representative_heads.clear();
+  cycle_offsets.clear();
+  cycle_nodes.clear();
+  best_heads_cycle.clear();
+  best_modifiers_cycle.clear();
+}
+
+// Get the Chu-Liu-Edmonds tables of the calling thread.
+static ChuLiuEdmondsWorkspace *GetChuLiuEdmondsWorkspace() {
+  static thread_local ChuLiuEdmondsWorkspace workspace;
+  return &workspace;
+}
+
+// Compare two candidate heads by their penalties first, then by their scores.
+static inline bool IsBetterHead(int penalty, double score, int other_penalty,
+                                double other_score) {
+  return penalty > other_penalty ||
+    (penalty == other_penalty && score > other_score);
+}
+
+// Pick the best candidate head of m, breaking ties in favor of the head that
+// comes first in the list of candidates. If m has no candidate heads (no
+// spanning tree exists), its parent is the root with a minus infinity score.
+static void PickBestHead(ChuLiuEdmondsWorkspace *workspace, int m,
+                         vector<int> *heads) {
+  int length = workspace->length;
+  const double *scores = &workspace->scores[m * length];
+  const int *penalties = &workspace->penalties[m * length];
+  const int *order = &workspace->order[m * length];
+  int best = -1;
+  double best_score = -std::numeric_limits<double>::infinity();
+  int best_penalty = 0;
+  bool tied = false;
+  for (int h = 0; h < length; ++h) {
+    if (order[h] < 0) continue;
+    if (best < 0 ||
+        IsBetterHead(penalties[h], scores[h], best_penalty, best_score)) {
+      best = h;
+      best_score = scores[h];
+      best_penalty = penalties[h];
+      tied = false;
+    } else if (penalties[h] == best_penalty && scores[h] == best_score) {
+      tied = true;
+      if (order[h] < order[best]) best = h;
+    }
+  }
+  (*heads)[m] = (best < 0) ? 0 : best;
+  workspace->best_scores[m] = best_score;
+  workspace->best_penalties[m] = best_penalty;
+  workspace->tied[m] = tied;
+}
 
-  // Look for cycles. Return after the first cycle is found.
-  vector<int> cycle;
-  vector<int> visited(length, 0);
+// Find the first cycle formed by the best heads, scanning the nodes from left
+// to right. Returns false if there are none.
+static bool FindCycle(ChuLiuEdmondsWorkspace *workspace,
+                      const vector<int> &heads) {
+  int length = workspace->length;
+  vector<int> &visited = workspace->visited;
+  workspace->cycle.clear();
+  std::fill(visited.begin(), visited.end(), 0);
   for (int m = 1; m < length; ++m) {
-    if ((*disabled)[m]) continue;
+    if (workspace->disabled[m]) continue;
     // Examine all the ancestors of m until the root or a cycle is found.
+    // If visited[h] < m, the node was visited earlier and seen not to be
+    // part of a cycle.
     int h = m;
-    while (h != 0) {
-      // If already visited, break and check if it is part of a cycle.
-      // If visited[h] < m, the node was visited earlier and seen not
-      // to be part of a cycle.
-      if (visited[h]) break;
+    while (h != 0 && !visited[h]) {
       visited[h] = m;
-      h = (*heads)[h];
+      h = heads[h];
     }
-
-    // Found a cycle to which h belongs.
-    // Obtain the full cycle.
-    if (visited[h] == m) {
-      m = h;
+    if (h != 0 && visited[h] == m) {
+      int k = h;
       do {
-        cycle.push_back(m);
-        m = (*heads)[m];
-      } while (m != h);
-      break;
+        workspace->cycle.push_back(k);
+        k = heads[k];
+      } while (k != h);
+      return true;
     }
   }
+  return false;
+}
 
-  // If there are no cycles, then this is a well formed tree.
-  if (cycle.empty()) {
-    *value = 0.0;
-    for (int m = 1; m < length; ++m) {
-      *value += best_scores[m];
-    }
-    return;
-  }
-
-  // Build a cycle membership vector for constant-time querying and compute the
-  // score of the cycle.
-  // Nominate a representative node for the cycle and disable all the others.
-  double cycle_score = 0.0;
-  vector<bool> in_cycle(length, false);
+// Contract the cycle in workspace->cycle into its first node (the
+// representative) and update the best heads of the nodes whose candidate
+// lists changed. This costs O(n * |cycle|).
+static void ContractCycle(ChuLiuEdmondsWorkspace *workspace,
+                          vector<int> *heads) {
+  int length = workspace->length;
+  const vector<int> &cycle = workspace->cycle;
+  vector<bool> &disabled = workspace->disabled;
+  vector<bool> &in_cycle = workspace->in_cycle;
+  const vector<double> &best_scores = workspace->best_scores;
+  const vector<int> &best_penalties = workspace->best_penalties;
+  vector<double> &scores = workspace->scores;
+  vector<int> &penalties = workspace->penalties;
+  vector<int> &order = workspace->order;
+
+  // Nominate a representative node for the cycle, disable all the others
+  // and compute the score of the cycle.
   int representative = cycle[0];
+  double cycle_score = 0.0;
+  int cycle_penalty = 0;
   for (int k = 0; k < cycle.size(); ++k) {
     int m = cycle[k];
     in_cycle[m] = true;
     cycle_score += best_scores[m];
-    if (m != representative) (*disabled)[m] = true;
-  }
-
-  // Contract the cycle.
-  // 1) Update the score of each child to the maximum score achieved by a parent
-  // node in the cycle.
-  vector<int> best_heads_cycle(length);
+    cycle_penalty += best_penalties[m];
+    if (m != representative) disabled[m] = true;
+  }
+
+  // Save what is needed to undo the contraction.
+  int contraction = workspace->representatives.size();
+  workspace->representatives.push_back(representative);
+  workspace->representative_heads.push_back((*heads)[representative]);
+  workspace->cycle_offsets.push_back(workspace->cycle_nodes.size());
+  workspace->cycle_nodes.insert(workspace->cycle_nodes.end(),
+                                cycle.begin(), cycle.end());
+  workspace->best_heads_cycle.resize((contraction + 1) * length);
+  workspace->best_modifiers_cycle.resize((contraction + 1) * length);
+  int *best_heads_cycle = &workspace->best_heads_cycle[contraction * length];
+  int *best_modifiers_cycle =
+    &workspace->best_modifiers_cycle[contraction * length];
+  // The representative is appended to the candidate lists of the other
+  // nodes, after all the heads they already have.
+  int representative_order = workspace->order_offset + contraction;
+
+  // 1) Replace the heads of each node within the cycle by the representative,
+  // with the maximum score achieved by a head in the cycle.
   for (int m = 1; m < length; ++m) {
-    if ((*disabled)[m] || m == representative) continue;
-    double best_score;
-    // If the list of candidate parents of m is shorter than the length of
-    // the cycle, use that. Otherwise, loop through the cycle.
+    if (disabled[m] || m == representative) continue;
+    double *scores_m = &scores[m * length];
+    int *penalties_m = &penalties[m * length];
+    int *order_m = &order[m * length];
     int best = -1;
-    for (int k = 0; k < (*candidate_heads)[m].size(); ++k) {
-      if (!in_cycle[(*candidate_heads)[m][k]]) continue;
-      if (best < 0 || (*candidate_scores)[m][k] > best_score) {
-        best = k;
-        best_score = (*candidate_scores)[m][best];
+    double best_score;
+    int best_penalty;
+    for (int k = 0; k < cycle.size(); ++k) {
+      int h = cycle[k];
+      if (order_m[h] < 0) continue;
+      if (best < 0 ||
+          IsBetterHead(penalties_m[h], scores_m[h], best_penalty,
+                       best_score) ||
+          (penalties_m[h] == best_penalty && scores_m[h] == best_score &&
+           order_m[h] < order_m[best])) {
+        best = h;
+        best_score = scores_m[h];
+        best_penalty = penalties_m[h];
       }
     }
+    best_heads_cycle[m] = best;
     if (best < 0) continue;
-    best_heads_cycle[m] = (*candidate_heads)[m][best];
-
-    // Reconstruct the list of candidate heads for this m.
-    int l = 0;
-    for (int k = 0; k < (*candidate_heads)[m].size(); ++k) {
-      int h = (*candidate_heads)[m][k];
-      double score = (*candidate_scores)[m][k];
-      if (!in_cycle[h]) {
-        (*candidate_heads)[m][l] = h;
-        (*candidate_scores)[m][l] = score;
-        ++l;
-      }
-    }
-    // If h is in the cycle and is not the representative node,
-    // it will be dropped from the list of candidate heads.
-    (*candidate_heads)[m][l] = representative;
-    (*candidate_scores)[m][l] = best_score;
-    (*candidate_heads)[m].resize(l + 1);
-    (*candidate_scores)[m].resize(l + 1);
-  }
-
-  // 2) Update the score of each candidate parent of the cycle supernode.
-  vector<int> best_modifiers_cycle(length, -1);
-  vector<int> candidate_heads_representative;
-  vector<double> candidate_scores_representative;
-
-  vector<double> best_scores_cycle(length);
-  // Loop through the cycle.
-  for (int k = 0; k < cycle.size(); ++k) {
-    int m = cycle[k];
-    for (int l = 0; l < (*candidate_heads)[m].size(); ++l) {
-      // Get heads out of the cycle.
-      int h = (*candidate_heads)[m][l];
-      if (in_cycle[h]) continue;
+    for (int k = 0; k < cycle.size(); ++k) {
+      order_m[cycle[k]] = -1;
+    }
+    scores_m[representative] = best_score;
+    penalties_m[representative] = best_penalty;
+    order_m[representative] = representative_order;
+
+    // If the best head of m was in the cycle, it is now the representative,
+    // unless another head achieves the same score.
+    if (in_cycle[(*heads)[m]]) {
+      if (workspace->tied[m]) {
+        PickBestHead(workspace, m, heads);
+      } else {
+        (*heads)[m] = representative;
+      }
+    }
+  }
 
-      double score = (*candidate_scores)[m][l] - best_scores[m];
-      if (best_modifiers_cycle[h] < 0 || score > best_scores_cycle[h]) {
+  // 2) The candidate heads of the representative are the heads of the nodes
+  // in the cycle, scored by the gain of breaking the cycle at that node.
+  double *scores_representative = &scores[representative * length];
+  int *penalties_representative = &penalties[representative * length];
+  int *order_representative = &order[representative * length];
+  vector<double> &best_scores_cycle = workspace->best_scores_cycle;
+  vector<int> &best_penalties_cycle = workspace->best_penalties_cycle;
+  for (int h = 0; h < length; ++h) {
+    best_modifiers_cycle[h] = -1;
+    if (in_cycle[h]) {
+      order_representative[h] = -1;
+      continue;
+    }
+    for (int k = 0; k < cycle.size(); ++k) {
+      int m = cycle[k];
+      if (order[m * length + h] < 0) continue;
+      double score = scores[m * length + h] - best_scores[m];
+      int penalty = penalties[m * length + h] - best_penalties[m];
+      if (best_modifiers_cycle[h] < 0 ||
+          IsBetterHead(penalty, score, best_penalties_cycle[h],
+                       best_scores_cycle[h])) {
         best_modifiers_cycle[h] = m;
         best_scores_cycle[h] = score;
+        best_penalties_cycle[h] = penalty;
       }
     }
+    if (best_modifiers_cycle[h] < 0) {
+      order_representative[h] = -1;
+    } else {
+      scores_representative[h] = best_scores_cycle[h] + cycle_score;
+      penalties_representative[h] = best_penalties_cycle[h] + cycle_penalty;
+      order_representative[h] = h;
+    }
   }
-  for (int h = 0; h < length; ++h) {
-    if (best_modifiers_cycle[h] < 0) continue;
-    double best_score = best_scores_cycle[h] + cycle_score;
-    candidate_heads_representative.push_back(h);
-    candidate_scores_representative.push_back(best_score);
-  }
-
-  // Reconstruct the list of candidate heads for the representative node.
-  (*candidate_heads)[representative] = candidate_heads_representative;
-  (*candidate_scores)[representative] = candidate_scores_representative;
-
-  // Save the current head of the representative node (it will be overwritten).
-  int head_representative = (*heads)[representative];
+  PickBestHead(workspace, representative, heads);
 
-  // Call itself recursively.
-  RunChuLiuEdmondsIteration(disabled,
-                            candidate_heads,
-                            candidate_scores,
-                            heads,
-                            value);
+  for (int k = 0; k < cycle.size(); ++k) {
+    in_cycle[cycle[k]] = false;
+  }
+}
 
-  // Uncontract the cycle.
-  int h = (*heads)[representative];
-  (*heads)[representative] = head_representative;
-  (*heads)[best_modifiers_cycle[h]] = h;
+// Find a maximum weighted arborescence with Edmonds' algorithm. The best
+// head of each node is picked and the first cycle found is contracted, until
+// there are no cycles left; the contractions are then undone in reverse
+// order. With dense tables, this runs in O(n^2) (barring exact ties).
+void DependencyDecoder::RunChuLiuEdmondsContractions(
+    ChuLiuEdmondsWorkspace *workspace,
+    vector<int> *heads,
+    double *value) {
+  int length = workspace->length;
+  vector<bool> &disabled = workspace->disabled;
+
+  heads->assign(length, -1);
+  for (int m = 1; m < length; ++m) {
+    PickBestHead(workspace, m, heads);
+  }
+  while (FindCycle(workspace, *heads)) {
+    ContractCycle(workspace, heads);
+  }
 
+  *value = 0.0;
   for (int m = 1; m < length; ++m) {
-    if ((*disabled)[m]) continue;
-    if ((*heads)[m] == representative) {
-      // Get the right parent from within the cycle.
-      (*heads)[m] = best_heads_cycle[m];
+    if (!disabled[m]) *value += workspace->best_scores[m];
+  }
+
+  // Uncontract the cycles.
+  for (int c = workspace->representatives.size() - 1; c >= 0; --c) {
+    int representative = workspace->representatives[c];
+    const int *best_heads_cycle = &workspace->best_heads_cycle[c * length];
+    const int *best_modifiers_cycle =
+      &workspace->best_modifiers_cycle[c * length];
+    int h = (*heads)[representative];
+    (*heads)[representative] = workspace->representative_heads[c];
+    if (best_modifiers_cycle[h] >= 0) {
+      (*heads)[best_modifiers_cycle[h]] = h;
+    } else {
+      // No arc enters the cycle (no spanning tree exists).
+      (*heads)[representative] = 0;
+    }
+    for (int m = 1; m < length; ++m) {
+      if (disabled[m]) continue;
+      if ((*heads)[m] == representative) {
+        // Get the right parent from within the cycle.
+        (*heads)[m] = best_heads_cycle[m];
+      }
+    }
+    int end = (c + 1 < workspace->cycle_offsets.size()) ?
+      workspace->cycle_offsets[c + 1] : workspace->cycle_nodes.size();
+    for (int k = workspace->cycle_offsets[c]; k < end; ++k) {
+      disabled[workspace->cycle_nodes[k]] = false;
     }
-  }
-  for (int k = 0; k < cycle.size(); ++k) {
-    int m = cycle[k];
-    (*disabled)[m] = false;
   }
 }
 
@@ -609,109 +790,137 @@ void DependencyDecoder::RunChuLiuEdmonds(int sentence_length,
                                          const vector<double> &scores,
                                          vector<int> *heads,
                                          double *value) {
-  vector<vector<int> > candidate_heads(sentence_length);
-  vector<vector<double> > candidate_scores(sentence_length);
-  vector<bool> disabled(sentence_length, false);
+  ChuLiuEdmondsWorkspace *workspace = GetChuLiuEdmondsWorkspace();
+  workspace->Initialize(sentence_length, arcs, scores, false);
+  RunChuLiuEdmondsContractions(workspace, heads, value);
+}
+
+// Same as above, but the root has a single child (or as few children as
+// possible, if some words can only attach to the root). Every arc from the
+// root gets a penalty of -1, and candidate heads are compared by their total
+// penalty before their score: this is the usual trick of subtracting a large
+// constant from the root arcs, without any loss of precision.
+void DependencyDecoder::RunChuLiuEdmondsSingleRoot(
+    int sentence_length,
+    const vector<DependencyPartArc*> &arcs,
+    const vector<double> &scores,
+    vector<int> *heads,
+    double *value) {
+  ChuLiuEdmondsWorkspace *workspace = GetChuLiuEdmondsWorkspace();
+  workspace->Initialize(sentence_length, arcs, scores, true);
+  RunChuLiuEdmondsContractions(workspace, heads, value);
+}
+
+void EisnerWorkspace::Initialize(int sentence_length,
+                                 const vector<DependencyPartArc*> &arcs) {
+  length = sentence_length;
+  int size = sentence_length * sentence_length;
+  index_arcs.assign(size, -1);
   for (int r = 0; r < arcs.size(); ++r) {
     int h = arcs[r]->head();
     int m = arcs[r]->modifier();
-    candidate_heads[m].push_back(h);
-    candidate_scores[m].push_back(scores[r]);
-  }
+    index_arcs[h * sentence_length + m] = r;
+  }
+  complete.assign(size, 0.0);
+  complete_transposed.assign(size, 0.0);
+  incomplete.assign(size, -std::numeric_limits<double>::infinity());
+  splits.assign(size, -std::numeric_limits<double>::infinity());
+  complete_backtrack.assign(size, -1);
+  incomplete_backtrack.assign(size, -1);
+  sums.resize(sentence_length);
+}
 
-  heads->assign(sentence_length, -1);
-  RunChuLiuEdmondsIteration(&disabled, &candidate_heads,
-                            &candidate_scores, heads, value);
+// Get the Eisner tables of the calling thread (the decoder may be shared by
+// several threads, e.g. when decoding a mini-batch in parallel).
+static EisnerWorkspace *GetEisnerWorkspace() {
+  static thread_local EisnerWorkspace workspace;
+  return &workspace;
+}
+
+// Return the first split point u in [begin, end) such that the arc h -> u
+// exists, or -1 if there is none. This is the split point picked by Eisner's
+// algorithm when every candidate of a complete span has score -infinity.
+static int FindFirstArc(const EisnerWorkspace &workspace, int h, int begin,
+                        int end) {
+  const int *index_arcs = &workspace.index_arcs[h * workspace.length];
+  for (int u = begin; u < end; ++u) {
+    if (index_arcs[u] >= 0) return u;
+  }
+  return -1;
 }
 
 // Run Eisner's algorithm for finding a maximal weighted projective dependency
-// tree.
+// tree. The tables live in a per-thread EisnerWorkspace, and the loop over the
+// split points of each span is a max over the sums of two contiguous rows.
 void DependencyDecoder::RunEisner(int sentence_length,
                                   const vector<DependencyPartArc*> &arcs,
                                   const vector<double> &scores,
                                   vector<int> *heads,
                                   double *value) {
-  vector<vector<int> > index_arcs(sentence_length,
-                                  vector<int>(sentence_length, -1));
-  int num_arcs = arcs.size();
-  for (int r = 0; r < num_arcs; ++r) {
-    int h = arcs[r]->head();
-    int m = arcs[r]->modifier();
-    index_arcs[h][m] = r;
-  }
+  EisnerWorkspace *workspace = GetEisnerWorkspace();
+  workspace->Initialize(sentence_length, arcs);
+  int n = sentence_length;
+  const int *index_arcs = workspace->index_arcs.data();
+  double *complete = workspace->complete.data();
+  double *complete_transposed = workspace->complete_transposed.data();
+  double *incomplete = workspace->incomplete.data();
+  int *complete_backtrack = workspace->complete_backtrack.data();
+  int *incomplete_backtrack = workspace->incomplete_backtrack.data();
+  double *sums = workspace->sums.data();
 
   heads->assign(sentence_length, -1);
 
-  // Initialize CKY table.
-  vector<vector<double> > complete_spans(sentence_length, vector<double>(
-    sentence_length, 0.0));
-  vector<vector<int> > complete_backtrack(sentence_length,
-                                          vector<int>(sentence_length, -1));
-  vector<double> incomplete_spans(num_arcs);
-  vector<int> incomplete_backtrack(num_arcs, -1);
-
   // Loop from smaller items to larger items.
   for (int k = 1; k < sentence_length; ++k) {
     for (int s = 1; s < sentence_length - k; ++s) {
       int t = s + k;
 
-      // First, create incomplete items.
-      int left_arc_index = index_arcs[t][s];
-      int right_arc_index = index_arcs[s][t];
+      // First, create incomplete items, maximizing
+      // complete[s][u] + complete[t][u + 1] over s <= u < t.
+      int left_arc_index = index_arcs[t * n + s];
+      int right_arc_index = index_arcs[s * n + t];
       if (left_arc_index >= 0 || right_arc_index >= 0) {
-        double best_value = -std::numeric_limits<double>::infinity();
-        int best = -1;
-        for (int u = s; u < t; ++u) {
-          double val = complete_spans[s][u] + complete_spans[t][u + 1];
-          if (best < 0 || val > best_value) {
-            best = u;
-            best_value = val;
-          }
-        }
+        double best_value = ComputeSumsAndMax(&complete[s * n + s],
+                                              &complete[t * n + s + 1],
+                                              k, sums);
+        int best = s + FindFirst(sums, k, best_value);
         if (left_arc_index >= 0) {
-          incomplete_spans[left_arc_index] =
-            best_value + scores[left_arc_index];
-          incomplete_backtrack[left_arc_index] = best;
+          incomplete[t * n + s] = best_value + scores[left_arc_index];
+          incomplete_backtrack[t * n + s] = best;
         }
         if (right_arc_index >= 0) {
-          incomplete_spans[right_arc_index] =
-            best_value + scores[right_arc_index];
-          incomplete_backtrack[right_arc_index] = best;
+          incomplete[s * n + t] = best_value + scores[right_arc_index];
+          incomplete_backtrack[s * n + t] = best;
         }
       }
 
       // Second, create complete items.
-      // 1) Left complete item.
-      double best_value = -std::numeric_limits<double>::infinity();
-      int best = -1;
-      for (int u = s; u < t; ++u) {
-        int left_arc_index = index_arcs[t][u];
-        if (left_arc_index >= 0) {
-          double val = complete_spans[u][s] + incomplete_spans[left_arc_index];
-          if (best < 0 || val > best_value) {
-            best = u;
-            best_value = val;
-          }
-        }
-      }
-      complete_spans[t][s] = best_value;
-      complete_backtrack[t][s] = best;
-
-      // 2) Right complete item.
-      best_value = -std::numeric_limits<double>::infinity();
-      best = -1;
-      for (int u = s + 1; u <= t; ++u) {
-        int right_arc_index = index_arcs[s][u];
-        if (right_arc_index >= 0) {
-          double val = complete_spans[u][t] + incomplete_spans[right_arc_index];
-          if (best < 0 || val > best_value) {
-            best = u;
-            best_value = val;
-          }
-        }
+      // 1) Left complete item, maximizing
+      // complete[u][s] + incomplete[t][u] over s <= u < t.
+      double best_value = ComputeSumsAndMax(&complete_transposed[s * n + s],
+                                            &incomplete[t * n + s], k, sums);
+      int best;
+      if (best_value == -std::numeric_limits<double>::infinity()) {
+        best = FindFirstArc(*workspace, t, s, t);
+      } else {
+        best = s + FindFirst(sums, k, best_value);
+      }
+      complete[t * n + s] = best_value;
+      complete_transposed[s * n + t] = best_value;
+      complete_backtrack[t * n + s] = best;
+
+      // 2) Right complete item, maximizing
+      // complete[u][t] + incomplete[s][u] over s < u <= t.
+      best_value = ComputeSumsAndMax(&complete_transposed[t * n + s + 1],
+                                     &incomplete[s * n + s + 1], k, sums);
+      if (best_value == -std::numeric_limits<double>::infinity()) {
+        best = FindFirstArc(*workspace, s, s + 1, t + 1);
+      } else {
+        best = s + 1 + FindFirst(sums, k, best_value);
       }
-      complete_spans[s][t] = best_value;
-      complete_backtrack[s][t] = best;
+      complete[s * n + t] = best_value;
+      complete_transposed[t * n + s] = best_value;
+      complete_backtrack[s * n + t] = best;
     }
   }
 
@@ -719,9 +928,9 @@ void DependencyDecoder::RunEisner(int sentence_length,
   double best_value = -std::numeric_limits<double>::infinity();
   int best = -1;
   for (int s = 1; s < sentence_length; ++s) {
-    int arc_index = index_arcs[0][s];
+    int arc_index = index_arcs[s];
     if (arc_index >= 0) {
-      double val = complete_spans[s][1] + complete_spans[s][sentence_length - 1] +
+      double val = complete[s * n + 1] + complete[s * n + sentence_length - 1] +
         scores[arc_index];
       if (best < 0 || val > best_value) {
         best = s;
@@ -734,280 +943,209 @@ void DependencyDecoder::RunEisner(int sentence_length,
   (*heads)[best] = 0;
 
   // Backtrack.
-  RunEisnerBacktrack(incomplete_backtrack, complete_backtrack, index_arcs, best,
-                     1, true, heads);
-  RunEisnerBacktrack(incomplete_backtrack, complete_backtrack, index_arcs, best,
-                     sentence_length - 1, true, heads);
-
-  //*value = complete_spans[0][sentence_length-1];
-  //RunEisnerBacktrack(incomplete_backtrack, complete_backtrack, index_arcs, 0,
-  //                   sentence_length-1, true, heads);
+  RunEisnerBacktrack(*workspace, best, 1, true, heads);
+  RunEisnerBacktrack(*workspace, best, sentence_length - 1, true, heads);
 }
 
-void DependencyDecoder::RunEisnerBacktrack(
-  const vector<int> &incomplete_backtrack,
-  const vector<vector<int> > &complete_backtrack,
-  const vector<vector<int> > &index_arcs,
-  int h, int m, bool complete, vector<int> *heads) {
+void DependencyDecoder::RunEisnerBacktrack(const EisnerWorkspace &workspace,
+                                           int h, int m, bool complete,
+                                           vector<int> *heads) {
   if (h == m) return;
+  int n = workspace.length;
+  CHECK_GE(h, 0);
+  CHECK_LT(h, n);
+  CHECK_GE(m, 0);
+  CHECK_LT(m, n);
   if (complete) {
-    CHECK_GE(h, 0);
-    CHECK_LT(h, complete_backtrack.size());
-    CHECK_GE(m, 0);
-    CHECK_LT(m, complete_backtrack.size());
-    int u = complete_backtrack[h][m];
+    int u = workspace.complete_backtrack[h * n + m];
     CHECK_GE(u, 0) << h << " " << m;
-    RunEisnerBacktrack(incomplete_backtrack, complete_backtrack, index_arcs,
-                       h, u, false, heads);
-    RunEisnerBacktrack(incomplete_backtrack, complete_backtrack, index_arcs,
-                       u, m, true, heads);
+    RunEisnerBacktrack(workspace, h, u, false, heads);
+    RunEisnerBacktrack(workspace, u, m, true, heads);
   } else {
-    int r = index_arcs[h][m];
-    CHECK_GE(r, 0);
-    CHECK_LT(r, incomplete_backtrack.size());
-    CHECK_GE(h, 0);
-    CHECK_LT(h, heads->size());
-    CHECK_GE(m, 0);
-    CHECK_LT(m, heads->size());
+    CHECK_GE(workspace.index_arcs[h * n + m], 0);
     (*heads)[m] = h;
-    int u = incomplete_backtrack[r];
+    int u = workspace.incomplete_backtrack[h * n + m];
     if (h < m) {
-      RunEisnerBacktrack(incomplete_backtrack, complete_backtrack, index_arcs,
-                         h, u, true, heads);
-      RunEisnerBacktrack(incomplete_backtrack, complete_backtrack, index_arcs,
-                         m, u + 1, true, heads);
+      RunEisnerBacktrack(workspace, h, u, true, heads);
+      RunEisnerBacktrack(workspace, m, u + 1, true, heads);
     } else {
-      RunEisnerBacktrack(incomplete_backtrack, complete_backtrack, index_arcs,
-                         m, u, true, heads);
-      RunEisnerBacktrack(incomplete_backtrack, complete_backtrack, index_arcs,
-                         h, u + 1, true, heads);
+      RunEisnerBacktrack(workspace, m, u, true, heads);
+      RunEisnerBacktrack(workspace, h, u + 1, true, heads);
     }
   }
 }
 
 // Run Eisner's inside algorithm (used to evaluate the log-partition function
-// and compute marginals in a projective model).
-void DependencyDecoder::RunEisnerInside(
-  int sentence_length,
-  const vector<DependencyPartArc*> &arcs,
-  const vector<double> &scores,
-  vector<double> *inside_incomplete_spans,
-  vector<vector<double> > *inside_complete_spans,
-  double *log_partition_function) {
-  vector<vector<int> > index_arcs(sentence_length,
-                                  vector<int>(sentence_length, -1));
-  int num_arcs = arcs.size();
-  for (int r = 0; r < num_arcs; ++r) {
-    int h = arcs[r]->head();
-    int m = arcs[r]->modifier();
-    index_arcs[h][m] = r;
-  }
-
-  // Initialize CKY table.
-  inside_incomplete_spans->assign(num_arcs, 0.0);
-  inside_complete_spans->resize(sentence_length);
-  for (int s = 0; s < sentence_length; ++s) {
-    (*inside_complete_spans)[s].assign(sentence_length, 0.0);
-  }
+// and compute marginals in a projective model). This has the same structure
+// as RunEisner, with a log-sum-exp in place of each max. The workspace must
+// have been initialized for the sentence.
+void DependencyDecoder::RunEisnerInside(const vector<double> &scores,
+                                        EisnerWorkspace *workspace,
+                                        double *log_partition_function) {
+  int n = workspace->length;
+  const int *index_arcs = workspace->index_arcs.data();
+  double *complete = workspace->complete.data();
+  double *complete_transposed = workspace->complete_transposed.data();
+  double *incomplete = workspace->incomplete.data();
+  double *splits = workspace->splits.data();
+  double *sums = workspace->sums.data();
 
   // Loop from smaller items to larger items.
-  for (int k = 1; k < sentence_length; ++k) {
-    for (int s = 1; s < sentence_length - k; ++s) {
+  for (int k = 1; k < n; ++k) {
+    for (int s = 1; s < n - k; ++s) {
       int t = s + k;
 
       // First, create incomplete items.
-      int left_arc_index = index_arcs[t][s];
-      int right_arc_index = index_arcs[s][t];
+      int left_arc_index = index_arcs[t * n + s];
+      int right_arc_index = index_arcs[s * n + t];
       if (left_arc_index >= 0 || right_arc_index >= 0) {
-        LogValD sum = LogValD::Zero();
-        for (int u = s; u < t; ++u) {
-          double val =
-            (*inside_complete_spans)[s][u] + (*inside_complete_spans)[t][u + 1];
-          sum += LogValD(val, false);
-        }
+        double value = LogSumExpOfSums(&complete[s * n + s],
+                                       &complete[t * n + s + 1], k, sums);
+        splits[s * n + t] = value;
         if (left_arc_index >= 0) {
-          (*inside_incomplete_spans)[left_arc_index] =
-            sum.logabs() + scores[left_arc_index];
+          incomplete[t * n + s] = value + scores[left_arc_index];
         }
         if (right_arc_index >= 0) {
-          (*inside_incomplete_spans)[right_arc_index] =
-            sum.logabs() + scores[right_arc_index];
+          incomplete[s * n + t] = value + scores[right_arc_index];
         }
       }
 
       // Second, create complete items.
       // 1) Left complete item.
-      LogValD sum = LogValD::Zero();
-      for (int u = s; u < t; ++u) {
-        int left_arc_index = index_arcs[t][u];
-        if (left_arc_index >= 0) {
-          double val = (*inside_complete_spans)[u][s] +
-            (*inside_incomplete_spans)[left_arc_index];
-          sum += LogValD(val, false);
-        }
-      }
-      (*inside_complete_spans)[t][s] = sum.logabs();
-      //LOG(INFO) << "inside_complete[" << t << "][" << s << "] = " << (*inside_complete_spans)[t][s];
+      double value = LogSumExpOfSums(&complete_transposed[s * n + s],
+                                     &incomplete[t * n + s], k, sums);
+      complete[t * n + s] = value;
+      complete_transposed[s * n + t] = value;
 
       // 2) Right complete item.
-      sum = LogValD::Zero();
-      for (int u = s + 1; u <= t; ++u) {
-        int right_arc_index = index_arcs[s][u];
-        if (right_arc_index >= 0) {
-          double val = (*inside_complete_spans)[u][t] +
-            (*inside_incomplete_spans)[right_arc_index];
-          sum += LogValD(val, false);
-        }
-      }
-      (*inside_complete_spans)[s][t] = sum.logabs();
-      //LOG(INFO) << "inside_complete[" << s << "][" << t << "] = " << (*inside_complete_spans)[s][t];
+      value = LogSumExpOfSums(&complete_transposed[t * n + s + 1],
+                              &incomplete[s * n + s + 1], k, sums);
+      complete[s * n + t] = value;
+      complete_transposed[t * n + s] = value;
     }
   }
 
   // Handle the (single) root.
-  LogValD sum = LogValD::Zero();
-  for (int s = 1; s < sentence_length; ++s) {
-    int arc_index = index_arcs[0][s];
+  int num_roots = 0;
+  double max_value = -std::numeric_limits<double>::infinity();
+  for (int s = 1; s < n; ++s) {
+    int arc_index = index_arcs[s];
     if (arc_index >= 0) {
-      (*inside_incomplete_spans)[arc_index] = (*inside_complete_spans)[s][1] +
-        scores[arc_index];
-      double val = (*inside_incomplete_spans)[arc_index] +
-        (*inside_complete_spans)[s][sentence_length - 1];
-      sum += LogValD(val, false);
+      incomplete[s] = complete[s * n + 1] + scores[arc_index];
+      double val = incomplete[s] + complete[s * n + n - 1];
+      sums[num_roots] = val;
+      ++num_roots;
+      if (val > max_value) max_value = val;
     }
   }
-  (*inside_complete_spans)[0][sentence_length - 1] = sum.logabs();
-  //LOG(INFO) << "inside_complete[" << 0 << "][" << sentence_length-1 << "] = " << (*inside_complete_spans)[0][sentence_length-1];
-
-  *log_partition_function = (*inside_complete_spans)[0][sentence_length - 1];
+  complete[n - 1] = LogSumExp(sums, num_roots, max_value);
+  *log_partition_function = complete[n - 1];
 }
 
-// Run Eisner's inside algorithm (used to evaluate the log-partition function
-// and compute marginals in a projective model).
-void DependencyDecoder::RunEisnerOutside(
-  int sentence_length,
-  const vector<DependencyPartArc*> &arcs,
-  const vector<double> &scores,
-  const vector<double> &inside_incomplete_spans,
-  const vector<vector<double> > &inside_complete_spans,
-  vector<double> *outside_incomplete_spans,
-  vector<vector<double> > *outside_complete_spans) {
-  vector<vector<int> > index_arcs(sentence_length,
-                                  vector<int>(sentence_length, -1));
-  int num_arcs = arcs.size();
-  for (int r = 0; r < num_arcs; ++r) {
-    int h = arcs[r]->head();
-    int m = arcs[r]->modifier();
-    index_arcs[h][m] = r;
-  }
-
-  // Initialize CKY table.
-  outside_incomplete_spans->assign(num_arcs, 0.0);
-  outside_complete_spans->resize(sentence_length);
-  for (int s = 0; s < sentence_length; ++s) {
-    (*outside_complete_spans)[s].assign(sentence_length, 0.0);
-  }
+// Run Eisner's outside algorithm, computing the marginal of each arc. Rather
+// than outside scores in log space, this propagates the outside weights
+// (expected counts) of the items from larger to smaller spans, i.e. the
+// gradient of the log-partition function with respect to the inside scores:
+// each term of a sum gets the weight of the item times its share
+// exp(term - item), which stays in [0, 1] and needs no logarithms. The
+// marginal of an arc is the weight of its incomplete item.
+void DependencyDecoder::RunEisnerOutside(const vector<double> &scores,
+                                         double log_partition_function,
+                                         EisnerWorkspace *workspace,
+                                         vector<double> *marginals) {
+  int n = workspace->length;
+  int size = n * n;
+  workspace->complete_adjoints.assign(size, 0.0);
+  workspace->complete_transposed_adjoints.assign(size, 0.0);
+  workspace->incomplete_adjoints.assign(size, 0.0);
+  const int *index_arcs = workspace->index_arcs.data();
+  const double *complete = workspace->complete.data();
+  const double *complete_transposed = workspace->complete_transposed.data();
+  const double *incomplete = workspace->incomplete.data();
+  const double *splits = workspace->splits.data();
+  double *complete_adjoints = workspace->complete_adjoints.data();
+  double *complete_transposed_adjoints =
+    workspace->complete_transposed_adjoints.data();
+  double *incomplete_adjoints = workspace->incomplete_adjoints.data();
+
+  marginals->assign(scores.size(), 0.0);
 
   // Handle the root.
-  for (int s = 1; s < sentence_length; ++s) {
-    int arc_index = index_arcs[0][s];
+  for (int s = 1; s < n; ++s) {
+    int arc_index = index_arcs[s];
     if (arc_index >= 0) {
-      (*outside_incomplete_spans)[arc_index] =
-        (*outside_complete_spans)[0][sentence_length - 1] +
-        inside_complete_spans[s][sentence_length - 1];
+      double weight = exp(incomplete[s] + complete[s * n + n - 1] -
+                          log_partition_function);
+      (*marginals)[arc_index] = weight;
+      complete_adjoints[s * n + 1] += weight;
+      complete_adjoints[s * n + n - 1] += weight;
     }
   }
 
   // Loop from larger items to smaller items.
-  for (int k = sentence_length - 2; k > 0; --k) {
-    for (int s = 1; s < sentence_length - k; ++s) {
+  for (int k = n - 2; k > 0; --k) {
+    for (int s = 1; s < n - k; ++s) {
       int t = s + k;
 
-      // First, create complete items.
-      // 1) Left complete item.
-      LogValD sum = LogValD::Zero();
-      for (int u = 0; u < s; ++u) {
-        if (u == 0 && t < sentence_length - 1) continue;
-        int arc_index = index_arcs[u][s];
-        if (arc_index >= 0) {
-          double val = (*outside_complete_spans)[u][t] +
-            inside_incomplete_spans[arc_index];
-          sum += LogValD(val, false);
+      // First, complete items.
+      // 1) Right complete item (sum over s < u <= t).
+      double weight = complete_adjoints[s * n + t] +
+        complete_transposed_adjoints[t * n + s];
+      double value = complete[s * n + t];
+      if (weight != 0.0 &&
+          value != -std::numeric_limits<double>::infinity()) {
+        const double *a = &complete_transposed[t * n + s + 1];
+        const double *b = &incomplete[s * n + s + 1];
+        double *a_adjoints = &complete_transposed_adjoints[t * n + s + 1];
+        double *b_adjoints = &incomplete_adjoints[s * n + s + 1];
+        for (int i = 0; i < k; ++i) {
+          double share = weight * exp(a[i] + b[i] - value);
+          a_adjoints[i] += share;
+          b_adjoints[i] += share;
         }
       }
-      for (int u = t + 1; u < sentence_length; ++u) {
-        int left_arc_index = index_arcs[u][s];
-        int right_arc_index = index_arcs[s][u];
-        if (right_arc_index >= 0) {
-          double val = (*outside_incomplete_spans)[right_arc_index] +
-            inside_complete_spans[u][t + 1] + scores[right_arc_index];
-          sum += LogValD(val, false);
-        }
-        if (left_arc_index >= 0) {
-          double val = (*outside_incomplete_spans)[left_arc_index] +
-            inside_complete_spans[u][t + 1] + scores[left_arc_index];
-          sum += LogValD(val, false);
-        }
-      }
-      (*outside_complete_spans)[s][t] = sum.logabs();
 
-      // 2) Right complete item.
-      sum = LogValD::Zero();
-      for (int u = t + 1; u < sentence_length; ++u) {
-        int arc_index = index_arcs[u][t];
-        if (arc_index >= 0) {
-          double val = (*outside_complete_spans)[u][s] +
-            inside_incomplete_spans[arc_index];
-          sum += LogValD(val, false);
+      // 2) Left complete item (sum over s <= u < t).
+      weight = complete_adjoints[t * n + s] +
+        complete_transposed_adjoints[s * n + t];
+      value = complete[t * n + s];
+      if (weight != 0.0 &&
+          value != -std::numeric_limits<double>::infinity()) {
+        const double *a = &complete_transposed[s * n + s];
+        const double *b = &incomplete[t * n + s];
+        double *a_adjoints = &complete_transposed_adjoints[s * n + s];
+        double *b_adjoints = &incomplete_adjoints[t * n + s];
+        for (int i = 0; i < k; ++i) {
+          double share = weight * exp(a[i] + b[i] - value);
+          a_adjoints[i] += share;
+          b_adjoints[i] += share;
         }
       }
-      for (int u = 0; u < s; ++u) {
-        if (u == 0 && s > 1) continue;
-        if (u == 0) {
-          // Must have s = 1.
-          int right_arc_index = index_arcs[u][t];
-          if (right_arc_index >= 0) {
-            double val = (*outside_incomplete_spans)[right_arc_index] +
-              scores[right_arc_index];
-            sum += LogValD(val, false);
-          }
-        } else {
-          int left_arc_index = index_arcs[t][u];
-          int right_arc_index = index_arcs[u][t];
-          if (right_arc_index >= 0) {
-            double val = (*outside_incomplete_spans)[right_arc_index] +
-              inside_complete_spans[u][s - 1] + scores[right_arc_index];
-            sum += LogValD(val, false);
-          }
-          if (left_arc_index >= 0) {
-            double val = (*outside_incomplete_spans)[left_arc_index] +
-              inside_complete_spans[u][s - 1] + scores[left_arc_index];
-            sum += LogValD(val, false);
-          }
-        }
-      }
-      (*outside_complete_spans)[t][s] = sum.logabs();
 
-      // Second, create incomplete items.
-      int left_arc_index = index_arcs[t][s];
-      int right_arc_index = index_arcs[s][t];
-      if (right_arc_index >= 0) {
-        LogValD sum = LogValD::Zero();
-        for (int u = t; u < sentence_length; ++u) {
-          double val =
-            (*outside_complete_spans)[s][u] + inside_complete_spans[t][u];
-          sum += LogValD(val, false);
-        }
-        (*outside_incomplete_spans)[right_arc_index] = sum.logabs();
-      }
+      // Second, incomplete items (sum over s <= u < t).
+      int left_arc_index = index_arcs[t * n + s];
+      int right_arc_index = index_arcs[s * n + t];
+      weight = 0.0;
       if (left_arc_index >= 0) {
-        LogValD sum = LogValD::Zero();
-        for (int u = 1; u <= s; ++u) {
-          double val =
-            (*outside_complete_spans)[t][u] + inside_complete_spans[s][u];
-          sum += LogValD(val, false);
+        (*marginals)[left_arc_index] = incomplete_adjoints[t * n + s];
+        weight += incomplete_adjoints[t * n + s];
+      }
+      if (right_arc_index >= 0) {
+        (*marginals)[right_arc_index] = incomplete_adjoints[s * n + t];
+        weight += incomplete_adjoints[s * n + t];
+      }
+      value = splits[s * n + t];
+      if (weight != 0.0 &&
+          value != -std::numeric_limits<double>::infinity()) {
+        const double *a = &complete[s * n + s];
+        const double *b = &complete[t * n + s + 1];
+        double *a_adjoints = &complete_adjoints[s * n + s];
+        double *b_adjoints = &complete_adjoints[t * n + s + 1];
+        for (int i = 0; i < k; ++i) {
+          double share = weight * exp(a[i] + b[i] - value);
+          a_adjoints[i] += share;
+          b_adjoints[i] += share;
         }
-        (*outside_incomplete_spans)[left_arc_index] = sum.logabs();
       }
     }
   }
@@ -1033,35 +1171,18 @@ void DependencyDecoder::DecodeInsideOutside(Instance *instance, Parts *parts,
     scores_arcs[r] = scores[offset_arcs + r];
   }
 
-  vector<double> inside_incomplete_spans;
-  vector<vector<double> > inside_complete_spans;
-  vector<double> outside_incomplete_spans;
-  vector<vector<double> > outside_complete_spans;
+  vector<double> marginals;
+  RunEisnerMarginals(sentence_length, arcs, scores_arcs, &marginals,
+                     log_partition_function);
 
-  RunEisnerInside(sentence_length, arcs, scores_arcs, &inside_incomplete_spans,
-                  &inside_complete_spans, log_partition_function);
-
-  RunEisnerOutside(sentence_length, arcs, scores_arcs, inside_incomplete_spans,
-                   inside_complete_spans, &outside_incomplete_spans,
-                   &outside_complete_spans);
-
-  // Compute the marginals and entropy.
+  // Compute the entropy.
   predicted_output->resize(parts->size());
   *entropy = *log_partition_function;
 
   //LOG(INFO) << "logZ = " << *log_partition_function;
 
   for (int r = 0; r < num_arcs; ++r) {
-    int h = static_cast<DependencyPartArc*>((*parts)[offset_arcs + r])->head();
-    int m = static_cast<DependencyPartArc*>((*parts)[offset_arcs + r])->modifier();
-    double value = exp(inside_incomplete_spans[r] +
-                       outside_incomplete_spans[r] -
-                       (*log_partition_function));
-
-    //LOG(INFO) << "inside[" << h << "][" << m << "] = " << inside_incomplete_spans[r];
-    //LOG(INFO) << "outside[" << h << "][" << m << "] = " << outside_incomplete_spans[r];
-    //LOG(INFO) << "Score arc[" << h << "][" << m << "] = " << scores[offset_arcs + r];
-    //LOG(INFO) << "Marginal arc[" << h << "][" << m << "] = " << value;
+    double value = marginals[r];
     if (value > 1.0) {
       if (!NEARLY_ZERO_TOL(value - 1.0, 1e-6)) {
         LOG(INFO) << "Marginals truncated to one (" << value << ")";
@@ -1077,19 +1198,294 @@ void DependencyDecoder::DecodeInsideOutside(Instance *instance, Parts *parts,
     }
     *entropy = 0.0;
   }
+}
 
-#if 0
-  vector<double> sum(sentence_length, 0.0);
-  for (int r = 0; r < num_arcs; ++r) {
-    int h = static_cast<DependencyPartArc*>((*parts)[offset_arcs + r])->head();
-    int m = static_cast<DependencyPartArc*>((*parts)[offset_arcs + r])->modifier();
-    sum[m] += (*predicted_output)[offset_arcs + r];
-    if (h == 0) sum[0] += (*predicted_output)[offset_arcs + r];
+// Run Eisner's inside-outside algorithm for computing the marginal of each arc
+// and the log-partition function of a projective model.
+void DependencyDecoder::RunEisnerMarginals(
+  int sentence_length,
+  const vector<DependencyPartArc*> &arcs,
+  const vector<double> &scores,
+  vector<double> *marginals,
+  double *log_partition_function) {
+  EisnerWorkspace *workspace = GetEisnerWorkspace();
+  workspace->Initialize(sentence_length, arcs);
+  RunEisnerInside(scores, workspace, log_partition_function);
+  RunEisnerOutside(scores, *log_partition_function, workspace, marginals);
+}
+
+void SecondOrderWorkspace::Initialize(int sentence_length,
+                                      bool grandparents) {
+  length = sentence_length;
+  use_grandparents = grandparents;
+  int n = sentence_length;
+  int size = (use_grandparents ? n : 1) * n * n;
+  arc_scores.assign(n * n, -std::numeric_limits<double>::infinity());
+  sibling_scores.assign(n * n * (n + 2), 0.0);
+  if (use_grandparents) {
+    grandparent_scores.assign(n * n * n, 0.0);
+  } else {
+    grandparent_scores.clear();
+  }
+  complete.assign(size, -std::numeric_limits<double>::infinity());
+  incomplete.assign(size, -std::numeric_limits<double>::infinity());
+  siblings.assign(size, -std::numeric_limits<double>::infinity());
+  complete_backtrack.assign(size, -1);
+  incomplete_backtrack.assign(size, -1);
+  siblings_backtrack.assign(size, -1);
+  partial_scores.resize(n);
+  sums.resize(n);
+}
+
+// Get the second-order tables of the calling thread.
+static SecondOrderWorkspace *GetSecondOrderWorkspace() {
+  static thread_local SecondOrderWorkspace workspace;
+  return &workspace;
+}
+
+static void BacktrackSecondOrderIncomplete(
+  const SecondOrderWorkspace &workspace, int g, int h, int m,
+  vector<int> *heads);
+
+// Recover the heads within the complete span [h][e] whose head has parent g.
+static void BacktrackSecondOrderComplete(const SecondOrderWorkspace &workspace,
+                                         int g, int h, int e,
+                                         vector<int> *heads) {
+  if (h == e) return;
+  int m = workspace.complete_backtrack[workspace.Span(g, h, e)];
+  BacktrackSecondOrderIncomplete(workspace, g, h, m, heads);
+  BacktrackSecondOrderComplete(workspace, h, m, e, heads);
+}
+
+// Recover the heads within the span of the arc h -> m, where h has parent g.
+static void BacktrackSecondOrderIncomplete(
+  const SecondOrderWorkspace &workspace, int g, int h, int m,
+  vector<int> *heads) {
+  (*heads)[m] = h;
+  int previous = workspace.incomplete_backtrack[workspace.Span(g, h, m)];
+  if (previous == h) {
+    // m is the innermost child of h on its side.
+    BacktrackSecondOrderComplete(workspace, h, m, (h < m) ? h + 1 : h - 1,
+                                 heads);
+    return;
   }
-  for (int m = 1; m < sentence_length; ++m) {
-    LOG(INFO) << "Sum " << m << " = " << sum[m];
+  BacktrackSecondOrderIncomplete(workspace, g, h, previous, heads);
+  int a = std::min(previous, m);
+  int b = std::max(previous, m);
+  int r = workspace.siblings_backtrack[workspace.Span(h, a, b)];
+  BacktrackSecondOrderComplete(workspace, h, a, r, heads);
+  BacktrackSecondOrderComplete(workspace, h, b, r + 1, heads);
 }
-#endif
+
+// Run the second-order extension of Eisner's algorithm (Koo and Collins,
+// 2010) for finding the best projective tree under arc, consecutive sibling
+// and grandparent scores. As in RunEisner, the root has a single child.
+// Every span is computed for all the possible parents g of its head, i.e.,
+// all the nodes out of the span; the terms that do not depend on g are
+// computed first, so that the loops over the split points are plain sums of
+// two rows. This takes O(n^4) time (O(n^3) without grandparents).
+void DependencyDecoder::RunSecondOrderEisner(SecondOrderWorkspace *workspace,
+                                             vector<int> *heads,
+                                             double *value) {
+  int n = workspace->length;
+  bool use_grandparents = workspace->use_grandparents;
+  int num_parents = use_grandparents ? n : 1;
+  const double *arc_scores = workspace->arc_scores.data();
+  const double *sibling_scores = workspace->sibling_scores.data();
+  const double *grandparent_scores = workspace->grandparent_scores.data();
+  double *complete = workspace->complete.data();
+  double *incomplete = workspace->incomplete.data();
+  double *siblings = workspace->siblings.data();
+  int *complete_backtrack = workspace->complete_backtrack.data();
+  int *incomplete_backtrack = workspace->incomplete_backtrack.data();
+  int *siblings_backtrack = workspace->siblings_backtrack.data();
+  double *partial_scores = workspace->partial_scores.data();
+  double *sums = workspace->sums.data();
+
+  // A node with no right children.
+  for (int g = 0; g < num_parents; ++g) {
+    for (int h = 1; h < n; ++h) {
+      complete[workspace->Span(g, h, h)] =
+        sibling_scores[workspace->Sibling(h, h, n)];
+    }
+  }
+
+  // Loop from smaller items to larger items.
+  for (int k = 1; k < n - 1; ++k) {
+    for (int s = 1; s < n - k; ++s) {
+      int t = s + k;
+
+      // First, create the items between two consecutive children s and t of
+      // some node p, maximizing complete[p][s][u] + complete[p][t][u + 1]
+      // over s <= u < t.
+      for (int p = 0; p < num_parents; ++p) {
+        if (use_grandparents && p == s) {
+          p = t;
+          continue;
+        }
+        // The root has a single child.
+        if (use_grandparents && p == 0) continue;
+        double best_value = -std::numeric_limits<double>::infinity();
+        int best = -1;
+        if (k > 1) {
+          best_value = ComputeSumsAndMax(&complete[workspace->Span(p, s, s)],
+                                         &complete[workspace->Span(p, t,
+                                                                   s + 1)],
+                                         k - 1, sums);
+          best = s + FindFirst(sums, k - 1, best_value);
+        }
+        // t has no left children.
+        double last_value = complete[workspace->Span(p, s, t - 1)] +
+          sibling_scores[workspace->Sibling(t, t, -1)];
+        if (best < 0 || last_value > best_value) {
+          best_value = last_value;
+          best = t - 1;
+        }
+        siblings[workspace->Span(p, s, t)] = best_value;
+        siblings_backtrack[workspace->Span(p, s, t)] = best;
+      }
+
+      // Second, create incomplete items, where the previous child of the head
+      // (if any) is the one that maximizes the score.
+      // 1) Right incomplete item, for the arc s -> t.
+      double arc_score = arc_scores[s * n + t];
+      if (arc_score != -std::numeric_limits<double>::infinity()) {
+        for (int m = s + 1; m < t; ++m) {
+          partial_scores[m - s - 1] = siblings[workspace->Span(s, m, t)] +
+            sibling_scores[workspace->Sibling(s, m, t)];
+        }
+        double first_value = sibling_scores[workspace->Sibling(s, s, t)] +
+          ((t == s + 1) ? sibling_scores[workspace->Sibling(t, t, -1)] :
+           complete[workspace->Span(s, t, s + 1)]);
+        for (int g = 0; g < num_parents; ++g) {
+          if (use_grandparents && g == s) {
+            g = t;
+            continue;
+          }
+          double best_value = first_value;
+          int best = s;
+          if (k > 1) {
+            double value = ComputeSumsAndMax(
+              &incomplete[workspace->Span(g, s, s + 1)], partial_scores,
+              k - 1, sums);
+            if (value > best_value) {
+              best_value = value;
+              best = s + 1 + FindFirst(sums, k - 1, value);
+            }
+          }
+          best_value += arc_score;
+          if (use_grandparents) {
+            best_value += grandparent_scores[(g * n + s) * n + t];
+          }
+          incomplete[workspace->Span(g, s, t)] = best_value;
+          incomplete_backtrack[workspace->Span(g, s, t)] = best;
+        }
+      }
+
+      // 2) Left incomplete item, for the arc t -> s.
+      arc_score = arc_scores[t * n + s];
+      if (arc_score != -std::numeric_limits<double>::infinity()) {
+        for (int m = s + 1; m < t; ++m) {
+          partial_scores[m - s - 1] = siblings[workspace->Span(t, s, m)] +
+            sibling_scores[workspace->Sibling(t, m, s)];
+        }
+        double first_value = sibling_scores[workspace->Sibling(t, t, s)] +
+          complete[workspace->Span(t, s, t - 1)];
+        for (int g = 0; g < num_parents; ++g) {
+          if (use_grandparents && g == s) {
+            g = t;
+            continue;
+          }
+          double best_value = first_value;
+          int best = t;
+          if (k > 1) {
+            double value = ComputeSumsAndMax(
+              &incomplete[workspace->Span(g, t, s + 1)], partial_scores,
+              k - 1, sums);
+            if (value > best_value) {
+              best_value = value;
+              best = s + 1 + FindFirst(sums, k - 1, value);
+            }
+          }
+          best_value += arc_score;
+          if (use_grandparents) {
+            best_value += grandparent_scores[(g * n + t) * n + s];
+          }
+          incomplete[workspace->Span(g, t, s)] = best_value;
+          incomplete_backtrack[workspace->Span(g, t, s)] = best;
+        }
+      }
+
+      // Third, create complete items, where the last child of the head is the
+      // one that maximizes the score.
+      // 1) Right complete item, maximizing incomplete[g][s][u] +
+      // complete[s][u][t] over s < u <= t.
+      for (int u = s + 1; u <= t; ++u) {
+        partial_scores[u - s - 1] = complete[workspace->Span(s, u, t)] +
+          sibling_scores[workspace->Sibling(s, u, n)];
+      }
+      for (int g = 0; g < num_parents; ++g) {
+        if (use_grandparents && g == s) {
+          g = t;
+          continue;
+        }
+        double best_value = ComputeSumsAndMax(
+          &incomplete[workspace->Span(g, s, s + 1)], partial_scores, k, sums);
+        complete[workspace->Span(g, s, t)] = best_value;
+        complete_backtrack[workspace->Span(g, s, t)] =
+          s + 1 + FindFirst(sums, k, best_value);
+      }
+
+      // 2) Left complete item, maximizing incomplete[g][t][u] +
+      // complete[t][u][s] over s <= u < t.
+      partial_scores[0] = sibling_scores[workspace->Sibling(s, s, -1)] +
+        sibling_scores[workspace->Sibling(t, s, -1)];
+      for (int u = s + 1; u < t; ++u) {
+        partial_scores[u - s] = complete[workspace->Span(t, u, s)] +
+          sibling_scores[workspace->Sibling(t, u, -1)];
+      }
+      for (int g = 0; g < num_parents; ++g) {
+        if (use_grandparents && g == s) {
+          g = t;
+          continue;
+        }
+        double best_value = ComputeSumsAndMax(
+          &incomplete[workspace->Span(g, t, s)], partial_scores, k, sums);
+        complete[workspace->Span(g, t, s)] = best_value;
+        complete_backtrack[workspace->Span(g, t, s)] =
+          s + FindFirst(sums, k, best_value);
+      }
+    }
+  }
+
+  // Get the optimal (single) child of the root.
+  double best_value = -std::numeric_limits<double>::infinity();
+  int best = -1;
+  for (int m = 1; m < n; ++m) {
+    double arc_score = arc_scores[m];
+    if (arc_score == -std::numeric_limits<double>::infinity()) continue;
+    double left_value = (m == 1) ?
+      sibling_scores[workspace->Sibling(m, m, -1)] :
+      complete[workspace->Span(0, m, 1)];
+    double val = arc_score + sibling_scores[workspace->Sibling(0, 0, m)] +
+      sibling_scores[workspace->Sibling(0, m, n)] + left_value +
+      complete[workspace->Span(0, m, n - 1)];
+    if (val > best_value) {
+      best = m;
+      best_value = val;
+    }
+  }
+
+  heads->assign(n, -1);
+  if (best < 0) {
+    *value = -std::numeric_limits<double>::infinity();
+    return;
+  }
+  // The root has no left children.
+  *value = best_value + sibling_scores[workspace->Sibling(0, 0, -1)];
+  (*heads)[best] = 0;
+  BacktrackSecondOrderComplete(*workspace, 0, best, 1, heads);
+  BacktrackSecondOrderComplete(*workspace, 0, best, n - 1, heads);
 }
 
 // Marginal decoder for the basic model; it invokes the matrix-tree theorem.
@@ -1102,6 +1498,140 @@ void DependencyDecoder::DecodeMatrixTree(Instance *instance, Parts *parts,
     static_cast<DependencyInstanceNumeric*>(instance)->size();
   DependencyParts *dependency_parts = static_cast<DependencyParts*>(parts);
 
+  int offset_arcs, num_arcs;
+  dependency_parts->GetOffsetArc(&offset_arcs, &num_arcs);
+  vector<DependencyPartArc*> arcs(num_arcs);
+  vector<double> scores_arcs(num_arcs);
+  for (int r = 0; r < num_arcs; ++r) {
+    arcs[r] = static_cast<DependencyPartArc*>((*parts)[offset_arcs + r]);
+    scores_arcs[r] = scores[offset_arcs + r];
+  }
+
+  vector<double> marginals;
+  RunMatrixTree(sentence_length, arcs, scores_arcs, &marginals,
+                log_partition_function);
+
+  // Compute the entropy.
+  predicted_output->resize(parts->size());
+  *entropy = *log_partition_function;
+  for (int r = 0; r < num_arcs; ++r) {
+    double value = marginals[r];
+    CHECK(!std::isnan(value));
+    if (value < 0.0) {
+      if (!NEARLY_ZERO_TOL(value, 1e-6)) {
+        LOG(INFO) << "Marginals truncated to zero (" << value << ")";
+      }
+    } else if (value > 1.0) {
+      if (!NEARLY_ZERO_TOL(value - 1.0, 1e-6)) {
+        LOG(INFO) << "Marginals truncated to one (" << value << ")";
+      }
+    }
+    (*predicted_output)[offset_arcs + r] = value;
+    *entropy -= (*predicted_output)[offset_arcs + r] * scores[offset_arcs + r];
+  }
+  if (*entropy < 0.0) {
+    if (!NEARLY_ZERO_TOL(*entropy, 1e-6)) {
+      LOG(INFO) << "Entropy truncated to zero (" << *entropy << ")";
+    }
+    *entropy = 0.0;
+  }
+}
+
+// Compute the arc marginals and the log-partition function with the
+// matrix-tree theorem in double precision. The potentials of the incoming
+// arcs of each word are divided by the largest one, so that they lie in
+// [0, 1] and the Kirchhoff matrix is diagonally dominant; this scales the
+// determinant by a known constant and leaves the marginals unchanged. The
+// LU decomposition is Eigen's blocked partial-pivoting one, whose updates
+// are matrix products. Returns false if the result is not reliable (e.g.,
+// the scaled matrix is numerically singular), so that the caller can fall
+// back to log-space arithmetic.
+static bool RunMatrixTreeScaled(int sentence_length,
+                                const vector<DependencyPartArc*> &arcs,
+                                const vector<double> &scores,
+                                vector<double> *marginals,
+                                double *log_partition_function) {
+  vector<double> max_scores(sentence_length,
+                            -std::numeric_limits<double>::infinity());
+  for (int r = 0; r < arcs.size(); ++r) {
+    int m = arcs[r]->modifier();
+    if (scores[r] > max_scores[m]) max_scores[m] = scores[r];
+  }
+  double log_scale = 0.0;
+  for (int m = 1; m < sentence_length; ++m) {
+    if (!std::isfinite(max_scores[m])) return false;
+    log_scale += max_scores[m];
+  }
+
+  // Set the Kirchhoff matrix: entry (h-1, m-1) is minus the potential of
+  // h -> m, and entry (m-1, m-1) is the sum of the potentials of the
+  // incoming arcs of m (including the one from the root).
+  vector<double> potentials(arcs.size());
+  Eigen::MatrixXd kirchhoff =
+    Eigen::MatrixXd::Zero(sentence_length - 1, sentence_length - 1);
+  for (int r = 0; r < arcs.size(); ++r) {
+    int h = arcs[r]->head();
+    int m = arcs[r]->modifier();
+    potentials[r] = exp(scores[r] - max_scores[m]);
+    if (h > 0) kirchhoff(h - 1, m - 1) -= potentials[r];
+    kirchhoff(m - 1, m - 1) += potentials[r];
+  }
+
+  // Take the log-determinant from the diagonal of U, since the determinant
+  // itself may overflow for long sentences.
+  Eigen::PartialPivLU<Eigen::MatrixXd> lu(kirchhoff);
+  const Eigen::MatrixXd &lu_matrix = lu.matrixLU();
+  // The sign of the row permutation is -1 to the number of even cycles.
+  const Eigen::VectorXi &permutation = lu.permutationP().indices();
+  vector<bool> visited(sentence_length - 1, false);
+  int sign = 1;
+  for (int i = 0; i < sentence_length - 1; ++i) {
+    if (visited[i]) continue;
+    int cycle_length = 0;
+    for (int j = i; !visited[j]; j = permutation(j)) {
+      visited[j] = true;
+      ++cycle_length;
+    }
+    if (cycle_length % 2 == 0) sign = -sign;
+  }
+  double log_determinant = 0.0;
+  for (int i = 0; i < sentence_length - 1; ++i) {
+    double pivot = lu_matrix(i, i);
+    if (pivot == 0.0 || !std::isfinite(pivot)) return false;
+    if (pivot < 0.0) sign = -sign;
+    log_determinant += log(fabs(pivot));
+  }
+  if (sign < 0) return false;
+
+  Eigen::MatrixXd inverted_kirchhoff = lu.inverse();
+  marginals->resize(arcs.size());
+  vector<double> total_marginals(sentence_length, 0.0);
+  for (int r = 0; r < arcs.size(); ++r) {
+    int h = arcs[r]->head();
+    int m = arcs[r]->modifier();
+    double value = inverted_kirchhoff(m - 1, m - 1);
+    if (h > 0) value -= inverted_kirchhoff(m - 1, h - 1);
+    value *= potentials[r];
+    if (!std::isfinite(value)) return false;
+    (*marginals)[r] = value;
+    total_marginals[m] += value;
+  }
+  // The marginals of the incoming arcs of each word must sum to one.
+  for (int m = 1; m < sentence_length; ++m) {
+    if (!NEARLY_EQ_TOL(total_marginals[m], 1.0, 1e-6)) return false;
+  }
+
+  *log_partition_function = log_determinant + log_scale;
+  return true;
+}
+
+// Same as above, with every value in log-space. This is much slower, but
+// it does not underflow.
+static void RunMatrixTreeLogSpace(int sentence_length,
+                                  const vector<DependencyPartArc*> &arcs,
+                                  const vector<double> &scores,
+                                  vector<double> *marginals,
+                                  double *log_partition_function) {
   // Matrix for storing the potentials.
   Eigen::MatrixXlogd potentials(sentence_length, sentence_length);
   // Kirchhoff matrix.
@@ -1109,24 +1639,22 @@ void DependencyDecoder::DecodeMatrixTree(Instance *instance, Parts *parts,
 
   // Compute an offset to improve numerical stability. This is a constant that
   // is subtracted from all scores.
-  int offset_arcs, num_arcs;
-  dependency_parts->GetOffsetArc(&offset_arcs, &num_arcs);
   double constant = 0.0;
-  for (int r = 0; r < num_arcs; ++r) {
-    constant += scores[offset_arcs + r];
+  for (int r = 0; r < arcs.size(); ++r) {
+    constant += scores[r];
   }
-  constant /= static_cast<double>(num_arcs);
+  constant /= static_cast<double>(arcs.size());
 
   // Set the potentials.
   for (int h = 0; h < sentence_length; ++h) {
     for (int m = 0; m < sentence_length; ++m) {
       potentials(m, h) = LogValD::Zero();
-      int r = dependency_parts->FindArc(h, m);
-      if (r >= 0) {
-        potentials(m, h) = LogValD(scores[r] - constant, false);
-      }
     }
   }
+  for (int r = 0; r < arcs.size(); ++r) {
+    potentials(arcs[r]->modifier(), arcs[r]->head()) =
+      LogValD(scores[r] - constant, false);
+  }
 
   // Set the Kirchhoff matrix.
   for (int h = 0; h < sentence_length - 1; ++h) {
@@ -1148,43 +1676,172 @@ void DependencyDecoder::DecodeMatrixTree(Instance *instance, Parts *parts,
   *log_partition_function = lu.determinant().logabs() +
     constant * (sentence_length - 1);
 
-  Eigen::MatrixXlogd marginals(sentence_length, sentence_length);
-  for (int h = 0; h < sentence_length; ++h) {
-    marginals(0, h) = LogValD::Zero();
+  marginals->resize(arcs.size());
+  for (int r = 0; r < arcs.size(); ++r) {
+    int h = arcs[r]->head();
+    int m = arcs[r]->modifier();
+    LogValD marginal = (h == 0) ?
+      potentials(m, h) * inverted_kirchhoff(m - 1, m - 1) :
+      potentials(m, h) *
+      (inverted_kirchhoff(m - 1, m - 1) - inverted_kirchhoff(m - 1, h - 1));
+    (*marginals)[r] = marginal.as_float();
   }
-  for (int m = 1; m < sentence_length; ++m) {
-    marginals(m, 0) = potentials(m, 0) * inverted_kirchhoff(m - 1, m - 1);
-    for (int h = 1; h < sentence_length; ++h) {
-      marginals(m, h) = potentials(m, h) *
-        (inverted_kirchhoff(m - 1, m - 1) - inverted_kirchhoff(m - 1, h - 1));
-    }
+}
+
+// Compute the marginal of each arc and the log-partition function of a
+// non-projective model with the matrix-tree theorem. Real arithmetic is used
+// whenever possible, falling back to log-space arithmetic otherwise.
+void DependencyDecoder::RunMatrixTree(int sentence_length,
+                                      const vector<DependencyPartArc*> &arcs,
+                                      const vector<double> &scores,
+                                      vector<double> *marginals,
+                                      double *log_partition_function) {
+  if (!RunMatrixTreeScaled(sentence_length, arcs, scores, marginals,
+                           log_partition_function)) {
+    VLOG(2) << "Falling back to the log-space matrix-tree theorem.";
+    RunMatrixTreeLogSpace(sentence_length, arcs, scores, marginals,
+                          log_partition_function);
   }
+}
 
-  // Compute the entropy.
-  predicted_output->resize(parts->size());
-  *entropy = *log_partition_function;
+// Check whether the exact second-order dynamic program can be used instead of
+// AD3: the tree must be projective and the only higher-order parts must be
+// consecutive siblings and grandparents.
+bool DependencyDecoder::UseSecondOrderEisner(Instance *instance,
+                                             Parts *parts) {
+  DependencyOptions *options = pipe_->GetDependencyOptions();
+  if (!options->projective()) return false;
+  int sentence_length =
+    static_cast<DependencyInstanceNumeric*>(instance)->size();
+  if (sentence_length > options->exact_decoding_max_length()) return false;
+
+  DependencyParts *dependency_parts = static_cast<DependencyParts*>(parts);
+  int offset, size;
+  dependency_parts->GetOffsetSibl(&offset, &size);
+  if (size > 0) return false;
+  dependency_parts->GetOffsetGrandSibl(&offset, &size);
+  if (size > 0) return false;
+  dependency_parts->GetOffsetTriSibl(&offset, &size);
+  if (size > 0) return false;
+  dependency_parts->GetOffsetNonproj(&offset, &size);
+  if (size > 0) return false;
+  dependency_parts->GetOffsetPath(&offset, &size);
+  if (size > 0) return false;
+  dependency_parts->GetOffsetHeadBigr(&offset, &size);
+  if (size > 0) return false;
+  return true;
+}
+
+// Exact decoder for projective models with consecutive sibling and
+// grandparent parts. Returns false if there is no projective tree with the
+// available arcs, in which case the caller should fall back to AD3.
+bool DependencyDecoder::DecodeSecondOrderEisner(
+  Instance *instance, Parts *parts,
+  const vector<double> &scores,
+  vector<double> *predicted_output) {
+  DependencyParts *dependency_parts = static_cast<DependencyParts*>(parts);
+  int sentence_length =
+    static_cast<DependencyInstanceNumeric*>(instance)->size();
+
+  int offset_arcs, num_arcs;
+  dependency_parts->GetOffsetArc(&offset_arcs, &num_arcs);
+  int offset_next_siblings, num_next_siblings;
+  dependency_parts->GetOffsetNextSibl(&offset_next_siblings,
+                                      &num_next_siblings);
+  int offset_grandparents, num_grandparents;
+  dependency_parts->GetOffsetGrandpar(&offset_grandparents, &num_grandparents);
+
+  SecondOrderWorkspace *workspace = GetSecondOrderWorkspace();
+  workspace->Initialize(sentence_length, num_grandparents > 0);
   for (int r = 0; r < num_arcs; ++r) {
-    int h = static_cast<DependencyPartArc*>((*parts)[offset_arcs + r])->head();
-    int m = static_cast<DependencyPartArc*>((*parts)[offset_arcs + r])->modifier();
-    if (marginals(m, h).signbit()) {
-      if (!NEARLY_ZERO_TOL(marginals(m, h).as_float(), 1e-6)) {
-        LOG(INFO) << "Marginals truncated to zero (" << marginals(m, h).as_float() << ")";
+    DependencyPartArc *arc =
+      static_cast<DependencyPartArc*>((*parts)[offset_arcs + r]);
+    workspace->arc_scores[arc->head() * sentence_length + arc->modifier()] =
+      scores[offset_arcs + r];
+  }
+  for (int r = 0; r < num_next_siblings; ++r) {
+    DependencyPartNextSibl *part = static_cast<DependencyPartNextSibl*>(
+      (*parts)[offset_next_siblings + r]);
+    workspace->sibling_scores[workspace->Sibling(part->head(),
+                                                 part->modifier(),
+                                                 part->next_sibling())] =
+      scores[offset_next_siblings + r];
+  }
+  for (int r = 0; r < num_grandparents; ++r) {
+    DependencyPartGrandpar *part = static_cast<DependencyPartGrandpar*>(
+      (*parts)[offset_grandparents + r]);
+    workspace->grandparent_scores[(part->grandparent() * sentence_length +
+                                   part->head()) * sentence_length +
+                                  part->modifier()] =
+      scores[offset_grandparents + r];
+  }
+
+  vector<int> heads;
+  double value;
+  RunSecondOrderEisner(workspace, &heads, &value);
+  if (value == -std::numeric_limits<double>::infinity()) return false;
+
+  for (int m = 1; m < sentence_length; ++m) {
+    int r = dependency_parts->FindArc(heads[m], m);
+    CHECK_GE(r, 0);
+    (*predicted_output)[r] = 1.0;
+  }
+
+  // Find the next child of each node's head, moving away from the head (or
+  // -1/n if there is none), and the innermost children of each node.
+  vector<int> next_children(sentence_length);
+  vector<int> first_left_children(sentence_length, -1);
+  vector<int> first_right_children(sentence_length, sentence_length);
+  for (int h = 0; h < sentence_length; ++h) {
+    int previous = h;
+    for (int m = h + 1; m < sentence_length; ++m) {
+      if (heads[m] != h) continue;
+      if (previous == h) {
+        first_right_children[h] = m;
+      } else {
+        next_children[previous] = m;
       }
-      CHECK(!std::isnan(marginals(m, h).as_float()));
-    } else if (marginals(m, h).logabs() > 0) {
-      if (!NEARLY_ZERO_TOL(marginals(m, h).as_float() - 1.0, 1e-6)) {
-        LOG(INFO) << "Marginals truncated to one (" << marginals(m, h).as_float() << ")";
+      previous = m;
+    }
+    if (previous != h) next_children[previous] = sentence_length;
+    previous = h;
+    for (int m = h - 1; m > 0; --m) {
+      if (heads[m] != h) continue;
+      if (previous == h) {
+        first_left_children[h] = m;
+      } else {
+        next_children[previous] = m;
       }
+      previous = m;
     }
-    (*predicted_output)[offset_arcs + r] = marginals(m, h).as_float();
-    *entropy -= (*predicted_output)[offset_arcs + r] * scores[offset_arcs + r];
+    if (previous != h) next_children[previous] = -1;
   }
-  if (*entropy < 0.0) {
-    if (!NEARLY_ZERO_TOL(*entropy, 1e-6)) {
-      LOG(INFO) << "Entropy truncated to zero (" << *entropy << ")";
+
+  for (int r = 0; r < num_next_siblings; ++r) {
+    DependencyPartNextSibl *part = static_cast<DependencyPartNextSibl*>(
+      (*parts)[offset_next_siblings + r]);
+    int h = part->head();
+    int m = part->modifier();
+    int s = part->next_sibling();
+    bool active;
+    if (m == h) {
+      active = (s > h) ? (first_right_children[h] == s) :
+        (first_left_children[h] == s);
+    } else {
+      active = (heads[m] == h && next_children[m] == s);
     }
-    *entropy = 0.0;
+    if (active) (*predicted_output)[offset_next_siblings + r] = 1.0;
   }
+  for (int r = 0; r < num_grandparents; ++r) {
+    DependencyPartGrandpar *part = static_cast<DependencyPartGrandpar*>(
+      (*parts)[offset_grandparents + r]);
+    if (heads[part->head()] == part->grandparent() &&
+        heads[part->modifier()] == part->head()) {
+      (*predicted_output)[offset_grandparents + r] = 1.0;
+    }
+  }
+
+  return true;
 }
 
 // Decode building a factor graph and calling the AD3 algorithm.
@@ -2545,23 +3202,45 @@ void DependencyDecoder::DecodeFactorGraph(Instance *instance, Parts *parts,
   double value_ref;
   double *value = &value_ref;
 
-  factor_graph->SetMaxIterationsAD3(500);
-  //factor_graph->SetMaxIterationsAD3(200);
-  factor_graph->SetEtaAD3(0.05);
-  factor_graph->AdaptEtaAD3(true);
-  factor_graph->SetResidualThresholdAD3(1e-3);
-  //factor_graph->SetResidualThresholdAD3(1e-6);
+  DependencyOptions *options = pipe_->GetDependencyOptions();
+  factor_graph->SetMaxIterationsAD3(options->ad3_max_iterations());
+  factor_graph->SetEtaAD3(options->ad3_eta());
+  factor_graph->AdaptEtaAD3(options->ad3_adapt_eta());
+  factor_graph->SetResidualThresholdAD3(options->ad3_residual_threshold());
 
   // Run AD3.
   chronowrap::Chronometer chrono;
   chrono.GetTime();
+  int ad3_status = AD3::STATUS_OPTIMAL_INTEGER;
   if (!solved) {
-    factor_graph->SolveLPMAPWithAD3(&posteriors, &additional_posteriors, value);
+    ad3_status = factor_graph->SolveLPMAPWithAD3(&posteriors,
+                                                 &additional_posteriors,
+                                                 value);
   }
   chrono.StopTime();
   double elapsed_time = chrono.GetElapsedTime();
   VLOG(2) << "Elapsed time (AD3) = " << elapsed_time << " sec."
     << " (" << sentence->size() << ") ";
+  const char *ad3_status_names[] = {
+    "integer", "fractional", "infeasible", "unsolved"
+  };
+  VLOG(1) << "AD3: length " << sentence->size()
+          << ", factors " << factor_graph->GetNumFactors()
+          << ", variables " << factor_graph->GetNumVariables()
+          << ", solution " << ad3_status_names[ad3_status]
+          << ", time " << elapsed_time << " sec.";
+  {
+    std::lock_guard<std::mutex> lock(ad3_statistics_mutex_);
+    ++ad3_statistics_.num_sentences;
+    if (ad3_status == AD3::STATUS_OPTIMAL_INTEGER) {
+      ++ad3_statistics_.num_integral;
+    } else if (ad3_status == AD3::STATUS_OPTIMAL_FRACTIONAL) {
+      ++ad3_statistics_.num_fractional;
+    } else {
+      ++ad3_statistics_.num_unsolved;
+    }
+    ad3_statistics_.time += elapsed_time;
+  }
 
   delete factor_graph;
 
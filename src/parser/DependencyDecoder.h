@@ -22,9 +22,134 @@
 #include "Decoder.h"
 #include "DependencyPart.h"
 #include "ad3/FactorGraph.h"
+#include <mutex>
 
 class DependencyPipe;
 
+// Tables of the exact decoder for projective second-order models with
+// consecutive siblings and grandparents (model 1 of Koo and Collins, 2010).
+// The spans are indexed by the parent of their head, [g][h][e], since the
+// grandparent parts depend on it; without grandparent parts that dimension
+// is dropped and the decoder runs in O(n^3) instead of O(n^4). Entry [h][h]
+// of the complete spans is the score of h having no right children.
+struct SecondOrderWorkspace {
+  // Resize the tables for a sentence and clear the part scores.
+  void Initialize(int sentence_length, bool use_grandparents);
+
+  // Index of the span [h][e] whose head has parent g.
+  int Span(int g, int h, int e) const {
+    return ((use_grandparents ? g : 0) * length + h) * length + e;
+  }
+  // Index of the consecutive siblings (h, m, s), with s = -1 or s = n if m is
+  // the outermost child of h, and m = h if s is the innermost one.
+  int Sibling(int h, int m, int s) const {
+    return (h * length + m) * (length + 2) + s + 1;
+  }
+
+  int length; // Sentence length (n), including the root.
+  bool use_grandparents;
+  vector<double> arc_scores; // [h][m]: score (-infinity if there is no arc).
+  vector<double> sibling_scores; // [h][m][s + 1]: score of the siblings.
+  vector<double> grandparent_scores; // [g][h][m]: score of the grandparent.
+  vector<double> complete; // [g][h][e]: score of the complete span.
+  vector<double> incomplete; // [g][h][m]: score of the span of h -> m.
+  vector<double> siblings; // [h][a][b]: score of the span between the
+                           // consecutive children a < b of h.
+  vector<int> complete_backtrack; // [g][h][e]: last child of h.
+  vector<int> incomplete_backtrack; // [g][h][m]: previous child of h, or h.
+  vector<int> siblings_backtrack; // [h][a][b]: best split point.
+  vector<double> partial_scores; // Scratch rows.
+  vector<double> sums;
+};
+
+// Statistics of the AD3 runs, accumulated over the sentences decoded with a
+// factor graph (i.e., with higher-order parts).
+struct AD3Statistics {
+  AD3Statistics() { Clear(); }
+  void Clear() {
+    num_sentences = 0;
+    num_integral = 0;
+    num_fractional = 0;
+    num_unsolved = 0;
+    time = 0.0;
+  }
+
+  int num_sentences;
+  int num_integral; // Converged to an integer solution.
+  int num_fractional; // Converged to a fractional solution.
+  int num_unsolved; // Stopped at the maximum number of iterations.
+  double time; // Seconds spent in AD3.
+};
+
+// Tables of Eisner's algorithms (first-order projective parsing), reused
+// across sentences so that no memory is allocated once they are large enough.
+// All tables are flat n x n arrays in row-major order: entry [h][e] of the
+// complete spans is the span headed by h that ends at e (on either side of
+// h), and entry [h][m] of the incomplete spans is the span of the arc h -> m.
+// The complete spans are also kept transposed, so that every loop over the
+// split points of a span reads rows with unit stride.
+struct EisnerWorkspace {
+  // Resize the tables for a sentence and index its arcs.
+  void Initialize(int sentence_length,
+                  const vector<DependencyPartArc*> &arcs);
+
+  int length; // Sentence length (n), including the root.
+  vector<int> index_arcs; // [h][m]: index of the arc h -> m, or -1.
+  vector<double> complete; // [h][e]: score of the complete span.
+  vector<double> complete_transposed; // [e][h]: same as complete.
+  vector<double> incomplete; // [h][m]: score (-infinity if there is no arc).
+  vector<double> splits; // [s][t]: score of the incomplete spans between s
+                         // and t, before adding the arc score.
+  vector<int> complete_backtrack; // [h][e]: best split point.
+  vector<int> incomplete_backtrack; // [h][m]: best split point.
+  vector<double> complete_adjoints; // [h][e]: outside weights.
+  vector<double> complete_transposed_adjoints; // [e][h]: more outside
+                                               // weights (to be added).
+  vector<double> incomplete_adjoints; // [h][m]: outside weights.
+  vector<double> sums; // Scratch row.
+};
+
+// State of the Chu-Liu-Edmonds algorithm (maximum spanning arborescence),
+// reused across sentences. The candidate heads of each node are kept in a
+// dense n x n table indexed by [m][h], and cycles are contracted in place
+// into a representative node, so each contraction costs O(n * |cycle|)
+// instead of copying the whole graph. The contractions are stacked so that
+// they can be undone in reverse order once the graph has no cycles left.
+// Besides its score, each candidate head has a penalty (the number of arcs
+// from the root it stands for, negated, if a single root is required), which
+// is compared first.
+struct ChuLiuEdmondsWorkspace {
+  // Resize the tables for a sentence and fill them with the arc scores.
+  void Initialize(int sentence_length,
+                  const vector<DependencyPartArc*> &arcs,
+                  const vector<double> &scores,
+                  bool single_root);
+
+  int length; // Sentence length (n), including the root.
+  int order_offset; // Order of the first head appended by a contraction.
+  vector<double> scores; // [m][h]: score of the candidate head h of m.
+  vector<int> penalties; // [m][h]: penalty of the candidate head h of m.
+  vector<int> order; // [m][h]: position of h in the list of candidate heads
+                     // of m (used to break ties), or -1 if h is not one.
+  vector<bool> disabled; // Nodes contracted into a representative.
+  vector<bool> in_cycle; // Nodes in the cycle being contracted.
+  vector<bool> tied; // True if the best head of m is not the only one.
+  vector<double> best_scores; // Score of the best head of each node.
+  vector<int> best_penalties; // Penalty of the best head of each node.
+  vector<int> visited; // Used to look for cycles.
+  vector<int> cycle; // Scratch list of the nodes in a cycle.
+  vector<double> best_scores_cycle; // Scratch row.
+  vector<int> best_penalties_cycle; // Scratch row.
+  // One entry per contraction.
+  vector<int> representatives; // Node standing for the contracted cycle.
+  vector<int> representative_heads; // Head of that node inside the cycle.
+  vector<int> cycle_offsets; // Start of each cycle in cycle_nodes.
+  vector<int> cycle_nodes; // Concatenated cycles.
+  // One row of length n per contraction.
+  vector<int> best_heads_cycle; // [m]: best head of m within the cycle.
+  vector<int> best_modifiers_cycle; // [h]: best modifier of h in the cycle.
+};
+
 class DependencyDecoder : public Decoder {
 public:
   DependencyDecoder() {};
@@ -73,12 +198,51 @@ public:
                         vector<int> *heads,
                         double *value);
 
+  void RunChuLiuEdmondsSingleRoot(int sentence_length,
+                                  const vector<DependencyPartArc*> &arcs,
+                                  const vector<double> &scores,
+                                  vector<int> *heads,
+                                  double *value);
+
   void RunEisner(int sentence_length,
                  const vector<DependencyPartArc*> &arcs,
                  const vector<double> &scores,
                  vector<int> *heads,
                  double *value);
 
+  void RunEisnerMarginals(int sentence_length,
+                          const vector<DependencyPartArc*> &arcs,
+                          const vector<double> &scores,
+                          vector<double> *marginals,
+                          double *log_partition_function);
+
+  void RunMatrixTree(int sentence_length,
+                     const vector<DependencyPartArc*> &arcs,
+                     const vector<double> &scores,
+                     vector<double> *marginals,
+                     double *log_partition_function);
+
+  void RunSecondOrderEisner(SecondOrderWorkspace *workspace,
+                            vector<int> *heads,
+                            double *value);
+
+  void SelectPrunerArcs(int sentence_length,
+                        const vector<DependencyPartArc*> &arcs,
+                        const vector<double> &posteriors,
+                        double posterior_threshold,
+                        int max_heads,
+                        vector<int> *offsets,
+                        vector<int> *selected_arcs);
+
+  void ClearAD3Statistics() {
+    std::lock_guard<std::mutex> lock(ad3_statistics_mutex_);
+    ad3_statistics_.Clear();
+  }
+  void GetAD3Statistics(AD3Statistics *statistics) {
+    std::lock_guard<std::mutex> lock(ad3_statistics_mutex_);
+    *statistics = ad3_statistics_;
+  }
+
 protected:
   void DecodeLabels(Instance *instance, Parts *parts,
                     const vector<double> &scores,
@@ -106,37 +270,33 @@ protected:
                            double *log_partition_function,
                            double *entropy);
 
+  bool UseSecondOrderEisner(Instance *instance, Parts *parts);
+
+  bool DecodeSecondOrderEisner(Instance *instance, Parts *parts,
+                               const vector<double> &scores,
+                               vector<double> *predicted_output);
+
   void DecodeFactorGraph(Instance *instance, Parts *parts,
                          const vector<double> &scores,
                          bool single_root,
                          bool relax,
                          vector<double> *predicted_output);
 
-  void RunChuLiuEdmondsIteration(vector<bool> *disabled,
-                                 vector<vector<int> > *candidate_heads,
-                                 vector<vector<double> > *candidate_scores,
-                                 vector<int> *heads,
-                                 double *value);
+  void RunChuLiuEdmondsContractions(ChuLiuEdmondsWorkspace *workspace,
+                                    vector<int> *heads,
+                                    double *value);
 
-  void RunEisnerBacktrack(const vector<int> &incomplete_backtrack,
-                          const vector<vector<int> > &complete_backtrack,
-                          const vector<vector<int> > &index_arcs,
+  void RunEisnerBacktrack(const EisnerWorkspace &workspace,
                           int h, int m, bool complete, vector<int> *heads);
 
-  void RunEisnerInside(int sentence_length,
-                       const vector<DependencyPartArc*> &arcs,
-                       const vector<double> &scores,
-                       vector<double> *inside_incomplete_spans,
-                       vector<vector<double> > *inside_complete_spans,
+  void RunEisnerInside(const vector<double> &scores,
+                       EisnerWorkspace *workspace,
                        double *log_partition_function);
 
-  void RunEisnerOutside(int sentence_length,
-                        const vector<DependencyPartArc*> &arcs,
-                        const vector<double> &scores,
-                        const vector<double> &inside_incomplete_spans,
-                        const vector<vector<double> > &inside_complete_spans,
-                        vector<double> *outside_incomplete_spans,
-                        vector<vector<double> > *outside_complete_spans);
+  void RunEisnerOutside(const vector<double> &scores,
+                        double log_partition_function,
+                        EisnerWorkspace *workspace,
+                        vector<double> *marginals);
 
 #ifdef USE_CPLEX
   void DecodeCPLEX(Instance *instance, Parts *parts,
@@ -147,6 +307,9 @@ protected:
 #endif
 protected:
   DependencyPipe *pipe_;
+  // Several threads may decode sentences at the same time.
+  std::mutex ad3_statistics_mutex_;
+  AD3Statistics ad3_statistics_;
 };
 
 #endif /* DEPENDENCYDECODER_H_ */
@@ -142,6 +142,14 @@ public:
 
   const Alphabet &GetLabelAlphabet() const { return label_alphabet_; };
 
+  // Checksum of the token and label alphabets, used to check that ids
+  // encoded with some dictionaries (e.g. in a binary corpus) match the
+  // current ones.
+  uint64_t GetChecksum() const {
+    return token_dictionary_->GetChecksum() * 1099511628211ULL +
+      label_alphabet_.GetChecksum();
+  }
+
 protected:
   Pipe *pipe_;
   TokenDictionary *token_dictionary_;
@@ -20,7 +20,9 @@
 #include "DependencyFeatures.h"
 #include "DependencyPart.h"
 #include "DependencyFeatureTemplates.h"
+#include <algorithm>
 #include <set>
+#include <utility>
 
 // Flags for specific options in feature definitions.
 // Note: this will be deprecated soon.
@@ -56,9 +58,7 @@ void DependencyFeatures::AddArcFeaturesLight(
   int r,
   int head,
   int modifier) {
-  CHECK(!input_features_[r]);
-  BinaryFeatures *features = new BinaryFeatures;
-  input_features_[r] = features;
+  BinaryFeatures *features = CreatePartFeatures(r, DEPENDENCYPART_ARC);
 
 #if USE_MST_FEATURES
   AddWordPairFeaturesMST(sentence, DependencyFeatureTemplateParts::ARC,
@@ -83,14 +83,40 @@ void DependencyFeatures::AddArcFeatures(DependencyInstanceNumeric* sentence,
     return;
   }
 
-  CHECK(!input_features_[r]);
-  BinaryFeatures *features = new BinaryFeatures;
-  input_features_[r] = features;
+  BinaryFeatures *features = CreatePartFeatures(r, DEPENDENCYPART_ARC);
 
   AddWordPairFeatures(sentence, DependencyFeatureTemplateParts::ARC,
                       head, modifier, true, true, features);
 }
 
+// Same as AddArcFeatures, but starting from the features that
+// AddArcFeaturesLight extracted for the same arc (e.g. by the pruner): they
+// are moved out of light_features or, with the large feature set, copied
+// into the features, between the lemma and morpho-syntactic features, which
+// are the only ones extracted here.
+void DependencyFeatures::AddArcFeaturesFromLight(
+  DependencyInstanceNumeric* sentence,
+  int r,
+  int head,
+  int modifier,
+  BinaryFeatures *light_features) {
+#if USE_MST_FEATURES
+  AddArcFeatures(sentence, r, head, modifier);
+#else
+  DependencyOptions *options = static_cast<class DependencyPipe*>(pipe_)->
+    GetDependencyOptions();
+  BinaryFeatures *features = CreatePartFeatures(r, DEPENDENCYPART_ARC);
+  if (options->large_feature_set()) {
+    AddWordPairFeaturesFromLight(sentence,
+                                 DependencyFeatureTemplateParts::ARC, head,
+                                 modifier, true, true, *light_features,
+                                 features);
+  } else {
+    features->swap(*light_features);
+  }
+#endif
+}
+
 // Add features for arbitrary siblings.
 void DependencyFeatures::AddArbitrarySiblingFeatures(
   DependencyInstanceNumeric* sentence,
@@ -119,9 +145,9 @@ void DependencyFeatures::AddSiblingFeatures(DependencyInstanceNumeric* sentence,
                                             int modifier,
                                             int sibling,
                                             bool consecutive) {
-  CHECK(!input_features_[r]);
-  BinaryFeatures *features = new BinaryFeatures;
-  input_features_[r] = features;
+  BinaryFeatures *features =
+    CreatePartFeatures(r, consecutive ? DEPENDENCYPART_NEXTSIBL :
+                       DEPENDENCYPART_SIBL);
 
   int sentence_length = sentence->size();
   bool first_child = consecutive && (head == modifier);
@@ -276,9 +302,7 @@ void DependencyFeatures::AddGrandparentFeatures(
   int grandparent,
   int head,
   int modifier) {
-  CHECK(!input_features_[r]);
-  BinaryFeatures *features = new BinaryFeatures;
-  input_features_[r] = features;
+  BinaryFeatures *features = CreatePartFeatures(r, DEPENDENCYPART_GRANDPAR);
 
   if (FLAGS_use_pair_features_second_order) {
     if (FLAGS_use_upper_dependencies) {
@@ -435,9 +459,7 @@ void DependencyFeatures::AddGrandSiblingFeatures(DependencyInstanceNumeric* sent
                                                  int head,
                                                  int modifier,
                                                  int sibling) {
-  CHECK(!input_features_[r]);
-  BinaryFeatures *features = new BinaryFeatures;
-  input_features_[r] = features;
+  BinaryFeatures *features = CreatePartFeatures(r, DEPENDENCYPART_GRANDSIBL);
 
   int sentence_length = sentence->size();
   bool first_child = (head == modifier);
@@ -542,9 +564,7 @@ void DependencyFeatures::AddTriSiblingFeatures(DependencyInstanceNumeric* senten
                                                int modifier,
                                                int sibling,
                                                int other_sibling) {
-  CHECK(!input_features_[r]);
-  BinaryFeatures *features = new BinaryFeatures;
-  input_features_[r] = features;
+  BinaryFeatures *features = CreatePartFeatures(r, DEPENDENCYPART_TRISIBL);
 
   // TODO(afm).
   int sentence_length = sentence->size();
@@ -653,9 +673,7 @@ void DependencyFeatures::AddNonprojectiveArcFeatures(
   int modifier) {
   // TODO: use AddWordPairFeatures instead.
   // TODO: implement AddLightWordPairFeatures?
-  CHECK(!input_features_[r]);
-  BinaryFeatures *features = new BinaryFeatures;
-  input_features_[r] = features;
+  BinaryFeatures *features = CreatePartFeatures(r, DEPENDENCYPART_NONPROJ);
 
   AddWordPairFeatures(sentence, DependencyFeatureTemplateParts::NONPROJARC,
                       head, modifier, true, true, features);
@@ -667,9 +685,7 @@ void DependencyFeatures::AddDirectedPathFeatures(
   int r,
   int ancestor,
   int descendant) {
-  CHECK(!input_features_[r]);
-  BinaryFeatures *features = new BinaryFeatures;
-  input_features_[r] = features;
+  BinaryFeatures *features = CreatePartFeatures(r, DEPENDENCYPART_PATH);
 
   int left_position, right_position;
   int span_length;
@@ -777,9 +793,7 @@ void DependencyFeatures::AddHeadBigramFeatures(
   int head,
   int modifier,
   int previous_head) {
-  CHECK(!input_features_[r]);
-  BinaryFeatures *features = new BinaryFeatures;
-  input_features_[r] = features;
+  BinaryFeatures *features = CreatePartFeatures(r, DEPENDENCYPART_HEADBIGRAM);
 
   int sentence_length = sentence->size();
   int left_position, right_position;
@@ -926,551 +940,558 @@ void DependencyFeatures::AddHeadBigramFeatures(
   }
 }
 
-// General function to add features for a pair of words (arcs, sibling words,
-// etc.) Can optionally use lemma and morpho-syntactic feature information.
-// The features are very similar to the ones used in Koo et al. EGSTRA.
-void DependencyFeatures::AddWordPairFeatures(DependencyInstanceNumeric* sentence,
-                                             int pair_type,
-                                             int head,
-                                             int modifier,
-                                             bool use_lemma_features,
-                                             bool use_morphological_features,
-                                             BinaryFeatures *features) {
-  int sentence_length = sentence->size();
-  // True if labeled dependency parsing.
-  bool labeled =
-    static_cast<DependencyOptions*>(pipe_->GetOptions())->labeled();
+// Atoms of the word pair features: the values conjoined by the templates of
+// kWordPairTemplates. H and M stand for the head and the modifier, p/pp and
+// n/nn for the words one/two positions before and after them, and W, P, Q,
+// L and F for word forms, coarse and fine POS tags, lemmas and
+// morpho-syntactic features.
+struct WordPairAtom {
+  enum types {
+    HW = 0, MW, HP, MP, HQ, MQ,
+    pHW, pMW, nHW, nMW, pHP, pMP, nHP, nMP, pHQ, pMQ, nHQ, nMQ,
+    ppHW, ppMW, nnHW, nnMW, ppHP, ppMP, nnHP, nnMP, ppHQ, ppMQ, nnHQ, nnMQ,
+    HL, ML, pHL, pML, nHL, nML, ppHL, ppML, nnHL, nnML,
+    HF, MF, // Current morpho-syntactic features (with their index).
+    BP, // Coarse POS of the current word between the head and the modifier.
+    DIST, // Exact arc length.
+    BIN, // Current bin of the arc length.
+    BFLAG_VERB, BFLAG_PUNC, BFLAG_COORD, // In-between flags.
+    ONE, // The constant 0x1.
+    COUNT
+  };
+};
+
+// Groups of word pair templates, in the order in which their keys are
+// written.
+struct WordPairGroup {
+  enum types {
+    HEAD_TOKEN = 0,
+    HEAD_MORPH, // Once per morpho-syntactic feature of the head.
+    MODIFIER_TOKEN,
+    MODIFIER_MORPH, // Once per morpho-syntactic feature of the modifier.
+    CONTEXT,
+    MORPH_PAIR, // Once per pair of features of the head and the modifier.
+    CONTEXT_DEPENDENCY,
+    RIGHT_ADJACENT, // If the modifier follows the head (not the root).
+    LEFT_ADJACENT, // If the modifier precedes the head.
+    DISTANCE,
+    BIN, // Once per bin up to the one of the arc length.
+    BIN_POS, // Same.
+    BETWEEN_FLAGS,
+    BETWEEN_POS, // Once per word between the head and the modifier.
+  };
+};
+
+// Options that the word pair templates may require.
+enum {
+  kWordPairLabeled = 0x1,
+  kWordPairContext1 = 0x2, // --dependency_token_context >= 1.
+  kWordPairContext2 = 0x4, // --dependency_token_context >= 2.
+  kWordPairLemmas = 0x8,
+  kWordPairMorphology = 0x10,
+  kNumWordPairOptions = 0x20,
+};
+
+typedef DependencyFeatureTemplateArc Arc;
+typedef WordPairAtom Atom;
+typedef WordPairGroup Group;
+
+// Templates of the word pair features (see AddWordPairFeatures). The
+// features involving the modifier only are kept in labeled parsing, since
+// they are conjoined with the label. In EGSTRA (but not here), token and
+// token contextual features go without direction flags.
+static constexpr FeatureTemplate kWordPairTemplates[] = {
+  // Token features (the bias is not in EGSTRA).
+  {Group::HEAD_TOKEN, Arc::BIAS, 0, "", {}},
+  {Group::HEAD_TOKEN, Arc::HP, 0, "P", {Atom::HP}},
+  {Group::HEAD_TOKEN, Arc::HQ, 0, "P", {Atom::HQ}},
+  {Group::HEAD_TOKEN, Arc::HW, 0, "W", {Atom::HW}},
+  {Group::HEAD_TOKEN, Arc::HL, kWordPairLemmas, "W", {Atom::HL}},
+  {Group::HEAD_TOKEN, Arc::HWP, 0, "WP", {Atom::HW, Atom::HP}},
+  {Group::HEAD_MORPH, Arc::HF, kWordPairMorphology, "W", {Atom::HF}},
+  {Group::HEAD_MORPH, Arc::HWF, kWordPairMorphology, "WW",
+   {Atom::HW, Atom::HF}},
+  {Group::MODIFIER_TOKEN, Arc::MP, kWordPairLabeled, "P", {Atom::MP}},
+  {Group::MODIFIER_TOKEN, Arc::MQ, kWordPairLabeled, "P", {Atom::MQ}},
+  {Group::MODIFIER_TOKEN, Arc::MW, kWordPairLabeled, "W", {Atom::MW}},
+  {Group::MODIFIER_TOKEN, Arc::ML, kWordPairLabeled | kWordPairLemmas, "W",
+   {Atom::ML}},
+  {Group::MODIFIER_TOKEN, Arc::MWP, kWordPairLabeled, "WP",
+   {Atom::MW, Atom::MP}},
+  {Group::MODIFIER_MORPH, Arc::MF, kWordPairLabeled, "W", {Atom::MF}},
+  {Group::MODIFIER_MORPH, Arc::MWF, kWordPairLabeled, "WW",
+   {Atom::MW, Atom::MF}},
+
+  // Token contextual features.
+  {Group::CONTEXT, Arc::pHP, kWordPairContext1, "P", {Atom::pHP}},
+  {Group::CONTEXT, Arc::nHP, kWordPairContext1, "P", {Atom::nHP}},
+  {Group::CONTEXT, Arc::pHQ, kWordPairContext1, "P", {Atom::pHQ}},
+  {Group::CONTEXT, Arc::nHQ, kWordPairContext1, "P", {Atom::nHQ}},
+  {Group::CONTEXT, Arc::pHW, kWordPairContext1, "W", {Atom::pHW}},
+  {Group::CONTEXT, Arc::nHW, kWordPairContext1, "W", {Atom::nHW}},
+  {Group::CONTEXT, Arc::pHL, kWordPairContext1 | kWordPairLemmas, "W",
+   {Atom::pHL}},
+  {Group::CONTEXT, Arc::nHL, kWordPairContext1 | kWordPairLemmas, "W",
+   {Atom::nHL}},
+  {Group::CONTEXT, Arc::pHWP, kWordPairContext1, "WP",
+   {Atom::pHW, Atom::pHP}},
+  {Group::CONTEXT, Arc::nHWP, kWordPairContext1, "WP",
+   {Atom::nHW, Atom::nHP}},
+  {Group::CONTEXT, Arc::pMP, kWordPairContext1 | kWordPairLabeled, "P",
+   {Atom::pMP}},
+  {Group::CONTEXT, Arc::nMP, kWordPairContext1 | kWordPairLabeled, "P",
+   {Atom::nMP}},
+  {Group::CONTEXT, Arc::pMQ, kWordPairContext1 | kWordPairLabeled, "P",
+   {Atom::pMQ}},
+  {Group::CONTEXT, Arc::nMQ, kWordPairContext1 | kWordPairLabeled, "P",
+   {Atom::nMQ}},
+  {Group::CONTEXT, Arc::pMW, kWordPairContext1 | kWordPairLabeled, "W",
+   {Atom::pMW}},
+  {Group::CONTEXT, Arc::nMW, kWordPairContext1 | kWordPairLabeled, "W",
+   {Atom::nMW}},
+  {Group::CONTEXT, Arc::pML,
+   kWordPairContext1 | kWordPairLabeled | kWordPairLemmas, "W", {Atom::pML}},
+  {Group::CONTEXT, Arc::nML,
+   kWordPairContext1 | kWordPairLabeled | kWordPairLemmas, "W", {Atom::nML}},
+  {Group::CONTEXT, Arc::pMWP, kWordPairContext1 | kWordPairLabeled, "WP",
+   {Atom::pMW, Atom::pMP}},
+  {Group::CONTEXT, Arc::nMWP, kWordPairContext1 | kWordPairLabeled, "WP",
+   {Atom::nMW, Atom::nMP}},
+  {Group::CONTEXT, Arc::ppHP, kWordPairContext2, "P", {Atom::ppHP}},
+  {Group::CONTEXT, Arc::nnHP, kWordPairContext2, "P", {Atom::nnHP}},
+  {Group::CONTEXT, Arc::ppHQ, kWordPairContext2, "P", {Atom::ppHQ}},
+  {Group::CONTEXT, Arc::nnHQ, kWordPairContext2, "P", {Atom::nnHQ}},
+  {Group::CONTEXT, Arc::ppHW, kWordPairContext2, "W", {Atom::ppHW}},
+  {Group::CONTEXT, Arc::nnHW, kWordPairContext2, "W", {Atom::nnHW}},
+  {Group::CONTEXT, Arc::ppHL, kWordPairContext2 | kWordPairLemmas, "W",
+   {Atom::ppHL}},
+  {Group::CONTEXT, Arc::nnHL, kWordPairContext2 | kWordPairLemmas, "W",
+   {Atom::nnHL}},
+  {Group::CONTEXT, Arc::ppHWP, kWordPairContext2, "WP",
+   {Atom::ppHW, Atom::ppHP}},
+  {Group::CONTEXT, Arc::nnHWP, kWordPairContext2, "WP",
+   {Atom::nnHW, Atom::nnHP}},
+  {Group::CONTEXT, Arc::ppMP, kWordPairContext2 | kWordPairLabeled, "P",
+   {Atom::ppMP}},
+  {Group::CONTEXT, Arc::nnMP, kWordPairContext2 | kWordPairLabeled, "P",
+   {Atom::nnMP}},
+  {Group::CONTEXT, Arc::ppMQ, kWordPairContext2 | kWordPairLabeled, "P",
+   {Atom::ppMQ}},
+  {Group::CONTEXT, Arc::nnMQ, kWordPairContext2 | kWordPairLabeled, "P",
+   {Atom::nnMQ}},
+  {Group::CONTEXT, Arc::ppMW, kWordPairContext2 | kWordPairLabeled, "W",
+   {Atom::ppMW}},
+  {Group::CONTEXT, Arc::nnMW, kWordPairContext2 | kWordPairLabeled, "W",
+   {Atom::nnMW}},
+  {Group::CONTEXT, Arc::ppML,
+   kWordPairContext2 | kWordPairLabeled | kWordPairLemmas, "W",
+   {Atom::ppML}},
+  {Group::CONTEXT, Arc::nnML,
+   kWordPairContext2 | kWordPairLabeled | kWordPairLemmas, "W",
+   {Atom::nnML}},
+  {Group::CONTEXT, Arc::ppMWP, kWordPairContext2 | kWordPairLabeled, "WP",
+   {Atom::ppMW, Atom::ppMP}},
+  {Group::CONTEXT, Arc::nnMWP, kWordPairContext2 | kWordPairLabeled, "WP",
+   {Atom::nnMW, Atom::nnMP}},
+
+  // Contextual bigram and trigram features involving POS.
+  {Group::CONTEXT, Arc::HP_pHP, 0, "PP", {Atom::HP, Atom::pHP}},
+  {Group::CONTEXT, Arc::HP_pHP_ppHP, 0, "PPP",
+   {Atom::HP, Atom::pHP, Atom::ppHP}},
+  {Group::CONTEXT, Arc::HP_nHP, 0, "PP", {Atom::HP, Atom::nHP}},
+  {Group::CONTEXT, Arc::HP_nHP_nnHP, 0, "PPP",
+   {Atom::HP, Atom::nHP, Atom::nnHP}},
+  {Group::CONTEXT, Arc::MP_pMP, kWordPairLabeled, "PP",
+   {Atom::MP, Atom::pMP}},
+  {Group::CONTEXT, Arc::MP_pMP_ppMP, kWordPairLabeled, "PPP",
+   {Atom::MP, Atom::pMP, Atom::ppMP}},
+  {Group::CONTEXT, Arc::MP_nMP, kWordPairLabeled, "PP",
+   {Atom::MP, Atom::nMP}},
+  {Group::CONTEXT, Arc::MP_nMP_nnMP, kWordPairLabeled, "PPP",
+   {Atom::MP, Atom::nMP, Atom::nnMP}},
+
+  // Dependency features (POS, lexical/bilexical, words and POS).
+  {Group::CONTEXT, Arc::HP_MP, 0, "PP", {Atom::HP, Atom::MP}},
+  {Group::CONTEXT, Arc::HW_MW, 0, "WW", {Atom::HW, Atom::MW}},
+  {Group::CONTEXT, Arc::HP_MW, 0, "WP", {Atom::MW, Atom::HP}},
+  {Group::CONTEXT, Arc::HP_MWP, 0, "WPP", {Atom::MW, Atom::MP, Atom::HP}},
+  {Group::CONTEXT, Arc::HW_MP, 0, "WP", {Atom::HW, Atom::MP}},
+  {Group::CONTEXT, Arc::HWP_MP, 0, "WPP", {Atom::HW, Atom::HP, Atom::MP}},
+  {Group::CONTEXT, Arc::HWP_MWP, 0, "WWPP",
+   {Atom::HW, Atom::MW, Atom::HP, Atom::MP}},
+
+  // Morpho-syntactic dependency features, alone and conjoined with POS.
+  {Group::MORPH_PAIR, Arc::HF_MF, kWordPairMorphology, "WW",
+   {Atom::HF, Atom::MF}},
+  {Group::MORPH_PAIR, Arc::HF_MP, kWordPairMorphology, "WP",
+   {Atom::HF, Atom::MP}},
+  {Group::MORPH_PAIR, Arc::HF_MFP, kWordPairMorphology, "WWP",
+   {Atom::HF, Atom::MF, Atom::MP}},
+  {Group::MORPH_PAIR, Arc::HP_MF, kWordPairMorphology, "WP",
+   {Atom::MF, Atom::HP}},
+  {Group::MORPH_PAIR, Arc::HFP_MF, kWordPairMorphology, "WWP",
+   {Atom::HF, Atom::MF, Atom::HP}},
+  {Group::MORPH_PAIR, Arc::HFP_MP, kWordPairMorphology, "WPP",
+   {Atom::HF, Atom::HP, Atom::MP}},
+  {Group::MORPH_PAIR, Arc::HP_MFP, kWordPairMorphology, "WPP",
+   {Atom::MF, Atom::HP, Atom::MP}},
+  {Group::MORPH_PAIR, Arc::HFP_MFP, kWordPairMorphology, "WWPP",
+   {Atom::HF, Atom::MF, Atom::HP, Atom::MP}},
+
+  // Contextual dependency features.
+  {Group::CONTEXT_DEPENDENCY, Arc::HP_MP_pHP, 0, "PPP",
+   {Atom::HP, Atom::MP, Atom::pHP}},
+  {Group::CONTEXT_DEPENDENCY, Arc::HP_MP_nHP, 0, "PPP",
+   {Atom::HP, Atom::MP, Atom::nHP}},
+  {Group::CONTEXT_DEPENDENCY, Arc::HP_MP_pMP, 0, "PPP",
+   {Atom::HP, Atom::MP, Atom::pMP}},
+  {Group::CONTEXT_DEPENDENCY, Arc::HP_MP_nMP, 0, "PPP",
+   {Atom::HP, Atom::MP, Atom::nMP}},
+  {Group::CONTEXT_DEPENDENCY, Arc::HP_MP_pHP_pMP, 0, "PPPP",
+   {Atom::HP, Atom::MP, Atom::pHP, Atom::pMP}},
+  {Group::CONTEXT_DEPENDENCY, Arc::HP_MP_nHP_nMP, 0, "PPPP",
+   {Atom::HP, Atom::MP, Atom::nHP, Atom::nMP}},
+  {Group::CONTEXT_DEPENDENCY, Arc::HP_MP_pHP_nMP, 0, "PPPP",
+   {Atom::HP, Atom::MP, Atom::pHP, Atom::nMP}},
+  {Group::CONTEXT_DEPENDENCY, Arc::HP_MP_nHP_pMP, 0, "PPPP",
+   {Atom::HP, Atom::MP, Atom::nHP, Atom::pMP}},
+  {Group::CONTEXT_DEPENDENCY, Arc::HP_MP_pHP_nHP_pMP_nMP, 0, "PPPPPP",
+   {Atom::HP, Atom::MP, Atom::pHP, Atom::nHP, Atom::pMP, Atom::nMP}},
+
+  // Features for adjacent dependencies.
+  {Group::RIGHT_ADJACENT, Arc::HP_MP_pHP, 0, "PPPP",
+   {Atom::HP, Atom::MP, Atom::pHP, Atom::ONE}},
+  {Group::RIGHT_ADJACENT, Arc::HP_MP_nMP, 0, "PPPP",
+   {Atom::HP, Atom::MP, Atom::nMP, Atom::ONE}},
+  {Group::RIGHT_ADJACENT, Arc::HP_MP_pHP_nMP, 0, "PPPPP",
+   {Atom::HP, Atom::MP, Atom::pHP, Atom::nMP, Atom::ONE}},
+  {Group::LEFT_ADJACENT, Arc::HP_MP_nHP, 0, "PPPP",
+   {Atom::HP, Atom::MP, Atom::nHP, Atom::ONE}},
+  {Group::LEFT_ADJACENT, Arc::HP_MP_pMP, 0, "PPPP",
+   {Atom::HP, Atom::MP, Atom::pMP, Atom::ONE}},
+  {Group::LEFT_ADJACENT, Arc::HP_MP_nHP_pMP, 0, "PPPPP",
+   {Atom::HP, Atom::MP, Atom::nHP, Atom::pMP, Atom::ONE}},
+
+  // Exact and binned arc length, alone and conjoined with POS.
+  {Group::DISTANCE, Arc::DIST, 0, "P", {Atom::DIST}},
+  {Group::BIN, Arc::BIAS, 0, "P", {Atom::BIN}},
+  {Group::BIN_POS, Arc::HP, 0, "PP", {Atom::HP, Atom::BIN}},
+  {Group::BIN_POS, Arc::MP, 0, "PP", {Atom::MP, Atom::BIN}},
+  {Group::BIN_POS, Arc::HP_MP, 0, "PPP", {Atom::HP, Atom::MP, Atom::BIN}},
+
+  // In-between flags, alone and conjoined with POS.
+  {Group::BETWEEN_FLAGS, Arc::BFLAG, 0, "P", {Atom::BFLAG_VERB}},
+  {Group::BETWEEN_FLAGS, Arc::BFLAG, 0, "P", {Atom::BFLAG_PUNC}},
+  {Group::BETWEEN_FLAGS, Arc::BFLAG, 0, "P", {Atom::BFLAG_COORD}},
+  {Group::BETWEEN_FLAGS, Arc::HP_MP_BFLAG, 0, "PPP",
+   {Atom::HP, Atom::MP, Atom::BFLAG_VERB}},
+  {Group::BETWEEN_FLAGS, Arc::HP_MP_BFLAG, 0, "PPP",
+   {Atom::HP, Atom::MP, Atom::BFLAG_PUNC}},
+  {Group::BETWEEN_FLAGS, Arc::HP_MP_BFLAG, 0, "PPP",
+   {Atom::HP, Atom::MP, Atom::BFLAG_COORD}},
+
+  // POS in the middle (for every word, even if its POS is repeated).
+  {Group::BETWEEN_POS, Arc::HP_MP_BP, 0, "PPP",
+   {Atom::HP, Atom::MP, Atom::BP}},
+  {Group::BETWEEN_POS, Arc::HW_MW_BP, 0, "WWP",
+   {Atom::HW, Atom::MW, Atom::BP}},
+  {Group::BETWEEN_POS, Arc::HW_MP_BP, 0, "WPP",
+   {Atom::HW, Atom::MP, Atom::BP}},
+  {Group::BETWEEN_POS, Arc::HP_MW_BP, 0, "WPP",
+   {Atom::MW, Atom::HP, Atom::BP}},
+};
+
+static constexpr int kNumWordPairTemplates =
+  sizeof(kWordPairTemplates) / sizeof(kWordPairTemplates[0]);
+
+template <int Group, int Options>
+using WordPairTemplates =
+  FeatureTemplateGroup<kWordPairTemplates, kNumWordPairTemplates, Group,
+                       Options>;
+
+// Options of the word pair templates for the current flags.
+static int GetWordPairOptions(bool labeled, bool use_lemma_features,
+                              bool use_morphological_features) {
+  int options = 0;
+  if (labeled) options |= kWordPairLabeled;
+  if (FLAGS_dependency_token_context >= 1) options |= kWordPairContext1;
+  if (FLAGS_dependency_token_context >= 2) options |= kWordPairContext2;
+  if (use_lemma_features) options |= kWordPairLemmas;
+  if (use_morphological_features) options |= kWordPairMorphology;
+  return options;
+}
+
+// Code of the k-th morpho-syntactic feature of a word, with the index k in
+// the lower 4 bits.
+static uint16_t GetMorphFeatureCode(DependencyInstanceNumeric* sentence,
+                                    int position, int k) {
+  uint16_t code = sentence->GetMorphFeature(position, k);
+  CHECK_LT(code, 0xfff);
+  if (k >= 0xf) {
+    LOG(WARNING) << "Too many morphological features (" << k << ")";
+    return (code << 4) | ((uint16_t)0xf);
+  }
+  return (code << 4) | ((uint16_t)k);
+}
 
+// Flags of the word pair keys: the pair type (4 bits) and the direction.
+static uint8_t GetWordPairFlags(int pair_type, int head, int modifier) {
   // Only 4 bits are allowed in feature_type.
   CHECK_LT(pair_type, 16);
   CHECK_GE(pair_type, 0);
-  uint8_t feature_type = pair_type;
-
-  int max_token_context = FLAGS_dependency_token_context; // 1.
+  uint8_t direction_code = (modifier < head) ? 0x0 : 0x1;
+  return static_cast<uint8_t>(pair_type) | (direction_code << 4);
+}
 
-  uint8_t direction_code; // 0x1 if right attachment, 0x0 otherwise.
-  uint8_t binned_length_code; // Binned arc length.
-  uint8_t exact_length_code; // Exact arc length.
-  int left_position, right_position;
-  if (modifier < head) {
-    left_position = modifier;
-    right_position = head;
-    direction_code = 0x0;
-  } else {
-    left_position = head;
-    right_position = modifier;
-    direction_code = 0x1;
-  }
+// Append the keys of the word pair features enabled with Options to features.
+// The number of keys is known once the loops are sized, so the vector is
+// resized once and the keys are written in place. If SourceOptions is not
+// negative, source holds the keys extracted for the same pair with
+// SourceOptions (a subset of Options); these are copied instead of being
+// extracted again, and only the others are computed (e.g. the lemma and
+// morpho-syntactic features missing from the features of the pruner). The
+// keys come in the same order either way.
+template <int Options, int SourceOptions>
+static void AddWordPairKeys(DependencyInstanceNumeric* sentence,
+                            uint8_t flags, int head, int modifier,
+                            const BinaryFeatures *source,
+                            BinaryFeatures *features) {
+  const bool copy_light = SourceOptions >= 0;
+  const bool labeled = (Options & kWordPairLabeled) != 0;
+  const bool lemmas = (Options & kWordPairLemmas) != 0;
+  const bool morphological = (Options & kWordPairMorphology) != 0;
+  int left_position = std::min(head, modifier);
+  int right_position = std::max(head, modifier);
   int arc_length = right_position - left_position;
 
-  // 7 possible values for binned_length_code (3 bits).
-  exact_length_code = (arc_length > 0xff) ? 0xff : arc_length;
-  if (arc_length > 40) {
-    binned_length_code = 0x6;
-  } else if (arc_length > 30) {
-    binned_length_code = 0x5;
-  } else if (arc_length > 20) {
-    binned_length_code = 0x4;
-  } else if (arc_length > 10) {
-    binned_length_code = 0x3;
-  } else if (arc_length > 5) {
-    binned_length_code = 0x2;
-  } else if (arc_length > 2) {
-    binned_length_code = 0x1;
-  } else {
-    binned_length_code = 0x0;
+  // Words/POS/lemmas and their context (padded with TOKEN_START/TOKEN_STOP).
+  // The values of the copied keys are not needed.
+  uint16_t values[Atom::COUNT];
+  values[Atom::HW] = sentence->GetFormId(head);
+  values[Atom::MW] = sentence->GetFormId(modifier);
+  values[Atom::HP] = sentence->GetCoarsePosId(head);
+  values[Atom::MP] = sentence->GetCoarsePosId(modifier);
+  if (lemmas) {
+    values[Atom::HL] = sentence->GetLemmaId(head);
+    values[Atom::ML] = sentence->GetLemmaId(modifier);
+    values[Atom::pHL] = sentence->GetContextLemmaId(head - 1);
+    values[Atom::pML] = sentence->GetContextLemmaId(modifier - 1);
+    values[Atom::nHL] = sentence->GetContextLemmaId(head + 1);
+    values[Atom::nML] = sentence->GetContextLemmaId(modifier + 1);
+    values[Atom::ppHL] = sentence->GetContextLemmaId(head - 2);
+    values[Atom::ppML] = sentence->GetContextLemmaId(modifier - 2);
+    values[Atom::nnHL] = sentence->GetContextLemmaId(head + 2);
+    values[Atom::nnML] = sentence->GetContextLemmaId(modifier + 2);
   }
-
-  // Codewords for accommodating word/POS information.
-  uint16_t HWID, MWID;
-  uint16_t HLID, MLID;
-  uint16_t HFID, MFID;
-  uint8_t HPID, MPID, BPID;
-  uint8_t HQID, MQID;
-  uint16_t pHWID, pMWID, nHWID, nMWID;
-  uint16_t pHLID, pMLID, nHLID, nMLID;
-  uint8_t pHPID, pMPID, nHPID, nMPID;
-  uint8_t pHQID, pMQID, nHQID, nMQID;
-  uint16_t ppHWID, ppMWID, nnHWID, nnMWID;
-  uint16_t ppHLID, ppMLID, nnHLID, nnMLID;
-  uint8_t ppHPID, ppMPID, nnHPID, nnMPID;
-  uint8_t ppHQID, ppMQID, nnHQID, nnMQID;
-
-  // Several flags.
-  // 4 bits to denote the kind of flag.
-  // Maximum will be 16 flags.
-  uint8_t flag_between_verb = 0x0;
-  uint8_t flag_between_punc = 0x1;
-  uint8_t flag_between_coord = 0x2;
-
-  // TODO: This is expensive and could be precomputed.
-  int num_between_verb = 0;
-  int num_between_punc = 0;
-  int num_between_coord = 0;
-  for (int i = left_position + 1; i < right_position; ++i) {
-    if (sentence->IsVerb(i)) {
-      ++num_between_verb;
-    } else if (sentence->IsPunctuation(i)) {
-      ++num_between_punc;
-    } else if (sentence->IsCoordination(i)) {
-      ++num_between_coord;
-    }
+  if (!copy_light) {
+    values[Atom::HQ] = sentence->GetPosId(head);
+    values[Atom::MQ] = sentence->GetPosId(modifier);
+    values[Atom::pHW] = sentence->GetContextFormId(head - 1);
+    values[Atom::pMW] = sentence->GetContextFormId(modifier - 1);
+    values[Atom::nHW] = sentence->GetContextFormId(head + 1);
+    values[Atom::nMW] = sentence->GetContextFormId(modifier + 1);
+    values[Atom::pHP] = sentence->GetContextCoarsePosId(head - 1);
+    values[Atom::pMP] = sentence->GetContextCoarsePosId(modifier - 1);
+    values[Atom::nHP] = sentence->GetContextCoarsePosId(head + 1);
+    values[Atom::nMP] = sentence->GetContextCoarsePosId(modifier + 1);
+    values[Atom::pHQ] = sentence->GetContextPosId(head - 1);
+    values[Atom::pMQ] = sentence->GetContextPosId(modifier - 1);
+    values[Atom::nHQ] = sentence->GetContextPosId(head + 1);
+    values[Atom::nMQ] = sentence->GetContextPosId(modifier + 1);
+    values[Atom::ppHW] = sentence->GetContextFormId(head - 2);
+    values[Atom::ppMW] = sentence->GetContextFormId(modifier - 2);
+    values[Atom::nnHW] = sentence->GetContextFormId(head + 2);
+    values[Atom::nnMW] = sentence->GetContextFormId(modifier + 2);
+    values[Atom::ppHP] = sentence->GetContextCoarsePosId(head - 2);
+    values[Atom::ppMP] = sentence->GetContextCoarsePosId(modifier - 2);
+    values[Atom::nnHP] = sentence->GetContextCoarsePosId(head + 2);
+    values[Atom::nnMP] = sentence->GetContextCoarsePosId(modifier + 2);
+    values[Atom::ppHQ] = sentence->GetContextPosId(head - 2);
+    values[Atom::ppMQ] = sentence->GetContextPosId(modifier - 2);
+    values[Atom::nnHQ] = sentence->GetContextPosId(head + 2);
+    values[Atom::nnMQ] = sentence->GetContextPosId(modifier + 2);
+    values[Atom::DIST] = (arc_length > 0xff) ? 0xff : arc_length;
+
+    // 4 bits to denote the kind of flag and 4 bits for the number of
+    // occurrences (at most 15). These counts are precomputed for the
+    // sentence.
+    int max_occurrences = 15;
+    int num_between_verb = std::min(
+      sentence->GetNumVerbsBetween(left_position, right_position),
+      max_occurrences);
+    int num_between_punc = std::min(
+      sentence->GetNumPunctuationsBetween(left_position, right_position),
+      max_occurrences);
+    int num_between_coord = std::min(
+      sentence->GetNumCoordinationsBetween(left_position, right_position),
+      max_occurrences);
+    values[Atom::BFLAG_VERB] = 0x0 | (num_between_verb << 4);
+    values[Atom::BFLAG_PUNC] = 0x1 | (num_between_punc << 4);
+    values[Atom::BFLAG_COORD] = 0x2 | (num_between_coord << 4);
+    values[Atom::ONE] = 0x1;
   }
 
-  // 4 bits to denote the number of occurrences for each flag.
-  // Maximum will be 15 occurrences.
-  int max_occurrences = 15;
-  if (num_between_verb > max_occurrences) num_between_verb = max_occurrences;
-  if (num_between_punc > max_occurrences) num_between_punc = max_occurrences;
-  if (num_between_coord > max_occurrences) num_between_coord = max_occurrences;
-  flag_between_verb |= (num_between_verb << 4);
-  flag_between_punc |= (num_between_punc << 4);
-  flag_between_coord |= (num_between_coord << 4);
-
-  // Maximum is 255 feature templates.
-  //LOG(INFO) << DependencyFeatureTemplateArc::COUNT;
-  CHECK_LT(DependencyFeatureTemplateArc::COUNT, 256);
-
-  uint64_t fkey;
-  uint8_t flags = 0;
-
-  // Words/POS.
-  HLID = sentence->GetLemmaId(head);
-  MLID = sentence->GetLemmaId(modifier);
-  HWID = sentence->GetFormId(head);
-  MWID = sentence->GetFormId(modifier);
-  HPID = sentence->GetCoarsePosId(head);
-  MPID = sentence->GetCoarsePosId(modifier);
-  HQID = sentence->GetPosId(head);
-  MQID = sentence->GetPosId(modifier);
-
-  // Contextual information.
-  // Context size = 1:
-  pHLID = (head > 0) ? sentence->GetLemmaId(head - 1) : TOKEN_START;
-  pMLID = (modifier > 0) ? sentence->GetLemmaId(modifier - 1) : TOKEN_START;
-  pHWID = (head > 0) ? sentence->GetFormId(head - 1) : TOKEN_START;
-  pMWID = (modifier > 0) ? sentence->GetFormId(modifier - 1) : TOKEN_START;
-  pHPID = (head > 0) ? sentence->GetCoarsePosId(head - 1) : TOKEN_START;
-  pMPID = (modifier > 0) ? sentence->GetCoarsePosId(modifier - 1) : TOKEN_START;
-  pHQID = (head > 0) ? sentence->GetPosId(head - 1) : TOKEN_START;
-  pMQID = (modifier > 0) ? sentence->GetPosId(modifier - 1) : TOKEN_START;
-
-  nHLID = (head < sentence_length - 1) ?
-    sentence->GetLemmaId(head + 1) : TOKEN_STOP;
-  nMLID = (modifier < sentence_length - 1) ?
-    sentence->GetLemmaId(modifier + 1) : TOKEN_STOP;
-  nHWID = (head < sentence_length - 1) ?
-    sentence->GetFormId(head + 1) : TOKEN_STOP;
-  nMWID = (modifier < sentence_length - 1) ?
-    sentence->GetFormId(modifier + 1) : TOKEN_STOP;
-  nHPID = (head < sentence_length - 1) ?
-    sentence->GetCoarsePosId(head + 1) : TOKEN_STOP;
-  nMPID = (modifier < sentence_length - 1) ?
-    sentence->GetCoarsePosId(modifier + 1) : TOKEN_STOP;
-  nHQID = (head < sentence_length - 1) ?
-    sentence->GetPosId(head + 1) : TOKEN_STOP;
-  nMQID = (modifier < sentence_length - 1) ?
-    sentence->GetPosId(modifier + 1) : TOKEN_STOP;
-
-  // Context size = 2:
-  ppHLID = (head > 1) ? sentence->GetLemmaId(head - 2) : TOKEN_START;
-  ppMLID = (modifier > 1) ? sentence->GetLemmaId(modifier - 2) : TOKEN_START;
-  ppHWID = (head > 1) ? sentence->GetFormId(head - 2) : TOKEN_START;
-  ppMWID = (modifier > 1) ? sentence->GetFormId(modifier - 2) : TOKEN_START;
-  ppHPID = (head > 1) ? sentence->GetCoarsePosId(head - 2) : TOKEN_START;
-  ppMPID = (modifier > 1) ? sentence->GetCoarsePosId(modifier - 2) : TOKEN_START;
-  ppHQID = (head > 1) ? sentence->GetPosId(head - 2) : TOKEN_START;
-  ppMQID = (modifier > 1) ? sentence->GetPosId(modifier - 2) : TOKEN_START;
-
-  nnHLID = (head < sentence_length - 2) ?
-    sentence->GetLemmaId(head + 2) : TOKEN_STOP;
-  nnMLID = (modifier < sentence_length - 2) ?
-    sentence->GetLemmaId(modifier + 2) : TOKEN_STOP;
-  nnHWID = (head < sentence_length - 2) ?
-    sentence->GetFormId(head + 2) : TOKEN_STOP;
-  nnMWID = (modifier < sentence_length - 2) ?
-    sentence->GetFormId(modifier + 2) : TOKEN_STOP;
-  nnHPID = (head < sentence_length - 2) ?
-    sentence->GetCoarsePosId(head + 2) : TOKEN_STOP;
-  nnMPID = (modifier < sentence_length - 2) ?
-    sentence->GetCoarsePosId(modifier + 2) : TOKEN_STOP;
-  nnHQID = (head < sentence_length - 2) ?
-    sentence->GetPosId(head + 2) : TOKEN_STOP;
-  nnMQID = (modifier < sentence_length - 2) ?
-    sentence->GetPosId(modifier + 2) : TOKEN_STOP;
-
-  // Code for feature type.
-  flags = feature_type; // 4 bits.
-  flags |= (direction_code << 4); // 1 more bit.
-
-  // Bias feature (not in EGSTRA).
-  fkey = encoder_.CreateFKey_NONE(DependencyFeatureTemplateArc::BIAS, flags);
-  AddFeature(fkey, features);
-
-  /////////////////////////////////////////////////////////////////////////////
-  // Token features.
-  /////////////////////////////////////////////////////////////////////////////
-
-  // Note: in EGSTRA (but not here), token and token contextual features go
-  // without direction flags.
-  // Coarse POS features.
-  fkey = encoder_.CreateFKey_P(DependencyFeatureTemplateArc::HP, flags, HPID);
-  AddFeature(fkey, features);
-  // Fine POS features.
-  fkey = encoder_.CreateFKey_P(DependencyFeatureTemplateArc::HQ, flags, HQID);
-  AddFeature(fkey, features);
-  // Lexical features.
-  fkey = encoder_.CreateFKey_W(DependencyFeatureTemplateArc::HW, flags, HWID);
-  AddFeature(fkey, features);
-  if (use_lemma_features) {
-    fkey = encoder_.CreateFKey_W(DependencyFeatureTemplateArc::HL, flags, HLID);
-    AddFeature(fkey, features);
+  int num_head_features =
+    morphological ? sentence->GetNumMorphFeatures(head) : 0;
+  int num_modifier_features =
+    labeled || morphological ? sentence->GetNumMorphFeatures(modifier) : 0;
+  bool right_adjacent = (head != 0 && head == modifier - 1);
+  bool left_adjacent = (head != 0 && head == modifier + 1);
+  // 7 possible values for the binned length code (3 bits).
+  int num_bins = sentence->GetBinnedLengthCode(arc_length) + 1;
+  int num_between = std::max(arc_length - 1, 0);
+  int num_keys =
+    WordPairTemplates<Group::HEAD_TOKEN, Options>::NumKeys +
+    num_head_features *
+    WordPairTemplates<Group::HEAD_MORPH, Options>::NumKeys +
+    WordPairTemplates<Group::MODIFIER_TOKEN, Options>::NumKeys +
+    num_modifier_features *
+    WordPairTemplates<Group::MODIFIER_MORPH, Options>::NumKeys +
+    WordPairTemplates<Group::CONTEXT, Options>::NumKeys +
+    num_head_features * num_modifier_features *
+    WordPairTemplates<Group::MORPH_PAIR, Options>::NumKeys +
+    WordPairTemplates<Group::CONTEXT_DEPENDENCY, Options>::NumKeys +
+    (right_adjacent ?
+     WordPairTemplates<Group::RIGHT_ADJACENT, Options>::NumKeys : 0) +
+    (left_adjacent ?
+     WordPairTemplates<Group::LEFT_ADJACENT, Options>::NumKeys : 0) +
+    WordPairTemplates<Group::DISTANCE, Options>::NumKeys +
+    num_bins * (WordPairTemplates<Group::BIN, Options>::NumKeys +
+                WordPairTemplates<Group::BIN_POS, Options>::NumKeys) +
+    WordPairTemplates<Group::BETWEEN_FLAGS, Options>::NumKeys +
+    num_between * WordPairTemplates<Group::BETWEEN_POS, Options>::NumKeys;
+  int offset = features->size();
+  features->resize(offset + num_keys);
+  uint64_t *keys = features->data() + offset;
+  const uint64_t *light_keys = copy_light ? source->data() : NULL;
+
+#define WRITE_WORD_PAIR_GROUP(group) \
+  keys = WordPairTemplates<Group::group, Options>::template \
+    Splice<SourceOptions>(flags, values, &light_keys, keys)
+
+  WRITE_WORD_PAIR_GROUP(HEAD_TOKEN);
+  // Technically should add context to the morpho-syntactic features too to
+  // match EGSTRA, but it would not add much relevant information.
+  for (int j = 0; j < num_head_features; ++j) {
+    values[Atom::HF] = GetMorphFeatureCode(sentence, head, j);
+    WRITE_WORD_PAIR_GROUP(HEAD_MORPH);
   }
-  // Features involving words and POS.
-  fkey = encoder_.CreateFKey_WP(DependencyFeatureTemplateArc::HWP, flags, HWID, HPID);
-  AddFeature(fkey, features);
-  // Morpho-syntactic features.
-  // Technically should add context here too to match egstra, but I don't think it
-  // would add much relevant information.
-  if (use_morphological_features) {
-    for (int j = 0; j < sentence->GetNumMorphFeatures(head); ++j) {
-      HFID = sentence->GetMorphFeature(head, j);
-      CHECK_LT(HFID, 0xfff);
-      if (j >= 0xf) {
-        LOG(WARNING) << "Too many morphological features (" << j << ")";
-        HFID = (HFID << 4) | ((uint16_t)0xf);
-      } else {
-        HFID = (HFID << 4) | ((uint16_t)j);
+  WRITE_WORD_PAIR_GROUP(MODIFIER_TOKEN);
+  if (WordPairTemplates<Group::MODIFIER_MORPH, Options>::NumKeys > 0) {
+    for (int k = 0; k < num_modifier_features; ++k) {
+      if (!copy_light) {
+        values[Atom::MF] = GetMorphFeatureCode(sentence, modifier, k);
       }
-      fkey = encoder_.CreateFKey_W(DependencyFeatureTemplateArc::HF, flags, HFID);
-      AddFeature(fkey, features);
-      fkey = encoder_.CreateFKey_WW(DependencyFeatureTemplateArc::HWF, flags, HWID, HFID);
-      AddFeature(fkey, features);
+      WRITE_WORD_PAIR_GROUP(MODIFIER_MORPH);
     }
   }
-
-  // If labeled parsing, features involving the modifier only are still useful,
-  // since they will be conjoined with the label.
-  if (labeled) {
-    fkey = encoder_.CreateFKey_P(DependencyFeatureTemplateArc::MP, flags, MPID);
-    AddFeature(fkey, features);
-    fkey = encoder_.CreateFKey_P(DependencyFeatureTemplateArc::MQ, flags, MQID);
-    AddFeature(fkey, features);
-    fkey = encoder_.CreateFKey_W(DependencyFeatureTemplateArc::MW, flags, MWID);
-    AddFeature(fkey, features);
-    if (use_lemma_features) {
-      fkey = encoder_.CreateFKey_W(DependencyFeatureTemplateArc::ML, flags, MLID);
-      AddFeature(fkey, features);
-    }
-    fkey = encoder_.CreateFKey_WP(DependencyFeatureTemplateArc::MWP, flags, MWID, MPID);
-    AddFeature(fkey, features);
-    for (int k = 0; k < sentence->GetNumMorphFeatures(modifier); ++k) {
-      MFID = sentence->GetMorphFeature(modifier, k);
-      CHECK_LT(MFID, 0xfff);
-      if (k >= 0xf) {
-        LOG(WARNING) << "Too many morphological features (" << k << ")";
-        MFID = (MFID << 4) | ((uint16_t)0xf);
-      } else {
-        MFID = (MFID << 4) | ((uint16_t)k);
-      }
-      fkey = encoder_.CreateFKey_W(DependencyFeatureTemplateArc::MF, flags, MFID);
-      AddFeature(fkey, features);
-      fkey = encoder_.CreateFKey_WW(DependencyFeatureTemplateArc::MWF, flags, MWID, MFID);
-      AddFeature(fkey, features);
+  WRITE_WORD_PAIR_GROUP(CONTEXT);
+  for (int j = 0; j < num_head_features; ++j) {
+    values[Atom::HF] = GetMorphFeatureCode(sentence, head, j);
+    for (int k = 0; k < num_modifier_features; ++k) {
+      values[Atom::MF] = GetMorphFeatureCode(sentence, modifier, k);
+      WRITE_WORD_PAIR_GROUP(MORPH_PAIR);
     }
   }
-
-  /////////////////////////////////////////////////////////////////////////////
-  // Token contextual features.
-  /////////////////////////////////////////////////////////////////////////////
-
-  if (max_token_context >= 1) {
-    fkey = encoder_.CreateFKey_P(DependencyFeatureTemplateArc::pHP, flags, pHPID);
-    AddFeature(fkey, features);
-    fkey = encoder_.CreateFKey_P(DependencyFeatureTemplateArc::nHP, flags, nHPID);
-    AddFeature(fkey, features);
-    fkey = encoder_.CreateFKey_P(DependencyFeatureTemplateArc::pHQ, flags, pHQID);
-    AddFeature(fkey, features);
-    fkey = encoder_.CreateFKey_P(DependencyFeatureTemplateArc::nHQ, flags, nHQID);
-    AddFeature(fkey, features);
-    fkey = encoder_.CreateFKey_W(DependencyFeatureTemplateArc::pHW, flags, pHWID);
-    AddFeature(fkey, features);
-    fkey = encoder_.CreateFKey_W(DependencyFeatureTemplateArc::nHW, flags, nHWID);
-    AddFeature(fkey, features);
-    if (use_lemma_features) {
-      fkey = encoder_.CreateFKey_W(DependencyFeatureTemplateArc::pHL, flags, pHLID);
-      AddFeature(fkey, features);
-      fkey = encoder_.CreateFKey_W(DependencyFeatureTemplateArc::nHL, flags, nHLID);
-      AddFeature(fkey, features);
-    }
-    fkey = encoder_.CreateFKey_WP(DependencyFeatureTemplateArc::pHWP, flags, pHWID, pHPID);
-    AddFeature(fkey, features);
-    fkey = encoder_.CreateFKey_WP(DependencyFeatureTemplateArc::nHWP, flags, nHWID, nHPID);
-    AddFeature(fkey, features);
-
-    // If labeled parsing, features involving the modifier only are still useful,
-    // since they will be conjoined with the label.
-    if (labeled) {
-      fkey = encoder_.CreateFKey_P(DependencyFeatureTemplateArc::pMP, flags, pMPID);
-      AddFeature(fkey, features);
-      fkey = encoder_.CreateFKey_P(DependencyFeatureTemplateArc::nMP, flags, nMPID);
-      AddFeature(fkey, features);
-      fkey = encoder_.CreateFKey_P(DependencyFeatureTemplateArc::pMQ, flags, pMQID);
-      AddFeature(fkey, features);
-      fkey = encoder_.CreateFKey_P(DependencyFeatureTemplateArc::nMQ, flags, nMQID);
-      AddFeature(fkey, features);
-      fkey = encoder_.CreateFKey_W(DependencyFeatureTemplateArc::pMW, flags, pMWID);
-      AddFeature(fkey, features);
-      fkey = encoder_.CreateFKey_W(DependencyFeatureTemplateArc::nMW, flags, nMWID);
-      AddFeature(fkey, features);
-      if (use_lemma_features) {
-        fkey = encoder_.CreateFKey_W(DependencyFeatureTemplateArc::pML, flags, pMLID);
-        AddFeature(fkey, features);
-        fkey = encoder_.CreateFKey_W(DependencyFeatureTemplateArc::nML, flags, nMLID);
-        AddFeature(fkey, features);
-      }
-      fkey = encoder_.CreateFKey_WP(DependencyFeatureTemplateArc::pMWP, flags, pMWID, pMPID);
-      AddFeature(fkey, features);
-      fkey = encoder_.CreateFKey_WP(DependencyFeatureTemplateArc::nMWP, flags, nMWID, nMPID);
-      AddFeature(fkey, features);
-    }
+  WRITE_WORD_PAIR_GROUP(CONTEXT_DEPENDENCY);
+  if (right_adjacent) {
+    WRITE_WORD_PAIR_GROUP(RIGHT_ADJACENT);
+  } else if (left_adjacent) {
+    WRITE_WORD_PAIR_GROUP(LEFT_ADJACENT);
   }
-
-  if (max_token_context >= 2) {
-    fkey = encoder_.CreateFKey_P(DependencyFeatureTemplateArc::ppHP, flags, ppHPID);
-    AddFeature(fkey, features);
-    fkey = encoder_.CreateFKey_P(DependencyFeatureTemplateArc::nnHP, flags, nnHPID);
-    AddFeature(fkey, features);
-    fkey = encoder_.CreateFKey_P(DependencyFeatureTemplateArc::ppHQ, flags, ppHQID);
-    AddFeature(fkey, features);
-    fkey = encoder_.CreateFKey_P(DependencyFeatureTemplateArc::nnHQ, flags, nnHQID);
-    AddFeature(fkey, features);
-    fkey = encoder_.CreateFKey_W(DependencyFeatureTemplateArc::ppHW, flags, ppHWID);
-    AddFeature(fkey, features);
-    fkey = encoder_.CreateFKey_W(DependencyFeatureTemplateArc::nnHW, flags, nnHWID);
-    AddFeature(fkey, features);
-    if (use_lemma_features) {
-      fkey = encoder_.CreateFKey_W(DependencyFeatureTemplateArc::ppHL, flags, ppHLID);
-      AddFeature(fkey, features);
-      fkey = encoder_.CreateFKey_W(DependencyFeatureTemplateArc::nnHL, flags, nnHLID);
-      AddFeature(fkey, features);
-    }
-    fkey = encoder_.CreateFKey_WP(DependencyFeatureTemplateArc::ppHWP, flags, ppHWID, ppHPID);
-    AddFeature(fkey, features);
-    fkey = encoder_.CreateFKey_WP(DependencyFeatureTemplateArc::nnHWP, flags, nnHWID, nnHPID);
-    AddFeature(fkey, features);
-
-    // If labeled parsing, features involving the modifier only are still useful,
-    // since they will be conjoined with the label.
-    if (labeled) {
-      fkey = encoder_.CreateFKey_P(DependencyFeatureTemplateArc::ppMP, flags, ppMPID);
-      AddFeature(fkey, features);
-      fkey = encoder_.CreateFKey_P(DependencyFeatureTemplateArc::nnMP, flags, nnMPID);
-      AddFeature(fkey, features);
-      fkey = encoder_.CreateFKey_P(DependencyFeatureTemplateArc::ppMQ, flags, ppMQID);
-      AddFeature(fkey, features);
-      fkey = encoder_.CreateFKey_P(DependencyFeatureTemplateArc::nnMQ, flags, nnMQID);
-      AddFeature(fkey, features);
-      fkey = encoder_.CreateFKey_W(DependencyFeatureTemplateArc::ppMW, flags, ppMWID);
-      AddFeature(fkey, features);
-      fkey = encoder_.CreateFKey_W(DependencyFeatureTemplateArc::nnMW, flags, nnMWID);
-      AddFeature(fkey, features);
-      if (use_lemma_features) {
-        fkey = encoder_.CreateFKey_W(DependencyFeatureTemplateArc::ppML, flags, ppMLID);
-        AddFeature(fkey, features);
-        fkey = encoder_.CreateFKey_W(DependencyFeatureTemplateArc::nnML, flags, nnMLID);
-        AddFeature(fkey, features);
-      }
-      fkey = encoder_.CreateFKey_WP(DependencyFeatureTemplateArc::ppMWP, flags, ppMWID, ppMPID);
-      AddFeature(fkey, features);
-      fkey = encoder_.CreateFKey_WP(DependencyFeatureTemplateArc::nnMWP, flags, nnMWID, nnMPID);
-      AddFeature(fkey, features);
-    }
+  WRITE_WORD_PAIR_GROUP(DISTANCE);
+  for (int bin = 0; bin < num_bins; ++bin) {
+    values[Atom::BIN] = bin;
+    WRITE_WORD_PAIR_GROUP(BIN);
   }
-
-  // Contextual bigram and trigram features involving POS.
-  fkey = encoder_.CreateFKey_PP(DependencyFeatureTemplateArc::HP_pHP, flags, HPID, pHPID);
-  AddFeature(fkey, features);
-  fkey = encoder_.CreateFKey_PPP(DependencyFeatureTemplateArc::HP_pHP_ppHP, flags, HPID, pHPID, ppHPID);
-  AddFeature(fkey, features);
-  fkey = encoder_.CreateFKey_PP(DependencyFeatureTemplateArc::HP_nHP, flags, HPID, nHPID);
-  AddFeature(fkey, features);
-  fkey = encoder_.CreateFKey_PPP(DependencyFeatureTemplateArc::HP_nHP_nnHP, flags, HPID, nHPID, nnHPID);
-  AddFeature(fkey, features);
-
-  // If labeled parsing, features involving the modifier only are still useful,
-  // since they will be conjoined with the label.
-  if (labeled) {
-    fkey = encoder_.CreateFKey_PP(DependencyFeatureTemplateArc::MP_pMP, flags, MPID, pMPID);
-    AddFeature(fkey, features);
-    fkey = encoder_.CreateFKey_PPP(DependencyFeatureTemplateArc::MP_pMP_ppMP, flags, MPID, pMPID, ppMPID);
-    AddFeature(fkey, features);
-    fkey = encoder_.CreateFKey_PP(DependencyFeatureTemplateArc::MP_nMP, flags, MPID, nMPID);
-    AddFeature(fkey, features);
-    fkey = encoder_.CreateFKey_PPP(DependencyFeatureTemplateArc::MP_nMP_nnMP, flags, MPID, nMPID, nnMPID);
-    AddFeature(fkey, features);
+  for (int bin = 0; bin < num_bins; ++bin) {
+    values[Atom::BIN] = bin;
+    WRITE_WORD_PAIR_GROUP(BIN_POS);
   }
-
-  /////////////////////////////////////////////////////////////////////////////
-  // Dependency features.
-  // Everything goes with direction flags and with coarse POS.
-  /////////////////////////////////////////////////////////////////////////////
-
-  // POS features.
-  fkey = encoder_.CreateFKey_PP(DependencyFeatureTemplateArc::HP_MP, flags, HPID, MPID);
-  AddFeature(fkey, features);
-
-  // Lexical/Bilexical features.
-  fkey = encoder_.CreateFKey_WW(DependencyFeatureTemplateArc::HW_MW, flags, HWID, MWID);
-  AddFeature(fkey, features);
-
-  // Features involving words and POS.
-  fkey = encoder_.CreateFKey_WP(DependencyFeatureTemplateArc::HP_MW, flags, MWID, HPID);
-  AddFeature(fkey, features);
-  fkey = encoder_.CreateFKey_WPP(DependencyFeatureTemplateArc::HP_MWP, flags, MWID, MPID, HPID);
-  AddFeature(fkey, features);
-  fkey = encoder_.CreateFKey_WP(DependencyFeatureTemplateArc::HW_MP, flags, HWID, MPID);
-  AddFeature(fkey, features);
-  fkey = encoder_.CreateFKey_WPP(DependencyFeatureTemplateArc::HWP_MP, flags, HWID, HPID, MPID);
-  AddFeature(fkey, features);
-  fkey = encoder_.CreateFKey_WWPP(DependencyFeatureTemplateArc::HWP_MWP, flags, HWID, MWID, HPID, MPID);
-  AddFeature(fkey, features);
-
-  // Morpho-syntactic features.
-  if (use_morphological_features) {
-    for (int j = 0; j < sentence->GetNumMorphFeatures(head); ++j) {
-      HFID = sentence->GetMorphFeature(head, j);
-      CHECK_LT(HFID, 0xfff);
-      if (j >= 0xf) {
-        LOG(WARNING) << "Too many morphological features (" << j << ")";
-        HFID = (HFID << 4) | ((uint16_t)0xf);
-      } else {
-        HFID = (HFID << 4) | ((uint16_t)j);
-      }
-      for (int k = 0; k < sentence->GetNumMorphFeatures(modifier); ++k) {
-        MFID = sentence->GetMorphFeature(modifier, k);
-        CHECK_LT(MFID, 0xfff);
-        if (k >= 0xf) {
-          LOG(WARNING) << "Too many morphological features (" << k << ")";
-          MFID = (MFID << 4) | ((uint16_t)0xf);
-        } else {
-          MFID = (MFID << 4) | ((uint16_t)k);
-        }
-        // Morphological features.
-        fkey = encoder_.CreateFKey_WW(DependencyFeatureTemplateArc::HF_MF, flags, HFID, MFID);
-        AddFeature(fkey, features);
-
-        // Morphological features conjoined with POS.
-        fkey = encoder_.CreateFKey_WP(DependencyFeatureTemplateArc::HF_MP, flags, HFID, MPID);
-        AddFeature(fkey, features);
-        fkey = encoder_.CreateFKey_WWP(DependencyFeatureTemplateArc::HF_MFP, flags, HFID, MFID, MPID);
-        AddFeature(fkey, features);
-        fkey = encoder_.CreateFKey_WP(DependencyFeatureTemplateArc::HP_MF, flags, MFID, HPID);
-        AddFeature(fkey, features);
-        fkey = encoder_.CreateFKey_WWP(DependencyFeatureTemplateArc::HFP_MF, flags, HFID, MFID, HPID);
-        AddFeature(fkey, features);
-        fkey = encoder_.CreateFKey_WPP(DependencyFeatureTemplateArc::HFP_MP, flags, HFID, HPID, MPID);
-        AddFeature(fkey, features);
-        fkey = encoder_.CreateFKey_WPP(DependencyFeatureTemplateArc::HP_MFP, flags, MFID, HPID, MPID);
-        AddFeature(fkey, features);
-        fkey = encoder_.CreateFKey_WWPP(DependencyFeatureTemplateArc::HFP_MFP, flags, HFID, MFID, HPID, MPID);
-        AddFeature(fkey, features);
-      }
-    }
+  WRITE_WORD_PAIR_GROUP(BETWEEN_FLAGS);
+  for (int i = left_position + 1; i < right_position; ++i) {
+    if (!copy_light) values[Atom::BP] = sentence->GetCoarsePosId(i);
+    WRITE_WORD_PAIR_GROUP(BETWEEN_POS);
   }
 
-  // Contextual features.
-  fkey = encoder_.CreateFKey_PPP(DependencyFeatureTemplateArc::HP_MP_pHP, flags, HPID, MPID, pHPID);
-  AddFeature(fkey, features);
-  fkey = encoder_.CreateFKey_PPP(DependencyFeatureTemplateArc::HP_MP_nHP, flags, HPID, MPID, nHPID);
-  AddFeature(fkey, features);
-  fkey = encoder_.CreateFKey_PPP(DependencyFeatureTemplateArc::HP_MP_pMP, flags, HPID, MPID, pMPID);
-  AddFeature(fkey, features);
-  fkey = encoder_.CreateFKey_PPP(DependencyFeatureTemplateArc::HP_MP_nMP, flags, HPID, MPID, nMPID);
-  AddFeature(fkey, features);
-  fkey = encoder_.CreateFKey_PPPP(DependencyFeatureTemplateArc::HP_MP_pHP_pMP, flags, HPID, MPID, pHPID, pMPID);
-  AddFeature(fkey, features);
-  fkey = encoder_.CreateFKey_PPPP(DependencyFeatureTemplateArc::HP_MP_nHP_nMP, flags, HPID, MPID, nHPID, nMPID);
-  AddFeature(fkey, features);
-  fkey = encoder_.CreateFKey_PPPP(DependencyFeatureTemplateArc::HP_MP_pHP_nMP, flags, HPID, MPID, pHPID, nMPID);
-  AddFeature(fkey, features);
-  fkey = encoder_.CreateFKey_PPPP(DependencyFeatureTemplateArc::HP_MP_nHP_pMP, flags, HPID, MPID, nHPID, pMPID);
-  AddFeature(fkey, features);
-  fkey = encoder_.CreateFKey_PPPPPP(DependencyFeatureTemplateArc::HP_MP_pHP_nHP_pMP_nMP, flags, HPID, MPID, pHPID, nHPID, pMPID, nMPID);
-  AddFeature(fkey, features);
-
-  // Features for adjacent dependencies.
-  if (head != 0 && head == modifier - 1) {
-    fkey = encoder_.CreateFKey_PPPP(DependencyFeatureTemplateArc::HP_MP_pHP, flags, HPID, MPID, pHPID, 0x1);
-    AddFeature(fkey, features);
-    fkey = encoder_.CreateFKey_PPPP(DependencyFeatureTemplateArc::HP_MP_nMP, flags, HPID, MPID, nMPID, 0x1);
-    AddFeature(fkey, features);
-    fkey = encoder_.CreateFKey_PPPPP(DependencyFeatureTemplateArc::HP_MP_pHP_nMP, flags, HPID, MPID, pHPID, nMPID, 0x1);
-    AddFeature(fkey, features);
-  } else if (head != 0 && head == modifier + 1) {
-    fkey = encoder_.CreateFKey_PPPP(DependencyFeatureTemplateArc::HP_MP_nHP, flags, HPID, MPID, nHPID, 0x1);
-    AddFeature(fkey, features);
-    fkey = encoder_.CreateFKey_PPPP(DependencyFeatureTemplateArc::HP_MP_pMP, flags, HPID, MPID, pMPID, 0x1);
-    AddFeature(fkey, features);
-    fkey = encoder_.CreateFKey_PPPPP(DependencyFeatureTemplateArc::HP_MP_nHP_pMP, flags, HPID, MPID, nHPID, pMPID, 0x1);
-    AddFeature(fkey, features);
-  }
+#undef WRITE_WORD_PAIR_GROUP
 
-  // Exact arc length.
-  fkey = encoder_.CreateFKey_P(DependencyFeatureTemplateArc::DIST, flags, exact_length_code);
-  AddFeature(fkey, features);
+  DCHECK(keys == features->data() + features->size());
+  DCHECK(!copy_light || light_keys == source->data() + source->size());
+}
 
-  // Binned arc length.
-  for (uint8_t bin = 0; bin <= binned_length_code; ++bin) {
-    fkey = encoder_.CreateFKey_P(DependencyFeatureTemplateArc::BIAS, flags, bin);
-    AddFeature(fkey, features);
-  }
+typedef void (*WordPairKeyAdder)(DependencyInstanceNumeric*, uint8_t, int,
+                                 int, const BinaryFeatures*, BinaryFeatures*);
+
+// The specialized key adders, indexed by their options: those extracting all
+// the keys, and those completing the keys extracted without lemmas and
+// morpho-syntactic features (with the same other options).
+template <size_t... Options>
+static const WordPairKeyAdder *GetWordPairKeyAdders(
+  std::index_sequence<Options...>) {
+  static const WordPairKeyAdder adders[] = {
+    &AddWordPairKeys<Options, -1>...
+  };
+  return adders;
+}
 
-  // POS features conjoined with binned arc length.
-  for (uint8_t bin = 0; bin <= binned_length_code; bin++) {
-    fkey = encoder_.CreateFKey_PP(DependencyFeatureTemplateArc::HP, flags, HPID, bin);
-    AddFeature(fkey, features);
-    fkey = encoder_.CreateFKey_PP(DependencyFeatureTemplateArc::MP, flags, MPID, bin);
-    AddFeature(fkey, features);
-    fkey = encoder_.CreateFKey_PPP(DependencyFeatureTemplateArc::HP_MP, flags, HPID, MPID, bin);
-    AddFeature(fkey, features);
-  }
+template <size_t... Options>
+static const WordPairKeyAdder *GetWordPairSplicingKeyAdders(
+  std::index_sequence<Options...>) {
+  static const WordPairKeyAdder adders[] = {
+    &AddWordPairKeys<Options, Options &
+                     ~(kWordPairLemmas | kWordPairMorphology)>...
+  };
+  return adders;
+}
 
-  // In-between flags.
-  fkey = encoder_.CreateFKey_P(DependencyFeatureTemplateArc::BFLAG, flags, flag_between_verb);
-  AddFeature(fkey, features);
-  fkey = encoder_.CreateFKey_P(DependencyFeatureTemplateArc::BFLAG, flags, flag_between_punc);
-  AddFeature(fkey, features);
-  fkey = encoder_.CreateFKey_P(DependencyFeatureTemplateArc::BFLAG, flags, flag_between_coord);
-  AddFeature(fkey, features);
+// General function to add features for a pair of words (arcs, sibling words,
+// etc.) Can optionally use lemma and morpho-syntactic feature information.
+// The features are very similar to the ones used in Koo et al. EGSTRA.
+// They are defined by kWordPairTemplates, and written by the key adder
+// specialized for the current options.
+void DependencyFeatures::AddWordPairFeatures(DependencyInstanceNumeric* sentence,
+                                             int pair_type,
+                                             int head,
+                                             int modifier,
+                                             bool use_lemma_features,
+                                             bool use_morphological_features,
+                                             BinaryFeatures *features) {
+  // Maximum is 255 feature templates.
+  CHECK_LT(DependencyFeatureTemplateArc::COUNT, 256);
+  static const WordPairKeyAdder *adders =
+    GetWordPairKeyAdders(std::make_index_sequence<kNumWordPairOptions>());
 
-  // POS features conjoined with in-between flag.
-  fkey = encoder_.CreateFKey_PPP(DependencyFeatureTemplateArc::HP_MP_BFLAG, flags, HPID, MPID, flag_between_verb);
-  AddFeature(fkey, features);
-  fkey = encoder_.CreateFKey_PPP(DependencyFeatureTemplateArc::HP_MP_BFLAG, flags, HPID, MPID, flag_between_punc);
-  AddFeature(fkey, features);
-  fkey = encoder_.CreateFKey_PPP(DependencyFeatureTemplateArc::HP_MP_BFLAG, flags, HPID, MPID, flag_between_coord);
-  AddFeature(fkey, features);
+  bool labeled =
+    static_cast<DependencyOptions*>(pipe_->GetOptions())->labeled();
+  int options = GetWordPairOptions(labeled, use_lemma_features,
+                                   use_morphological_features);
+  adders[options](sentence, GetWordPairFlags(pair_type, head, modifier),
+                  head, modifier, NULL, features);
+}
 
-  set<int> BPIDs;
-  set<int> BWIDs;
-  for (int i = left_position + 1; i < right_position; ++i) {
-    BPID = sentence->GetCoarsePosId(i);
-    if (BPIDs.find(BPID) == BPIDs.end()) {
-      BPIDs.insert(BPID);
+// Same as AddWordPairFeatures, given the features extracted for the same
+// pair without lemmas and morpho-syntactic information (light_features),
+// which are copied into features rather than extracted again.
+void DependencyFeatures::AddWordPairFeaturesFromLight(
+  DependencyInstanceNumeric* sentence,
+  int pair_type,
+  int head,
+  int modifier,
+  bool use_lemma_features,
+  bool use_morphological_features,
+  const BinaryFeatures &light_features,
+  BinaryFeatures *features) {
+  static const WordPairKeyAdder *adders =
+    GetWordPairSplicingKeyAdders(
+      std::make_index_sequence<kNumWordPairOptions>());
 
-      // POS in the middle.
-      fkey = encoder_.CreateFKey_PPP(DependencyFeatureTemplateArc::HP_MP_BP, flags, HPID, MPID, BPID);
-      AddFeature(fkey, features);
-      fkey = encoder_.CreateFKey_WWP(DependencyFeatureTemplateArc::HW_MW_BP, flags, HWID, MWID, BPID);
-      AddFeature(fkey, features);
-      fkey = encoder_.CreateFKey_WPP(DependencyFeatureTemplateArc::HW_MP_BP, flags, HWID, MPID, BPID);
-      AddFeature(fkey, features);
-      fkey = encoder_.CreateFKey_WPP(DependencyFeatureTemplateArc::HP_MW_BP, flags, MWID, HPID, BPID);
-      AddFeature(fkey, features);
-    }
-    BPIDs.clear();
-  }
+  bool labeled =
+    static_cast<DependencyOptions*>(pipe_->GetOptions())->labeled();
+  int options = GetWordPairOptions(labeled, use_lemma_features,
+                                   use_morphological_features);
+  adders[options](sentence, GetWordPairFlags(pair_type, head, modifier),
+                  head, modifier, &light_features, features);
 }
 
 // General function to add features for a pair of words (arcs, sibling words,
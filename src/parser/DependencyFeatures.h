@@ -21,7 +21,9 @@
 
 #include "Features.h"
 #include "DependencyInstanceNumeric.h"
+#include "DependencyPart.h"
 #include "FeatureEncoder.h"
+#include "SerializationUtils.h"
 
 class DependencyOptions;
 
@@ -45,22 +47,51 @@ class DependencyFeatures : public Features {
 public:
   DependencyFeatures() {};
   DependencyFeatures(Pipe* pipe) { pipe_ = pipe; }
-  virtual ~DependencyFeatures() { Clear(); }
+  virtual ~DependencyFeatures() {
+    Clear();
+    for (int k = 0; k < NUM_DEPENDENCYPARTS; ++k) {
+      for (int i = 0; i < feature_pools_[k].size(); ++i) {
+        delete feature_pools_[k][i];
+      }
+    }
+  }
 
 public:
+  // The feature vectors are not deleted, but kept (cleared) in a pool for
+  // the next instance. There is one pool per part type, since the number of
+  // features depends mostly on the type of part.
   void Clear() {
     for (int r = 0; r < input_features_.size(); ++r) {
       if (!input_features_[r]) continue;
       input_features_[r]->clear();
-      delete input_features_[r];
+      feature_pools_[input_feature_types_[r]].push_back(input_features_[r]);
       input_features_[r] = NULL;
     }
     input_features_.clear();
+    input_feature_types_.clear();
   }
 
   void Initialize(Instance *instance, Parts *parts) {
     Clear();
     input_features_.resize(parts->size(), static_cast<BinaryFeatures*>(NULL));
+    input_feature_types_.resize(parts->size());
+  }
+
+  // Create the (empty) feature vector of the r-th part, which is of type
+  // part_type, taking it from the pool if possible.
+  BinaryFeatures *CreatePartFeatures(int r, int part_type) {
+    CHECK(!input_features_[r]);
+    vector<BinaryFeatures*> &pool = feature_pools_[part_type];
+    BinaryFeatures *features;
+    if (pool.empty()) {
+      features = new BinaryFeatures;
+    } else {
+      features = pool.back();
+      pool.pop_back();
+    }
+    input_features_[r] = features;
+    input_feature_types_[r] = part_type;
+    return features;
   }
 
   int GetNumPartFeatures(int r) const {
@@ -79,6 +110,40 @@ public:
     return input_features_[r];
   };
 
+  // Save/load the features of every part to/from a flat buffer (e.g. to
+  // cache them across training epochs), advancing *data when loading: the
+  // number of features of each part (-1 if it has no feature vector) and
+  // then its keys, copied as they are. Loading requires the parts the
+  // features refer to.
+  void Save(vector<char> *buffer) {
+    AppendToBuffer(static_cast<int>(input_features_.size()), buffer);
+    for (int r = 0; r < input_features_.size(); ++r) {
+      if (!input_features_[r]) {
+        AppendToBuffer(-1, buffer);
+        continue;
+      }
+      const BinaryFeatures &features = *input_features_[r];
+      AppendToBuffer(static_cast<int>(features.size()), buffer);
+      AppendToBuffer(features.data(), features.size(), buffer);
+    }
+  }
+
+  void Load(const char **data, const char *end, Parts *parts) {
+    Initialize(NULL, parts);
+    int num_parts;
+    CHECK(ReadFromBuffer(data, end, &num_parts));
+    CHECK_EQ(num_parts, parts->size());
+    for (int r = 0; r < num_parts; ++r) {
+      int num_features;
+      CHECK(ReadFromBuffer(data, end, &num_features));
+      if (num_features < 0) continue;
+      BinaryFeatures *features = CreatePartFeatures(r, (*parts)[r]->type());
+      features->resize(num_features);
+      CHECK(ReadFromBuffer(data, end, features->data(), num_features))
+        << "Corrupt cached features.";
+    }
+  }
+
 public:
   void AddArcFeaturesLight(DependencyInstanceNumeric *sentence,
                            int r,
@@ -90,6 +155,12 @@ public:
                       int head,
                       int modifier);
 
+  void AddArcFeaturesFromLight(DependencyInstanceNumeric *sentence,
+                               int r,
+                               int head,
+                               int modifier,
+                               BinaryFeatures *light_features);
+
   void AddArbitrarySiblingFeatures(DependencyInstanceNumeric* sentence,
                                    int r,
                                    int head,
@@ -154,6 +225,15 @@ protected:
                            bool use_morphological_features,
                            BinaryFeatures *features);
 
+  void AddWordPairFeaturesFromLight(DependencyInstanceNumeric* sentence,
+                                    int pair_type,
+                                    int head,
+                                    int modifier,
+                                    bool use_lemma_features,
+                                    bool use_morphological_features,
+                                    const BinaryFeatures &light_features,
+                                    BinaryFeatures *features);
+
   void AddWordPairFeaturesMST(DependencyInstanceNumeric* sentence,
                               int pair_type,
                               int head,
@@ -166,6 +246,8 @@ protected:
 
 protected:
   vector<BinaryFeatures*> input_features_; // Vector of input features.
+  vector<int> input_feature_types_; // Type of the part of each vector.
+  vector<BinaryFeatures*> feature_pools_[NUM_DEPENDENCYPARTS]; // Unused.
   FeatureEncoder encoder_; // Encoder that converts features into a codeword.
 };
 
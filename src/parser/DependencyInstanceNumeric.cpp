@@ -143,4 +143,155 @@ void DependencyInstanceNumeric::Initialize(
     relations_[i] = dictionary.GetLabelAlphabet().Lookup(
       instance->GetDependencyRelation(i));
   }
+
+  BuildFeatureContext();
 }
+
+// Precompute the feature context of the sentence: prefix counts of verbs,
+// punctuation and coordinations (so that the counts between two words take
+// constant time), binned span lengths, and padded context windows of ids.
+void DependencyInstanceNumeric::BuildFeatureContext() {
+  int length = size();
+
+  num_verbs_before_.assign(length + 1, 0);
+  num_puncs_before_.assign(length + 1, 0);
+  num_coords_before_.assign(length + 1, 0);
+  for (int i = 0; i < length; ++i) {
+    num_verbs_before_[i + 1] = num_verbs_before_[i];
+    num_puncs_before_[i + 1] = num_puncs_before_[i];
+    num_coords_before_[i + 1] = num_coords_before_[i];
+    if (is_verb_[i]) {
+      ++num_verbs_before_[i + 1];
+    } else if (is_punc_[i]) {
+      ++num_puncs_before_[i + 1];
+    } else if (is_coord_[i]) {
+      ++num_coords_before_[i + 1];
+    }
+  }
+
+  binned_length_codes_.resize(length);
+  for (int l = 0; l < length; ++l) {
+    if (l > 40) {
+      binned_length_codes_[l] = 0x6;
+    } else if (l > 30) {
+      binned_length_codes_[l] = 0x5;
+    } else if (l > 20) {
+      binned_length_codes_[l] = 0x4;
+    } else if (l > 10) {
+      binned_length_codes_[l] = 0x3;
+    } else if (l > 5) {
+      binned_length_codes_[l] = 0x2;
+    } else if (l > 2) {
+      binned_length_codes_[l] = 0x1;
+    } else {
+      binned_length_codes_[l] = 0x0;
+    }
+  }
+
+  const vector<int> *ids[] = { &form_ids_, &lemma_ids_, &pos_ids_, &cpos_ids_ };
+  vector<int> *context_ids[] = { &context_form_ids_, &context_lemma_ids_,
+                                 &context_pos_ids_, &context_cpos_ids_ };
+  for (int k = 0; k < 4; ++k) {
+    context_ids[k]->assign(kContextPadding, TOKEN_START);
+    context_ids[k]->insert(context_ids[k]->end(), ids[k]->begin(),
+                           ids[k]->end());
+    context_ids[k]->insert(context_ids[k]->end(), kContextPadding, TOKEN_STOP);
+  }
+}
+
+// Each sentence is stored as one record: the number of integers that follow,
+// then the sentence length n, nine blocks of n integers (form, lower-cased
+// form, lemma, prefix, suffix, POS, CPOS, word class flags, head, relation),
+// the n numbers of morphological features, and the feature ids themselves.
+// The record is written and read with a single call.
+void DependencyInstanceNumeric::Save(FILE *fs) {
+  int length = size();
+  vector<int> record;
+  record.reserve(1 + 11 * length);
+  record.push_back(length);
+  record.insert(record.end(), form_ids_.begin(), form_ids_.end());
+  record.insert(record.end(), form_lower_ids_.begin(), form_lower_ids_.end());
+  record.insert(record.end(), lemma_ids_.begin(), lemma_ids_.end());
+  record.insert(record.end(), prefix_ids_.begin(), prefix_ids_.end());
+  record.insert(record.end(), suffix_ids_.begin(), suffix_ids_.end());
+  record.insert(record.end(), pos_ids_.begin(), pos_ids_.end());
+  record.insert(record.end(), cpos_ids_.begin(), cpos_ids_.end());
+  for (int i = 0; i < length; ++i) {
+    int flags = 0;
+    if (is_noun_[i]) flags |= 0x1;
+    if (is_verb_[i]) flags |= 0x2;
+    if (is_punc_[i]) flags |= 0x4;
+    if (is_coord_[i]) flags |= 0x8;
+    record.push_back(flags);
+  }
+  record.insert(record.end(), heads_.begin(), heads_.end());
+  record.insert(record.end(), relations_.begin(), relations_.end());
+  for (int i = 0; i < length; ++i) {
+    record.push_back(feats_ids_[i].size());
+  }
+  for (int i = 0; i < length; ++i) {
+    record.insert(record.end(), feats_ids_[i].begin(), feats_ids_[i].end());
+  }
+
+  int num_values = record.size();
+  bool success = WriteInteger(fs, num_values);
+  CHECK(success);
+  CHECK_EQ(fwrite(&record[0], sizeof(int), num_values, fs), num_values);
+}
+
+bool DependencyInstanceNumeric::Load(FILE *fs) {
+  int num_values;
+  if (!ReadInteger(fs, &num_values)) return false;
+  CHECK_GT(num_values, 0);
+  vector<int> record(num_values);
+  CHECK_EQ(fread(&record[0], sizeof(int), num_values, fs), num_values)
+    << "Truncated binary instance.";
+
+  int length = record[0];
+  CHECK_GE(length, 0) << "Corrupt binary instance.";
+  CHECK_GE(num_values - 1, 11 * static_cast<int64_t>(length))
+    << "Corrupt binary instance.";
+  const int *values = &record[0] + 1;
+  form_ids_.assign(values, values + length);
+  values += length;
+  form_lower_ids_.assign(values, values + length);
+  values += length;
+  lemma_ids_.assign(values, values + length);
+  values += length;
+  prefix_ids_.assign(values, values + length);
+  values += length;
+  suffix_ids_.assign(values, values + length);
+  values += length;
+  pos_ids_.assign(values, values + length);
+  values += length;
+  cpos_ids_.assign(values, values + length);
+  values += length;
+  is_noun_.resize(length);
+  is_verb_.resize(length);
+  is_punc_.resize(length);
+  is_coord_.resize(length);
+  for (int i = 0; i < length; ++i) {
+    is_noun_[i] = (values[i] & 0x1) != 0;
+    is_verb_[i] = (values[i] & 0x2) != 0;
+    is_punc_[i] = (values[i] & 0x4) != 0;
+    is_coord_[i] = (values[i] & 0x8) != 0;
+  }
+  values += length;
+  heads_.assign(values, values + length);
+  values += length;
+  relations_.assign(values, values + length);
+  values += length;
+  const int *num_feats = values;
+  values += length;
+  const int *end = &record[0] + num_values;
+  feats_ids_.resize(length);
+  for (int i = 0; i < length; ++i) {
+    CHECK_GE(num_feats[i], 0) << "Corrupt binary instance.";
+    CHECK_LE(num_feats[i], end - values) << "Corrupt binary instance.";
+    feats_ids_[i].assign(values, values + num_feats[i]);
+    values += num_feats[i];
+  }
+  CHECK(values == end) << "Corrupt binary instance.";
+  BuildFeatureContext();
+  return true;
+}
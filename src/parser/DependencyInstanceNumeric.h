@@ -34,8 +34,9 @@ public:
   virtual ~DependencyInstanceNumeric() { Clear(); };
 
   Instance* Copy() {
-    CHECK(false) << "Not implemented.";
-    return NULL;
+    DependencyInstanceNumeric *instance = new DependencyInstanceNumeric;
+    *instance = *this;
+    return instance;
   }
 
   int size() { return (int)form_ids_.size(); };
@@ -57,11 +58,24 @@ public:
     is_punc_.clear();
     is_coord_.clear();
     heads_.clear();
+    num_verbs_before_.clear();
+    num_puncs_before_.clear();
+    num_coords_before_.clear();
+    binned_length_codes_.clear();
+    context_form_ids_.clear();
+    context_lemma_ids_.clear();
+    context_pos_ids_.clear();
+    context_cpos_ids_.clear();
   }
 
   void Initialize(const DependencyDictionary &dictionary,
                   DependencyInstance *instance);
 
+  // Binary serialization (one length-prefixed record of integers per
+  // sentence). Load returns false at the end of the file.
+  void Save(FILE *fs);
+  bool Load(FILE *fs);
+
   void GetAllAncestors(const std::vector<int> &heads,
                        int descend,
                        std::vector<int>* ancestors) const {
@@ -134,6 +148,56 @@ public:
   int GetHead(int i) { return heads_[i]; };
   int GetRelationId(int i) { return relations_[i]; };
 
+  void SetHead(int i, int head) { heads_[i] = head; }
+  void SetRelationId(int i, int id) { relations_[i] = id; }
+
+  // Feature context: information used by the feature extractors for many
+  // pairs of words, precomputed once per sentence by Initialize/Load.
+
+  // Number of verbs, punctuation tokens and coordinations strictly between
+  // positions left and right, with left <= right. Each word is counted at
+  // most once, in the first of these classes it belongs to.
+  int GetNumVerbsBetween(int left, int right) {
+    return CountBetween(num_verbs_before_, left, right);
+  }
+  int GetNumPunctuationsBetween(int left, int right) {
+    return CountBetween(num_puncs_before_, left, right);
+  }
+  int GetNumCoordinationsBetween(int left, int right) {
+    return CountBetween(num_coords_before_, left, right);
+  }
+
+  // Binned length (0 to 6) of a span of length 0 to size() - 1: up to 2, 5,
+  // 10, 20, 30, 40, or more.
+  int GetBinnedLengthCode(int length) { return binned_length_codes_[length]; }
+
+  // Form/lemma/POS/CPOS ids in a context window: position i may be up to
+  // kContextPadding tokens before the start of the sentence (TOKEN_START)
+  // or after its end (TOKEN_STOP).
+  static const int kContextPadding = 2;
+  int GetContextFormId(int i) {
+    return context_form_ids_[i + kContextPadding];
+  }
+  int GetContextLemmaId(int i) {
+    return context_lemma_ids_[i + kContextPadding];
+  }
+  int GetContextPosId(int i) {
+    return context_pos_ids_[i + kContextPadding];
+  }
+  int GetContextCoarsePosId(int i) {
+    return context_cpos_ids_[i + kContextPadding];
+  }
+
+protected:
+  void BuildFeatureContext();
+
+  // Number of elements strictly between left and right, given the number of
+  // elements before each position.
+  static int CountBetween(const vector<int> &num_before, int left, int right) {
+    if (right <= left + 1) return 0;
+    return num_before[right] - num_before[left + 1];
+  }
+
 protected:
   vector<int> form_ids_;
   vector<int> form_lower_ids_;
@@ -150,6 +214,16 @@ protected:
   vector<bool> is_coord_;
   vector<int> heads_;
   vector<int> relations_;
+
+  // Feature context (see BuildFeatureContext).
+  vector<int> num_verbs_before_;
+  vector<int> num_puncs_before_;
+  vector<int> num_coords_before_;
+  vector<uint8_t> binned_length_codes_;
+  vector<int> context_form_ids_;
+  vector<int> context_lemma_ids_;
+  vector<int> context_pos_ids_;
+  vector<int> context_cpos_ids_;
 };
 
 #endif /* DEPENDENCYINSTANCENUMERIC_H_ */
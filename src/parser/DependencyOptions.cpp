@@ -27,7 +27,14 @@ using namespace std;
 DEFINE_string(file_format, "conll",
               "Format of the input file containing the data. Use ""conll"" for "
               "the format used in CONLL-X, and ""text"" for tokenized sentences"
-              "(one per line, with tokens separated by white-spaces.");
+              "(one per line, with tokens separated by white-spaces. Use "
+              """binary"" for corpora converted with --file_binary_corpus; "
+              "these are read and written as dictionary ids, skipping all "
+              "string processing.");
+DEFINE_string(file_binary_corpus, "",
+              "If non-empty, convert the CONLL file given by --file_test into "
+              "a binary corpus at this path, using the dictionaries of the "
+              "model given by --file_model, and exit.");
 DEFINE_string(model_type, "standard",
               "Model type. This a string formed by the one or several of the "
               "following pieces:"
@@ -57,6 +64,27 @@ DEFINE_bool(labeled, true,
 DEFINE_bool(projective, false,
             "True for forcing the parser to output single-rooted projective "
             "trees.");
+DEFINE_bool(single_root, false,
+            "True for forcing the non-projective parser to output "
+            "single-rooted trees. Only used by the basic (arc-factored) "
+            "decoder; it is not saved in the model file.");
+DEFINE_int32(exact_decoding_max_length, 100,
+             "Maximum sentence length (including the root) for decoding "
+             "projective models with consecutive sibling and grandparent parts "
+             "exactly with dynamic programming instead of AD3. The dynamic "
+             "program takes O(n^4) time with grandparent parts; 0 always "
+             "uses AD3.");
+DEFINE_int32(ad3_max_iterations, 500,
+             "Maximum number of iterations of AD3, used for decoding with "
+             "higher-order parts.");
+DEFINE_double(ad3_eta, 0.05,
+              "Initial penalty parameter of the augmented Lagrangian in AD3.");
+DEFINE_bool(ad3_adapt_eta, true,
+            "True for adapting the AD3 penalty parameter to the primal and "
+            "dual residuals.");
+DEFINE_double(ad3_residual_threshold, 1e-3,
+              "AD3 stops when both the primal and dual residuals are below "
+              "this threshold.");
 DEFINE_bool(prune_labels, true,
             "True for pruning the set of possible labels taking into account "
             "the labels that have occured for each pair of POS tags in the "
@@ -207,11 +235,18 @@ void DependencyOptions::Initialize() {
   large_feature_set_ = FLAGS_large_feature_set;
   labeled_ = FLAGS_labeled;
   projective_ = FLAGS_projective;
+  single_root_ = FLAGS_single_root;
+  exact_decoding_max_length_ = FLAGS_exact_decoding_max_length;
+  ad3_max_iterations_ = FLAGS_ad3_max_iterations;
+  ad3_eta_ = FLAGS_ad3_eta;
+  ad3_adapt_eta_ = FLAGS_ad3_adapt_eta;
+  ad3_residual_threshold_ = FLAGS_ad3_residual_threshold;
   prune_labels_ = FLAGS_prune_labels;
   prune_distances_ = FLAGS_prune_distances;
   prune_basic_ = FLAGS_prune_basic;
   use_pretrained_pruner_ = FLAGS_use_pretrained_pruner;
   file_pruner_model_ = FLAGS_file_pruner_model;
+  file_binary_corpus_ = FLAGS_file_binary_corpus;
   pruner_posterior_threshold_ = FLAGS_pruner_posterior_threshold;
   pruner_max_heads_ = FLAGS_pruner_max_heads;
 
@@ -21,6 +21,10 @@
 
 #include "Options.h"
 
+DECLARE_string(file_binary_corpus);
+DECLARE_double(pruner_posterior_threshold);
+DECLARE_int32(pruner_max_heads);
+
 class DependencyOptions : public Options {
 public:
   DependencyOptions() {};
@@ -42,11 +46,19 @@ public:
   bool large_feature_set() { return large_feature_set_; };
   bool labeled() { return labeled_; }
   bool projective() { return projective_; }
+  bool single_root() { return single_root_; }
+  int exact_decoding_max_length() { return exact_decoding_max_length_; }
+  int ad3_max_iterations() { return ad3_max_iterations_; }
+  double ad3_eta() { return ad3_eta_; }
+  bool ad3_adapt_eta() { return ad3_adapt_eta_; }
+  double ad3_residual_threshold() { return ad3_residual_threshold_; }
   bool prune_labels() { return prune_labels_; }
   bool prune_distances() { return prune_distances_; }
   bool prune_basic() { return prune_basic_; }
   bool use_pretrained_pruner() { return use_pretrained_pruner_; }
   const string &GetPrunerModelFilePath() { return file_pruner_model_; }
+  const string &file_format() { return file_format_; }
+  const string &GetBinaryCorpusFilePath() { return file_binary_corpus_; }
   double GetPrunerPosteriorThreshold() { return pruner_posterior_threshold_; }
   double GetPrunerMaxHeads() { return pruner_max_heads_; }
 
@@ -65,11 +77,18 @@ protected:
   bool large_feature_set_;
   bool labeled_;
   bool projective_;
+  bool single_root_;
+  int exact_decoding_max_length_;
+  int ad3_max_iterations_;
+  double ad3_eta_;
+  bool ad3_adapt_eta_;
+  double ad3_residual_threshold_;
   bool prune_labels_;
   bool prune_distances_;
   bool prune_basic_;
   bool use_pretrained_pruner_;
   string file_pruner_model_;
+  string file_binary_corpus_;
   double pruner_posterior_threshold_;
   int pruner_max_heads_;
   bool use_arbitrary_siblings_;
@@ -17,76 +17,267 @@
 // along with TurboParser 2.3.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "DependencyPart.h"
+#include "SerializationUtils.h"
 
 void DependencyParts::DeleteAll() {
   for (int i = 0; i < NUM_DEPENDENCYPARTS; ++i) {
     offsets_[i] = -1;
   }
+  pruner_generation_ = 0;
 
   DeleteIndices();
 
-  for (iterator iter = begin(); iter != end(); iter++) {
-    if ((*iter) != NULL) {
-      delete (*iter);
-      *iter = NULL;
-    }
-  }
-
+  // The parts live in the arenas, which keep their memory for the next
+  // instance.
   clear();
+  arcs_.Reset();
+  labeled_arcs_.Reset();
+  siblings_.Reset();
+  next_siblings_.Reset();
+  grandparents_.Reset();
+  grandsiblings_.Reset();
+  trisiblings_.Reset();
+  nonprojective_arcs_.Reset();
+  paths_.Reset();
+  head_bigrams_.Reset();
 }
 
 void DependencyParts::DeleteIndices() {
-  for (int i = 0; i < index_.size(); ++i) {
-    index_[i].clear();
-  }
+  // Keep the memory of the indices for the next instance.
+  index_offsets_.clear();
   index_.clear();
+  index_labeled_offsets_.clear();
+  index_labeled_.clear();
+}
 
-  for (int i = 0; i < index_labeled_.size(); ++i) {
-    for (int j = 0; j < index_labeled_[i].size(); ++j) {
-      index_labeled_[i][j].clear();
-    }
-    index_labeled_[i].clear();
+// Build the sparse index of the num_parts arcs starting at offset, which are
+// of type part_type and are DependencyPartArc or DependencyPartLabeledArc:
+// the (head, part index) pairs of each modifier, sorted.
+template <class PartArc>
+static void BuildArcIndex(const DependencyParts &parts, int offset,
+                          int num_parts, int part_type, int sentence_length,
+                          vector<int> *offsets,
+                          vector<pair<int, int> > *index) {
+  // Group the arcs by modifier (counting sort).
+  offsets->assign(sentence_length + 1, 0);
+  for (int r = 0; r < num_parts; ++r) {
+    Part *part = parts[offset + r];
+    CHECK(part->type() == part_type);
+    int m = static_cast<PartArc*>(part)->modifier();
+    CHECK_GE(m, 0);
+    CHECK_LT(m, sentence_length);
+    ++(*offsets)[m + 1];
+  }
+  for (int m = 0; m < sentence_length; ++m) {
+    (*offsets)[m + 1] += (*offsets)[m];
+  }
+  // Use the first entries of offsets as insertion positions, and restore them
+  // afterwards.
+  index->resize(num_parts);
+  for (int r = 0; r < num_parts; ++r) {
+    PartArc *arc = static_cast<PartArc*>(parts[offset + r]);
+    (*index)[(*offsets)[arc->modifier()]++] =
+      pair<int, int>(arc->head(), offset + r);
+  }
+  for (int m = sentence_length; m > 0; --m) {
+    (*offsets)[m] = (*offsets)[m - 1];
+  }
+  (*offsets)[0] = 0;
+
+  // Sort the arcs of each modifier by head (they are usually sorted already).
+  for (int m = 0; m < sentence_length; ++m) {
+    vector<pair<int, int> >::iterator begin = index->begin() + (*offsets)[m];
+    vector<pair<int, int> >::iterator end = index->begin() + (*offsets)[m + 1];
+    if (!is_sorted(begin, end)) sort(begin, end);
   }
-  index_labeled_.clear();
 }
 
 void DependencyParts::BuildIndices(int sentence_length, bool labeled) {
   DeleteIndices();
-  index_.resize(sentence_length);
-  for (int h = 0; h < sentence_length; ++h) {
-    index_[h].resize(sentence_length);
-    for (int m = 0; m < sentence_length; ++m) {
-      index_[h][m] = -1;
-    }
-  }
 
   int offset, num_basic_parts;
   GetOffsetArc(&offset, &num_basic_parts);
-  for (int r = 0; r < num_basic_parts; ++r) {
-    Part *part = (*this)[offset + r];
-    CHECK(part->type() == DEPENDENCYPART_ARC);
-    int h = static_cast<DependencyPartArc*>(part)->head();
-    int m = static_cast<DependencyPartArc*>(part)->modifier();
-    index_[h][m] = offset + r;
-  }
+  BuildArcIndex<DependencyPartArc>(*this, offset, num_basic_parts,
+                                   DEPENDENCYPART_ARC, sentence_length,
+                                   &index_offsets_, &index_);
 
   if (labeled) {
-    index_labeled_.resize(sentence_length);
-    for (int h = 0; h < sentence_length; ++h) {
-      index_labeled_[h].resize(sentence_length);
-      for (int m = 0; m < sentence_length; ++m) {
-        index_labeled_[h][m].clear();
-      }
-    }
-
     int offset, num_labeled_arcs;
     GetOffsetLabeledArc(&offset, &num_labeled_arcs);
-    for (int r = 0; r < num_labeled_arcs; ++r) {
-      Part *part = (*this)[offset + r];
-      CHECK(part->type() == DEPENDENCYPART_LABELEDARC);
-      int h = static_cast<DependencyPartLabeledArc*>(part)->head();
-      int m = static_cast<DependencyPartLabeledArc*>(part)->modifier();
-      index_labeled_[h][m].push_back(offset + r);
+    BuildArcIndex<DependencyPartLabeledArc>(*this, offset, num_labeled_arcs,
+                                            DEPENDENCYPART_LABELEDARC,
+                                            sentence_length,
+                                            &index_labeled_offsets_,
+                                            &index_labeled_);
+  }
+}
+
+// Number of indices of each type of part, as saved by DependencyParts::Save.
+static const int kNumCachedPartFields[NUM_DEPENDENCYPARTS] = {
+  2, // DEPENDENCYPART_ARC
+  3, // DEPENDENCYPART_LABELEDARC
+  3, // DEPENDENCYPART_SIBL
+  3, // DEPENDENCYPART_NEXTSIBL
+  3, // DEPENDENCYPART_GRANDPAR
+  4, // DEPENDENCYPART_GRANDSIBL
+  4, // DEPENDENCYPART_TRISIBL
+  2, // DEPENDENCYPART_NONPROJ
+  2, // DEPENDENCYPART_PATH
+  3  // DEPENDENCYPART_HEADBIGRAM
+};
+
+void DependencyParts::Save(vector<char> *buffer) {
+  // Write the type of each part and then all their indices, in two blocks.
+  vector<uint8_t> types(size());
+  vector<int> fields;
+  fields.reserve(3 * size());
+  for (int r = 0; r < size(); ++r) {
+    Part *part = (*this)[r];
+    types[r] = part->type();
+    switch (part->type()) {
+    case DEPENDENCYPART_ARC: {
+      DependencyPartArc *arc = static_cast<DependencyPartArc*>(part);
+      fields.push_back(arc->head());
+      fields.push_back(arc->modifier());
+      break;
+    }
+    case DEPENDENCYPART_LABELEDARC: {
+      DependencyPartLabeledArc *arc =
+        static_cast<DependencyPartLabeledArc*>(part);
+      fields.push_back(arc->head());
+      fields.push_back(arc->modifier());
+      fields.push_back(arc->label());
+      break;
+    }
+    case DEPENDENCYPART_SIBL: {
+      DependencyPartSibl *sibl = static_cast<DependencyPartSibl*>(part);
+      fields.push_back(sibl->head());
+      fields.push_back(sibl->modifier());
+      fields.push_back(sibl->sibling());
+      break;
+    }
+    case DEPENDENCYPART_NEXTSIBL: {
+      DependencyPartNextSibl *sibl = static_cast<DependencyPartNextSibl*>(part);
+      fields.push_back(sibl->head());
+      fields.push_back(sibl->modifier());
+      fields.push_back(sibl->next_sibling());
+      break;
+    }
+    case DEPENDENCYPART_GRANDPAR: {
+      DependencyPartGrandpar *grandpar =
+        static_cast<DependencyPartGrandpar*>(part);
+      fields.push_back(grandpar->grandparent());
+      fields.push_back(grandpar->head());
+      fields.push_back(grandpar->modifier());
+      break;
+    }
+    case DEPENDENCYPART_GRANDSIBL: {
+      DependencyPartGrandSibl *grandsibl =
+        static_cast<DependencyPartGrandSibl*>(part);
+      fields.push_back(grandsibl->grandparent());
+      fields.push_back(grandsibl->head());
+      fields.push_back(grandsibl->modifier());
+      fields.push_back(grandsibl->sibling());
+      break;
+    }
+    case DEPENDENCYPART_TRISIBL: {
+      DependencyPartTriSibl *trisibl = static_cast<DependencyPartTriSibl*>(part);
+      fields.push_back(trisibl->head());
+      fields.push_back(trisibl->modifier());
+      fields.push_back(trisibl->sibling());
+      fields.push_back(trisibl->other_sibling());
+      break;
+    }
+    case DEPENDENCYPART_NONPROJ: {
+      DependencyPartNonproj *arc = static_cast<DependencyPartNonproj*>(part);
+      fields.push_back(arc->head());
+      fields.push_back(arc->modifier());
+      break;
+    }
+    case DEPENDENCYPART_PATH: {
+      DependencyPartPath *path = static_cast<DependencyPartPath*>(part);
+      fields.push_back(path->ancestor());
+      fields.push_back(path->descendant());
+      break;
+    }
+    case DEPENDENCYPART_HEADBIGRAM: {
+      DependencyPartHeadBigram *bigram =
+        static_cast<DependencyPartHeadBigram*>(part);
+      fields.push_back(bigram->head());
+      fields.push_back(bigram->modifier());
+      fields.push_back(bigram->previous_head());
+      break;
+    }
+    default:
+      CHECK(false) << "Unknown part type: " << part->type();
+    }
+  }
+
+  AppendToBuffer(static_cast<int>(size()), buffer);
+  AppendToBuffer(static_cast<int>(fields.size()), buffer);
+  AppendToBuffer(&offsets_[0], NUM_DEPENDENCYPARTS, buffer);
+  AppendToBuffer(types.data(), types.size(), buffer);
+  AppendToBuffer(fields.data(), fields.size(), buffer);
+}
+
+void DependencyParts::Load(const char **data, const char *end) {
+  Initialize();
+  int num_parts, num_fields;
+  CHECK(ReadFromBuffer(data, end, &num_parts));
+  CHECK(ReadFromBuffer(data, end, &num_fields));
+  CHECK(ReadFromBuffer(data, end, &offsets_[0], NUM_DEPENDENCYPARTS));
+  CHECK_GE(num_parts, 0);
+  CHECK_GE(num_fields, 0);
+  CHECK_LE(static_cast<size_t>(num_parts) + num_fields * sizeof(int),
+           static_cast<size_t>(end - *data)) << "Corrupt cached parts.";
+  // The types are read in place; the fields, which may be unaligned, are
+  // copied part by part.
+  const uint8_t *types = reinterpret_cast<const uint8_t*>(*data);
+  const char *fields = *data + num_parts;
+  const char *fields_end = fields + num_fields * sizeof(int);
+  *data = fields_end;
+
+  resize(num_parts);
+  int f[4];
+  for (int r = 0; r < num_parts; ++r) {
+    int num_part_fields = (types[r] < NUM_DEPENDENCYPARTS) ?
+      kNumCachedPartFields[types[r]] : 0;
+    CHECK(ReadFromBuffer(&fields, fields_end, f, num_part_fields))
+      << "Corrupt cached parts.";
+    switch (types[r]) {
+    case DEPENDENCYPART_ARC:
+      (*this)[r] = CreatePartArc(f[0], f[1]);
+      break;
+    case DEPENDENCYPART_LABELEDARC:
+      (*this)[r] = CreatePartLabeledArc(f[0], f[1], f[2]);
+      break;
+    case DEPENDENCYPART_SIBL:
+      (*this)[r] = CreatePartSibl(f[0], f[1], f[2]);
+      break;
+    case DEPENDENCYPART_NEXTSIBL:
+      (*this)[r] = CreatePartNextSibl(f[0], f[1], f[2]);
+      break;
+    case DEPENDENCYPART_GRANDPAR:
+      (*this)[r] = CreatePartGrandpar(f[0], f[1], f[2]);
+      break;
+    case DEPENDENCYPART_GRANDSIBL:
+      (*this)[r] = CreatePartGrandSibl(f[0], f[1], f[2], f[3]);
+      break;
+    case DEPENDENCYPART_TRISIBL:
+      (*this)[r] = CreatePartTriSibl(f[0], f[1], f[2], f[3]);
+      break;
+    case DEPENDENCYPART_NONPROJ:
+      (*this)[r] = CreatePartNonproj(f[0], f[1]);
+      break;
+    case DEPENDENCYPART_PATH:
+      (*this)[r] = CreatePartPath(f[0], f[1]);
+      break;
+    case DEPENDENCYPART_HEADBIGRAM:
+      (*this)[r] = CreatePartHeadBigram(f[0], f[1], f[2]);
+      break;
+    default:
+      CHECK(false) << "Unknown part type: " << static_cast<int>(types[r]);
     }
   }
+  CHECK(fields == fields_end) << "Corrupt cached parts.";
 }
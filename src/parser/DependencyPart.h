@@ -20,6 +20,8 @@
 #define DEPENDENCYPART_H_
 
 #include <stdio.h>
+#include <limits.h>
+#include <algorithm>
 #include <vector>
 #include "Part.h"
 
@@ -401,9 +403,26 @@ private:
   int hp_; // Index of the head of the previous word (m_ - 1).
 };
 
+// Indices of the labeled arcs with a given head and modifier, as returned by
+// DependencyParts::FindLabeledArcs. It points to the (head, index) entries of
+// the labeled arc index, and is invalidated when the index is rebuilt.
+class LabeledArcIndices {
+public:
+  LabeledArcIndices(const pair<int, int> *begin, const pair<int, int> *end) :
+    begin_(begin), end_(end) {};
+
+  int size() const { return end_ - begin_; }
+  bool empty() const { return end_ == begin_; }
+  int operator[](int k) const { return begin_[k].second; }
+
+private:
+  const pair<int, int> *begin_;
+  const pair<int, int> *end_;
+};
+
 class DependencyParts : public Parts {
 public:
-  DependencyParts() {};
+  DependencyParts() : pruner_generation_(0) {};
   virtual ~DependencyParts() { DeleteAll(); };
 
   void Initialize() {
@@ -413,53 +432,79 @@ public:
     }
   }
 
+  // The parts are allocated in arenas owned by this object, which are reset
+  // by Initialize/DeleteAll; they must not be deleted individually.
   Part *CreatePartArc(int head, int modifier) {
-    return new DependencyPartArc(head, modifier);
+    return arcs_.Create(head, modifier);
   }
   Part *CreatePartLabeledArc(int head, int modifier, int label) {
-    return new DependencyPartLabeledArc(head, modifier, label);
+    return labeled_arcs_.Create(head, modifier, label);
   }
   Part *CreatePartSibl(int head, int modifier, int sibling) {
-    return new DependencyPartSibl(head, modifier, sibling);
+    return siblings_.Create(head, modifier, sibling);
   }
   Part *CreatePartNextSibl(int head, int modifier, int sibling) {
-    return new DependencyPartNextSibl(head, modifier, sibling);
+    return next_siblings_.Create(head, modifier, sibling);
   }
   Part *CreatePartGrandpar(int grandparent, int head, int modifier) {
-    return new DependencyPartGrandpar(grandparent, head, modifier);
+    return grandparents_.Create(grandparent, head, modifier);
   }
   Part *CreatePartGrandSibl(int grandparent, int head, int modifier, int sibling) {
-    return new DependencyPartGrandSibl(grandparent, head, modifier, sibling);
+    return grandsiblings_.Create(grandparent, head, modifier, sibling);
   }
   Part *CreatePartTriSibl(int head, int modifier, int sibling, int other_sibling) {
-    return new DependencyPartTriSibl(head, modifier, sibling, other_sibling);
+    return trisiblings_.Create(head, modifier, sibling, other_sibling);
   }
   Part *CreatePartNonproj(int head, int modifier) {
-    return new DependencyPartNonproj(head, modifier);
+    return nonprojective_arcs_.Create(head, modifier);
   }
   Part *CreatePartPath(int ancestor, int descendant) {
-    return new DependencyPartPath(ancestor, descendant);
+    return paths_.Create(ancestor, descendant);
   }
   Part *CreatePartHeadBigram(int head, int modifier, int previous_head) {
-    return new DependencyPartHeadBigram(head, modifier, previous_head);
+    return head_bigrams_.Create(head, modifier, previous_head);
   }
 
-  void Save(FILE* fs) {
-    CHECK(false) << "To be implemented.";
-  }
-  void Load(FILE* fs) {
-    CHECK(false) << "To be implemented.";
+  // Save/load the parts and their offsets to/from a flat buffer (e.g. to
+  // cache them across training epochs), advancing *data when loading. The
+  // indices are not saved; call BuildIndices after loading.
+  void Save(vector<char> *buffer);
+  void Load(const char **data, const char *end);
+
+  // Generation of the call to DependencyPipe::Prune that selected these
+  // parts, or 0 if they were not pruned since they were last reset.
+  uint64_t pruner_generation() const { return pruner_generation_; }
+  void set_pruner_generation(uint64_t generation) {
+    pruner_generation_ = generation;
   }
 
 public:
   void DeleteAll();
 
 public:
+  // The arc indices are sparse: the arcs of each modifier are kept sorted by
+  // head, so their size is linear in the number of arcs (rather than
+  // quadratic in the sentence length), and finding an arc takes a binary
+  // search among the candidate heads of its modifier.
   void BuildIndices(int sentence_length, bool labeled);
   void DeleteIndices();
-  int FindArc(int head, int modifier) { return index_[head][modifier]; };
-  const vector<int> &FindLabeledArcs(int head, int modifier) {
-    return index_labeled_[head][modifier];
+  int FindArc(int head, int modifier) {
+    const pair<int, int> *begin = index_.data() + index_offsets_[modifier];
+    const pair<int, int> *end = index_.data() + index_offsets_[modifier + 1];
+    // If there are repeated arcs, take the last one.
+    const pair<int, int> *it =
+      upper_bound(begin, end, pair<int, int>(head, INT_MAX));
+    if (it == begin || (it - 1)->first != head) return -1;
+    return (it - 1)->second;
+  };
+  LabeledArcIndices FindLabeledArcs(int head, int modifier) {
+    const pair<int, int> *begin =
+      index_labeled_.data() + index_labeled_offsets_[modifier];
+    const pair<int, int> *end =
+      index_labeled_.data() + index_labeled_offsets_[modifier + 1];
+    begin = lower_bound(begin, end, pair<int, int>(head, INT_MIN));
+    end = upper_bound(begin, end, pair<int, int>(head, INT_MAX));
+    return LabeledArcIndices(begin, end);
   }
 
   // True is model is arc-factored, i.e., all parts are unlabeled arcs.
@@ -564,9 +609,27 @@ private:
   }
 
 private:
-  vector<vector<int> >  index_;
-  vector<vector<vector<int> > > index_labeled_;
+  // Arc indices: (head, part index) of the arcs of modifier m, sorted, are
+  // index_[index_offsets_[m]] to index_[index_offsets_[m+1] - 1]; the same
+  // for the labeled arcs.
+  vector<int> index_offsets_;
+  vector<pair<int, int> > index_;
+  vector<int> index_labeled_offsets_;
+  vector<pair<int, int> > index_labeled_;
   int offsets_[NUM_DEPENDENCYPARTS];
+  uint64_t pruner_generation_; // See pruner_generation().
+
+  // Arenas holding the parts of each type.
+  PartArena<DependencyPartArc> arcs_;
+  PartArena<DependencyPartLabeledArc> labeled_arcs_;
+  PartArena<DependencyPartSibl> siblings_;
+  PartArena<DependencyPartNextSibl> next_siblings_;
+  PartArena<DependencyPartGrandpar> grandparents_;
+  PartArena<DependencyPartGrandSibl> grandsiblings_;
+  PartArena<DependencyPartTriSibl> trisiblings_;
+  PartArena<DependencyPartNonproj> nonprojective_arcs_;
+  PartArena<DependencyPartPath> paths_;
+  PartArena<DependencyPartHeadBigram> head_bigrams_;
 };
 
 #endif /* DEPENDENCYPART_H_ */
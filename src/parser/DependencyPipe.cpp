@@ -21,6 +21,7 @@
 #include <sstream>
 #include <vector>
 #include <queue>
+#include <atomic>
 #ifndef _WIN32
 #include <sys/time.h>
 #else
@@ -42,7 +43,7 @@ void DependencyPipe::SaveModel(FILE* fs) {
   CHECK(success);
   token_dictionary_->Save(fs);
   Pipe::SaveModel(fs);
-  pruner_parameters_->Save(fs);
+  pruner_parameters_->Save(fs, model_layout_);
 }
 
 void DependencyPipe::LoadModel(FILE* fs) {
@@ -61,10 +62,11 @@ void DependencyPipe::LoadModel(FILE* fs) {
     SetTokenDictionary(token_dictionary_);
   token_dictionary_->Load(fs);
   Pipe::LoadModel(fs);
-  pruner_parameters_->Load(fs);
+  pruner_parameters_->Load(fs, model_layout_);
+  if (!options_->train()) pruner_parameters_->Freeze();
 }
 
-void DependencyPipe::LoadPrunerModel(FILE* fs) {
+void DependencyPipe::LoadPrunerModel(FILE* fs, const StreamLayout &layout) {
   LOG(INFO) << "Loading pruner model...";
   // This will be ignored but must be passed to the pruner pipe constructor,
   // so that when loading the pruner model the actual options are not
@@ -73,18 +75,21 @@ void DependencyPipe::LoadPrunerModel(FILE* fs) {
   DependencyPipe* pipe = new DependencyPipe(&pruner_options);
   //DependencyPipe* pipe = new DependencyPipe(options_);
   pipe->Initialize();
+  pipe->model_layout_ = layout;
   pipe->LoadModel(fs);
   delete pruner_parameters_;
   pruner_parameters_ = pipe->parameters_;
   pipe->parameters_ = NULL;
   delete pipe;
+  // A pretrained pruner is never updated.
+  pruner_parameters_->Freeze();
   LOG(INFO) << "Done.";
 }
 
 void DependencyPipe::LoadPrunerModelByName(const string &model_name) {
-  FILE *fs = fopen(model_name.c_str(), "rb");
-  CHECK(fs) << "Could not open pruner model file for reading: " << model_name;
-  LoadPrunerModel(fs);
+  StreamLayout layout;
+  FILE *fs = OpenModelFile(model_name, &layout);
+  LoadPrunerModel(fs, layout);
   fclose(fs);
 }
 
@@ -92,6 +97,13 @@ void DependencyPipe::PreprocessData() {
   delete token_dictionary_;
   CreateTokenDictionary();
   static_cast<DependencyDictionary*>(dictionary_)->SetTokenDictionary(token_dictionary_);
+  if (UseBinaryFormat()) {
+    // A binary corpus stores the dictionaries it was encoded with.
+    LOG(INFO) << "Loading dictionaries from the binary corpus...";
+    static_cast<DependencyBinaryReader*>(reader_)->
+      LoadDictionaries(options_->GetTrainingFilePath());
+    return;
+  }
   static_cast<DependencyTokenDictionary*>(token_dictionary_)->Initialize(GetDependencyReader());
   static_cast<DependencyDictionary*>(dictionary_)->CreateLabelDictionary(GetDependencyReader());
 }
@@ -108,26 +120,32 @@ void DependencyPipe::ComputeScores(Instance *instance, Parts *parts,
   }
   scores->resize(parts->size());
   DependencyParts *dependency_parts = static_cast<DependencyParts*>(parts);
+  // Parts scored from their "simple" features; these are scored in one batch
+  // after the loop.
+  vector<int> simple_parts;
+  simple_parts.reserve(parts->size());
+  // Labels of the current arc and their scores, reused across arcs.
+  vector<int> allowed_labels;
+  vector<double> label_scores;
   for (int r = 0; r < parts->size(); ++r) {
     // Labeled arcs will be treated by looking at the unlabeled arcs and
     // conjoining with the label.
     if (pruner) CHECK_EQ((*parts)[r]->type(), DEPENDENCYPART_ARC);
     if ((*parts)[r]->type() == DEPENDENCYPART_LABELEDARC) continue;
-    const BinaryFeatures &part_features = features->GetPartFeatures(r);
     if ((*parts)[r]->type() == DEPENDENCYPART_ARC && !pruner &&
         GetDependencyOptions()->labeled()) {
+      const BinaryFeatures &part_features = features->GetPartFeatures(r);
       (*scores)[r] = 0.0;
       DependencyPartArc *arc = static_cast<DependencyPartArc*>((*parts)[r]);
-      const vector<int> &index_labeled_parts =
+      LabeledArcIndices index_labeled_parts =
         dependency_parts->FindLabeledArcs(arc->head(), arc->modifier());
-      vector<int> allowed_labels(index_labeled_parts.size());
+      allowed_labels.resize(index_labeled_parts.size());
       for (int k = 0; k < index_labeled_parts.size(); ++k) {
         DependencyPartLabeledArc *labeled_arc =
           static_cast<DependencyPartLabeledArc*>(
             (*parts)[index_labeled_parts[k]]);
         allowed_labels[k] = labeled_arc->label();
       }
-      vector<double> label_scores;
       parameters->ComputeLabelScores(part_features, allowed_labels,
                                      &label_scores);
       for (int k = 0; k < index_labeled_parts.size(); ++k) {
@@ -135,8 +153,9 @@ void DependencyPipe::ComputeScores(Instance *instance, Parts *parts,
       }
       continue;
     }
-    (*scores)[r] = parameters->ComputeScore(part_features);
+    simple_parts.push_back(r);
   }
+  parameters->ComputeScores(*features, simple_parts, scores);
 }
 
 void DependencyPipe::RemoveUnsupportedFeatures(Instance *instance, Parts *parts,
@@ -315,6 +334,21 @@ void DependencyPipe::MakeParts(Instance *instance,
   }
 }
 
+void DependencyPipe::LoadCachedPartsAndFeatures(const char **data,
+                                                const char *end,
+                                                Instance *instance,
+                                                Parts *parts,
+                                                Features *features) {
+  int sentence_length =
+    static_cast<DependencyInstanceNumeric*>(instance)->size();
+  DependencyParts *dependency_parts = static_cast<DependencyParts*>(parts);
+  dependency_parts->Load(data, end);
+  // Rebuild the same indices as MakeParts.
+  dependency_parts->BuildIndices(sentence_length, train_pruner_ ? false :
+                                 GetDependencyOptions()->labeled());
+  static_cast<DependencyFeatures*>(features)->Load(data, end, parts);
+}
+
 void DependencyPipe::MakePartsBasic(Instance *instance,
                                     Parts *parts,
                                     vector<double> *gold_outputs) {
@@ -327,15 +361,19 @@ void DependencyPipe::MakePartsBasic(Instance *instance,
 
   MakePartsBasic(instance, false, parts, gold_outputs);
   dependency_parts->BuildOffsets();
-  dependency_parts->BuildIndices(sentence_length, false);
 
-  // Prune using a basic first-order model.
-  if (GetDependencyOptions()->prune_basic()) {
+  // Prune using a basic first-order model. The pruner does not need the arc
+  // index, which is only built for the arcs that survive.
+  if (!GetDependencyOptions()->prune_basic()) {
+    dependency_parts->BuildIndices(sentence_length, false);
+  } else {
+    BeginProfilingStage(PIPE_STAGE_PRUNE);
     if (options_->train()) {
       Prune(instance, parts, gold_outputs, true);
     } else {
       Prune(instance, parts, gold_outputs, false);
     }
+    EndProfilingStage(PIPE_STAGE_PRUNE);
     // In principle, the pruner should never make the graph
     // ill-formed, but this seems to happen sometimes...
     int num_parts_initial = 0;
@@ -1291,6 +1329,31 @@ bool DependencyPipe::IsProjectiveArc(const vector<int> &heads,
   return true;
 }
 
+// Arc features extracted by the pruner in the calling thread. Prune keeps the
+// features of the arcs that survive (at their new indices), so that
+// MakeSelectedFeatures can start from them instead of extracting the arc
+// features again. Each call to Prune gets a new generation, which is stored
+// both here and in the pruned parts: the features are only reused for the
+// parts of the same generation (instances and parts are recycled, so their
+// addresses do not identify them).
+struct PrunerFeatures {
+  DependencyFeatures features;
+  uint64_t generation = 0; // Generation of the kept features (0 if none).
+  vector<int> heads; // Head and modifier of each kept arc.
+  vector<int> modifiers;
+};
+
+static PrunerFeatures *GetPrunerFeatures() {
+  static thread_local PrunerFeatures pruner_features;
+  return &pruner_features;
+}
+
+// Get a new pruner generation, unique across threads.
+static uint64_t NewPrunerGeneration() {
+  static std::atomic<uint64_t> last_generation(0);
+  return ++last_generation;
+}
+
 void DependencyPipe::MakeSelectedFeatures(Instance *instance,
                                           Parts *parts,
                                           bool pruner,
@@ -1305,6 +1368,14 @@ void DependencyPipe::MakeSelectedFeatures(Instance *instance,
 
   dependency_features->Initialize(instance, parts);
 
+  // Reuse the arc features computed by the pruner for this instance, if any.
+  PrunerFeatures *pruner_features = GetPrunerFeatures();
+  bool use_pruner_features = !pruner &&
+    dependency_parts->pruner_generation() != 0 &&
+    pruner_features->generation == dependency_parts->pruner_generation();
+  int num_pruner_arcs = use_pruner_features ?
+    pruner_features->heads.size() : 0;
+
   // Even in the case of labeled parsing, build features for unlabeled arcs
   // only. They will later be conjoined with the labels.
   int offset, size;
@@ -1317,11 +1388,21 @@ void DependencyPipe::MakeSelectedFeatures(Instance *instance,
     if (pruner) {
       dependency_features->AddArcFeaturesLight(sentence, r, arc->head(),
                                                arc->modifier());
+    } else if (r < num_pruner_arcs &&
+               pruner_features->heads[r] == arc->head() &&
+               pruner_features->modifiers[r] == arc->modifier()) {
+      dependency_features->AddArcFeaturesFromLight(
+        sentence, r, arc->head(), arc->modifier(),
+        pruner_features->features.GetMutablePartFeatures(r));
     } else {
       dependency_features->AddArcFeatures(sentence, r, arc->head(),
                                           arc->modifier());
     }
   }
+  if (use_pruner_features) {
+    pruner_features->features.Clear();
+    pruner_features->generation = 0;
+  }
 
   // Build features for arbitrary siblings.
   dependency_parts->GetOffsetSibl(&offset, &size);
@@ -1443,13 +1524,19 @@ void DependencyPipe::MakeSelectedFeatures(Instance *instance,
 
 // Prune basic parts (arcs and labeled arcs) using a first-order model.
 // The vectors of basic parts is given as input, and those elements that are
-// to be pruned are deleted from the vector.
+// to be pruned are removed from the vector (their memory stays in the arena
+// of the parts until the next instance).
 // If gold_outputs is not NULL, that vector will also be pruned.
 void DependencyPipe::Prune(Instance *instance, Parts *parts,
                            vector<double> *gold_outputs,
                            bool preserve_gold) {
   DependencyParts *dependency_parts = static_cast<DependencyParts*>(parts);
-  Features *features = CreateFeatures();
+  // Reuse the pruner features across calls in each thread, so that their
+  // vectors are recycled (see DependencyFeatures::Clear).
+  PrunerFeatures *pruner_features = GetPrunerFeatures();
+  pruner_features->features.SetPipe(this);
+  pruner_features->generation = 0;
+  Features *features = &pruner_features->features;
   vector<double> scores;
   vector<double> predicted_outputs;
 
@@ -1461,17 +1548,25 @@ void DependencyPipe::Prune(Instance *instance, Parts *parts,
   GetDependencyDecoder()->DecodePruner(instance, parts, scores,
                                        &predicted_outputs);
 
+  // Keep the features of the arcs that survive, for MakeSelectedFeatures.
+  pruner_features->heads.clear();
+  pruner_features->modifiers.clear();
   double threshold = 0.5;
   int r0 = 0;
   for (int r = 0; r < parts->size(); ++r) {
     // Preserve gold parts (at training time).
     if (predicted_outputs[r] >= threshold ||
         (preserve_gold && (*gold_outputs)[r] >= threshold)) {
+      DependencyPartArc *arc = static_cast<DependencyPartArc*>((*parts)[r]);
+      pruner_features->heads.push_back(arc->head());
+      pruner_features->modifiers.push_back(arc->modifier());
+      if (r0 != r) {
+        pruner_features->features.GetMutablePartFeatures(r0)->swap(
+          *pruner_features->features.GetMutablePartFeatures(r));
+      }
       (*parts)[r0] = (*parts)[r];
       if (gold_outputs) (*gold_outputs)[r0] = (*gold_outputs)[r];
       ++r0;
-    } else {
-      delete (*parts)[r];
     }
   }
 
@@ -1480,11 +1575,18 @@ void DependencyPipe::Prune(Instance *instance, Parts *parts,
   dependency_parts->DeleteIndices();
   dependency_parts->SetOffsetArc(0, parts->size());
 
-  delete features;
+  uint64_t generation = NewPrunerGeneration();
+  pruner_features->generation = generation;
+  dependency_parts->set_pruner_generation(generation);
 }
 
 void DependencyPipe::LabelInstance(Parts *parts, const vector<double> &output,
                                    Instance *instance) {
+  if (UseBinaryFormat()) {
+    LabelNumericInstance(parts, output,
+                         static_cast<DependencyInstanceNumeric*>(instance));
+    return;
+  }
   DependencyParts *dependency_parts = static_cast<DependencyParts*>(parts);
   DependencyInstance *dependency_instance =
     static_cast<DependencyInstance*>(instance);
@@ -1530,3 +1632,67 @@ void DependencyPipe::LabelInstance(Parts *parts, const vector<double> &output,
     }
   }
 }
+
+// Same as LabelInstance, for instances read from a binary corpus: heads and
+// label ids are written directly, without going through the label names.
+void DependencyPipe::LabelNumericInstance(Parts *parts,
+                                          const vector<double> &output,
+                                          DependencyInstanceNumeric *instance) {
+  DependencyParts *dependency_parts = static_cast<DependencyParts*>(parts);
+  bool labeled = GetDependencyOptions()->labeled();
+  int instance_length = instance->size();
+  for (int m = 0; m < instance_length; ++m) {
+    instance->SetHead(m, -1);
+    if (labeled) instance->SetRelationId(m, -1);
+  }
+  double threshold = 0.5;
+
+  int offset, num_arcs;
+  if (labeled) {
+    dependency_parts->GetOffsetLabeledArc(&offset, &num_arcs);
+  } else {
+    dependency_parts->GetOffsetArc(&offset, &num_arcs);
+  }
+  for (int r = 0; r < num_arcs; ++r) {
+    if (output[offset + r] < threshold) continue;
+    if (labeled) {
+      DependencyPartLabeledArc *arc =
+        static_cast<DependencyPartLabeledArc*>((*dependency_parts)[offset + r]);
+      instance->SetHead(arc->modifier(), arc->head());
+      instance->SetRelationId(arc->modifier(), arc->label());
+    } else {
+      DependencyPartArc *arc =
+        static_cast<DependencyPartArc*>((*dependency_parts)[offset + r]);
+      instance->SetHead(arc->modifier(), arc->head());
+    }
+  }
+  for (int m = 1; m < instance_length; ++m) {
+    if (instance->GetHead(m) < 0) {
+      VLOG(2) << "Word without head.";
+      instance->SetHead(m, 0);
+      if (labeled) instance->SetRelationId(m, 0);
+    }
+  }
+}
+
+void DependencyPipe::SaveBinaryCorpus(const string &input_path,
+                                      const string &output_path) {
+  DependencyReader reader;
+  DependencyBinaryWriter writer(GetDependencyDictionary());
+  reader.Open(input_path);
+  writer.Open(output_path);
+  int num_instances = 0;
+  DependencyInstanceNumeric instance_numeric;
+  for (Instance *instance = reader.GetNext(); instance != NULL;
+       instance = reader.GetNext()) {
+    instance_numeric.Initialize(*GetDependencyDictionary(),
+                                static_cast<DependencyInstance*>(instance));
+    writer.Write(&instance_numeric);
+    delete instance;
+    ++num_instances;
+  }
+  writer.Close();
+  reader.Close();
+  LOG(INFO) << "Wrote " << num_instances << " instances to " << output_path
+            << ".";
+}
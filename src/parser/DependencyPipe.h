@@ -67,6 +67,21 @@ public:
     LoadPrunerModelByName(GetDependencyOptions()->GetPrunerModelFilePath());
   }
 
+  // Compact the parameters of the parser and of the pruner.
+  int CompactParameters(double threshold, int max_features_per_type) {
+    return Pipe::CompactParameters(threshold, max_features_per_type) +
+      pruner_parameters_->Compact(threshold, max_features_per_type);
+  }
+
+  // Get the parsing accuracy (unlabeled attachment score).
+  double GetEvaluationScore() {
+    return static_cast<double>(num_tokens_ - num_head_mistakes_) /
+      static_cast<double>(num_tokens_);
+  }
+
+  // Convert a CONLL file into a binary corpus, using the current dictionaries.
+  void SaveBinaryCorpus(const string &input_path, const string &output_path);
+
   // Check if a tree is projective.
   // TODO(atm): This function should probably be moved to another class.
   bool IsProjectiveTree(const vector<int> &heads) const {
@@ -81,8 +96,20 @@ protected:
     dictionary_ = new DependencyDictionary(this);
     GetDependencyDictionary()->SetTokenDictionary(token_dictionary_);
   };
-  void CreateReader() { reader_ = new DependencyReader; };
-  void CreateWriter() { writer_ = new DependencyWriter; };
+  void CreateReader() {
+    if (UseBinaryFormat()) {
+      reader_ = new DependencyBinaryReader(GetDependencyDictionary());
+    } else {
+      reader_ = new DependencyReader;
+    }
+  };
+  void CreateWriter() {
+    if (UseBinaryFormat()) {
+      writer_ = new DependencyBinaryWriter(GetDependencyDictionary());
+    } else {
+      writer_ = new DependencyWriter;
+    }
+  };
   void CreateDecoder() { decoder_ = new DependencyDecoder(this); };
   Parts *CreateParts() { return new DependencyParts; };
   Features *CreateFeatures() { return new DependencyFeatures(this); };
@@ -91,6 +118,10 @@ protected:
     token_dictionary_ = new TokenDictionary(this);
   };
 
+  bool UseBinaryFormat() {
+    return GetDependencyOptions()->file_format() == "binary";
+  }
+
   Parameters *GetTrainingParameters() {
     if (train_pruner_) return pruner_parameters_;
     return parameters_;
@@ -99,6 +130,8 @@ protected:
   void PreprocessData();
 
   Instance *GetFormattedInstance(Instance *instance) {
+    // Binary corpora are read directly as numeric instances.
+    if (UseBinaryFormat()) return instance;
     DependencyInstanceNumeric *instance_numeric =
       new DependencyInstanceNumeric;
     instance_numeric->Initialize(*GetDependencyDictionary(),
@@ -106,10 +139,18 @@ protected:
     return instance_numeric;
   }
 
+  // The root symbol is not counted.
+  int GetNumTokens(Instance *instance) {
+    if (UseBinaryFormat()) {
+      return static_cast<DependencyInstanceNumeric*>(instance)->size() - 1;
+    }
+    return static_cast<DependencyInstance*>(instance)->size() - 1;
+  }
+
   void SaveModel(FILE* fs);
   void LoadModel(FILE* fs);
 
-  void LoadPrunerModel(FILE* fs);
+  void LoadPrunerModel(FILE* fs, const StreamLayout &layout);
   void LoadPrunerModelByName(const string &model_name);
 
   void EnforceWellFormedGraph(Instance *instance,
@@ -212,8 +253,22 @@ protected:
   void TouchParameters(Parts *parts, Features *features,
                        const vector<bool> &selected_parts);
 
+  // The parts (after pruning) and the features of a training sentence do not
+  // change across epochs, so they can be cached.
+  bool SupportsFeatureCache() { return true; }
+  void SaveCachedPartsAndFeatures(vector<char> *buffer, Instance *instance,
+                                  Parts *parts, Features *features) {
+    static_cast<DependencyParts*>(parts)->Save(buffer);
+    static_cast<DependencyFeatures*>(features)->Save(buffer);
+  }
+  void LoadCachedPartsAndFeatures(const char **data, const char *end,
+                                  Instance *instance,
+                                  Parts *parts, Features *features);
+
   void LabelInstance(Parts *parts, const vector<double> &output,
                      Instance *instance);
+  void LabelNumericInstance(Parts *parts, const vector<double> &output,
+                            DependencyInstanceNumeric *instance);
 
   void Prune(Instance *instance, Parts *parts, vector<double> *gold_outputs,
              bool preserve_gold);
@@ -223,6 +278,7 @@ protected:
     num_head_pruned_mistakes_ = 0;
     num_heads_after_pruning_ = 0;
     num_tokens_ = 0;
+    GetDependencyDecoder()->ClearAD3Statistics();
     chrono.GetTime();
   }
   virtual void EvaluateInstance(Instance *instance,
@@ -230,13 +286,14 @@ protected:
                                 Parts *parts,
                                 const vector<double> &gold_outputs,
                                 const vector<double> &predicted_outputs) {
-    DependencyInstance *dependency_instance =
-      static_cast<DependencyInstance*>(instance);
+    int length = UseBinaryFormat() ?
+      static_cast<DependencyInstanceNumeric*>(instance)->size() :
+      static_cast<DependencyInstance*>(instance)->size();
     DependencyParts *dependency_parts = static_cast<DependencyParts*>(parts);
-    for (int m = 1; m < dependency_instance->size(); ++m) {
+    for (int m = 1; m < length; ++m) {
       int head = -1;
       int num_possible_heads = 0;
-      for (int h = 0; h < dependency_instance->size(); ++h) {
+      for (int h = 0; h < length; ++h) {
         int r = dependency_parts->FindArc(h, m);
         if (r < 0) continue;
         ++num_possible_heads;
@@ -259,9 +316,7 @@ protected:
     }
   }
   virtual void EndEvaluation() {
-    LOG(INFO) << "Parsing accuracy: " <<
-      static_cast<double>(num_tokens_ - num_head_mistakes_) /
-      static_cast<double>(num_tokens_);
+    LOG(INFO) << "Parsing accuracy: " << GetEvaluationScore();
     LOG(INFO) << "Pruning recall: " <<
       static_cast<double>(num_tokens_ - num_head_pruned_mistakes_) /
       static_cast<double>(num_tokens_);
@@ -274,6 +329,15 @@ protected:
     double tokens_per_second = static_cast<double>(num_tokens_) / num_seconds;
     LOG(INFO) << "Parsing speed: "
       << tokens_per_second << " tokens per second.";
+    AD3Statistics ad3_statistics;
+    GetDependencyDecoder()->GetAD3Statistics(&ad3_statistics);
+    if (ad3_statistics.num_sentences > 0) {
+      LOG(INFO) << "AD3: " << ad3_statistics.num_sentences << " sentences, "
+        << ad3_statistics.num_integral << " integer, "
+        << ad3_statistics.num_fractional << " fractional, "
+        << ad3_statistics.num_unsolved << " unsolved, "
+        << ad3_statistics.time << " sec.";
+    }
   }
 
 #if 0
@@ -17,6 +17,9 @@
 // along with TurboParser 2.3.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "DependencyReader.h"
+#include "DependencyDictionary.h"
+#include "DependencyInstanceNumeric.h"
+#include "SerializationUtils.h"
 #include "Utils.h"
 #include <iostream>
 #include <sstream>
@@ -100,3 +103,65 @@ Instance *DependencyReader::GetNext() {
 
   return static_cast<Instance*>(instance);
 }
+
+void DependencyBinaryReader::ReadHeader(const string &filepath,
+                                        uint64_t *dictionary_checksum,
+                                        uint64_t *dictionary_size) {
+  fs_ = fopen(filepath.c_str(), "rb");
+  CHECK(fs_) << "Could not open " << filepath << ".";
+  bool success;
+  uint64_t check, version;
+  success = ReadUINT64(fs_, &check);
+  CHECK(success);
+  CHECK_EQ(check, kDependencyBinaryCorpusCheck)
+    << filepath << " is not a binary corpus.";
+  success = ReadUINT64(fs_, &version);
+  CHECK(success);
+  CHECK_EQ(version, kDependencyBinaryCorpusVersion)
+    << "Unsupported binary corpus version.";
+  success = ReadUINT64(fs_, dictionary_checksum);
+  CHECK(success);
+  success = ReadUINT64(fs_, dictionary_size);
+  CHECK(success);
+}
+
+void DependencyBinaryReader::Open(const string &filepath) {
+  uint64_t dictionary_checksum;
+  uint64_t dictionary_size;
+  ReadHeader(filepath, &dictionary_checksum, &dictionary_size);
+
+  // The ids are only meaningful with the dictionaries they were encoded with.
+  CHECK_EQ(dictionary_checksum, dictionary_->GetChecksum())
+    << filepath << " was encoded with different dictionaries than the "
+    << "ones of the current model.";
+
+  // Skip the dictionaries.
+  CHECK_EQ(0, fseek(fs_, dictionary_size, SEEK_CUR));
+}
+
+void DependencyBinaryReader::Close() {
+  if (fs_) fclose(fs_);
+  fs_ = NULL;
+}
+
+Instance *DependencyBinaryReader::GetNext() {
+  if (!fs_) return NULL;
+  DependencyInstanceNumeric *instance = new DependencyInstanceNumeric;
+  if (!instance->Load(fs_)) {
+    delete instance;
+    return NULL;
+  }
+  return instance;
+}
+
+void DependencyBinaryReader::LoadDictionaries(const string &filepath) {
+  uint64_t dictionary_checksum;
+  uint64_t dictionary_size;
+  ReadHeader(filepath, &dictionary_checksum, &dictionary_size);
+  dictionary_->GetTokenDictionary()->Load(fs_);
+  dictionary_->Load(fs_);
+  Close();
+
+  CHECK_EQ(dictionary_checksum, dictionary_->GetChecksum())
+    << "Corrupted dictionaries in " << filepath << ".";
+}
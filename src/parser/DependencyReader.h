@@ -22,9 +22,18 @@
 #include "DependencyInstance.h"
 #include "Reader.h"
 #include <fstream>
+#include <stdio.h>
+#include <stdint.h>
 
 using namespace std;
 
+class DependencyDictionary;
+
+// Header fields of binary corpora (see DependencyBinaryWriter).
+const uint64_t kDependencyBinaryCorpusCheck = 1234567891;
+// Version 2 replaced the alphabet sizes by a checksum of the dictionaries.
+const uint64_t kDependencyBinaryCorpusVersion = 2;
+
 class DependencyReader : public Reader {
 public:
   DependencyReader() {};
@@ -34,4 +43,36 @@ public:
   Instance *GetNext();
 };
 
+// Reader for pre-tokenized binary corpora (--file_format=binary), as written
+// by DependencyBinaryWriter. Instances are returned directly as
+// DependencyInstanceNumeric, with no string processing or dictionary lookups.
+// The header of the file stores the dictionaries used for the encoding; the
+// ids are checked against the current dictionaries when the file is opened.
+class DependencyBinaryReader : public DependencyReader {
+public:
+  DependencyBinaryReader(DependencyDictionary *dictionary) {
+    dictionary_ = dictionary;
+    fs_ = NULL;
+  }
+  virtual ~DependencyBinaryReader() { Close(); }
+
+public:
+  void Open(const string &filepath);
+  void Close();
+  Instance *GetNext();
+
+  // Load the token and label dictionaries stored in the header of a binary
+  // corpus. Used when training directly from a binary corpus.
+  void LoadDictionaries(const string &filepath);
+
+protected:
+  // Read the file header and leave the stream at the dictionaries.
+  void ReadHeader(const string &filepath, uint64_t *dictionary_checksum,
+                  uint64_t *dictionary_size);
+
+protected:
+  DependencyDictionary *dictionary_;
+  FILE *fs_;
+};
+
 #endif /* DEPENDENCYREADER_H_ */
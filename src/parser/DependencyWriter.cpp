@@ -18,6 +18,9 @@
 
 #include "DependencyWriter.h"
 #include "DependencyInstance.h"
+#include "DependencyInstanceNumeric.h"
+#include "DependencyDictionary.h"
+#include "SerializationUtils.h"
 #include <iostream>
 #include <sstream>
 
@@ -39,3 +42,41 @@ void DependencyWriter::Write(Instance *instance) {
 }
 
 void DependencyWriter::WriteFormatted(Pipe * pipe, Instance *instance) {}
+
+// A binary corpus starts with a check number, a version, the checksum of
+// the encoding dictionaries, the size in bytes of the serialized
+// dictionaries, and the dictionaries themselves; then one record per
+// sentence follows (see DependencyInstanceNumeric::Save).
+void DependencyBinaryWriter::Open(const string &filepath) {
+  fs_ = fopen(filepath.c_str(), "wb");
+  CHECK(fs_) << "Could not open " << filepath << ".";
+  bool success;
+  success = WriteUINT64(fs_, kDependencyBinaryCorpusCheck);
+  CHECK(success);
+  success = WriteUINT64(fs_, kDependencyBinaryCorpusVersion);
+  CHECK(success);
+  success = WriteUINT64(fs_, dictionary_->GetChecksum());
+  CHECK(success);
+
+  // Write a placeholder for the dictionary size and fill it in afterwards.
+  long size_position = ftell(fs_);
+  success = WriteUINT64(fs_, 0);
+  CHECK(success);
+  long dictionary_position = ftell(fs_);
+  dictionary_->GetTokenDictionary()->Save(fs_);
+  dictionary_->Save(fs_);
+  long end_position = ftell(fs_);
+  CHECK_EQ(0, fseek(fs_, size_position, SEEK_SET));
+  success = WriteUINT64(fs_, end_position - dictionary_position);
+  CHECK(success);
+  CHECK_EQ(0, fseek(fs_, end_position, SEEK_SET));
+}
+
+void DependencyBinaryWriter::Close() {
+  if (fs_) fclose(fs_);
+  fs_ = NULL;
+}
+
+void DependencyBinaryWriter::Write(Instance *instance) {
+  static_cast<DependencyInstanceNumeric*>(instance)->Save(fs_);
+}
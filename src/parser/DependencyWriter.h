@@ -21,6 +21,7 @@
 
 #include "Writer.h"
 #include <fstream>
+#include <stdio.h>
 
 using namespace std;
 
@@ -34,4 +35,28 @@ public:
   void WriteFormatted(Pipe * pipe, Instance *instance);
 };
 
+class DependencyDictionary;
+
+// Writer for pre-tokenized binary corpora (--file_format=binary). Expects
+// DependencyInstanceNumeric instances; the header stores the dictionaries
+// that give meaning to the ids.
+class DependencyBinaryWriter : public DependencyWriter {
+public:
+  DependencyBinaryWriter(DependencyDictionary *dictionary) {
+    dictionary_ = dictionary;
+    fs_ = NULL;
+  }
+  virtual ~DependencyBinaryWriter() { Close(); }
+
+public:
+  void Open(const string &filepath);
+  void Close();
+  void Write(Instance *instance);
+  void WriteFormatted(Pipe * pipe, Instance *instance) {}
+
+protected:
+  DependencyDictionary *dictionary_;
+  FILE *fs_;
+};
+
 #endif /* DEPENDENCYWRITER_H_ */
@@ -32,6 +32,8 @@ using namespace std;
 
 void TrainParser();
 void TestParser();
+void ConvertParserModel();
+void ConvertCorpusToBinary();
 
 int main(int argc, char** argv) {
   // Initialize Google's logging library.
@@ -40,7 +42,13 @@ int main(int argc, char** argv) {
   // Parse command line flags.
   google::ParseCommandLineFlags(&argc, &argv, true);
 
-  if (FLAGS_train) {
+  if (FLAGS_file_mapped_model != "") {
+    LOG(INFO) << "Converting parser model..." << endl;
+    ConvertParserModel();
+  } else if (FLAGS_file_binary_corpus != "") {
+    LOG(INFO) << "Converting corpus to binary format..." << endl;
+    ConvertCorpusToBinary();
+  } else if (FLAGS_train) {
     LOG(INFO) << "Training parser..." << endl;
     TrainParser();
   } else if (FLAGS_test) {
@@ -125,3 +133,48 @@ void TestParser() {
 
   LOG(INFO) << "Testing took " << time << " sec." << endl;
 }
+
+void ConvertParserModel() {
+  double time;
+  chronowrap::Chronometer chrono;
+  chrono.GetTime();
+
+  DependencyOptions *options = new DependencyOptions;
+  options->Initialize();
+
+  DependencyPipe *pipe = new DependencyPipe(options);
+  pipe->Initialize();
+  pipe->LoadModelFile();
+  pipe->SaveMappedModelFile();
+
+  delete pipe;
+  delete options;
+
+  chrono.StopTime();
+  time = chrono.GetElapsedTime();
+
+  LOG(INFO) << "Conversion took " << time << " sec." << endl;
+}
+
+void ConvertCorpusToBinary() {
+  double time;
+  chronowrap::Chronometer chrono;
+  chrono.GetTime();
+
+  DependencyOptions *options = new DependencyOptions;
+  options->Initialize();
+
+  DependencyPipe *pipe = new DependencyPipe(options);
+  pipe->Initialize();
+  pipe->LoadModelFile();
+  pipe->SaveBinaryCorpus(options->GetTestFilePath(),
+                         options->GetBinaryCorpusFilePath());
+
+  delete pipe;
+  delete options;
+
+  chrono.StopTime();
+  time = chrono.GetElapsedTime();
+
+  LOG(INFO) << "Conversion took " << time << " sec." << endl;
+}
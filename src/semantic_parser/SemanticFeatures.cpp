@@ -21,6 +21,7 @@
 #include "SemanticPart.h"
 #include "SemanticFeatureTemplates.h"
 #include <set>
+#include <algorithm>
 
 // Flags for specific options in feature definitions.
 // Note: this will be deprecated soon.
@@ -47,9 +48,7 @@ void SemanticFeatures::AddPredicateFeatures(SemanticInstanceNumeric* sentence,
                                             int predicate_id) {
   //LOG(INFO) << "Adding predicate features";
 
-  CHECK(!input_features_[r]);
-  BinaryFeatures *features = new BinaryFeatures;
-  input_features_[r] = features;
+  CreatePartFeatures(r, false);
 
   if (FLAGS_srl_use_predicate_features) {
     AddPredicateFeatures(sentence, false,
@@ -77,7 +76,6 @@ void SemanticFeatures::AddArcFeatures(SemanticInstanceNumeric* sentence,
   AddPredicateFeatures(sentence, SemanticFeatureTemplateParts::ARC_PREDICATE,
                        r, predicate, predicate_id);
 
-  int sentence_length = sentence->size();
   // True if labeled semantic parsing.
   bool labeled =
     static_cast<SemanticOptions*>(pipe_->GetOptions())->labeled();
@@ -111,22 +109,9 @@ void SemanticFeatures::AddArcFeatures(SemanticInstanceNumeric* sentence,
   }
   arc_length = right_position - left_position;
 
-  // 7 possible values for binned_length_code (3 bits)
-  if (arc_length > 40) {
-    binned_length_code = 0x3; //0x6;
-  } else if (arc_length > 30) {
-    binned_length_code = 0x3; //0x5;
-  } else if (arc_length > 20) {
-    binned_length_code = 0x3; //0x4;
-  } else if (arc_length > 10) {
-    binned_length_code = 0x3;
-  } else if (arc_length > 5) {
-    binned_length_code = 0x2;
-  } else if (arc_length > 2) {
-    binned_length_code = 0x1;
-  } else {
-    binned_length_code = 0x0;
-  }
+  // 4 possible values for binned_length_code (lengths above 10 share the
+  // same bin).
+  binned_length_code = std::min(sentence->GetBinnedLengthCode(arc_length), 0x3);
 
   // List of argument dependents, left and right siblings.
   const vector<int> &argument_dependents = sentence->GetModifiers(argument);
@@ -233,12 +218,11 @@ void SemanticFeatures::AddArcFeatures(SemanticInstanceNumeric* sentence,
     rMWID = 0x0;
   }
 
-  // Contextual information.
-  pHPID = (predicate > 0) ? (*pos_ids)[predicate - 1] : TOKEN_START;
-  pMPID = (argument > 0) ? (*pos_ids)[argument - 1] : TOKEN_START;
-  nHPID = (predicate < sentence_length - 1) ? (*pos_ids)[predicate + 1] : TOKEN_STOP;
-  nMPID = (argument < sentence_length - 1) ?
-    (*pos_ids)[argument + 1] : TOKEN_STOP;
+  // Contextual information (padded with TOKEN_START/TOKEN_STOP).
+  pHPID = sentence->GetContextPosId(predicate - 1);
+  pMPID = sentence->GetContextPosId(argument - 1);
+  nHPID = sentence->GetContextPosId(predicate + 1);
+  nMPID = sentence->GetContextPosId(argument + 1);
 
   // Maximum is 255 feature templates.
   CHECK_LT(SemanticFeatureTemplateArc::COUNT, 256);
@@ -430,23 +414,13 @@ void SemanticFeatures::AddArcFeatures(SemanticInstanceNumeric* sentence,
   SemanticOptions *options = static_cast<class SemanticPipe*>(pipe_)->
     GetSemanticOptions();
 
-  BinaryFeatures *features = new BinaryFeatures;
-  if (labeled) {
-    CHECK_GE(r, 0);
-    CHECK_LT(r, input_labeled_features_.size());
-    CHECK(!input_labeled_features_[r]);
-    input_labeled_features_[r] = features;
-  } else {
-    CHECK(!input_features_[r]);
-    input_features_[r] = features;
-  }
+  BinaryFeatures *features = CreatePartFeatures(r, labeled);
 
   // Add arc predicate features.
   AddPredicateFeatures(sentence, labeled,
                        SemanticFeatureTemplateParts::ARC_PREDICATE,
                        r, predicate, predicate_id);
 
-  int sentence_length = sentence->size();
   bool use_dependency_features = options->use_dependency_syntactic_features();
   bool use_contextual_dependency_features = use_dependency_features;
   bool use_contextual_features = FLAGS_srl_use_contextual_features;
@@ -479,21 +453,7 @@ void SemanticFeatures::AddArcFeatures(SemanticInstanceNumeric* sentence,
 
   // 7 possible values for binned_length_code (3 bits).
   exact_length_code = (arc_length > 0xff) ? 0xff : arc_length;
-  if (arc_length > 40) {
-    binned_length_code = 0x6;
-  } else if (arc_length > 30) {
-    binned_length_code = 0x5;
-  } else if (arc_length > 20) {
-    binned_length_code = 0x4;
-  } else if (arc_length > 10) {
-    binned_length_code = 0x3;
-  } else if (arc_length > 5) {
-    binned_length_code = 0x2;
-  } else if (arc_length > 2) {
-    binned_length_code = 0x1;
-  } else {
-    binned_length_code = 0x0;
-  }
+  binned_length_code = sentence->GetBinnedLengthCode(arc_length);
 
   // List of argument dependents, left and right siblings.
   const vector<int> &argument_dependents = sentence->GetModifiers(argument);
@@ -546,19 +506,13 @@ void SemanticFeatures::AddArcFeatures(SemanticInstanceNumeric* sentence,
   uint8_t flag_between_punc = 0x1;
   uint8_t flag_between_coord = 0x2;
 
-  // TODO: This is expensive and could be precomputed.
-  int num_between_verb = 0;
-  int num_between_punc = 0;
-  int num_between_coord = 0;
-  for (int i = left_position + 1; i < right_position; ++i) {
-    if (sentence->IsVerb(i)) {
-      ++num_between_verb;
-    } else if (sentence->IsPunctuation(i)) {
-      ++num_between_punc;
-    } else if (sentence->IsCoordination(i)) {
-      ++num_between_coord;
-    }
-  }
+  // These counts are precomputed for the sentence.
+  int num_between_verb =
+    sentence->GetNumVerbsBetween(left_position, right_position);
+  int num_between_punc =
+    sentence->GetNumPunctuationsBetween(left_position, right_position);
+  int num_between_coord =
+    sentence->GetNumCoordinationsBetween(left_position, right_position);
 
   // 4 bits to denote the number of occurrences for each flag.
   // Maximum will be 15 occurrences.
@@ -638,48 +592,36 @@ void SemanticFeatures::AddArcFeatures(SemanticInstanceNumeric* sentence,
     rMWID = 0x0;
   }
 
-  // Contextual information.
+  // Contextual information (padded with TOKEN_START/TOKEN_STOP).
   // Context size = 1:
-  pHLID = (predicate > 0) ? sentence->GetLemmaId(predicate - 1) : TOKEN_START;
-  pMLID = (argument > 0) ? sentence->GetLemmaId(argument - 1) : TOKEN_START;
-  pHWID = (predicate > 0) ? sentence->GetFormId(predicate - 1) : TOKEN_START;
-  pMWID = (argument > 0) ? sentence->GetFormId(argument - 1) : TOKEN_START;
-  pHPID = (predicate > 0) ? sentence->GetPosId(predicate - 1) : TOKEN_START;
-  pMPID = (argument > 0) ? sentence->GetPosId(argument - 1) : TOKEN_START;
-
-  nHLID = (predicate < sentence_length - 1) ?
-    sentence->GetLemmaId(predicate + 1) : TOKEN_STOP;
-  nMLID = (argument < sentence_length - 1) ?
-    sentence->GetLemmaId(argument + 1) : TOKEN_STOP;
-  nHWID = (predicate < sentence_length - 1) ?
-    sentence->GetFormId(predicate + 1) : TOKEN_STOP;
-  nMWID = (argument < sentence_length - 1) ?
-    sentence->GetFormId(argument + 1) : TOKEN_STOP;
-  nHPID = (predicate < sentence_length - 1) ?
-    sentence->GetPosId(predicate + 1) : TOKEN_STOP;
-  nMPID = (argument < sentence_length - 1) ?
-    sentence->GetPosId(argument + 1) : TOKEN_STOP;
+  pHLID = sentence->GetContextLemmaId(predicate - 1);
+  pMLID = sentence->GetContextLemmaId(argument - 1);
+  pHWID = sentence->GetContextFormId(predicate - 1);
+  pMWID = sentence->GetContextFormId(argument - 1);
+  pHPID = sentence->GetContextPosId(predicate - 1);
+  pMPID = sentence->GetContextPosId(argument - 1);
+
+  nHLID = sentence->GetContextLemmaId(predicate + 1);
+  nMLID = sentence->GetContextLemmaId(argument + 1);
+  nHWID = sentence->GetContextFormId(predicate + 1);
+  nMWID = sentence->GetContextFormId(argument + 1);
+  nHPID = sentence->GetContextPosId(predicate + 1);
+  nMPID = sentence->GetContextPosId(argument + 1);
 
   // Context size = 2:
-  ppHLID = (predicate > 1) ? sentence->GetLemmaId(predicate - 2) : TOKEN_START;
-  ppMLID = (argument > 1) ? sentence->GetLemmaId(argument - 2) : TOKEN_START;
-  ppHWID = (predicate > 1) ? sentence->GetFormId(predicate - 2) : TOKEN_START;
-  ppMWID = (argument > 1) ? sentence->GetFormId(argument - 2) : TOKEN_START;
-  ppHPID = (predicate > 1) ? sentence->GetPosId(predicate - 2) : TOKEN_START;
-  ppMPID = (argument > 1) ? sentence->GetPosId(argument - 2) : TOKEN_START;
-
-  nnHLID = (predicate < sentence_length - 2) ?
-    sentence->GetLemmaId(predicate + 2) : TOKEN_STOP;
-  nnMLID = (argument < sentence_length - 2) ?
-    sentence->GetLemmaId(argument + 2) : TOKEN_STOP;
-  nnHWID = (predicate < sentence_length - 2) ?
-    sentence->GetFormId(predicate + 2) : TOKEN_STOP;
-  nnMWID = (argument < sentence_length - 2) ?
-    sentence->GetFormId(argument + 2) : TOKEN_STOP;
-  nnHPID = (predicate < sentence_length - 2) ?
-    sentence->GetPosId(predicate + 2) : TOKEN_STOP;
-  nnMPID = (argument < sentence_length - 2) ?
-    sentence->GetPosId(argument + 2) : TOKEN_STOP;
+  ppHLID = sentence->GetContextLemmaId(predicate - 2);
+  ppMLID = sentence->GetContextLemmaId(argument - 2);
+  ppHWID = sentence->GetContextFormId(predicate - 2);
+  ppMWID = sentence->GetContextFormId(argument - 2);
+  ppHPID = sentence->GetContextPosId(predicate - 2);
+  ppMPID = sentence->GetContextPosId(argument - 2);
+
+  nnHLID = sentence->GetContextLemmaId(predicate + 2);
+  nnMLID = sentence->GetContextLemmaId(argument + 2);
+  nnHWID = sentence->GetContextFormId(predicate + 2);
+  nnMWID = sentence->GetContextFormId(argument + 2);
+  nnHPID = sentence->GetContextPosId(predicate + 2);
+  nnMPID = sentence->GetContextPosId(argument + 2);
 
   // Code for feature type.
   flags = feature_type; // 4 bits.
@@ -1091,14 +1033,7 @@ void SemanticFeatures::AddSiblingFeatures(SemanticInstanceNumeric* sentence,
                                           int first_argument,
                                           int second_argument,
                                           bool consecutive) {
-  BinaryFeatures *features = new BinaryFeatures;
-  if (labeled) {
-    CHECK(!input_labeled_features_[r]);
-    input_labeled_features_[r] = features;
-  } else {
-    CHECK(!input_features_[r]);
-    input_features_[r] = features;
-  }
+  BinaryFeatures *features = CreatePartFeatures(r, labeled);
 
   int sentence_length = sentence->size();
   // Note: unlike the dependency parser case, here the first child
@@ -1301,9 +1236,7 @@ void SemanticFeatures::AddSecondOrderFeatures(
   int argument,
   bool coparents,
   bool consecutive) {
-  CHECK(!input_features_[r]);
-  BinaryFeatures *features = new BinaryFeatures;
-  input_features_[r] = features;
+  BinaryFeatures *features = CreatePartFeatures(r, false);
 
   int sentence_length = sentence->size();
 
@@ -21,6 +21,7 @@
 
 #include "Features.h"
 #include "SemanticInstanceNumeric.h"
+#include "SemanticPart.h"
 #include "FeatureEncoder.h"
 
 class SemanticOptions;
@@ -29,25 +30,40 @@ class SemanticFeatures : public Features {
 public:
   SemanticFeatures() {};
   SemanticFeatures(Pipe* pipe) { pipe_ = pipe; }
-  virtual ~SemanticFeatures() { Clear(); }
+  virtual ~SemanticFeatures() {
+    Clear();
+    for (int k = 0; k < NUM_SEMANTICPARTS; ++k) {
+      for (int i = 0; i < feature_pools_[k].size(); ++i) {
+        delete feature_pools_[k][i];
+      }
+      for (int i = 0; i < labeled_feature_pools_[k].size(); ++i) {
+        delete labeled_feature_pools_[k][i];
+      }
+    }
+  }
 
 public:
+  // The feature vectors are not deleted, but kept (cleared) in a pool for
+  // the next instance, as in DependencyFeatures. There is one pool per part
+  // type, since the number of features depends mostly on the type of part.
   void Clear() {
     CHECK_EQ(input_features_.size(), input_labeled_features_.size());
     for (int r = 0; r < input_features_.size(); ++r) {
       if (input_features_[r]) {
         input_features_[r]->clear();
-        delete input_features_[r];
+        feature_pools_[input_feature_types_[r]].push_back(input_features_[r]);
         input_features_[r] = NULL;
       }
       if (input_labeled_features_[r]) {
         input_labeled_features_[r]->clear();
-        delete input_labeled_features_[r];
+        labeled_feature_pools_[input_feature_types_[r]].push_back(
+          input_labeled_features_[r]);
         input_labeled_features_[r] = NULL;
       }
     }
     input_features_.clear();
     input_labeled_features_.clear();
+    input_feature_types_.clear();
   }
 
   void Initialize(Instance *instance, Parts *parts) {
@@ -55,6 +71,32 @@ public:
     input_features_.resize(parts->size(), static_cast<BinaryFeatures*>(NULL));
     input_labeled_features_.resize(parts->size(),
                                    static_cast<BinaryFeatures*>(NULL));
+    input_feature_types_.resize(parts->size());
+    for (int r = 0; r < parts->size(); ++r) {
+      input_feature_types_[r] = (*parts)[r]->type();
+    }
+  }
+
+  // Create the (empty) unlabeled or labeled feature vector of the r-th part,
+  // taking it from the pool of its part type if possible.
+  BinaryFeatures *CreatePartFeatures(int r, bool labeled) {
+    vector<BinaryFeatures*> &slot = labeled ?
+      input_labeled_features_ : input_features_;
+    CHECK_GE(r, 0);
+    CHECK_LT(r, slot.size());
+    CHECK(!slot[r]);
+    vector<BinaryFeatures*> &pool = labeled ?
+      labeled_feature_pools_[input_feature_types_[r]] :
+      feature_pools_[input_feature_types_[r]];
+    BinaryFeatures *features;
+    if (pool.empty()) {
+      features = new BinaryFeatures;
+    } else {
+      features = pool.back();
+      pool.pop_back();
+    }
+    slot[r] = features;
+    return features;
   }
 
   int GetNumPartFeatures(int r) const {
@@ -215,6 +257,11 @@ protected:
   // Vector of input features to be conjoined with a label to produce a
   // "labeled" feature.
   vector<BinaryFeatures*> input_labeled_features_;
+  // Type of the part of each vector.
+  vector<int> input_feature_types_;
+  // Cleared vectors to be reused by the next instance, per part type.
+  vector<BinaryFeatures*> feature_pools_[NUM_SEMANTICPARTS];
+  vector<BinaryFeatures*> labeled_feature_pools_[NUM_SEMANTICPARTS];
   // Encoder that converts features into a codeword.
   FeatureEncoder encoder_;
 };
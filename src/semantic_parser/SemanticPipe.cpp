@@ -50,7 +50,7 @@ void SemanticPipe::SaveModel(FILE* fs) {
   token_dictionary_->Save(fs);
   dependency_dictionary_->Save(fs);
   Pipe::SaveModel(fs);
-  pruner_parameters_->Save(fs);
+  pruner_parameters_->Save(fs, model_layout_);
 }
 
 void SemanticPipe::LoadModel(FILE* fs) {
@@ -74,10 +74,11 @@ void SemanticPipe::LoadModel(FILE* fs) {
     SetDependencyDictionary(dependency_dictionary_);
   dependency_dictionary_->Load(fs);
   Pipe::LoadModel(fs);
-  pruner_parameters_->Load(fs);
+  pruner_parameters_->Load(fs, model_layout_);
+  if (!options_->train()) pruner_parameters_->Freeze();
 }
 
-void SemanticPipe::LoadPrunerModel(FILE* fs) {
+void SemanticPipe::LoadPrunerModel(FILE* fs, const StreamLayout &layout) {
   LOG(INFO) << "Loading pruner model...";
   // This will be ignored but must be passed to the pruner pipe constructor,
   // so that when loading the pruner model the actual options are not
@@ -86,18 +87,21 @@ void SemanticPipe::LoadPrunerModel(FILE* fs) {
   SemanticPipe* pipe = new SemanticPipe(&pruner_options);
   //SemanticPipe* pipe = new SemanticPipe(options_);
   pipe->Initialize();
+  pipe->model_layout_ = layout;
   pipe->LoadModel(fs);
   delete pruner_parameters_;
   pruner_parameters_ = pipe->parameters_;
   pipe->parameters_ = NULL;
   delete pipe;
+  // A pretrained pruner is never updated.
+  pruner_parameters_->Freeze();
   LOG(INFO) << "Done.";
 }
 
 void SemanticPipe::LoadPrunerModelByName(const string &model_name) {
-  FILE *fs = fopen(model_name.c_str(), "rb");
-  CHECK(fs) << "Could not open pruner model file for reading: " << model_name;
-  LoadPrunerModel(fs);
+  StreamLayout layout;
+  FILE *fs = OpenModelFile(model_name, &layout);
+  LoadPrunerModel(fs, layout);
   fclose(fs);
 }
 
@@ -130,6 +134,10 @@ void SemanticPipe::ComputeScores(Instance *instance, Parts *parts,
   }
   scores->resize(parts->size());
   SemanticParts *semantic_parts = static_cast<SemanticParts*>(parts);
+  // Parts with unlabeled features; these are scored in one batch after the
+  // loop.
+  vector<int> unlabeled_parts;
+  unlabeled_parts.reserve(parts->size());
   for (int r = 0; r < parts->size(); ++r) {
     bool has_unlabeled_features =
       (semantic_features->GetNumPartFeatures(r) > 0);
@@ -143,9 +151,7 @@ void SemanticPipe::ComputeScores(Instance *instance, Parts *parts,
 
     // Compute scores for the unlabeled features.
     if (has_unlabeled_features) {
-      const BinaryFeatures &part_features =
-        semantic_features->GetPartFeatures(r);
-      (*scores)[r] = parameters->ComputeScore(part_features);
+      unlabeled_parts.push_back(r);
     } else {
       (*scores)[r] = 0.0;
     }
@@ -211,6 +217,7 @@ void SemanticPipe::ComputeScores(Instance *instance, Parts *parts,
       }
     }
   }
+  parameters->ComputeScores(*semantic_features, unlabeled_parts, scores);
 }
 
 void SemanticPipe::RemoveUnsupportedFeatures(Instance *instance, Parts *parts,
@@ -584,11 +591,13 @@ void SemanticPipe::MakePartsBasic(Instance *instance,
 
   // Prune using a basic first-order model.
   if (GetSemanticOptions()->prune_basic()) {
+    BeginProfilingStage(PIPE_STAGE_PRUNE);
     if (options_->train()) {
       Prune(instance, parts, gold_outputs, true);
     } else {
       Prune(instance, parts, gold_outputs, false);
     }
+    EndProfilingStage(PIPE_STAGE_PRUNE);
     semantic_parts->BuildOffsets();
     semantic_parts->BuildIndices(sentence_length, false);
   }
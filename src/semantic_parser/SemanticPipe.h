@@ -70,6 +70,24 @@ public:
     LoadPrunerModelByName(GetSemanticOptions()->GetPrunerModelFilePath());
   }
 
+  // Compact the parameters of the parser and of the pruner.
+  int CompactParameters(double threshold, int max_features_per_type) {
+    return Pipe::CompactParameters(threshold, max_features_per_type) +
+      pruner_parameters_->Compact(threshold, max_features_per_type);
+  }
+
+  // Get the labeled F1 of the predicted arcs.
+  double GetEvaluationScore() {
+    double labeled_precision =
+      static_cast<double>(num_matched_labeled_arcs_) /
+      static_cast<double>(num_predicted_labeled_arcs_);
+    double labeled_recall =
+      static_cast<double>(num_matched_labeled_arcs_) /
+      static_cast<double>(num_gold_labeled_arcs_);
+    return 2.0 * labeled_precision * labeled_recall /
+      (labeled_precision + labeled_recall);
+  }
+
 protected:
   void CreateDictionary() {
     dictionary_ = new SemanticDictionary(this);
@@ -109,10 +127,15 @@ protected:
     return instance_numeric;
   }
 
+  // The root symbol is not counted.
+  int GetNumTokens(Instance *instance) {
+    return static_cast<SemanticInstance*>(instance)->size() - 1;
+  }
+
   void SaveModel(FILE* fs);
   void LoadModel(FILE* fs);
 
-  void LoadPrunerModel(FILE* fs);
+  void LoadPrunerModel(FILE* fs, const StreamLayout &layout);
   void LoadPrunerModelByName(const string &model_name);
 
   void MakeParts(Instance *instance, Parts *parts,
@@ -28,33 +28,21 @@ class SequenceFeatures : public Features {
 public:
   SequenceFeatures() {};
   SequenceFeatures(Pipe* pipe) { pipe_ = pipe; }
-  virtual ~SequenceFeatures() { Clear(); }
+  virtual ~SequenceFeatures() {
+    Clear();
+    DeletePool(&unigram_pool_);
+    DeletePool(&bigram_pool_);
+    DeletePool(&trigram_pool_);
+  }
 
 public:
+  // The feature vectors are not deleted, but kept (cleared) in a pool for
+  // the next instance, as in DependencyFeatures. There is one pool per
+  // n-gram order, since the number of features depends mostly on it.
   void Clear() {
-    for (int i = 0; i < input_features_unigrams_.size(); ++i) {
-      if (!input_features_unigrams_[i]) continue;
-      input_features_unigrams_[i]->clear();
-      delete input_features_unigrams_[i];
-      input_features_unigrams_[i] = NULL;
-    }
-    input_features_unigrams_.clear();
-
-    for (int i = 0; i < input_features_bigrams_.size(); ++i) {
-      if (!input_features_bigrams_[i]) continue;
-      input_features_bigrams_[i]->clear();
-      delete input_features_bigrams_[i];
-      input_features_bigrams_[i] = NULL;
-    }
-    input_features_bigrams_.clear();
-
-    for (int i = 0; i < input_features_trigrams_.size(); ++i) {
-      if (!input_features_trigrams_[i]) continue;
-      input_features_trigrams_[i]->clear();
-      delete input_features_trigrams_[i];
-      input_features_trigrams_[i] = NULL;
-    }
-    input_features_trigrams_.clear();
+    ReleaseFeatures(&input_features_unigrams_, &unigram_pool_);
+    ReleaseFeatures(&input_features_bigrams_, &bigram_pool_);
+    ReleaseFeatures(&input_features_trigrams_, &trigram_pool_);
   }
 
   void Initialize(Instance *instance, Parts *parts) {
@@ -95,25 +83,69 @@ public:
   virtual void AddUnigramFeatures(SequenceInstanceNumeric *sentence,
                                   int position) {
     // Add an empty feature vector.
-    CHECK(!input_features_unigrams_[position]);
-    BinaryFeatures *features = new BinaryFeatures;
-    input_features_unigrams_[position] = features;
+    CreateUnigramFeatures(position);
   }
 
   virtual void AddBigramFeatures(SequenceInstanceNumeric *sentence,
                                  int position) {
     // Add an empty feature vector.
-    CHECK(!input_features_bigrams_[position]);
-    BinaryFeatures *features = new BinaryFeatures;
-    input_features_bigrams_[position] = features;
+    CreateBigramFeatures(position);
   }
 
   virtual void AddTrigramFeatures(SequenceInstanceNumeric *sentence,
                                   int position) {
     // Add an empty feature vector.
-    CHECK(!input_features_trigrams_[position]);
-    BinaryFeatures *features = new BinaryFeatures;
-    input_features_trigrams_[position] = features;
+    CreateTrigramFeatures(position);
+  }
+
+protected:
+  // Create the (empty) feature vector of the unigram/bigram/trigram at
+  // a position, taking it from the pool if possible.
+  BinaryFeatures *CreateUnigramFeatures(int position) {
+    return CreateFeatures(position, &input_features_unigrams_, &unigram_pool_);
+  }
+
+  BinaryFeatures *CreateBigramFeatures(int position) {
+    return CreateFeatures(position, &input_features_bigrams_, &bigram_pool_);
+  }
+
+  BinaryFeatures *CreateTrigramFeatures(int position) {
+    return CreateFeatures(position, &input_features_trigrams_, &trigram_pool_);
+  }
+
+private:
+  BinaryFeatures *CreateFeatures(int position,
+                                 vector<BinaryFeatures*> *input_features,
+                                 vector<BinaryFeatures*> *pool) {
+    CHECK(!(*input_features)[position]) << position << " "
+                                        << input_features->size();
+    BinaryFeatures *features;
+    if (pool->empty()) {
+      features = new BinaryFeatures;
+    } else {
+      features = pool->back();
+      pool->pop_back();
+    }
+    (*input_features)[position] = features;
+    return features;
+  }
+
+  void ReleaseFeatures(vector<BinaryFeatures*> *input_features,
+                       vector<BinaryFeatures*> *pool) {
+    for (int i = 0; i < input_features->size(); ++i) {
+      if (!(*input_features)[i]) continue;
+      (*input_features)[i]->clear();
+      pool->push_back((*input_features)[i]);
+      (*input_features)[i] = NULL;
+    }
+    input_features->clear();
+  }
+
+  void DeletePool(vector<BinaryFeatures*> *pool) {
+    for (int i = 0; i < pool->size(); ++i) {
+      delete (*pool)[i];
+    }
+    pool->clear();
   }
 
 protected:
@@ -121,6 +153,10 @@ protected:
   vector<BinaryFeatures*> input_features_unigrams_;
   vector<BinaryFeatures*> input_features_bigrams_;
   vector<BinaryFeatures*> input_features_trigrams_;
+  // Cleared vectors to be reused by the next instance.
+  vector<BinaryFeatures*> unigram_pool_;
+  vector<BinaryFeatures*> bigram_pool_;
+  vector<BinaryFeatures*> trigram_pool_;
 };
 
 #endif /* SEQUENCEFEATURES_H_ */
@@ -83,6 +83,8 @@ void SequencePipe::ComputeScores(Instance *instance,
     static_cast<SequenceFeatures*>(features);
   SequenceDictionary *sequence_dictionary = GetSequenceDictionary();
   scores->resize(parts->size());
+  // Label scores of the current part, reused across parts.
+  vector<double> tag_scores;
 
   // Compute scores for the unigram parts.
   for (int i = 0; i < sentence->size(); ++i) {
@@ -98,7 +100,6 @@ void SequencePipe::ComputeScores(Instance *instance,
         static_cast<SequencePartUnigram*>((*parts)[index_unigram_parts[k]]);
       allowed_tags[k] = unigram->tag();
     }
-    vector<double> tag_scores;
     parameters_->ComputeLabelScores(unigram_features,
                                     allowed_tags,
                                     &tag_scores);
@@ -123,7 +124,6 @@ void SequencePipe::ComputeScores(Instance *instance,
                                                              bigram->tag());
       }
 
-      vector<double> tag_scores;
       parameters_->ComputeLabelScores(bigram_features,
                                       bigram_tags,
                                       &tag_scores);
@@ -151,7 +151,6 @@ void SequencePipe::ComputeScores(Instance *instance,
           trigram->tag());
       }
 
-      vector<double> tag_scores;
       parameters_->ComputeLabelScores(trigram_features,
                                       trigram_tags,
                                       &tag_scores);
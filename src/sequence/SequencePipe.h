@@ -46,6 +46,12 @@ public:
     return static_cast<SequenceOptions*>(options_);
   };
 
+  // Get the tagging accuracy.
+  double GetEvaluationScore() {
+    return static_cast<double>(num_tokens_ - num_tag_mistakes_) /
+      static_cast<double>(num_tokens_);
+  }
+
 protected:
   virtual void CreateDictionary() {
     dictionary_ = new SequenceDictionary(this);
@@ -71,6 +77,10 @@ protected:
     return instance_numeric;
   }
 
+  int GetNumTokens(Instance *instance) {
+    return static_cast<SequenceInstance*>(instance)->size();
+  }
+
 protected:
   virtual void SaveModel(FILE* fs);
   virtual void LoadModel(FILE* fs);
@@ -143,9 +153,7 @@ protected:
   virtual void EndEvaluation() {
     LOG(INFO) << "Correct predictions: " << (num_tokens_ - num_tag_mistakes_)
       << " out of " << static_cast<double>(num_tokens_);
-    LOG(INFO) << "Tagging accuracy: " <<
-      static_cast<double>(num_tokens_ - num_tag_mistakes_) /
-      static_cast<double>(num_tokens_);
+    LOG(INFO) << "Tagging accuracy: " << GetEvaluationScore();
     chrono.StopTime();
     double num_seconds = chrono.GetElapsedTime();
     double tokens_per_second = static_cast<double>(num_tokens_) / num_seconds;
@@ -85,6 +85,20 @@ public:
   int GetNumForms() const { return form_alphabet_.size(); }
   int GetNumLemmas() const { return lemma_alphabet_.size(); }
 
+  // Checksum of all the alphabets (see Alphabet::GetChecksum).
+  uint64_t GetChecksum() const {
+    const Alphabet *alphabets[] = {
+      &form_alphabet_, &form_lower_alphabet_, &lemma_alphabet_,
+      &prefix_alphabet_, &suffix_alphabet_, &feats_alphabet_, &pos_alphabet_,
+      &cpos_alphabet_, &shape_alphabet_
+    };
+    uint64_t checksum = 0;
+    for (size_t i = 0; i < sizeof(alphabets) / sizeof(alphabets[0]); ++i) {
+      checksum = checksum * 1099511628211ULL + alphabets[i]->GetChecksum();
+    }
+    return checksum;
+  }
+
   int GetFormId(const std::string &form) const {
     return form_alphabet_.Lookup(form);
   }
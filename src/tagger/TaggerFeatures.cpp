@@ -23,9 +23,7 @@
 
 void TaggerFeatures::AddUnigramFeatures(SequenceInstanceNumeric *sentence,
                                         int position) {
-  CHECK(!input_features_unigrams_[position]);
-  BinaryFeatures *features = new BinaryFeatures;
-  input_features_unigrams_[position] = features;
+  BinaryFeatures *features = CreateUnigramFeatures(position);
 
   int sentence_length = sentence->size();
 
@@ -105,9 +103,7 @@ void TaggerFeatures::AddUnigramFeatures(SequenceInstanceNumeric *sentence,
 
 void TaggerFeatures::AddBigramFeatures(SequenceInstanceNumeric *sentence,
                                        int position) {
-  CHECK(!input_features_bigrams_[position]) << position << " " << sentence->size();
-  BinaryFeatures *features = new BinaryFeatures;
-  input_features_bigrams_[position] = features;
+  BinaryFeatures *features = CreateBigramFeatures(position);
 
   uint64_t fkey;
   uint8_t flags = 0x0;
@@ -120,9 +116,7 @@ void TaggerFeatures::AddBigramFeatures(SequenceInstanceNumeric *sentence,
 
 void TaggerFeatures::AddTrigramFeatures(SequenceInstanceNumeric *sentence,
                                         int position) {
-  CHECK(!input_features_trigrams_[position]) << position << " " << sentence->size();
-  BinaryFeatures *features = new BinaryFeatures;
-  input_features_trigrams_[position] = features;
+  BinaryFeatures *features = CreateTrigramFeatures(position);
 
   uint64_t fkey;
   uint8_t flags = 0x0;
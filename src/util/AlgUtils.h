@@ -20,6 +20,11 @@
 #define ALGUTILS_H
 
 #include <vector>
+#include <limits>
+#include <math.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 using namespace std;
 
@@ -44,4 +49,62 @@ extern int project_onto_simplex(double* x, int d, double r);
 
 extern int project_onto_cone_cached(double* x, int d,
                                     vector<pair<double, int> >& y);
+
+// Kernels for the inner loops of dynamic programs over contiguous rows.
+// Compute sums[i] = a[i] + b[i] for 0 <= i < length and return the largest
+// sum (-infinity if length is zero). With SSE2, two pairs of doubles are
+// added and compared per step.
+inline double ComputeSumsAndMax(const double *a, const double *b, int length,
+                                double *sums) {
+  double max_sum = -std::numeric_limits<double>::infinity();
+  int i = 0;
+#if defined(__SSE2__)
+  if (length >= 4) {
+    __m128d max0 = _mm_set1_pd(max_sum);
+    __m128d max1 = max0;
+    for (; i + 4 <= length; i += 4) {
+      __m128d sum0 = _mm_add_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i));
+      __m128d sum1 = _mm_add_pd(_mm_loadu_pd(a + i + 2),
+                                _mm_loadu_pd(b + i + 2));
+      _mm_storeu_pd(sums + i, sum0);
+      _mm_storeu_pd(sums + i + 2, sum1);
+      max0 = _mm_max_pd(max0, sum0);
+      max1 = _mm_max_pd(max1, sum1);
+    }
+    double lanes[2];
+    _mm_storeu_pd(lanes, _mm_max_pd(max0, max1));
+    max_sum = MAX(lanes[0], lanes[1]);
+  }
+#endif
+  for (; i < length; ++i) {
+    sums[i] = a[i] + b[i];
+    if (sums[i] > max_sum) max_sum = sums[i];
+  }
+  return max_sum;
+}
+
+// Return the first position of value in values, or -1 if not found.
+inline int FindFirst(const double *values, int length, double value) {
+  for (int i = 0; i < length; ++i) {
+    if (values[i] == value) return i;
+  }
+  return -1;
+}
+
+// Return log(sum_i exp(values[i])), computed stably around the largest value.
+inline double LogSumExp(const double *values, int length, double max_value) {
+  if (max_value == -std::numeric_limits<double>::infinity()) return max_value;
+  double total = 0.0;
+  for (int i = 0; i < length; ++i) {
+    total += exp(values[i] - max_value);
+  }
+  return max_value + log(total);
+}
+
+// Return log(sum_i exp(a[i] + b[i])), storing the sums a[i] + b[i] in sums.
+inline double LogSumExpOfSums(const double *a, const double *b, int length,
+                              double *sums) {
+  double max_sum = ComputeSumsAndMax(a, b, length, sums);
+  return LogSumExp(sums, length, max_sum);
+}
 #endif // ALGUTILS_H
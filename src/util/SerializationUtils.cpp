@@ -17,7 +17,14 @@
 // along with TurboParser 2.3.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "SerializationUtils.h"
+#include <cstdlib>
 #include <cstring>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 bool WriteString(FILE *fs, const std::string& data) {
   const char *buffer = data.c_str();
@@ -127,3 +134,95 @@ bool ReadIntegerVector(FILE *fs, std::vector<int> *values) {
   }
   return true;
 }
+
+FILE *OpenMemoryStreamForReading(const char *data, size_t size) {
+#ifdef _WIN32
+  return NULL;
+#else
+  return fmemopen(const_cast<char*>(data), size, "rb");
+#endif
+}
+
+bool WritePadding(FILE *fs, int alignment) {
+  long position = ftell(fs);
+  if (position < 0)
+    return false;
+  while (position % alignment != 0) {
+    if (EOF == fputc(0, fs))
+      return false;
+    ++position;
+  }
+  return true;
+}
+
+bool SkipPadding(FILE *fs, int alignment) {
+  long position = ftell(fs);
+  if (position < 0)
+    return false;
+  long padding = (alignment - position % alignment) % alignment;
+  if (0 != fseek(fs, padding, SEEK_CUR))
+    return false;
+  return true;
+}
+
+MappedFile::~MappedFile() {
+#ifndef _WIN32
+  if (data_) munmap(const_cast<char*>(data_), size_);
+#endif
+}
+
+bool MappedFile::Open(const std::string &file_name) {
+#ifdef _WIN32
+  return false;
+#else
+  int fd = open(file_name.c_str(), O_RDONLY);
+  if (fd < 0)
+    return false;
+  struct stat file_status;
+  if (0 != fstat(fd, &file_status) || file_status.st_size == 0) {
+    close(fd);
+    return false;
+  }
+  void *data = mmap(NULL, file_status.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED)
+    return false;
+  data_ = static_cast<const char*>(data);
+  size_ = file_status.st_size;
+  return true;
+#endif
+}
+
+FILE *OpenMappedStream(const MappedFilePtr &mapped_file,
+                       StreamLayout *layout) {
+  FILE *fs = OpenMemoryStreamForReading(mapped_file->data(),
+                                        mapped_file->size());
+  if (!fs)
+    return NULL;
+  layout->mapped = true;
+  layout->mapped_file = mapped_file;
+  return fs;
+}
+
+FILE *CreateTemporaryFile(std::string *file_name) {
+#ifdef _WIN32
+  return NULL;
+#else
+  const char *directory = getenv("TMPDIR");
+  if (!directory || !*directory) directory = "/tmp";
+  std::string name_template = std::string(directory) + "/turboparser.XXXXXX";
+  std::vector<char> name(name_template.begin(), name_template.end());
+  name.push_back('\0');
+  int fd = mkstemp(name.data());
+  if (fd < 0)
+    return NULL;
+  FILE *fs = fdopen(fd, "wb");
+  if (!fs) {
+    close(fd);
+    remove(name.data());
+    return NULL;
+  }
+  *file_name = name.data();
+  return fs;
+#endif
+}
@@ -20,9 +20,11 @@
 #define SERIALIZATIONUTILS_H_
 
 #include <stdio.h>
+#include <string.h>
 #include <string>
 #include <stdint.h>
 #include <vector>
+#include <memory>
 
 extern bool WriteString(FILE *fs, const std::string& data);
 extern bool WriteBool(FILE *fs, bool value);
@@ -40,4 +42,80 @@ extern bool ReadUINT64(FILE *fs, uint64_t *value);
 extern bool ReadDouble(FILE *fs, double *value);
 extern bool ReadIntegerVector(FILE *fs, std::vector<int> *values);
 
+// Open a stream reading from a buffer in memory. Return NULL if not
+// supported by the platform.
+extern FILE *OpenMemoryStreamForReading(const char *data, size_t size);
+
+// Append the bytes of count values to a flat buffer, or read them back from
+// *data, advancing it. Reading returns false if the buffer ends (at end)
+// before the values. Many small records can thus be kept in one contiguous
+// block, without a stream per record (see the feature cache of Pipe).
+template<typename T>
+inline void AppendToBuffer(const T *values, size_t count,
+                           std::vector<char> *buffer) {
+  const char *bytes = reinterpret_cast<const char*>(values);
+  buffer->insert(buffer->end(), bytes, bytes + count * sizeof(T));
+}
+template<typename T>
+inline void AppendToBuffer(const T &value, std::vector<char> *buffer) {
+  AppendToBuffer(&value, 1, buffer);
+}
+template<typename T>
+inline bool ReadFromBuffer(const char **data, const char *end, T *values,
+                           size_t count) {
+  size_t size = count * sizeof(T);
+  if (static_cast<size_t>(end - *data) < size) return false;
+  memcpy(values, *data, size);
+  *data += size;
+  return true;
+}
+template<typename T>
+inline bool ReadFromBuffer(const char **data, const char *end, T *value) {
+  return ReadFromBuffer(data, end, value, 1);
+}
+
+// Write zeros (or skip bytes, when reading) until the position of the stream
+// is a multiple of alignment.
+extern bool WritePadding(FILE *fs, int alignment);
+extern bool SkipPadding(FILE *fs, int alignment);
+
+// A read-only file mapped in memory.
+class MappedFile {
+public:
+  MappedFile() { data_ = NULL; size_ = 0; }
+  virtual ~MappedFile();
+
+  // Map a file in memory. Return false if that is not possible.
+  bool Open(const std::string &file_name);
+
+  const char *data() const { return data_; }
+  size_t size() const { return size_; }
+
+private:
+  const char *data_;
+  size_t size_;
+};
+
+typedef std::shared_ptr<MappedFile> MappedFilePtr;
+
+// Layout of a stream, passed along with it to the classes that save/load
+// themselves. A stream in the "mapped layout" is read and written as any
+// other FILE*, but classes that store large arrays (e.g. the parameter
+// vectors) write them aligned and, when reading from a mapped file, use them
+// in place instead of copying them. Readers hold the MappedFilePtr to keep
+// the file mapped for as long as they point into it.
+struct StreamLayout {
+  StreamLayout() : mapped(false) {}
+  bool mapped; // True if the stream uses the mapped layout.
+  MappedFilePtr mapped_file; // File mapped behind the stream, if reading.
+};
+
+// Open a stream reading a mapped file from its beginning, setting its layout.
+extern FILE *OpenMappedStream(const MappedFilePtr &mapped_file,
+                              StreamLayout *layout);
+
+// Create a new temporary file (in $TMPDIR, or /tmp) and open it for writing,
+// setting its name. Return NULL if that is not possible.
+extern FILE *CreateTemporaryFile(std::string *file_name);
+
 #endif // SERIALIZATIONUTILS_H_
@@ -17,3 +17,81 @@
 // along with TurboParser 2.3.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "TimeUtils.h"
+#include <algorithm>
+#include <math.h>
+#include <glog/logging.h>
+
+StageProfiler::StageProfiler(const std::vector<std::string> &stage_names) {
+  stage_names_ = stage_names;
+  allocation_counter_ = NULL;
+  int num_stages = stage_names_.size();
+  item_stage_times_.resize(num_stages);
+  item_stage_allocations_.resize(num_stages);
+  item_stage_used_.resize(num_stages);
+  stage_latencies_.resize(num_stages);
+  stage_allocations_.assign(num_stages, 0);
+  total_allocations_ = 0;
+  num_tokens_ = 0;
+}
+
+void StageProfiler::BeginItem() {
+  frames_.clear();
+  item_stage_times_.assign(item_stage_times_.size(), 0.0);
+  item_stage_allocations_.assign(item_stage_allocations_.size(), 0);
+  item_stage_used_.assign(item_stage_used_.size(), false);
+  item_start_allocations_ = GetNumAllocations();
+  item_start_time_ = std::chrono::steady_clock::now();
+}
+
+void StageProfiler::EndItem(int num_tokens) {
+  std::chrono::duration<double> elapsed =
+    std::chrono::steady_clock::now() - item_start_time_;
+  item_latencies_.push_back(elapsed.count());
+  total_allocations_ += GetNumAllocations() - item_start_allocations_;
+  num_tokens_ += num_tokens;
+  for (int stage = 0; stage < GetNumStages(); ++stage) {
+    if (!item_stage_used_[stage]) continue;
+    stage_latencies_[stage].push_back(item_stage_times_[stage]);
+    stage_allocations_[stage] += item_stage_allocations_[stage];
+  }
+}
+
+void StageProfiler::BeginStage(int stage) {
+  Frame frame;
+  frame.stage = stage;
+  frame.nested_time = 0.0;
+  frame.nested_allocations = 0;
+  frame.start_allocations = GetNumAllocations();
+  frame.start_time = std::chrono::steady_clock::now();
+  frames_.push_back(frame);
+}
+
+void StageProfiler::EndStage(int stage) {
+  std::chrono::steady_clock::time_point end_time =
+    std::chrono::steady_clock::now();
+  uint64_t end_allocations = GetNumAllocations();
+  CHECK(!frames_.empty());
+  const Frame &frame = frames_.back();
+  CHECK_EQ(frame.stage, stage) << "Stages must be properly nested.";
+  std::chrono::duration<double> elapsed = end_time - frame.start_time;
+  uint64_t allocations = end_allocations - frame.start_allocations;
+  item_stage_times_[stage] += elapsed.count() - frame.nested_time;
+  item_stage_allocations_[stage] += allocations - frame.nested_allocations;
+  item_stage_used_[stage] = true;
+  frames_.pop_back();
+  if (!frames_.empty()) {
+    frames_.back().nested_time += elapsed.count();
+    frames_.back().nested_allocations += allocations;
+  }
+}
+
+double StageProfiler::ComputePercentile(const std::vector<double> &latencies,
+                                        double p) {
+  if (latencies.empty()) return 0.0;
+  std::vector<double> sorted_latencies = latencies;
+  std::sort(sorted_latencies.begin(), sorted_latencies.end());
+  int rank = static_cast<int>(ceil(p / 100.0 * sorted_latencies.size()));
+  if (rank < 1) rank = 1;
+  if (rank > sorted_latencies.size()) rank = sorted_latencies.size();
+  return sorted_latencies[rank - 1];
+}
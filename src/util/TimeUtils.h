@@ -20,5 +20,89 @@
 #define TIMEUTILS_H
 
 #include "chrono.h"
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// Collects per-stage latencies and allocation counts over a sequence of
+// items (e.g. sentences), for benchmarking. Stages may be nested; the time
+// and allocations of a nested stage are not counted in the enclosing one.
+class StageProfiler {
+public:
+  StageProfiler(const std::vector<std::string> &stage_names);
+  virtual ~StageProfiler() {};
+
+  // Set a function returning the number of heap allocations made so far
+  // (e.g. from a replaced operator new). Without it, allocations are not
+  // counted.
+  void SetAllocationCounter(uint64_t (*allocation_counter)()) {
+    allocation_counter_ = allocation_counter;
+  }
+  bool CountsAllocations() const { return allocation_counter_ != NULL; }
+
+  // An item only gets recorded when EndItem is called; an item that is
+  // begun but not ended (e.g. a failed read at the end of the input) is
+  // discarded by the next BeginItem.
+  void BeginItem();
+  void EndItem(int num_tokens);
+  void BeginStage(int stage);
+  void EndStage(int stage);
+
+  int GetNumStages() const { return stage_names_.size(); }
+  const std::string &GetStageName(int stage) const {
+    return stage_names_[stage];
+  }
+  int GetNumItems() const { return item_latencies_.size(); }
+  int64_t GetNumTokens() const { return num_tokens_; }
+
+  // Latencies in seconds, one per item in which the stage was run.
+  const std::vector<double> &GetStageLatencies(int stage) const {
+    return stage_latencies_[stage];
+  }
+  uint64_t GetStageAllocations(int stage) const {
+    return stage_allocations_[stage];
+  }
+  // End-to-end latencies in seconds, one per item.
+  const std::vector<double> &GetItemLatencies() const {
+    return item_latencies_;
+  }
+  uint64_t GetTotalAllocations() const { return total_allocations_; }
+
+  // Nearest-rank percentile (p in [0, 100]) of a set of latencies.
+  static double ComputePercentile(const std::vector<double> &latencies,
+                                  double p);
+
+protected:
+  uint64_t GetNumAllocations() const {
+    return allocation_counter_ ? allocation_counter_() : 0;
+  }
+
+protected:
+  struct Frame {
+    int stage;
+    std::chrono::steady_clock::time_point start_time;
+    uint64_t start_allocations;
+    double nested_time;
+    uint64_t nested_allocations;
+  };
+
+  std::vector<std::string> stage_names_;
+  uint64_t (*allocation_counter_)();
+  std::vector<Frame> frames_;
+
+  // State of the current item.
+  std::chrono::steady_clock::time_point item_start_time_;
+  uint64_t item_start_allocations_;
+  std::vector<double> item_stage_times_;
+  std::vector<uint64_t> item_stage_allocations_;
+  std::vector<bool> item_stage_used_;
+
+  // Totals over the recorded items.
+  std::vector<std::vector<double> > stage_latencies_;
+  std::vector<uint64_t> stage_allocations_;
+  std::vector<double> item_latencies_;
+  uint64_t total_allocations_;
+  int64_t num_tokens_;
+};
 
 #endif // TIME_UTILS_H
@@ -24,6 +24,18 @@
 #include <gflags/gflags.h>
 #include "TimeUtils.h"
 #include "StringUtils.h"
+#ifdef _WIN32
+#include <xmmintrin.h>
+#endif
+
+// Hint the processor to bring the cache line holding address into the cache,
+// ahead of a read.
+#ifdef _WIN32
+#define PREFETCH_READ(address) \
+  _mm_prefetch(reinterpret_cast<const char*>(address), _MM_HINT_T0)
+#else
+#define PREFETCH_READ(address) __builtin_prefetch(address, 0, 3)
+#endif
 
 class GlogIsInit {
 public: